@@ -0,0 +1,250 @@
+#include "background_query.h"
+#include "hash_index.h"
+#include "key.h"
+#include "thread_pool.h"
+#include "rmutil/alloc.h"
+
+static SIThreadPool *pool = NULL;
+
+typedef struct {
+  RedisModuleBlockedClient *bc;
+  RedisIndex *idx;
+  SIQuery q;
+  SICursor *c;
+
+  // the ids found by the scan. they are copied since the index may change once
+  // the worker releases its lock
+  char **ids;
+  size_t numIds;
+  size_t cap;
+
+  // the ids read from each partition of a partitioned index, and the number of
+  // partitions still being scanned
+  SIPartitionRun *runs;
+  int numRuns;
+  int pending;
+
+  // set if the cursor reads a snapshot of the index, without locking it
+  int pinned;
+
+  int cmdOffset;
+} bgQuery;
+
+/* The scan of one partition of a partitioned index */
+typedef struct {
+  bgQuery *bq;
+  int part;
+  size_t cap;
+} bgPartitionScan;
+
+int BackgroundQuery_Init(int numThreads) {
+  if (numThreads > 0) {
+    pool = SI_NewThreadPool(numThreads);
+    return pool ? REDISMODULE_OK : REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+int BackgroundQuery_Eligible(RedisModuleCtx *ctx, SICursor *c) {
+  if (pool == NULL || c->stats.estimatedCost < SI_BACKGROUND_MIN_COST) {
+    return 0;
+  }
+  return RedisModule_GetContextFlags != NULL &&
+         !(RedisModule_GetContextFlags(ctx) &
+           (REDISMODULE_CTX_FLAGS_MULTI | REDISMODULE_CTX_FLAGS_LUA));
+}
+
+static void bgQuery_AddId(bgQuery *bq, SIId id) {
+  if (bq->numIds == bq->cap) {
+    bq->cap = bq->cap ? bq->cap * 2 : 64;
+    bq->ids = realloc(bq->ids, bq->cap * sizeof(char *));
+  }
+  bq->ids[bq->numIds++] = strdup(id);
+}
+
+/* Runs on a worker thread */
+static void bgQuery_Scan(void *arg) {
+  bgQuery *bq = arg;
+  SIIndex *idx = &bq->idx->idx;
+  SICursor *c = bq->c;
+
+  // snapshots are read in one go, while changes are applied
+  if (bq->pinned) {
+    SIId id;
+    while ((id = c->Next(c->ctx))) {
+      bgQuery_AddId(bq, id);
+    }
+    RedisModule_UnblockClient(bq->bc, bq);
+    return;
+  }
+
+  int done = 0;
+  while (!done) {
+    idx->ReadLock(idx->ctx);
+    // cursors that can't be suspended are read in one go
+    for (int i = 0; i < SI_BACKGROUND_CHUNK || !c->Suspend; i++) {
+      SIId id = c->Next(c->ctx);
+      if (!id) {
+        done = 1;
+        break;
+      }
+      bgQuery_AddId(bq, id);
+    }
+    if (!done) {
+      c->Suspend(c->ctx);
+    }
+    idx->Unlock(idx->ctx);
+  }
+
+  RedisModule_UnblockClient(bq->bc, bq);
+}
+
+/* Merge the runs of all the partitions into the query's ids, and free them */
+static void bgQuery_MergeRuns(bgQuery *bq) {
+  for (int i = 0; i < bq->numRuns; i++) {
+    bq->numIds += bq->runs[i].num;
+  }
+  bq->ids = malloc((bq->numIds ? bq->numIds : 1) * sizeof(char *));
+  SI_MergePartitionRuns(bq->c, bq->runs, (SIId *)bq->ids);
+
+  // the merged ids are owned by the query now
+  for (int i = 0; i < bq->numRuns; i++) {
+    if (bq->runs[i].keys) {
+      for (size_t j = 0; j < bq->runs[i].num; j++) {
+        SIMultiKey_Free(bq->runs[i].keys[j]);
+      }
+    }
+    free(bq->runs[i].ids);
+    free(bq->runs[i].keys);
+  }
+  free(bq->runs);
+  bq->runs = NULL;
+}
+
+/* Runs on a worker thread, in parallel to the scans of the other partitions.
+ * Cursors in key order save a copy of the key of every id, so the runs can be
+ * merged by key once all of them are read */
+static void bgQuery_ScanPartition(void *arg) {
+  bgPartitionScan *ps = arg;
+  bgQuery *bq = ps->bq;
+  SIIndex *part = &bq->idx->idx.partitions[ps->part];
+  int num;
+  SICursor *c = SI_PartitionCursors(bq->c, &num)[ps->part];
+  SIPartitionRun *run = &bq->runs[ps->part];
+
+  int done = 0;
+  while (!done) {
+    if (!bq->pinned) {
+      part->ReadLock(part->ctx);
+    }
+    for (int i = 0; i < SI_BACKGROUND_CHUNK || bq->pinned; i++) {
+      SIMultiKey *key = NULL;
+      SIId id = c->Peek ? c->Peek(c->ctx, (void **)&key) : c->Next(c->ctx);
+      if (!id) {
+        done = 1;
+        break;
+      }
+      if (run->num == ps->cap) {
+        ps->cap = ps->cap ? ps->cap * 2 : 64;
+        run->ids = realloc(run->ids, ps->cap * sizeof(SIId));
+        if (c->Peek) {
+          run->keys = realloc(run->keys, ps->cap * sizeof(void *));
+        }
+      }
+      run->ids[run->num] = strdup(id);
+      if (c->Peek) {
+        run->keys[run->num] = SI_NewMultiKey(key->keys, key->size);
+        c->Next(c->ctx);
+      }
+      run->num++;
+    }
+    if (!bq->pinned) {
+      if (!done) {
+        c->Suspend(c->ctx);
+      }
+      part->Unlock(part->ctx);
+    }
+  }
+  free(ps);
+
+  // the last partition to finish merges the results
+  if (__atomic_sub_fetch(&bq->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+    bgQuery_MergeRuns(bq);
+    RedisModule_UnblockClient(bq->bc, bq);
+  }
+}
+
+static int bgQuery_Reply(RedisModuleCtx *ctx, RedisModuleString **argv,
+                         int argc) {
+  bgQuery *bq = RedisModule_GetBlockedClientPrivateData(ctx);
+
+  if (!bq->cmdOffset) {
+    RedisModule_ReplyWithArray(ctx, bq->numIds);
+    for (size_t i = 0; i < bq->numIds; i++) {
+      RedisModule_ReplyWithStringBuffer(ctx, bq->ids[i], strlen(bq->ids[i]));
+    }
+    return REDISMODULE_OK;
+  }
+
+  // the client's arguments are kept until its reply is sent
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  int num = 0;
+  for (size_t i = 0; i < bq->numIds; i++) {
+    num += HashIndex_ReplyWithReadCommand(ctx, bq->ids[i], argv + bq->cmdOffset,
+                                          argc - bq->cmdOffset);
+  }
+  RedisModule_ReplySetArrayLength(ctx, num);
+  return REDISMODULE_OK;
+}
+
+/* Runs on the main thread, whether the client was replied to or disconnected
+ */
+static void bgQuery_Free(void *arg) {
+  bgQuery *bq = arg;
+  for (size_t i = 0; i < bq->numIds; i++) {
+    free(bq->ids[i]);
+  }
+  free(bq->ids);
+  SICursor_Free(bq->c);
+  SIQuery_Free(&bq->q);
+  RedisIndex_DecRef(bq->idx);
+  free(bq);
+}
+
+int BackgroundQuery_Run(RedisModuleCtx *ctx, RedisIndex *idx, SIQuery q,
+                        SICursor *c, int cmdOffset) {
+  bgQuery *bq = calloc(1, sizeof(bgQuery));
+  bq->idx = idx;
+  bq->q = q;
+  bq->c = c;
+  bq->cmdOffset = cmdOffset;
+  // keep the index alive even if its key is deleted while we scan it
+  RedisIndex_IncRef(idx);
+
+  // the index may change before a worker picks the query up. Scans that can be
+  // pinned read the index as it is now, and never hold its lock
+  bq->pinned = idx->idx.Snapshot(idx->idx.ctx, c);
+  if (!bq->pinned && c->Suspend) {
+    c->Suspend(c->ctx);
+  }
+
+  bq->bc = RedisModule_BlockClient(ctx, bgQuery_Reply, NULL, bgQuery_Free, 0);
+
+  // the partitions of a partitioned index are scanned in parallel
+  int num;
+  SICursor **parts = SI_PartitionCursors(c, &num);
+  if (parts) {
+    bq->runs = calloc(num, sizeof(SIPartitionRun));
+    bq->numRuns = num;
+    bq->pending = num;
+    for (int i = 0; i < num; i++) {
+      bgPartitionScan *ps = malloc(sizeof(bgPartitionScan));
+      *ps = (bgPartitionScan){.bq = bq, .part = i, .cap = 0};
+      SIThreadPool_Push(pool, bgQuery_ScanPartition, ps);
+    }
+    return REDISMODULE_OK;
+  }
+
+  SIThreadPool_Push(pool, bgQuery_Scan, bq);
+  return REDISMODULE_OK;
+}
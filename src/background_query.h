@@ -0,0 +1,37 @@
+#ifndef __SI_BACKGROUND_QUERY_H__
+#define __SI_BACKGROUND_QUERY_H__
+
+#include "redismodule.h"
+#include "index_type.h"
+
+/* Expensive read queries are executed on a pool of worker threads, while their
+ * client is blocked. Their cursors are pinned to a snapshot of the index when
+ * they start, so workers read them without locking the index, and writes on the
+ * main thread never wait for them. Cursors that can't be pinned are scanned in
+ * chunks, holding the index's read lock for one chunk at a time, so writes are
+ * never stalled for long. The partitions of a partitioned index are scanned in parallel, each
+ * under its own lock, and the last worker to finish merges their results. The
+ * results are replied to on the main thread */
+
+#define SI_DEFAULT_THREADS 4
+// queries the planner estimates to cost less than this run on the main thread
+#define SI_BACKGROUND_MIN_COST 1000
+// the number of rows a worker scans per read lock
+#define SI_BACKGROUND_CHUNK 1024
+
+/* Start the worker pool. With 0 threads all queries run on the main thread */
+int BackgroundQuery_Init(int numThreads);
+
+/* Returns 1 if a query cursor should be executed in the background. Clients
+ * can't be blocked in transactions or Lua scripts, so their queries always run
+ * on the main thread, as do all queries on servers that can't tell */
+int BackgroundQuery_Eligible(RedisModuleCtx *ctx, SICursor *c);
+
+/* Block the client and execute the query cursor in the background. The query
+ * and cursor are owned by the background query from now on. If cmdOffset is
+ * not 0, the read command at that offset of the command's arguments is executed
+ * for each id, like in IDX.FROM. Otherwise the ids are replied */
+int BackgroundQuery_Run(RedisModuleCtx *ctx, RedisIndex *idx, SIQuery q,
+                        SICursor *c, int cmdOffset);
+
+#endif
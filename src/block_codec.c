@@ -0,0 +1,339 @@
+#include <stdint.h>
+#include "block_codec.h"
+#include "rmutil/alloc.h"
+
+static sds putVarint(sds s, u_int64_t v) {
+  unsigned char buf[10];
+  int n = 0;
+  while (v >= 0x80) {
+    buf[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  buf[n++] = v;
+  return sdscatlen(s, buf, n);
+}
+
+/* Read a varint, returns 0 if it runs past the end of the buffer */
+static int getVarint(const unsigned char **p, const unsigned char *end,
+                     u_int64_t *v) {
+  *v = 0;
+  for (int shift = 0; *p < end && shift < 64; shift += 7) {
+    unsigned char b = *(*p)++;
+    *v |= (u_int64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Map signed differences to unsigned ones, so small negative numbers are
+ * small varints */
+static u_int64_t zigzag(int64_t v) {
+  return ((u_int64_t)v << 1) ^ (u_int64_t)(v >> 63);
+}
+
+static int64_t unzigzag(u_int64_t v) {
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* The integer value of the integer like types */
+static int64_t intValue(SIValue *v) {
+  switch (v->type) {
+  case T_INT32:
+    return v->intval;
+  case T_UINT:
+    return (int64_t)v->uintval;
+  case T_BOOL:
+    return v->boolval;
+  case T_TIME:
+    return v->timeval;
+  default:
+    return v->longval;
+  }
+}
+
+static SIValue intToValue(int64_t i, SIType t) {
+  switch (t) {
+  case T_INT32:
+    return SI_IntVal((int32_t)i);
+  case T_UINT:
+    return SI_UintVal((u_int64_t)i);
+  case T_BOOL:
+    return SI_BoolVal((int)i);
+  case T_TIME:
+    return SI_TimeVal((time_t)i);
+  default:
+    return SI_LongVal(i);
+  }
+}
+
+/* Append a string as the length of the prefix it shares with the previous one,
+ * and the rest of it */
+static sds putSharedPrefix(sds s, sds *prev, const char *str, size_t len) {
+  size_t shared = 0, plen = sdslen(*prev);
+  while (shared < len && shared < plen && (*prev)[shared] == str[shared]) {
+    shared++;
+  }
+  s = putVarint(s, shared);
+  s = putVarint(s, len - shared);
+  s = sdscatlen(s, str + shared, len - shared);
+  *prev = sdscpylen(*prev, str, len);
+  return s;
+}
+
+static int getSharedPrefix(siBlockColumnReader *c) {
+  u_int64_t shared, len;
+  if (!getVarint(&c->pos, c->end, &shared) ||
+      !getVarint(&c->pos, c->end, &len) || shared > sdslen(c->prevStr) ||
+      len > (u_int64_t)(c->end - c->pos)) {
+    return 0;
+  }
+  sdssetlen(c->prevStr, shared);
+  c->prevStr = sdscatlen(c->prevStr, c->pos, len);
+  c->pos += len;
+  return 1;
+}
+
+static sds putFixed(sds s, u_int64_t v, int bytes) {
+  unsigned char buf[8];
+  for (int i = 0; i < bytes; i++) {
+    buf[i] = v >> (8 * i);
+  }
+  return sdscatlen(s, buf, bytes);
+}
+
+static int getFixed(siBlockColumnReader *c, int bytes, u_int64_t *v) {
+  if (c->end - c->pos < bytes) {
+    return 0;
+  }
+  *v = 0;
+  for (int i = 0; i < bytes; i++) {
+    *v |= (u_int64_t)c->pos[i] << (8 * i);
+  }
+  c->pos += bytes;
+  return 1;
+}
+
+SIBlockWriter *SI_NewBlockWriter(SISpec *spec) {
+  SIBlockWriter *w = malloc(sizeof(SIBlockWriter));
+  w->spec = spec;
+  w->numRecords = 0;
+  w->ids = sdsempty();
+  w->prevId = sdsempty();
+  w->block = sdsempty();
+  w->cols = calloc(spec->numProps, sizeof(siBlockColumn));
+  for (size_t i = 0; i < spec->numProps; i++) {
+    w->cols[i].data = sdsempty();
+    w->cols[i].nulls = sdsempty();
+    w->cols[i].prevStr = sdsempty();
+  }
+  return w;
+}
+
+void SIBlockWriter_Add(SIBlockWriter *w, SIId id, SIMultiKey *key) {
+  w->ids = putSharedPrefix(w->ids, &w->prevId, id, strlen(id));
+
+  for (size_t i = 0; i < w->spec->numProps; i++) {
+    siBlockColumn *c = &w->cols[i];
+    if (w->numRecords % 8 == 0) {
+      c->nulls = sdscatlen(c->nulls, "\0", 1);
+    }
+    SIValue *v = &key->keys[i];
+    if (SIValue_IsNullPtr(v)) {
+      c->nulls[sdslen(c->nulls) - 1] |= 1 << (w->numRecords % 8);
+      c->hasNulls = 1;
+      continue;
+    }
+
+    switch (w->spec->properties[i].type) {
+    case T_STRING:
+      c->data = putSharedPrefix(c->data, &c->prevStr, v->stringval.str,
+                                v->stringval.len);
+      break;
+    case T_FLOAT: {
+      u_int32_t bits;
+      memcpy(&bits, &v->floatval, sizeof(bits));
+      c->data = putFixed(c->data, bits, 4);
+      break;
+    }
+    case T_DOUBLE: {
+      u_int64_t bits;
+      memcpy(&bits, &v->doubleval, sizeof(bits));
+      c->data = putFixed(c->data, bits, 8);
+      break;
+    }
+    default: {
+      // differences wrap around, so they are computed as unsigned numbers
+      int64_t n = intValue(v);
+      c->data = putVarint(
+          c->data, zigzag((int64_t)((u_int64_t)n - (u_int64_t)c->prevInt)));
+      c->prevInt = n;
+    }
+    }
+  }
+  w->numRecords++;
+}
+
+const char *SIBlockWriter_Flush(SIBlockWriter *w, size_t *len) {
+  sdsclear(w->block);
+  w->block = putVarint(w->block, sdslen(w->ids));
+  for (size_t i = 0; i < w->spec->numProps; i++) {
+    siBlockColumn *c = &w->cols[i];
+    w->block = putVarint(w->block, 1 + (c->hasNulls ? sdslen(c->nulls) : 0) +
+                                       sdslen(c->data));
+  }
+
+  w->block = sdscatlen(w->block, w->ids, sdslen(w->ids));
+  sdsclear(w->ids);
+  sdsclear(w->prevId);
+  for (size_t i = 0; i < w->spec->numProps; i++) {
+    siBlockColumn *c = &w->cols[i];
+    w->block = sdscatlen(w->block, c->hasNulls ? "\1" : "\0", 1);
+    if (c->hasNulls) {
+      w->block = sdscatlen(w->block, c->nulls, sdslen(c->nulls));
+    }
+    w->block = sdscatlen(w->block, c->data, sdslen(c->data));
+    sdsclear(c->data);
+    sdsclear(c->nulls);
+    sdsclear(c->prevStr);
+    c->hasNulls = 0;
+    c->prevInt = 0;
+  }
+  w->numRecords = 0;
+
+  *len = sdslen(w->block);
+  return w->block;
+}
+
+void SIBlockWriter_Free(SIBlockWriter *w) {
+  for (size_t i = 0; i < w->spec->numProps; i++) {
+    sdsfree(w->cols[i].data);
+    sdsfree(w->cols[i].nulls);
+    sdsfree(w->cols[i].prevStr);
+  }
+  free(w->cols);
+  sdsfree(w->ids);
+  sdsfree(w->prevId);
+  sdsfree(w->block);
+  free(w);
+}
+
+SIBlockReader *SI_NewBlockReader(SISpec *spec, const char *buf, size_t len,
+                                 size_t numRecords) {
+  SIBlockReader *r = malloc(sizeof(SIBlockReader));
+  r->spec = spec;
+  r->numRecords = numRecords;
+  r->current = 0;
+  r->error = 0;
+  r->ids = (siBlockColumnReader){.prevStr = sdsempty()};
+  r->cols = calloc(spec->numProps, sizeof(siBlockColumnReader));
+  for (size_t i = 0; i < spec->numProps; i++) {
+    r->cols[i].prevStr = sdsempty();
+  }
+
+  // the section lengths, then the sections one after the other
+  const unsigned char *p = (const unsigned char *)buf, *end = p + len;
+  u_int64_t lens[spec->numProps + 1];
+  for (size_t i = 0; i <= spec->numProps; i++) {
+    if (!getVarint(&p, end, &lens[i])) {
+      r->error = 1;
+      return r;
+    }
+  }
+  for (size_t i = 0; i <= spec->numProps; i++) {
+    siBlockColumnReader *c = i ? &r->cols[i - 1] : &r->ids;
+    if (lens[i] > (u_int64_t)(end - p)) {
+      r->error = 1;
+      return r;
+    }
+    c->pos = p;
+    c->end = p + lens[i];
+    p = c->end;
+    if (!i) {
+      continue;
+    }
+
+    size_t bitmapLen = (numRecords + 7) / 8;
+    if (c->pos == c->end ||
+        (*c->pos && (size_t)(c->end - c->pos) < 1 + bitmapLen)) {
+      r->error = 1;
+      return r;
+    }
+    c->nulls = *c->pos++ ? c->pos : NULL;
+    if (c->nulls) {
+      c->pos += bitmapLen;
+    }
+  }
+  return r;
+}
+
+int SIBlockReader_Next(SIBlockReader *r, SIId *id, SIValue *vals) {
+  if (r->error || r->current == r->numRecords) {
+    return 0;
+  }
+  if (!getSharedPrefix(&r->ids)) {
+    goto error;
+  }
+  *id = r->ids.prevStr;
+
+  for (size_t i = 0; i < r->spec->numProps; i++) {
+    siBlockColumnReader *c = &r->cols[i];
+    if (c->nulls && (c->nulls[r->current / 8] >> (r->current % 8)) & 1) {
+      vals[i] = SI_NullVal();
+      continue;
+    }
+
+    SIType t = r->spec->properties[i].type;
+    u_int64_t n;
+    switch (t) {
+    case T_STRING:
+      if (!getSharedPrefix(c)) {
+        goto error;
+      }
+      vals[i] = SI_StringVal((SIString){
+          .str = c->prevStr, .len = sdslen(c->prevStr), .refcount = NULL});
+      break;
+    case T_FLOAT: {
+      if (!getFixed(c, 4, &n)) {
+        goto error;
+      }
+      u_int32_t bits = n;
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      vals[i] = SI_FloatVal(f);
+      break;
+    }
+    case T_DOUBLE: {
+      if (!getFixed(c, 8, &n)) {
+        goto error;
+      }
+      double d;
+      memcpy(&d, &n, sizeof(d));
+      vals[i] = SI_DoubleVal(d);
+      break;
+    }
+    default:
+      if (!getVarint(&c->pos, c->end, &n)) {
+        goto error;
+      }
+      c->prevInt = (int64_t)((u_int64_t)c->prevInt + (u_int64_t)unzigzag(n));
+      vals[i] = intToValue(c->prevInt, t);
+    }
+  }
+  r->current++;
+  return 1;
+
+error:
+  r->error = 1;
+  return 0;
+}
+
+void SIBlockReader_Free(SIBlockReader *r) {
+  for (size_t i = 0; i < r->spec->numProps; i++) {
+    sdsfree(r->cols[i].prevStr);
+  }
+  free(r->cols);
+  sdsfree(r->ids.prevStr);
+  free(r);
+}
@@ -0,0 +1,87 @@
+#ifndef __SI_BLOCK_CODEC_H__
+#define __SI_BLOCK_CODEC_H__
+
+#include <stdlib.h>
+#include "value.h"
+#include "key.h"
+#include "spec.h"
+#include "rmutil/sds.h"
+
+/* A compact column encoding of index records, used to persist indexes in
+ * blocks of records instead of one value at a time.
+ *
+ * Records are added in index order, and every column is encoded on its own,
+ * relative to the previous value of the column:
+ *  - integer, bool and time values as zigzag varints of their difference
+ *  - strings and ids as the length of the prefix they share, and the rest
+ *  - floats and doubles as their raw little endian bits
+ * Columns with NULL values start with a bitmap of the rows that have one, and
+ * the values of the other rows follow. The type of the values is the one of
+ * their column in the spec, so no type is encoded per value.
+ *
+ * A block starts with the varint lengths of the ids and of every column, and
+ * the encoded sections follow */
+
+// the number of records in each persisted block
+#define SI_BLOCK_SIZE 1024
+
+typedef struct {
+  // the values of the column, and a bitmap of the rows with a NULL value
+  sds data;
+  sds nulls;
+  int hasNulls;
+  // the last non NULL value, that the next one is encoded relative to
+  int64_t prevInt;
+  sds prevStr;
+} siBlockColumn;
+
+typedef struct {
+  SISpec *spec;
+  size_t numRecords;
+  sds ids;
+  sds prevId;
+  siBlockColumn *cols;
+  // the encoded block, valid until the next record is added
+  sds block;
+} SIBlockWriter;
+
+SIBlockWriter *SI_NewBlockWriter(SISpec *spec);
+
+/* Append a record to the current block */
+void SIBlockWriter_Add(SIBlockWriter *w, SIId id, SIMultiKey *key);
+
+/* Encode the records added since the last flush into a block, and start a new
+ * one. The block is owned by the writer */
+const char *SIBlockWriter_Flush(SIBlockWriter *w, size_t *len);
+
+void SIBlockWriter_Free(SIBlockWriter *w);
+
+typedef struct {
+  const unsigned char *pos, *end;
+  // the NULL bitmap, or NULL if the column has no NULL values
+  const unsigned char *nulls;
+  int64_t prevInt;
+  sds prevStr;
+} siBlockColumnReader;
+
+typedef struct {
+  SISpec *spec;
+  size_t numRecords, current;
+  siBlockColumnReader ids;
+  siBlockColumnReader *cols;
+  // set if the block is truncated or corrupt
+  int error;
+} SIBlockReader;
+
+/* Read a block of numRecords records. The buffer must outlive the reader */
+SIBlockReader *SI_NewBlockReader(SISpec *spec, const char *buf, size_t len,
+                                 size_t numRecords);
+
+/* Decode the next record into its id and one value per column of the spec.
+ * The id and the strings are owned by the reader, and valid until the next
+ * call. Returns 0 at the end of the block, or if it's corrupt */
+int SIBlockReader_Next(SIBlockReader *r, SIId *id, SIValue *vals);
+
+void SIBlockReader_Free(SIBlockReader *r);
+
+#endif
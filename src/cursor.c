@@ -1,5 +1,12 @@
 #include "index.h"
 #include "rmutil/alloc.h"
+#include <time.h>
+
+double SI_Clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1000000 + (double)ts.tv_nsec / 1000;
+}
 
 void SICursor_Free(SICursor *c) {
   if (c->Release) {
@@ -14,6 +21,11 @@ SICursor *SI_NewCursor(void *ctx) {
   c->total = 0;
   c->ctx = ctx;
   c->error = SI_CURSOR_OK;
+  c->stats = (SICursorStats){0};
+  c->Next = NULL;
+  c->Suspend = NULL;
+  c->Peek = NULL;
+  c->Release = NULL;
 
   return c;
 }
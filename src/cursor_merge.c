@@ -0,0 +1,168 @@
+#include <string.h>
+#include "index.h"
+#include "rmutil/alloc.h"
+
+typedef enum { SI_MERGE_AND, SI_MERGE_OR } siMergeOp;
+
+typedef struct {
+  siMergeOp op;
+  SICursor **cursors;
+  int num;
+  SICursorStats *stats;
+
+  // the merged ids, sorted
+  SIId *ids;
+  size_t numIds;
+  size_t cap;
+  size_t pos;
+  int done;
+} mergeCtx;
+
+static int cmpIds(const void *p1, const void *p2) {
+  return strcmp(*(SIId *)p1, *(SIId *)p2);
+}
+
+static int cmpCursorRows(const void *p1, const void *p2) {
+  double r1 = (*(SICursor **)p1)->stats.estimatedRows;
+  double r2 = (*(SICursor **)p2)->stats.estimatedRows;
+  return r1 < r2 ? -1 : (r1 > r2 ? 1 : 0);
+}
+
+static void merge_addId(mergeCtx *mc, SIId id) {
+  if (mc->numIds == mc->cap) {
+    mc->cap = mc->cap ? mc->cap * 2 : 64;
+    mc->ids = realloc(mc->ids, mc->cap * sizeof(SIId));
+  }
+  mc->ids[mc->numIds++] = id;
+}
+
+/* Sort the collected ids and remove duplicates */
+static void merge_sortIds(mergeCtx *mc) {
+  if (mc->numIds < 2) return;
+  qsort(mc->ids, mc->numIds, sizeof(SIId), cmpIds);
+  size_t n = 1;
+  for (size_t i = 1; i < mc->numIds; i++) {
+    if (strcmp(mc->ids[i], mc->ids[n - 1])) {
+      mc->ids[n++] = mc->ids[i];
+    }
+  }
+  mc->numIds = n;
+}
+
+/* Keep only the collected ids that the cursor returns as well. Ids are marked
+ * in a bitmap as the cursor finds them, so the cursor's results are never
+ * stored */
+static void merge_intersect(mergeCtx *mc, SICursor *c) {
+  u_int8_t *bitmap = calloc(mc->numIds / 8 + 1, 1);
+  SIId id;
+  while (NULL != (id = c->Next(c->ctx))) {
+    SIId *p = bsearch(&id, mc->ids, mc->numIds, sizeof(SIId), cmpIds);
+    if (p) {
+      size_t i = p - mc->ids;
+      bitmap[i / 8] |= 1 << (i % 8);
+    }
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < mc->numIds; i++) {
+    if (bitmap[i / 8] & (1 << (i % 8))) {
+      mc->ids[n++] = mc->ids[i];
+    }
+  }
+  mc->numIds = n;
+  free(bitmap);
+}
+
+static void merge_collect(mergeCtx *mc, SICursor *c) {
+  SIId id;
+  while (NULL != (id = c->Next(c->ctx))) {
+    merge_addId(mc, id);
+  }
+}
+
+static void merge_run(mergeCtx *mc) {
+  // the cursor with the fewest expected rows drives an intersection, the
+  // others just filter its ids, and are not read at all once nothing is left
+  merge_collect(mc, mc->cursors[0]);
+  if (mc->op == SI_MERGE_AND) {
+    merge_sortIds(mc);
+  }
+  for (int i = 1; i < mc->num; i++) {
+    if (mc->op == SI_MERGE_AND) {
+      if (mc->numIds == 0) break;
+      merge_intersect(mc, mc->cursors[i]);
+    } else {
+      merge_collect(mc, mc->cursors[i]);
+    }
+  }
+  if (mc->op == SI_MERGE_OR) {
+    merge_sortIds(mc);
+  }
+
+  for (int i = 0; i < mc->num; i++) {
+    SICursorStats *st = &mc->cursors[i]->stats;
+    mc->stats->planTime += st->planTime;
+    mc->stats->rangesScanned += st->rangesScanned;
+    mc->stats->nodesVisited += st->nodesVisited;
+    mc->stats->comparisons += st->comparisons;
+    mc->stats->rowsFiltered += st->rowsFiltered;
+  }
+  mc->done = 1;
+}
+
+static SIId merge_Next(void *ctx) {
+  mergeCtx *mc = ctx;
+  if (!mc->done) {
+    merge_run(mc);
+  }
+  if (mc->pos >= mc->numIds) {
+    return NULL;
+  }
+  mc->stats->rowsReturned++;
+  return mc->ids[mc->pos++];
+}
+
+static void merge_Release(void *ctx) {
+  mergeCtx *mc = ctx;
+  for (int i = 0; i < mc->num; i++) {
+    SICursor_Free(mc->cursors[i]);
+  }
+  free(mc->cursors);
+  free(mc->ids);
+  free(mc);
+}
+
+static SICursor *newMergeCursor(siMergeOp op, SICursor **cursors, int num) {
+  mergeCtx *mc = calloc(1, sizeof(mergeCtx));
+  mc->op = op;
+  mc->num = num;
+  mc->cursors = malloc(num * sizeof(SICursor *));
+  memcpy(mc->cursors, cursors, num * sizeof(SICursor *));
+  qsort(mc->cursors, num, sizeof(SICursor *), cmpCursorRows);
+
+  SICursor *c = SI_NewCursor(mc);
+  mc->stats = &c->stats;
+  c->Next = merge_Next;
+  c->Release = merge_Release;
+  // an intersection returns at most the rows of its smallest cursor
+  c->stats.estimatedRows =
+      op == SI_MERGE_AND ? mc->cursors[0]->stats.estimatedRows : 0;
+  for (int i = 0; i < num; i++) {
+    c->stats.estimatedCost += cursors[i]->stats.estimatedCost;
+    if (op != SI_MERGE_AND) {
+      c->stats.estimatedRows += cursors[i]->stats.estimatedRows;
+    }
+    if (cursors[i]->error != SI_CURSOR_OK) {
+      c->error = cursors[i]->error;
+    }
+  }
+  return c;
+}
+
+SICursor *SI_NewIntersectCursor(SICursor **cursors, int num) {
+  return newMergeCursor(SI_MERGE_AND, cursors, num);
+}
+
+SICursor *SI_NewUnionCursor(SICursor **cursors, int num) {
+  return newMergeCursor(SI_MERGE_OR, cursors, num);
+}
@@ -0,0 +1,124 @@
+#include <float.h>
+#include "cursor_registry.h"
+#include "util/khash.h"
+#include "rmutil/alloc.h"
+
+KHASH_MAP_INIT_INT64(khCursors, RedisCursor *);
+
+static khash_t(khCursors) *cursors = NULL;
+static u_int64_t lastCursorId = 0;
+// the earliest time an open cursor may expire, in microseconds. reading a
+// cursor only pushes its expiry back, so this stays a lower bound until the
+// next scan of the registry
+static double nextExpiry = 0;
+// set when an index was deleted since the last scan of the registry
+static int indexDropped = 0;
+
+RedisCursor *RedisCursor_New(RedisIndex *idx, SIQuery q, SICursor *c,
+                             size_t count, long long maxIdle) {
+  if (!cursors) {
+    cursors = kh_init(khCursors);
+  }
+  RedisCursor_ExpireIdle();
+  if (kh_size(cursors) >= SI_CURSOR_MAX_OPEN) {
+    return NULL;
+  }
+
+  RedisCursor *rc = malloc(sizeof(RedisCursor));
+  rc->id = ++lastCursorId;
+  rc->idx = idx;
+  RedisIndex_IncRef(idx);
+  rc->q = q;
+  rc->c = c;
+  rc->count = count;
+  rc->maxIdle = maxIdle;
+  rc->lastAccess = SI_Clock();
+  double expiry = rc->lastAccess + (double)maxIdle * 1000;
+  if (kh_size(cursors) == 0 || expiry < nextExpiry) {
+    nextExpiry = expiry;
+  }
+
+  int ret;
+  khiter_t k = kh_put(khCursors, cursors, rc->id, &ret);
+  kh_value(cursors, k) = rc;
+  return rc;
+}
+
+RedisCursor *RedisCursor_Get(u_int64_t id) {
+  if (!cursors) {
+    return NULL;
+  }
+  RedisCursor_ExpireIdle();
+
+  khiter_t k = kh_get(khCursors, cursors, id);
+  if (k == kh_end(cursors)) {
+    return NULL;
+  }
+  RedisCursor *rc = kh_value(cursors, k);
+  rc->lastAccess = SI_Clock();
+  return rc;
+}
+
+void RedisCursor_Free(RedisCursor *rc) {
+  khiter_t k = kh_get(khCursors, cursors, rc->id);
+  if (k != kh_end(cursors)) {
+    kh_del(khCursors, cursors, k);
+  }
+  SICursor_Free(rc->c);
+  SIQuery_Free(&rc->q);
+  RedisIndex_DecRef(rc->idx);
+  free(rc);
+}
+
+/* Free all the cursors matching a predicate. We collect them first since we
+ * can't delete from the table while iterating it */
+static void freeCursorsWhere(int (*pred)(RedisCursor *rc, void *arg),
+                             void *arg) {
+  if (!cursors || kh_size(cursors) == 0) {
+    return;
+  }
+  RedisCursor *victims[kh_size(cursors)];
+  int n = 0;
+  for (khiter_t k = kh_begin(cursors); k != kh_end(cursors); ++k) {
+    if (kh_exist(cursors, k) && pred(kh_value(cursors, k), arg)) {
+      victims[n++] = kh_value(cursors, k);
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    RedisCursor_Free(victims[i]);
+  }
+}
+
+/* Cursors expire when they are idle for too long, or their index was deleted */
+static int isExpired(RedisCursor *rc, void *now) {
+  return __atomic_load_n(&rc->idx->dropped, __ATOMIC_ACQUIRE) ||
+         *(double *)now - rc->lastAccess > (double)rc->maxIdle * 1000;
+}
+
+void RedisCursor_ExpireIdle() {
+  if (!cursors || kh_size(cursors) == 0) {
+    return;
+  }
+  // cleared before the scan, so a drop during it is seen by the next one
+  int dropped = __atomic_exchange_n(&indexDropped, 0, __ATOMIC_ACQ_REL);
+  double now = SI_Clock();
+  if (!dropped && now < nextExpiry) {
+    return;
+  }
+  freeCursorsWhere(isExpired, &now);
+
+  nextExpiry = DBL_MAX;
+  for (khiter_t k = kh_begin(cursors); k != kh_end(cursors); ++k) {
+    if (kh_exist(cursors, k)) {
+      RedisCursor *rc = kh_value(cursors, k);
+      double expiry = rc->lastAccess + (double)rc->maxIdle * 1000;
+      if (expiry < nextExpiry) {
+        nextExpiry = expiry;
+      }
+    }
+  }
+}
+
+void RedisCursor_IndexDropped() {
+  __atomic_store_n(&indexDropped, 1, __ATOMIC_RELEASE);
+}
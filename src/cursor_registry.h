@@ -0,0 +1,54 @@
+#ifndef __SI_CURSOR_REGISTRY_H__
+#define __SI_CURSOR_REGISTRY_H__
+
+#include "index_type.h"
+#include "query.h"
+
+/* Server side cursors let clients consume big result sets in batches, with
+ * IDX.SELECT ... WITHCURSOR and IDX.CURSOR READ. Open cursors are kept in a
+ * global registry by their id. Cursors that are not read for more than their
+ * max idle time, or whose index key was deleted, are expired lazily whenever
+ * cursors are accessed or indexes are written - an abandoned snapshot cursor
+ * would otherwise keep its index pinned, and its delta buffer growing. Open
+ * cursors hold a reference to their index */
+
+#define SI_CURSOR_DEFAULT_COUNT 1000
+#define SI_CURSOR_DEFAULT_MAXIDLE 300000
+#define SI_CURSOR_MAX_OPEN 1024
+
+typedef struct {
+  u_int64_t id;
+  RedisIndex *idx;
+  // the query is kept alive as long as the cursor since its plan uses it
+  SIQuery q;
+  SICursor *c;
+  // the default batch size of the cursor
+  size_t count;
+  // max idle time in milliseconds, and the last time the cursor was read in
+  // microseconds
+  long long maxIdle;
+  double lastAccess;
+} RedisCursor;
+
+/* Register a new cursor for a query on an index. The cursor takes ownership of
+ * the query and index cursor. Returns NULL if there are too many open cursors
+ */
+RedisCursor *RedisCursor_New(RedisIndex *idx, SIQuery q, SICursor *c,
+                             size_t count, long long maxIdle);
+
+/* Get an open cursor by its id, or NULL if it does not exist or expired */
+RedisCursor *RedisCursor_Get(u_int64_t id);
+
+/* Remove a cursor from the registry and free it */
+void RedisCursor_Free(RedisCursor *rc);
+
+/* Free all the cursors that were idle for longer than their max idle time, or
+ * whose index was deleted. Cheap when no cursor can have expired yet, so it's
+ * called on every write */
+void RedisCursor_ExpireIdle();
+
+/* Note that an index was deleted, so its cursors are freed by the next call to
+ * RedisCursor_ExpireIdle. May be called from any thread */
+void RedisCursor_IndexDropped();
+
+#endif
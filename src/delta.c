@@ -0,0 +1,290 @@
+#include <string.h>
+#include "delta.h"
+#include "rmutil/alloc.h"
+
+SIDelta *SI_NewDelta(skiplist *main) {
+  SIDelta *d = malloc(sizeof(SIDelta));
+  d->adds = skiplistCreate(main->compare, main->cmpCtx, main->valcmp);
+  d->dels = skiplistCreate(main->compare, main->cmpCtx, main->valcmp);
+  d->numChanges = 0;
+  return d;
+}
+
+/* Find the tombstone of an entry. Returns the node holding it, and sets pos to
+ * its offset in the node, or returns NULL if there is none */
+static skiplistNode *findTombstone(SIDelta *d, SIMultiKey *key, SIId id,
+                                   unsigned int *pos) {
+  skiplistNode *n = skiplistFind(d->dels, key);
+  if (n) {
+    for (unsigned int i = 0; i < n->numVals; i++) {
+      if (!strcmp(n->vals[i], id)) {
+        *pos = i;
+        return n;
+      }
+    }
+  }
+  return NULL;
+}
+
+SIMultiKey *SIDelta_Insert(SIDelta *d, SIMultiKey *key, SIId id) {
+  // the entry is back in the main skiplist
+  unsigned int pos;
+  skiplistNode *n = findTombstone(d, key, id, &pos);
+  if (n) {
+    SIMultiKey *mainKey = n->obj;
+    SIId copy = n->vals[pos];
+    skiplistDelete(d->dels, mainKey, copy);
+    free(copy);
+    d->numChanges--;
+    return mainKey;
+  }
+
+  n = skiplistInsert(d->adds, key, id);
+  d->numChanges++;
+  return n ? n->obj : key;
+}
+
+int SIDelta_Remove(SIDelta *d, SIMultiKey *key, SIId id) {
+  int rc = skiplistDelete(d->adds, key, id);
+  if (rc != SKIPLIST_NOTFOUND) {
+    d->numChanges--;
+    return rc == SKIPLIST_DELETED_NODE;
+  }
+
+  // the key is the main node's, and lives as long as the node
+  skiplistInsert(d->dels, key, strdup(id));
+  d->numChanges++;
+  return 0;
+}
+
+int SIDelta_IsDeleted(SIDelta *d, SIMultiKey *key, SIId id) {
+  unsigned int pos;
+  return findTombstone(d, key, id, &pos) != NULL;
+}
+
+/* Free the nodes of a buffer skiplist, and their ids */
+static void freeBuffer(skiplist *sl, int freeKeys) {
+  for (skiplistNode *n = sl->header->level[0].forward; n;
+       n = n->level[0].forward) {
+    for (unsigned int i = 0; i < n->numVals; i++) {
+      free(n->vals[i]);
+    }
+    if (freeKeys) {
+      SIMultiKey_Free(n->obj);
+    }
+  }
+  skiplistFree(sl);
+}
+
+size_t SIDelta_MergeSome(SIDelta *d, skiplist *main, size_t max,
+                         SIDeltaMoveFunc onMove, void *ctx) {
+  size_t merged = 0;
+  skiplistNode *n;
+  // tombstones first, so the adds never meet the nodes they replace
+  while (merged < max && (n = d->dels->header->level[0].forward)) {
+    SIMultiKey *key = n->obj;
+    SIId id = n->vals[n->numVals - 1];
+    int rc = skiplistDelete(main, key, id);
+    skiplistDelete(d->dels, key, id);
+    free(id);
+    // the tombstones of a main node always go before it does
+    if (rc == SKIPLIST_DELETED_NODE) {
+      SIMultiKey_Free(key);
+    }
+    merged++;
+    d->numChanges--;
+  }
+
+  // the adds are taken in key order, and each insert into the main skiplist
+  // starts from the previous one's position
+  while (merged < max && (n = d->adds->header->level[0].forward)) {
+    SIMultiKey *key = n->obj;
+    if (n->numVals > max - merged) {
+      // only some of the node's ids fit: they go to the main node of an equal
+      // key, or of a copy of it, since the buffer still owns its key
+      skiplistNode *m = skiplistFind(main, key);
+      SIMultiKey *mainKey = m ? m->obj : SI_NewMultiKey(key->keys, key->size);
+      while (merged < max) {
+        SIId id = n->vals[n->numVals - 1];
+        skiplistInsert(main, mainKey, id);
+        onMove(id, mainKey, ctx);
+        skiplistDelete(d->adds, key, id);
+        merged++;
+        d->numChanges--;
+      }
+      break;
+    }
+
+    skiplistNode *m = NULL;
+    for (unsigned int i = 0; i < n->numVals; i++) {
+      m = skiplistInsert(main, key, n->vals[i]);
+    }
+    // an equal key was already in the main skiplist
+    int moved = m && m->obj != key;
+    if (moved) {
+      for (unsigned int i = 0; i < n->numVals; i++) {
+        onMove(n->vals[i], m->obj, ctx);
+      }
+    }
+    merged += n->numVals;
+    d->numChanges -= n->numVals;
+    // the main skiplist owns the ids now, and the key unless it was moved
+    skiplistDelete(d->adds, key, NULL);
+    if (moved) {
+      SIMultiKey_Free(key);
+    }
+  }
+  return d->numChanges;
+}
+
+void SIDelta_Merge(SIDelta *d, skiplist *main, SIDeltaMoveFunc onMove,
+                   void *ctx) {
+  SIDelta_MergeSome(d, main, (size_t)-1, onMove, ctx);
+}
+
+void SIDelta_Free(SIDelta *d) {
+  freeBuffer(d->adds, 1);
+  freeBuffer(d->dels, 0);
+  free(d);
+}
+
+SIDelta *SIDelta_Copy(SIDelta *d, skiplist *main) {
+  SIDelta *c = SI_NewDelta(main);
+  // the nodes are inserted in order, each one after the previous
+  for (skiplistNode *n = d->adds->header->level[0].forward; n;
+       n = n->level[0].forward) {
+    SIMultiKey *key = n->obj;
+    key = SI_NewMultiKey(key->keys, key->size);
+    for (unsigned int i = 0; i < n->numVals; i++) {
+      skiplistInsert(c->adds, key, strdup(n->vals[i]));
+    }
+  }
+  for (skiplistNode *n = d->dels->header->level[0].forward; n;
+       n = n->level[0].forward) {
+    for (unsigned int i = 0; i < n->numVals; i++) {
+      skiplistInsert(c->dels, n->obj, strdup(n->vals[i]));
+    }
+  }
+  c->numChanges = d->numChanges;
+  return c;
+}
+
+/* Start iterating a range of one of the skiplists. A NULL min starts from the
+ * first node */
+static skiplistIterator iterateRange(skiplist *sl, SIMultiKey *min,
+                                     SIMultiKey *max, int minExclusive,
+                                     int maxExclusive) {
+  if (min) {
+    return skiplistIterateRange(sl, min, max, minExclusive, maxExclusive);
+  }
+  skiplistIterator it = skiplistIterateAll(sl);
+  it.current = sl->header->level[0].forward;
+  return it;
+}
+
+/* Compare the current entries of two iterators, by key and then by id */
+static int cmpEntries(SIDeltaIterator *it, skiplistIterator *a,
+                      skiplistIterator *b) {
+  skiplist *sl = it->main.sl;
+  it->mergeCmps++;
+  int c = sl->compare(a->current->obj, b->current->obj, sl->cmpCtx);
+  if (c) {
+    return c;
+  }
+  return sl->valcmp(a->current->vals[a->currentValOffset],
+                    b->current->vals[b->currentValOffset]);
+}
+
+/* Skip the main entries that have tombstones, and position the iterator on
+ * the lowest of the main and the adds entries */
+static void settle(SIDeltaIterator *it) {
+  if (it->d) {
+    while (it->main.current) {
+      int deleted = 0;
+      while (it->dels.current) {
+        int c = cmpEntries(it, &it->dels, &it->main);
+        if (c >= 0) {
+          deleted = c == 0;
+          break;
+        }
+        skiplistIterator_Next(&it->dels);
+      }
+      if (!deleted) {
+        break;
+      }
+      skiplistIterator_Next(&it->main);
+      skiplistIterator_Next(&it->dels);
+    }
+  }
+
+  if (it->main.current && it->adds.current) {
+    it->cur = cmpEntries(it, &it->adds, &it->main) < 0 ? SI_DELTA_ADDS
+                                                        : SI_DELTA_MAIN;
+  } else if (it->main.current) {
+    it->cur = SI_DELTA_MAIN;
+  } else if (it->adds.current) {
+    it->cur = SI_DELTA_ADDS;
+  } else {
+    it->cur = SI_DELTA_END;
+  }
+
+  it->numCmps = it->main.numCmps + it->adds.numCmps + it->dels.numCmps +
+                it->mergeCmps;
+  it->numVisited =
+      it->main.numVisited + it->adds.numVisited + it->dels.numVisited;
+}
+
+SIDeltaIterator SIDelta_IterateRange(SIDelta *d, skiplist *main,
+                                     SIMultiKey *min, SIMultiKey *max,
+                                     int minExclusive, int maxExclusive) {
+  SIDeltaIterator it = {.d = d, .mergeCmps = 0};
+  it.main = iterateRange(main, min, max, minExclusive, maxExclusive);
+  if (d) {
+    it.adds = iterateRange(d->adds, min, max, minExclusive, maxExclusive);
+    it.dels = iterateRange(d->dels, min, max, minExclusive, maxExclusive);
+  }
+  settle(&it);
+  return it;
+}
+
+/* The iterator positioned on the current entry, or NULL */
+static skiplistIterator *current(SIDeltaIterator *it) {
+  switch (it->cur) {
+  case SI_DELTA_MAIN:
+    return &it->main;
+  case SI_DELTA_ADDS:
+    return &it->adds;
+  default:
+    return NULL;
+  }
+}
+
+SIMultiKey *SIDeltaIterator_Current(SIDeltaIterator *it, SIId *id) {
+  skiplistIterator *cur = current(it);
+  if (!cur) {
+    return NULL;
+  }
+  if (id) {
+    *id = cur->current->vals[cur->currentValOffset];
+  }
+  return cur->current->obj;
+}
+
+SIId SIDeltaIterator_Next(SIDeltaIterator *it) {
+  skiplistIterator *cur = current(it);
+  if (!cur) {
+    return NULL;
+  }
+  SIId ret = skiplistIterator_Next(cur);
+  settle(it);
+  return ret;
+}
+
+void SIDeltaIterator_Seek(SIDeltaIterator *it, SIMultiKey *key, SIId id) {
+  skiplistIterator_Seek(&it->main, key, id);
+  if (it->d) {
+    skiplistIterator_Seek(&it->adds, key, id);
+    skiplistIterator_Seek(&it->dels, key, id);
+  }
+  settle(it);
+}
@@ -0,0 +1,105 @@
+#ifndef __SI_DELTA_H__
+#define __SI_DELTA_H__
+
+#include <stdlib.h>
+#include "key.h"
+#include "skiplist/skiplist.h"
+
+/* A write optimized delta buffer in front of an index's main skiplist, for
+ * indexes with a high ingest rate (LSM style).
+ *
+ * Changes don't touch the main skiplist. New entries are inserted into a small
+ * skiplist of adds, and entries of the main skiplist that were deleted get a
+ * tombstone in a small skiplist of deletes, pointing to the main node's key.
+ * An entry is never both in the main skiplist and in the adds - re-adding a
+ * deleted main entry just removes its tombstone.
+ *
+ * Scans merge the three skiplists in (key, value) order, skipping the main
+ * entries that have tombstones. The buffer is merged into the main skiplist
+ * from its start: the deletes first, then the adds in key order, so each
+ * insert continues from the previous one's position. Merging moves one entry
+ * at a time, so it can be spread over many writes */
+
+// the number of buffered changes that starts merging the buffer into the main
+// skiplist
+#define SI_DELTA_MAX_CHANGES 4096
+// the number of entries merged by each write while the buffer is merged, on
+// top of twice the changes the write buffered itself
+#define SI_DELTA_MERGE_STEP 64
+
+typedef struct {
+  skiplist *adds;
+  // the tombstones own copies of their ids
+  skiplist *dels;
+  // the number of entries in the adds and deletes
+  size_t numChanges;
+} SIDelta;
+
+/* Called by SIDelta_Merge for ids whose key was replaced by an equal key that
+ * was already in the main skiplist */
+typedef void (*SIDeltaMoveFunc)(SIId id, SIMultiKey *key, void *ctx);
+
+SIDelta *SI_NewDelta(skiplist *main);
+
+/* Add an entry. Returns the key now holding it - the key of a tombstoned main
+ * entry, an equal key already in the adds, or the given key itself. If it's not
+ * the given key, the caller keeps ownership of it */
+SIMultiKey *SIDelta_Insert(SIDelta *d, SIMultiKey *key, SIId id);
+
+/* Remove an entry, that is either in the adds or in the main skiplist. Returns
+ * 1 if it was in the adds, and no node holds its key anymore */
+int SIDelta_Remove(SIDelta *d, SIMultiKey *key, SIId id);
+
+/* Returns 1 if a main skiplist entry has a tombstone */
+int SIDelta_IsDeleted(SIDelta *d, SIMultiKey *key, SIId id);
+
+/* Move the first entries of the buffer into the main skiplist, until max
+ * entries were moved or the buffer is empty. The keys of deleted main
+ * nodes, and of adds merged into existing main nodes are freed. Returns the
+ * number of entries left in the buffer */
+size_t SIDelta_MergeSome(SIDelta *d, skiplist *main, size_t max,
+                         SIDeltaMoveFunc onMove, void *ctx);
+
+/* Fold the whole buffer into the main skiplist, and empty it */
+void SIDelta_Merge(SIDelta *d, skiplist *main, SIDeltaMoveFunc onMove,
+                   void *ctx);
+
+/* Free the buffer, with the keys and ids of the adds */
+void SIDelta_Free(SIDelta *d);
+
+/* Copy a buffer, so it can be read while the original changes. The adds are
+ * copied with their keys and ids, and the tombstones share the main skiplist's
+ * keys, which must not change while the copy is used */
+SIDelta *SIDelta_Copy(SIDelta *d, skiplist *main);
+
+/* Iterates a range of the main skiplist merged with a delta buffer */
+typedef struct {
+  SIDelta *d;
+  skiplistIterator main, adds, dels;
+  // the iterator positioned on the current entry - main or adds - or none at
+  // the end. not a pointer, so the iterator can be copied
+  enum { SI_DELTA_END, SI_DELTA_MAIN, SI_DELTA_ADDS } cur;
+  // the comparisons made merging the iterators
+  unsigned long mergeCmps;
+  // the total number of comparisons and nodes visited so far
+  unsigned long numCmps;
+  unsigned long numVisited;
+} SIDeltaIterator;
+
+/* Iterate a range of the main skiplist and the delta, which may be NULL. A
+ * NULL min iterates the whole skiplist */
+SIDeltaIterator SIDelta_IterateRange(SIDelta *d, skiplist *main,
+                                     SIMultiKey *min, SIMultiKey *max,
+                                     int minExclusive, int maxExclusive);
+
+/* Get the key of the current entry, and set id to its id if it's not NULL.
+ * Returns NULL at the end of the range */
+SIMultiKey *SIDeltaIterator_Current(SIDeltaIterator *it, SIId *id);
+
+/* Return the id of the current entry and advance to the next one */
+SIId SIDeltaIterator_Next(SIDeltaIterator *it);
+
+/* Reposition the iterator on the first entry not lower than (key, id) */
+void SIDeltaIterator_Seek(SIDeltaIterator *it, SIMultiKey *key, SIId id);
+
+#endif
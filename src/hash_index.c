@@ -1,5 +1,9 @@
+#include <pthread.h>
+#include <unistd.h>
 #include "hash_index.h"
+#include "cursor_registry.h"
 #include "rmutil/strings.h"
+#include "rmutil/sds.h"
 #include "rmutil/alloc.h"
 
 #define ID_SUB_TOKEN "$"
@@ -29,31 +33,28 @@ RedisModuleCallReply *__callParametricCommand(RedisModuleCtx *ctx, SIId id,
   return r;
 }
 
-int HashIndex_ExecuteReadCommand(RedisModuleCtx *ctx, RedisIndex *idx,
-                                 SIQuery *query, RedisModuleString **argv,
-                                 int argc) {
-  SICursor *c = idx->idx.Find(idx->idx.ctx, query);
-  if (c->error != QE_OK) {
-    // TODO: proper error reporting in cursor
-    return RedisModule_ReplyWithError(ctx, "Error executing query");
+int HashIndex_ReplyWithReadCommand(RedisModuleCtx *ctx, SIId id,
+                                   RedisModuleString **argv, int argc) {
+  RedisModule_ReplyWithSimpleString(ctx, id);
+
+  RedisModuleCallReply *rep = __callParametricCommand(ctx, id, argv, argc);
+  if (rep) {
+    RedisModule_ReplyWithCallReply(ctx, rep);
+  } else {
+    RedisModule_ReplyWithError(ctx, "Could not execute command");
   }
+  return 2;
+}
 
+int HashIndex_ExecuteReadCommand(RedisModuleCtx *ctx, SICursor *c,
+                                 RedisModuleString **argv, int argc) {
   RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
   int num = 0;
   SIId id;
   while (NULL != (id = c->Next(c->ctx))) {
-    RedisModule_ReplyWithSimpleString(ctx, id);
-
-    RedisModuleCallReply *rep = __callParametricCommand(ctx, id, argv, argc);
-    if (rep) {
-      RedisModule_ReplyWithCallReply(ctx, rep);
-    } else {
-      RedisModule_ReplyWithError(ctx, "Could not execute command");
-    }
-    num += 2;
+    num += HashIndex_ReplyWithReadCommand(ctx, id, argv, argc);
   }
 
-  SICursor_Free(c);
   RedisModule_ReplySetArrayLength(ctx, num);
   return REDISMODULE_OK;
 }
@@ -148,6 +149,7 @@ IdSource HashIndex_GetIdsForCommand(RedisModuleString **argv, int argc,
  * current values */
 int reindexHashHandler(RedisModuleCtx *ctx, RedisIndex *idx,
                        RedisModuleString *hkey) {
+  RedisCursor_ExpireIdle();
   RedisModuleKey *k = RedisModule_OpenKey(ctx, hkey, REDISMODULE_READ);
 
   if (k == NULL || RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_HASH ||
@@ -207,6 +209,7 @@ error:
  * deletion */
 int deleteHandler(RedisModuleCtx *ctx, RedisIndex *idx,
                   RedisModuleString *hkey) {
+  RedisCursor_ExpireIdle();
   SIId id = (char *)RedisModule_StringPtrLen(hkey, NULL);
   SIChangeSet cs = SI_NewChangeSet(1);
   SIChangeSet_AddCahnge(&cs, SI_NewDelChange(id));
@@ -259,3 +262,268 @@ IndexedTransaction CreateIndexedTransaction(RedisModuleCtx *ctx,
 
   return ret;
 }
+
+/* All the hash indexes. Those created with a key PREFIX are kept current by
+ * keyspace notifications on the keys matching their prefix, and the others
+ * drop the hashes that expire or are evicted */
+static RedisIndex **hashIndexes = NULL;
+static size_t numHashIndexes = 0;
+// indexes are untracked on the lazy free thread by FLUSHALL ASYNC, so the
+// list is locked while it's changed or walked
+static pthread_mutex_t hashIndexesLock = PTHREAD_MUTEX_INITIALIZER;
+
+void HashIndex_Track(RedisIndex *idx) {
+  pthread_mutex_lock(&hashIndexesLock);
+  hashIndexes =
+      realloc(hashIndexes, (numHashIndexes + 1) * sizeof(RedisIndex *));
+  hashIndexes[numHashIndexes++] = idx;
+  pthread_mutex_unlock(&hashIndexesLock);
+}
+
+void HashIndex_Untrack(RedisIndex *idx) {
+  pthread_mutex_lock(&hashIndexesLock);
+  for (size_t i = 0; i < numHashIndexes; i++) {
+    if (hashIndexes[i] == idx) {
+      hashIndexes[i] = hashIndexes[--numHashIndexes];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&hashIndexesLock);
+}
+
+/* Get the index stored at a key of the current db, or NULL if it's not an
+ * index */
+static RedisIndex *openIndexKey(RedisModuleCtx *ctx, RedisModuleString *name) {
+  RedisModuleKey *k = RedisModule_OpenKey(ctx, name, REDISMODULE_READ);
+  RedisIndex *ret = NULL;
+  if (RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_EMPTY &&
+      RedisModule_ModuleTypeGetType(k) == IndexType) {
+    ret = RedisModule_ModuleTypeGetValue(k);
+  }
+  RedisModule_CloseKey(k);
+  return ret;
+}
+
+/* Returns 1 if a tracked index lives in the db the notification came from.
+ * The same prefix may be indexed in several databases */
+static int isInCurrentDb(RedisModuleCtx *ctx, RedisIndex *idx) {
+  RedisModuleString *name =
+      RedisModule_CreateString(ctx, idx->keyName, strlen(idx->keyName));
+  int ret = openIndexKey(ctx, name) == idx;
+  RedisModule_FreeString(ctx, name);
+  return ret;
+}
+
+/* Reindex a hash, or remove it from the index if the key no longer holds one */
+static void updateFromKey(RedisModuleCtx *ctx, RedisIndex *idx,
+                          RedisModuleString *hkey) {
+  RedisModuleKey *k = RedisModule_OpenKey(ctx, hkey, REDISMODULE_READ);
+  int type = RedisModule_KeyType(k);
+  RedisModule_CloseKey(k);
+
+  if (type == REDISMODULE_KEYTYPE_HASH) {
+    reindexHashHandler(ctx, idx, hkey);
+  } else {
+    deleteHandler(ctx, idx, hkey);
+  }
+}
+
+static int isEvent(const char *event, const char **events) {
+  for (int i = 0; events[i] != NULL; i++) {
+    if (!strcmp(event, events[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// keys that are gone. replicas get the expirations of their master as DELs,
+// and UNLINK fires del as well
+static const char *hashDeleteEvents[] = {"del", "expired", "evicted",
+                                         "rename_from", NULL};
+// events that never change the value of a key
+static const char *hashKeepEvents[] = {"expire", NULL};
+
+static int keyspaceNotification(RedisModuleCtx *ctx, int type,
+                                const char *event, RedisModuleString *key) {
+  // a stale count only skips or delays the locked walk below
+  if (numHashIndexes == 0) {
+    return REDISMODULE_OK;
+  }
+
+  // a renamed index keeps tracking its keys under its new name
+  if (!strcmp(event, "rename_to")) {
+    RedisIndex *idx = openIndexKey(ctx, key);
+    if (idx && idx->keyName) {
+      size_t len;
+      const char *name = RedisModule_StringPtrLen(key, &len);
+      free(idx->keyName);
+      idx->keyName = strndup(name, len);
+      return REDISMODULE_OK;
+    }
+  }
+
+  // any other event may have replaced the key's value - HSET and friends, but
+  // also SET over a hash, RESTORE, or the target of RENAME, MOVE and COPY. the
+  // key is reindexed, or removed if it no longer holds a hash
+  int del = isEvent(event, hashDeleteEvents);
+  if (!del && isEvent(event, hashKeepEvents)) {
+    return REDISMODULE_OK;
+  }
+
+  size_t len;
+  const char *k = RedisModule_StringPtrLen(key, &len);
+  pthread_mutex_lock(&hashIndexesLock);
+  for (size_t i = 0; i < numHashIndexes; i++) {
+    RedisIndex *idx = hashIndexes[i];
+    if (idx->prefix) {
+      size_t plen = strlen(idx->prefix);
+      if (len < plen || memcmp(k, idx->prefix, plen)) {
+        continue;
+      }
+    } else if (!del || !idx->idx.Contains(idx->idx.ctx, (SIId)k)) {
+      // indexes without a prefix are only updated by commands, but can't keep
+      // the ids of hashes that no longer exist. most deleted keys are not in
+      // the index, which the reverse index tells without taking its lock
+      continue;
+    }
+    if (!isInCurrentDb(ctx, idx)) {
+      continue;
+    }
+    if (del) {
+      deleteHandler(ctx, idx, key);
+    } else {
+      updateFromKey(ctx, idx, key);
+    }
+  }
+  pthread_mutex_unlock(&hashIndexesLock);
+  return REDISMODULE_OK;
+}
+
+int HashIndex_SubscribeKeyspaceEvents(RedisModuleCtx *ctx) {
+  // not available before the keyspace notification API was added
+  if (RedisModule_SubscribeToKeyspaceEvents == NULL) {
+    return REDISMODULE_ERR;
+  }
+  return RedisModule_SubscribeToKeyspaceEvents(
+      ctx, REDISMODULE_NOTIFY_GENERIC | REDISMODULE_NOTIFY_STRING |
+               REDISMODULE_NOTIFY_HASH | REDISMODULE_NOTIFY_EXPIRED |
+               REDISMODULE_NOTIFY_EVICTED,
+      keyspaceNotification);
+}
+
+/* A backfill indexing the existing hashes of a prefix index. It holds a
+ * reference to its index */
+typedef struct {
+  RedisIndex *idx;
+  // SCAN's MATCH pattern for the prefix, and the position of the scan
+  sds pattern;
+  long long cursor;
+} backfillJob;
+
+/* Select the db the index lives in. Returns 0 if it's no longer stored in any
+ * db - the index was deleted or replaced since the last slice */
+static int selectIndexDb(RedisModuleCtx *ctx, RedisIndex *idx) {
+  for (int db = 0; RedisModule_SelectDb(ctx, db) == REDISMODULE_OK; db++) {
+    if (isInCurrentDb(ctx, idx)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Run SCAN steps from the backfill's cursor for one time slice, indexing the
+ * keys found. Returns 1 when the whole keyspace was scanned */
+static int backfillSlice(RedisModuleCtx *ctx, backfillJob *job) {
+  double start = SI_Clock();
+  do {
+    RedisModuleCallReply *r =
+        RedisModule_Call(ctx, "SCAN", "lcccc", job->cursor, "MATCH",
+                         job->pattern, "COUNT", SI_BACKFILL_SCAN_COUNT);
+    if (!r || RedisModule_CallReplyType(r) != REDISMODULE_REPLY_ARRAY ||
+        RedisModule_CallReplyLength(r) != 2) {
+      if (r) RedisModule_FreeCallReply(r);
+      RedisModule_Log(ctx, "warning", "Backfill of index %s failed",
+                      job->idx->keyName);
+      return 1;
+    }
+
+    job->cursor = strtoll(RedisModule_CallReplyStringPtr(
+                              RedisModule_CallReplyArrayElement(r, 0), NULL),
+                          NULL, 10);
+    RedisModuleCallReply *keys = RedisModule_CallReplyArrayElement(r, 1);
+    for (size_t i = 0; i < RedisModule_CallReplyLength(keys); i++) {
+      RedisModuleString *hkey = RedisModule_CreateStringFromCallReply(
+          RedisModule_CallReplyArrayElement(keys, i));
+      updateFromKey(ctx, job->idx, hkey);
+      RedisModule_FreeString(ctx, hkey);
+    }
+    job->idx->backfillKeys += RedisModule_CallReplyLength(keys);
+    RedisModule_FreeCallReply(r);
+  } while (job->cursor != 0 && SI_Clock() - start < SI_BACKFILL_SLICE_US);
+
+  return job->cursor == 0;
+}
+
+/* The backfill thread. It takes the server's lock for one slice at a time, so
+ * commands and queries on the index keep running between slices. Keys written
+ * during the backfill are indexed by keyspace events, and indexing them again
+ * when the scan reaches them changes nothing */
+static void *backfillThread(void *arg) {
+  backfillJob *job = arg;
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(NULL);
+
+  int done = 0;
+  while (!done) {
+    RedisModule_ThreadSafeContextLock(ctx);
+    done = !selectIndexDb(ctx, job->idx) || backfillSlice(ctx, job);
+    if (done) {
+      job->idx->backfilling = 0;
+      RedisIndex_DecRef(job->idx);
+    }
+    RedisModule_ThreadSafeContextUnlock(ctx);
+    if (!done) {
+      usleep(SI_BACKFILL_PAUSE_US);
+    }
+  }
+
+  RedisModule_FreeThreadSafeContext(ctx);
+  sdsfree(job->pattern);
+  free(job);
+  return NULL;
+}
+
+int HashIndex_StartBackfill(RedisIndex *idx) {
+  // not available before thread safe contexts were added
+  if (RedisModule_GetThreadSafeContext == NULL) {
+    return REDISMODULE_ERR;
+  }
+
+  backfillJob *job = malloc(sizeof(backfillJob));
+  job->idx = idx;
+  job->cursor = 0;
+  // SCAN's MATCH is a glob pattern, so we escape the prefix
+  job->pattern = sdsempty();
+  for (const char *p = idx->prefix; *p; p++) {
+    if (strchr("*?[]\\", *p)) {
+      job->pattern = sdscatlen(job->pattern, "\\", 1);
+    }
+    job->pattern = sdscatlen(job->pattern, p, 1);
+  }
+  job->pattern = sdscat(job->pattern, "*");
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, backfillThread, job) != 0) {
+    sdsfree(job->pattern);
+    free(job);
+    return REDISMODULE_ERR;
+  }
+  pthread_detach(thread);
+
+  // we are called with the server's lock held, so the thread can't run yet.
+  // The scan starts over from the first key, and so does its count
+  idx->backfilling = 1;
+  idx->backfillKeys = 0;
+  RedisIndex_IncRef(idx);
+  return REDISMODULE_OK;
+}
@@ -12,9 +12,15 @@ RedisModuleCallReply *__callParametricCommand(RedisModuleCtx *ctx, SIId id,
                                               RedisModuleString **argv,
                                               int argc);
 
-int HashIndex_ExecuteReadCommand(RedisModuleCtx *ctx, RedisIndex *idx,
-                                 SIQuery *query, RedisModuleString **argv,
-                                 int argc);
+/* Reply with an id and the reply of a read command executed on it. Returns
+ * the number of replies added */
+int HashIndex_ReplyWithReadCommand(RedisModuleCtx *ctx, SIId id,
+                                   RedisModuleString **argv, int argc);
+
+/* Execute a read command for every id of a query cursor, and reply with the
+ * ids and their replies */
+int HashIndex_ExecuteReadCommand(RedisModuleCtx *ctx, SICursor *c,
+                                 RedisModuleString **argv, int argc);
 
 /* And indexed command proxy is a generic callback that based on the command at
  * hand, executes it and operates on the index accordingly */
@@ -41,6 +47,31 @@ IdSource HashIndex_GetIdsForCommand(RedisModuleString **argv, int argc,
                                     void **pctx);
 int HashIndex_IndexHashObject(RedisModuleCtx *ctx, RedisIndex *idx,
                               RedisModuleString *hkey);
+
+/* Start following keyspace events for a hash index. An index with a key prefix
+ * is kept current with the keys matching its prefix, and the others drop the
+ * ids of hashes that expire or are evicted */
+void HashIndex_Track(RedisIndex *idx);
+/* Stop following keyspace events for an index that is being freed */
+void HashIndex_Untrack(RedisIndex *idx);
+
+/* Subscribe to the keyspace events of tracked indexes. Fails if the server
+ * does not support keyspace notifications for modules */
+int HashIndex_SubscribeKeyspaceEvents(RedisModuleCtx *ctx);
+
+// the time a backfill holds the server's lock for, before letting it serve
+// other clients
+#define SI_BACKFILL_SLICE_US 5000
+// the pause between backfill slices
+#define SI_BACKFILL_PAUSE_US 1000
+// the SCAN COUNT of each backfill step
+#define SI_BACKFILL_SCAN_COUNT "100"
+
+/* Index all the existing hashes whose keys start with the index's prefix, on
+ * a background thread. The index is flagged as backfilling until it's done,
+ * and counts the keys it backfilled from zero. Must be called with the
+ * server's lock held */
+int HashIndex_StartBackfill(RedisIndex *idx);
 #endif
  
         
@@ -1,9 +1,16 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pthread_rwlockattr_setkind_np */
+#endif
 #include "index.h"
 #include "key.h"
 #include "skiplist/skiplist.h"
 #include "reverse_index.h"
 #include "query_plan.h"
+#include "stats.h"
+#include "trigram.h"
+#include "delta.h"
 #include <stdio.h>
+#include <pthread.h>
 #include "rmutil/alloc.h"
 
 typedef struct {
@@ -12,11 +19,46 @@ typedef struct {
   u_int8_t numFuncs;
 
   skiplist *sl;
+  // the write buffer of indexes created with SI_INDEX_DELTA, or of any index
+  // while scans are pinned to it, or NULL
+  SIDelta *delta;
 
   size_t length;
   SIReverseIndex *ri;
+  SIIndexStats *stats;
+  // the trigram index of each column, or NULL for columns without one
+  SITrigramIndex **trigrams;
+  // incremented on every change to the index, so suspended scans know they
+  // need to re-seek
+  u_int64_t version;
+  // the number of scans reading a snapshot of the index. While there are any,
+  // the main skiplist doesn't change - changes go to the delta buffer, which
+  // is not merged until the last of them is released
+  int pins;
+  // set while the delta buffer is being merged into the main skiplist, a few
+  // entries on every write
+  int merging;
+
+  pthread_rwlock_t lock;
+  // planning updates the statistics' histograms, so concurrent readers plan
+  // one at a time
+  pthread_mutex_t planLock;
 } compoundIndex;
 
+/* Add or remove an id from the trigram indexes of its values */
+void compoundIndex_updateTrigrams(compoundIndex *idx, SIId id, SIMultiKey *key,
+                                  int add) {
+  for (int i = 0; i < idx->spec.numProps; i++) {
+    if (idx->trigrams[i] && key->keys[i].type == T_STRING) {
+      if (add) {
+        SITrigramIndex_Add(idx->trigrams[i], id, &key->keys[i].stringval);
+      } else {
+        SITrigramIndex_Remove(idx->trigrams[i], id, &key->keys[i].stringval);
+      }
+    }
+  }
+}
+
 /* Delete an id from the index. return 1 if it was in the index, 0 otherwise */
 int compoundIndex_applyDel(compoundIndex *idx, SIChange ch) {
   SIMultiKey *oldkey = NULL;
@@ -25,67 +67,271 @@ int compoundIndex_applyDel(compoundIndex *idx, SIChange ch) {
   int exists = SIReverseIndex_Exists(idx->ri, ch.id, &oldkey);
 
   if (exists) {
-    skiplistDelete(idx->sl, oldkey, ch.id);
-    free(oldkey);
+    SIIndexStats_Remove(idx->stats, oldkey);
+    compoundIndex_updateTrigrams(idx, ch.id, oldkey, 0);
+    // the key is shared by all the ids in its node, and owned by the node
+    if (idx->delta) {
+      if (SIDelta_Remove(idx->delta, oldkey, ch.id)) {
+        SIMultiKey_Free(oldkey);
+      }
+    } else if (skiplistDelete(idx->sl, oldkey, ch.id) ==
+               SKIPLIST_DELETED_NODE) {
+      SIMultiKey_Free(oldkey);
+    }
     SIReverseIndex_Delete(idx->ri, ch.id);
     --idx->length;
+    ++idx->version;
     return SI_INDEX_OK;
   }
 
   return SI_INDEX_NOTFOUND;
 }
 
-int compoundIndex_applyAdd(compoundIndex *idx, SIChange ch) {
-  SIValueVector vec;
-  // if the id is already in the index, we need to delete the old index entry
-  // and replace with a new one.
-  //
-  // TODO: Optimize this to make sure we don't delete and insert if the records
-  // are the same
-
-  SIMultiKey *key = NULL;
-  // check for duplicate if needed
-  if (idx->spec.flags & SI_INDEX_UNIQUE) {
-    key = SI_NewMultiKey(ch.v.vals, ch.v.len);
-    skiplistNode *n = skiplistFind(idx->sl, key);
-    if (n != NULL) {
-      // if we have an existing value, make sure it belongs to the same id!
-
-      // there can only be 1 val per node in unique idx
-      if (!strcmp(n->vals[0], ch.id)) {
-        // the same id and key are already in the index, no need to do anything
-        SIMultiKey_Free(key);
-        return SI_INDEX_OK;
+/* Create an index key from a change's values */
+SIMultiKey *compoundIndex_newKey(compoundIndex *idx, SIValueVector v) {
+  SIMultiKey *key = SI_NewMultiKey(v.vals, v.len);
+  SIMultiKey_Collate(key, &idx->spec);
+  return key;
+}
+
+/* Returns the id other than the given one that holds a key, in the main
+ * skiplist or in the delta buffer of a unique index, or NULL if there's none */
+SIId compoundIndex_keyHolder(compoundIndex *idx, SIId id, SIMultiKey *key) {
+  skiplistNode *n;
+  if (idx->delta) {
+    n = skiplistFind(idx->delta->adds, key);
+    if (n && strcmp(n->vals[0], id)) {
+      return n->vals[0];
+    }
+  }
+  n = skiplistFind(idx->sl, key);
+  if (n) {
+    for (unsigned int i = 0; i < n->numVals; i++) {
+      if (strcmp(n->vals[i], id) &&
+          (!idx->delta || !SIDelta_IsDeleted(idx->delta, key, n->vals[i]))) {
+        return n->vals[i];
       }
+    }
+  }
+  return NULL;
+}
 
-      // the id stored there is of another record. we have a duplicate!
-      SIMultiKey_Free(key);
-      return SI_INDEX_DUPLICATE_KEY;
+/* Insert an id into an index with a delta buffer. The main skiplist is only
+ * read, for unique indexes */
+int compoundIndex_addKeyDelta(compoundIndex *idx, SIId id, SIMultiKey *key,
+                              SIMultiKey *oldkey) {
+  if ((idx->spec.flags & SI_INDEX_UNIQUE) &&
+      compoundIndex_keyHolder(idx, id, key)) {
+    SIMultiKey_Free(key);
+    return SI_INDEX_DUPLICATE_KEY;
+  }
+
+  if (oldkey) {
+    SIIndexStats_Remove(idx->stats, oldkey);
+    compoundIndex_updateTrigrams(idx, id, oldkey, 0);
+    if (SIDelta_Remove(idx->delta, oldkey, id)) {
+      SIMultiKey_Free(oldkey);
     }
+    --idx->length;
   }
 
+  SIMultiKey *stored = SIDelta_Insert(idx->delta, key, id);
+  if (stored != key) {
+    SIMultiKey_Free(key);
+    key = stored;
+  }
+  SIReverseIndex_Insert(idx->ri, id, key);
+  SIIndexStats_Add(idx->stats, key);
+  compoundIndex_updateTrigrams(idx, id, key, 1);
+  ++idx->length;
+  ++idx->version;
+  return SI_INDEX_OK;
+}
+
+/* Insert an id with its already built key. The key is owned by the index from
+ * now on */
+int compoundIndex_addKey(compoundIndex *idx, SIId id, SIMultiKey *key) {
+  // if the id is already in the index, we need to replace its old entry
   SIMultiKey *oldkey = NULL;
-  int exists = SIReverseIndex_Exists(idx->ri, ch.id, &oldkey);
+  int exists = SIReverseIndex_Exists(idx->ri, id, &oldkey);
+  // the record is indexed with the same values - nothing to do
+  if (exists && SICmpMultiKey(oldkey, key, idx->sl->cmpCtx) == 0) {
+    SIMultiKey_Free(key);
+    return SI_INDEX_OK;
+  }
+  if (idx->delta) {
+    return compoundIndex_addKeyDelta(idx, id, key, exists ? oldkey : NULL);
+  }
+
+  // a single descent checks for duplicates in unique indexes, and inserts the
+  // id or moves its old entry to the new key
+  skiplistNode *n;
+  int rc = skiplistUpsert(idx->sl, key, exists ? oldkey : NULL, id,
+                          idx->spec.flags & SI_INDEX_UNIQUE, &n);
+  if (rc == SKIPLIST_UPSERT_DUPLICATE) {
+    SIMultiKey_Free(key);
+    return SI_INDEX_DUPLICATE_KEY;
+  }
+
   if (exists) {
-    // // compose the old key and delete it from the skiplist
-    skiplistDelete(idx->sl, oldkey, ch.id);
+    SIIndexStats_Remove(idx->stats, oldkey);
+    compoundIndex_updateTrigrams(idx, id, oldkey, 0);
+    if (rc == SKIPLIST_UPSERT_RELEASED) {
+      SIMultiKey_Free(oldkey);
+    }
     --idx->length;
-    free(oldkey);
+  }
+
+  // if the key was already in the index, the id was added to the existing node
+  // and we share its key
+  if (n->obj != key) {
+    SIMultiKey_Free(key);
+    key = n->obj;
   }
   // insert the id and values to the reverse index
-  // TODO: check memory management of all this stuff
-  if (!key) {
-    key = SI_NewMultiKey(ch.v.vals, ch.v.len);
+  SIReverseIndex_Insert(idx->ri, id, key);
+  SIIndexStats_Add(idx->stats, key);
+  compoundIndex_updateTrigrams(idx, id, key, 1);
+  ++idx->length;
+  ++idx->version;
+  return SI_INDEX_OK;
+}
+
+int compoundIndex_applyAdd(compoundIndex *idx, SIChange ch) {
+  return compoundIndex_addKey(idx, ch.id, compoundIndex_newKey(idx, ch.v));
+}
+
+/* An add change of a batch, with its key built ahead of inserting it */
+typedef struct {
+  SIChange *ch;
+  SIMultiKey *key;
+  // the change's position in the change set
+  size_t pos;
+} siBatchEntry;
+
+int cmpBatchIds(const void *p1, const void *p2) {
+  const siBatchEntry *e1 = p1, *e2 = p2;
+  int rc = strcmp(e1->ch->id, e2->ch->id);
+  if (rc) return rc;
+  return e1->pos < e2->pos ? -1 : e1->pos > e2->pos;
+}
+
+/* Stable bottom up merge sort of batch entries by their keys */
+void sortBatch(siBatchEntry *ents, size_t num, SICmpFuncVector *fv) {
+  siBatchEntry *tmp = malloc(num * sizeof(siBatchEntry));
+  for (size_t width = 1; width < num; width *= 2) {
+    for (size_t lo = 0; lo < num; lo += 2 * width) {
+      size_t mid = lo + width < num ? lo + width : num;
+      size_t hi = lo + 2 * width < num ? lo + 2 * width : num;
+      size_t i = lo, j = mid, k = lo;
+      while (i < mid && j < hi) {
+        tmp[k++] = SICmpMultiKey(ents[j].key, ents[i].key, fv) < 0 ? ents[j++]
+                                                                   : ents[i++];
+      }
+      while (i < mid) tmp[k++] = ents[i++];
+      while (j < hi) tmp[k++] = ents[j++];
+    }
+    memcpy(ents, tmp, num * sizeof(siBatchEntry));
   }
-  SIReverseIndex_Insert(idx->ri, ch.id, key);
+  free(tmp);
+}
 
-  skiplistInsert(idx->sl, key, ch.id);
-  ++idx->length;
+int cmpIds(const void *p1, const void *p2) {
+  return strcmp(*(const SIId *)p1, *(const SIId *)p2);
+}
+
+/* Check that a batch sorted by keys leaves a unique index unique. A key may be
+ * held by an id that moves to another key in the batch - those ids are removed
+ * from the index before the batch is inserted, so that inserting it in key
+ * order never meets them. ids is the batch's ids in sorted order */
+int compoundIndex_checkUniqueBatch(compoundIndex *idx, siBatchEntry *ents,
+                                   size_t num, SIId *ids) {
+  SIId *moved = malloc(num * sizeof(SIId));
+  size_t numMoved = 0;
+  for (size_t i = 0; i < num; i++) {
+    if (i > 0 &&
+        SICmpMultiKey(ents[i - 1].key, ents[i].key, idx->sl->cmpCtx) == 0) {
+      free(moved);
+      return SI_INDEX_DUPLICATE_KEY;
+    }
+    SIId holder = compoundIndex_keyHolder(idx, ents[i].ch->id, ents[i].key);
+    if (holder) {
+      if (!bsearch(&holder, ids, num, sizeof(SIId), cmpIds)) {
+        free(moved);
+        return SI_INDEX_DUPLICATE_KEY;
+      }
+      moved[numMoved++] = holder;
+    }
+  }
+
+  for (size_t i = 0; i < numMoved; i++) {
+    compoundIndex_applyDel(idx, (SIChange){.type = SI_CHDEL, .id = moved[i]});
+  }
+  free(moved);
   return SI_INDEX_OK;
 }
 
-int compoundIndex_Apply(void *ctx, SIChangeSet cs) {
-  compoundIndex *idx = ctx;
+/* Apply a change set made only of adds. The changes are inserted in key order,
+ * so each skiplist insert starts from the position of the previous one instead
+ * of descending from the head of the list. Only the last change of each id in
+ * the batch is applied, which is what applying them in order would leave.
+ * Unique indexes are checked for the whole batch first, so a batch with a
+ * duplicate key changes nothing */
+int compoundIndex_applyAddBatch(compoundIndex *idx, SIChangeSet cs) {
+  siBatchEntry *ents = malloc(cs.numChanges * sizeof(siBatchEntry));
+  for (size_t i = 0; i < cs.numChanges; i++) {
+    ents[i] = (siBatchEntry){.ch = &cs.changes[i], .key = NULL, .pos = i};
+  }
+
+  qsort(ents, cs.numChanges, sizeof(siBatchEntry), cmpBatchIds);
+  size_t num = 0;
+  for (size_t i = 0; i < cs.numChanges; i++) {
+    if (i + 1 < cs.numChanges &&
+        !strcmp(ents[i].ch->id, ents[i + 1].ch->id)) {
+      continue;
+    }
+    ents[num] = ents[i];
+    ents[num].key = compoundIndex_newKey(idx, ents[i].ch->v);
+    num++;
+  }
+  int rc = SI_INDEX_OK;
+  if (idx->spec.flags & SI_INDEX_UNIQUE) {
+    // the entries are still in id order
+    SIId *ids = malloc(num * sizeof(SIId));
+    for (size_t i = 0; i < num; i++) {
+      ids[i] = ents[i].ch->id;
+    }
+    sortBatch(ents, num, idx->sl->cmpCtx);
+    rc = compoundIndex_checkUniqueBatch(idx, ents, num, ids);
+    free(ids);
+  } else {
+    sortBatch(ents, num, idx->sl->cmpCtx);
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    if (rc == SI_INDEX_OK) {
+      rc = compoundIndex_addKey(idx, ents[i].ch->id, ents[i].key);
+    } else {
+      SIMultiKey_Free(ents[i].key);
+    }
+  }
+  free(ents);
+  return rc;
+}
+
+int compoundIndex_applyChangeSet(compoundIndex *idx, SIChangeSet cs) {
+  int adds = 0;
+  for (size_t i = 0; i < cs.numChanges; i++) {
+    if (cs.changes[i].type != SI_CHADD) break;
+    // this value is not applicable to the index
+    if (cs.changes[i].v.len != idx->numFuncs) {
+      return SI_INDEX_ERROR;
+    }
+    adds++;
+  }
+  if (adds > 1 && adds == cs.numChanges) {
+    return compoundIndex_applyAddBatch(idx, cs);
+  }
 
   for (size_t i = 0; i < cs.numChanges; i++) {
     // printf("applying change %d for key %s\n", cs.changes[i].type,
@@ -109,14 +355,217 @@ int compoundIndex_Apply(void *ctx, SIChangeSet cs) {
   return SI_INDEX_OK;
 }
 
+/* Point the reverse index of an id at the main skiplist key it was merged into */
+static void compoundIndex_onDeltaMove(SIId id, SIMultiKey *key, void *ctx) {
+  SIReverseIndex_Insert(((compoundIndex *)ctx)->ri, id, key);
+}
+
+/* Fold the delta buffer into the main skiplist. Suspended scans re-seek, since
+ * their position may have moved between the skiplists */
+void compoundIndex_mergeDelta(compoundIndex *idx) {
+  SIDelta_Merge(idx->delta, idx->sl, compoundIndex_onDeltaMove, idx);
+  idx->merging = 0;
+  ++idx->version;
+}
+
+/* Returns 1 if scans are reading a snapshot of the main skiplist */
+static int compoundIndex_isPinned(compoundIndex *idx) {
+  return __atomic_load_n(&idx->pins, __ATOMIC_ACQUIRE) > 0;
+}
+
+/* Fold the delta buffer into the main skiplist once it's big enough. Indexes
+ * created without SI_INDEX_DELTA only buffer changes while scans are pinned,
+ * and their buffer is folded and dropped once the last of them is released.
+ * The buffer is folded a few entries at a time, on each write that buffered
+ * applied changes: a write merges SI_DELTA_MERGE_STEP entries plus twice its
+ * own, so the buffer shrinks and no write pays for a whole merge */
+void compoundIndex_maybeMergeDelta(compoundIndex *idx, size_t applied) {
+  if (!idx->delta || compoundIndex_isPinned(idx)) {
+    return;
+  }
+  int keep = idx->spec.flags & SI_INDEX_DELTA;
+  if (!idx->merging && keep && idx->delta->numChanges < SI_DELTA_MAX_CHANGES) {
+    return;
+  }
+  idx->merging = 1;
+  if (idx->delta->numChanges) {
+    SIDelta_MergeSome(idx->delta, idx->sl, SI_DELTA_MERGE_STEP + 2 * applied,
+                      compoundIndex_onDeltaMove, idx);
+    ++idx->version;
+  }
+  if (idx->delta->numChanges) {
+    return;
+  }
+  idx->merging = 0;
+  if (!keep) {
+    SIDelta_Free(idx->delta);
+    idx->delta = NULL;
+    // suspended scans must not iterate the dropped buffer
+    ++idx->version;
+  }
+}
+
+void compoundIndex_Traverse(void *ctx, IndexVisitor cb, void *visitCtx);
+
+static void compoundIndex_statsVisitor(SIId id, void *key, void *ctx) {
+  SIIndexStats_Add(ctx, key);
+}
+
+/* Rebuild the statistics from the rows of the index once removals made them
+ * stale */
+void compoundIndex_maybeRebuildStats(compoundIndex *idx) {
+  if (SIIndexStats_NeedsRebuild(idx->stats)) {
+    SIIndexStats_Clear(idx->stats);
+    compoundIndex_Traverse(idx, compoundIndex_statsVisitor, idx->stats);
+  }
+}
+
+int compoundIndex_Apply(void *ctx, SIChangeSet cs) {
+  compoundIndex *idx = ctx;
+
+  pthread_rwlock_wrlock(&idx->lock);
+  int rc = compoundIndex_applyChangeSet(idx, cs);
+  compoundIndex_maybeRebuildStats(idx);
+  compoundIndex_maybeMergeDelta(idx, cs.numChanges);
+  pthread_rwlock_unlock(&idx->lock);
+  return rc;
+}
+
+int compoundIndex_Load(void *ctx, SILoadRun *run) {
+  compoundIndex *idx = ctx;
+
+  pthread_rwlock_wrlock(&idx->lock);
+  // the records go straight to the main skiplist, where a merge of the delta
+  // buffer would move them anyway - unless it's pinned by snapshots
+  SIDelta *delta = idx->delta;
+  int pinned = compoundIndex_isPinned(idx);
+  if (!pinned) {
+    if (delta && delta->numChanges) {
+      compoundIndex_mergeDelta(idx);
+    }
+    idx->delta = NULL;
+  }
+
+  // the records come in key order, so every insert continues from the
+  // previous one's position, and their keys are adopted as they are
+  int rc = SI_INDEX_OK;
+  size_t i = 0;
+  while (i < run->num && rc == SI_INDEX_OK) {
+    SILoadEntry *e = &run->ents[i];
+    if (e->key->size != idx->numFuncs) {
+      rc = SI_INDEX_ERROR;
+      break;
+    }
+    rc = compoundIndex_addKey(idx, e->id, e->key);
+    if (rc != SI_INDEX_OK) {
+      // the key was freed with the failed insert
+      free(e->id);
+    }
+    i++;
+  }
+  run->num -= i;
+  memmove(run->ents, run->ents + i, run->num * sizeof(SILoadEntry));
+
+  if (!pinned) {
+    idx->delta = delta;
+  }
+  pthread_rwlock_unlock(&idx->lock);
+  return rc;
+}
+
+SILoadRun SI_NewLoadRun(size_t cap) {
+  return (SILoadRun){
+      .ents = malloc(cap * sizeof(SILoadEntry)), .num = 0, .cap = cap};
+}
+
+void SILoadRun_Add(SILoadRun *run, SIId id, SIValue *vals, SISpec *spec) {
+  if (run->num == run->cap) {
+    run->cap = run->cap ? run->cap * 2 : 16;
+    run->ents = realloc(run->ents, run->cap * sizeof(SILoadEntry));
+  }
+  SIMultiKey *key = SI_NewMultiKey(vals, spec->numProps);
+  SIMultiKey_Collate(key, spec);
+  run->ents[run->num++] = (SILoadEntry){.id = strdup(id), .key = key};
+}
+
+static int cmpLoadEntries(SILoadEntry *e1, SILoadEntry *e2,
+                          SICmpFuncVector *fv) {
+  int rc = SICmpMultiKey(e1->key, e2->key, fv);
+  return rc ? rc : strcmp(e1->id, e2->id);
+}
+
+void SILoadRun_Sort(SILoadRun *run, SISpec *spec) {
+  SIKeyCmpFunc funcs[spec->numProps];
+  for (int i = 0; i < spec->numProps; i++) {
+    funcs[i] = SI_KeyCmpFunc(spec->properties[i].type);
+  }
+  SICmpFuncVector fv = {.cmpFuncs = funcs, .numFuncs = spec->numProps};
+
+  size_t num = run->num, sorted = 1;
+  while (sorted < num &&
+         cmpLoadEntries(&run->ents[sorted - 1], &run->ents[sorted], &fv) <= 0) {
+    sorted++;
+  }
+  if (sorted >= num) {
+    return;
+  }
+
+  // bottom up merge sort, like the batches of changes
+  SILoadEntry *ents = run->ents, *tmp = malloc(num * sizeof(SILoadEntry));
+  for (size_t width = 1; width < num; width *= 2) {
+    for (size_t lo = 0; lo < num; lo += 2 * width) {
+      size_t mid = lo + width < num ? lo + width : num;
+      size_t hi = lo + 2 * width < num ? lo + 2 * width : num;
+      size_t i = lo, j = mid, k = lo;
+      while (i < mid && j < hi) {
+        tmp[k++] = cmpLoadEntries(&ents[j], &ents[i], &fv) < 0 ? ents[j++]
+                                                                : ents[i++];
+      }
+      while (i < mid) tmp[k++] = ents[i++];
+      while (j < hi) tmp[k++] = ents[j++];
+    }
+    memcpy(ents, tmp, num * sizeof(SILoadEntry));
+  }
+  free(tmp);
+}
+
+void SILoadRun_Free(SILoadRun *run) {
+  for (size_t i = 0; i < run->num; i++) {
+    free(run->ents[i].id);
+    SIMultiKey_Free(run->ents[i].key);
+  }
+  free(run->ents);
+}
+
+void compoundIndex_ReadLock(void *ctx) {
+  pthread_rwlock_rdlock(&((compoundIndex *)ctx)->lock);
+}
+
+void compoundIndex_Unlock(void *ctx) {
+  pthread_rwlock_unlock(&((compoundIndex *)ctx)->lock);
+}
+
 size_t compoundIndex_Len(void *ctx) {
   // TODO: This is the index CARDINALITY - not length!
   return ((compoundIndex *)ctx)->length;
 }
 
+int compoundIndex_Contains(void *ctx, SIId id) {
+  SIMultiKey *key;
+  return SIReverseIndex_Exists(((compoundIndex *)ctx)->ri, id, &key);
+}
+
+size_t compoundIndex_Buffered(void *ctx) {
+  compoundIndex *idx = ctx;
+  return idx->delta ? idx->delta->numChanges : 0;
+}
+
 SICursor *compoundIndex_Find(void *ctx, SIQuery *q);
+SIQueryPlan *compoundIndex_Explain(void *ctx, SIQuery *q);
+int compoundIndex_Snapshot(void *ctx, SICursor *c);
+long compoundIndex_DeleteWhere(void *ctx, SIQuery *q, IndexVisitor cb,
+                               void *visitCtx);
 void compoundIndex_Free(void *ctx);
-void compoundIndex_Traverse(void *ctx, IndexVisitor cb, void *visitCtx);
 
 int _cmpIds(void *p1, void *p2) {
   SIId id1 = p1, id2 = p2;
@@ -129,40 +578,33 @@ SIIndex SI_NewCompoundIndex(SISpec spec) {
   idx->cmpFuncs = calloc(spec.numProps, sizeof(SIKeyCmpFunc));
   idx->numFuncs = spec.numProps;
   idx->ri = SI_NewReverseIndex();
+  idx->trigrams = calloc(spec.numProps, sizeof(SITrigramIndex *));
   idx->length = 0;
+  idx->version = 0;
+  idx->pins = 0;
+  idx->merging = 0;
+  // writers go first: with the default reader preference a steady stream of
+  // background scans could keep the main thread from ever applying a change
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&idx->lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  pthread_mutex_init(&idx->planLock, NULL);
 
   for (u_int8_t i = 0; i < spec.numProps; i++) {
-    switch (spec.properties[i].type) {
-    case T_STRING:
-      idx->cmpFuncs[i] = si_cmp_string;
-      break;
-    case T_INT32:
-      idx->cmpFuncs[i] = si_cmp_int;
-      break;
-    case T_INT64:
-      idx->cmpFuncs[i] = si_cmp_long;
-      break;
-    case T_FLOAT:
-      idx->cmpFuncs[i] = si_cmp_float;
-      break;
-    case T_DOUBLE:
-      idx->cmpFuncs[i] = si_cmp_double;
-      break;
-    case T_BOOL:
-      idx->cmpFuncs[i] = si_cmp_int;
-      break;
-    case T_TIME:
-      idx->cmpFuncs[i] = si_cmp_time;
-      break;
-    case T_UINT:
-      idx->cmpFuncs[i] = si_cmp_uint;
-      break;
-
-    default: // TODO - implement all other types here
-
+    idx->cmpFuncs[i] = SI_KeyCmpFunc(spec.properties[i].type);
+    if (!idx->cmpFuncs[i]) {
       printf("unimplemented type %d! PANIC!\n", spec.properties[i].type);
       exit(-1);
     }
+    if (spec.properties[i].type == T_STRING &&
+        spec.properties[i].flags & SI_PROP_TRIGRAM) {
+      idx->trigrams[i] = SI_NewTrigramIndex();
+    }
   }
 
   SICmpFuncVector *sctx = malloc(sizeof(SICmpFuncVector));
@@ -170,14 +612,26 @@ SIIndex SI_NewCompoundIndex(SISpec spec) {
   sctx->numFuncs = idx->numFuncs;
 
   idx->sl = skiplistCreate(SICmpMultiKey, sctx, _cmpIds);
+  idx->delta = spec.flags & SI_INDEX_DELTA ? SI_NewDelta(idx->sl) : NULL;
+  idx->stats = SI_NewIndexStats(&idx->spec, idx->cmpFuncs);
 
   SIIndex ret;
   ret.ctx = idx;
   ret.Find = compoundIndex_Find;
+  ret.Explain = compoundIndex_Explain;
+  ret.Snapshot = compoundIndex_Snapshot;
   ret.Apply = compoundIndex_Apply;
+  ret.DeleteWhere = compoundIndex_DeleteWhere;
+  ret.Load = compoundIndex_Load;
   ret.Len = compoundIndex_Len;
+  ret.Contains = compoundIndex_Contains;
+  ret.Buffered = compoundIndex_Buffered;
   ret.Traverse = compoundIndex_Traverse;
+  ret.ReadLock = compoundIndex_ReadLock;
+  ret.Unlock = compoundIndex_Unlock;
   ret.Free = compoundIndex_Free;
+  ret.partitions = NULL;
+  ret.numPartitions = 0;
   return ret;
 }
 
@@ -187,7 +641,35 @@ typedef struct {
   // the current scan range we are scanning. we need to scan them all!
   int currentScanRange;
 
-  skiplistIterator it;
+  SIDeltaIterator it;
+
+  // for skip scans - the current value of the leading column, and a one
+  // column key used to seek past it
+  SIValue leading;
+  SIMultiKey *probe;
+
+  // set once the current entry was checked against the filters, by a peek
+  int matched;
+
+  // set if the scan reads a snapshot of the index, with a private copy of the
+  // delta buffer as it was when it was pinned, or NULL if it was empty
+  int pinned;
+  SIDelta *snapDelta;
+
+  // the position to resume from if the index changed while the scan was
+  // suspended
+  int suspended;
+  u_int64_t version;
+  SIMultiKey *resumeKey;
+  SIId resumeId;
+
+  // for trigram scans - the candidate ids to verify
+  SIId *candidates;
+  size_t numCandidates;
+  size_t candidatePos;
+
+  // the execution stats of the cursor wrapping the scan
+  SICursorStats *stats;
 } ciScanCtx;
 
 siPlanRange *scanCtx_CurrentRange(ciScanCtx *c) {
@@ -201,8 +683,10 @@ siPlanRange *scanCtx_CurrentRange(ciScanCtx *c) {
 }
 
 /* Eval a predicate query node against a given key. Returns 1 if the key
- * staisfies the predicate */
-int evalPredicate(SIPredicate *pred, SIMultiKey *mk, SICmpFuncVector *fv) {
+ * staisfies the predicate. The number of comparisons made is added to numCmps
+ */
+int evalPredicate(SIPredicate *pred, SIMultiKey *mk, SICmpFuncVector *fv,
+                  size_t *numCmps) {
   if (pred->propId < 0 || pred->propId >= mk->size) {
     return 0;
   }
@@ -211,29 +695,41 @@ int evalPredicate(SIPredicate *pred, SIMultiKey *mk, SICmpFuncVector *fv) {
   switch (pred->t) {
   // compare equals
   case PRED_EQ:
+    ++*numCmps;
     return 0 == cmp(&mk->keys[pred->propId], &pred->eq.v, NULL);
 
   // compare IN
   case PRED_IN:
+    // the key matches if it equals any of the values
     for (int i = 0; i < pred->in.numvals; i++) {
-      if (cmp(&mk->keys[pred->propId], &pred->in.vals[i], NULL) != 0) {
-        return 0;
+      ++*numCmps;
+      if (cmp(&mk->keys[pred->propId], &pred->in.vals[i], NULL) == 0) {
+        return 1;
       }
     }
-    // we only return true if the IN actually had values in it
-    return pred->in.numvals > 0;
-    break;
+    return 0;
 
-  // compare !=
+  // compare != - NULL values are never different from anything, matching the
+  // ranges the planner builds for it
   case PRED_NE:
-    return cmp(&mk->keys[pred->propId], &pred->eq.v, NULL) != 0;
+    ++*numCmps;
+    return !SIValue_IsNull(mk->keys[pred->propId]) &&
+           cmp(&mk->keys[pred->propId], &pred->ne.v, NULL) != 0;
 
   // compare range
+  case PRED_LIKE:
+    ++*numCmps;
+    return mk->keys[pred->propId].type == T_STRING &&
+           SI_LikeMatch(&mk->keys[pred->propId].stringval,
+                        &pred->like.pattern.stringval) != pred->like.negated;
+
   case PRED_RNG: {
+    ++*numCmps;
     int minc = cmp(&mk->keys[pred->propId], &pred->rng.min, NULL);
     if (minc < 0 || (minc == 0 && pred->rng.minExclusive)) {
       return 0;
     }
+    ++*numCmps;
     int maxc = cmp(&mk->keys[pred->propId], &pred->rng.max, NULL);
     if (maxc > 0 || (maxc == 0 && pred->rng.maxExclusive)) {
       return 0;
@@ -248,72 +744,250 @@ int evalPredicate(SIPredicate *pred, SIMultiKey *mk, SICmpFuncVector *fv) {
 
 /* Eval a key against a query node, whether a logical or predicate node. If the
  * node is a logical operator, its children are evaluated recursivel */
-int evalKey(SIQueryNode *n, SIMultiKey *mk, SICmpFuncVector *fv) {
+int evalKey(SIQueryNode *n, SIMultiKey *mk, SICmpFuncVector *fv,
+            size_t *numCmps) {
   // passthrough nodes always return 1
   if (n->type & QN_PASSTHRU) {
     return 1;
   }
   // predicate nodes are evaluated one by one
   if (n->type == QN_PRED) {
-    return evalPredicate(&n->pred, mk, fv);
+    return evalPredicate(&n->pred, mk, fv, numCmps);
   } else if (n->type != QN_LOGIC) {
     // WTF?
     return 0;
   }
 
   // a logic node always has left and right that are either ORed or ANDed
-  int leftEval = evalKey(n->op.left, mk, fv);
+  int leftEval = evalKey(n->op.left, mk, fv, numCmps);
   // we will not evluate the RHS unless there's a need to
   if (n->op.op == OP_OR) {
-    return leftEval || evalKey(n->op.right, mk, fv);
+    return leftEval || evalKey(n->op.right, mk, fv, numCmps);
   }
-  return leftEval && evalKey(n->op.right, mk, fv);
+  return leftEval && evalKey(n->op.right, mk, fv, numCmps);
 }
 
-SIId scan_next(void *ctx) {
+/* The delta buffer a scan reads with the main skiplist */
+static SIDelta *scanCtx_Delta(ciScanCtx *sc) {
+  return sc->pinned ? sc->snapDelta : sc->idx->delta;
+}
+
+/* Start iterating the current scan range, if there is one */
+void scanCtx_StartRange(ciScanCtx *sc) {
+  siPlanRange *cr = scanCtx_CurrentRange(sc);
+  if (cr) {
+    sc->it = SIDelta_IterateRange(scanCtx_Delta(sc), sc->idx->sl, cr->min,
+                                  cr->max, cr->minExclusive, cr->maxExclusive);
+    sc->stats->rangesScanned++;
+    sc->stats->comparisons += sc->it.numCmps;
+    sc->stats->nodesVisited += sc->it.numVisited;
+  }
+}
+
+/* Skip scans - seek to the next distinct value of the leading column, and
+ * plug it into all the plan's ranges. Returns 0 if there are no more values */
+int scanCtx_NextLeadingValue(ciScanCtx *sc) {
+  SIDeltaIterator it;
+  if (SIValue_IsNull(sc->leading)) {
+    sc->probe->keys[0] = SI_NegativeInfVal();
+    it = SIDelta_IterateRange(scanCtx_Delta(sc), sc->idx->sl, sc->probe, NULL,
+                              0, 0);
+  } else {
+    sc->probe->keys[0] = sc->leading;
+    it = SIDelta_IterateRange(scanCtx_Delta(sc), sc->idx->sl, sc->probe, NULL,
+                              1, 0);
+  }
+  sc->stats->comparisons += it.numCmps;
+  sc->stats->nodesVisited += it.numVisited;
+  SIMultiKey *mk = SIDeltaIterator_Current(&it, NULL);
+  if (!mk) {
+    sc->currentScanRange = sc->plan->numRanges;
+    return 0;
+  }
+
+  // we keep our own copy of the value, so the scan can be resumed even if the
+  // record it came from was deleted. strings are copied and not referenced,
+  // since concurrent readers can't share the index's reference counts
+  SIValue_Free(&sc->leading);
+  sc->leading = mk->keys[0];
+  if (sc->leading.type == T_STRING) {
+    sc->leading.stringval = SIString_Copy(sc->leading.stringval);
+  }
+  for (int i = 0; i < sc->plan->numRanges; i++) {
+    siPlanRange *rng;
+    Vector_Get(sc->plan->ranges, i, &rng);
+    rng->min->keys[0] = sc->leading;
+    rng->max->keys[0] = sc->leading;
+  }
+  sc->currentScanRange = 0;
+  scanCtx_StartRange(sc);
+  return 1;
+}
+
+/* Save the position of a scan, so it can be resumed if the index changes.
+ * Snapshots don't change, and their scans just go on */
+void scan_suspend(void *ctx) {
   ciScanCtx *sc = ctx;
-  skiplistNode *n;
-  SIId ret = NULL;
+  if (sc->pinned) {
+    return;
+  }
+  sc->suspended = 1;
+  sc->version = sc->idx->version;
+
+  if (sc->resumeKey) {
+    SIMultiKey_Free(sc->resumeKey);
+    free(sc->resumeId);
+    sc->resumeKey = NULL;
+    sc->resumeId = NULL;
+  }
+  SIId id;
+  SIMultiKey *mk = SIDeltaIterator_Current(&sc->it, &id);
+  if (mk) {
+    sc->resumeKey = SI_NewMultiKey(mk->keys, mk->size);
+    sc->resumeId = strdup(id);
+  }
+}
+
+/* Re-seek a scan to its saved position. The iterator is started again, since
+ * the delta buffer it was iterating may have been merged or dropped */
+static void scan_seekSaved(ciScanCtx *sc) {
+  siPlanRange *cr = scanCtx_CurrentRange(sc);
+  if (!cr || !sc->resumeKey) {
+    return;
+  }
+  // the entry at the saved position may have changed
+  sc->matched = 0;
+  sc->it = SIDelta_IterateRange(scanCtx_Delta(sc), sc->idx->sl, cr->min,
+                                cr->max, cr->minExclusive, cr->maxExclusive);
+  SIDeltaIterator_Seek(&sc->it, sc->resumeKey, sc->resumeId);
+  sc->stats->comparisons += sc->it.numCmps;
+  sc->stats->nodesVisited += sc->it.numVisited;
+}
+
+/* Re-seek a suspended scan to its saved position if the index was changed */
+void scan_resume(ciScanCtx *sc) {
+  sc->suspended = 0;
+  if (sc->version != sc->idx->version) {
+    scan_seekSaved(sc);
+  }
+}
+
+/* Advance the scan's iterator by one entry */
+static SIId scan_advance(ciScanCtx *sc) {
+  unsigned long numCmps = sc->it.numCmps, numVisited = sc->it.numVisited;
+  SIId ret = SIDeltaIterator_Next(&sc->it);
+  sc->stats->comparisons += sc->it.numCmps - numCmps;
+  sc->stats->nodesVisited += sc->it.numVisited - numVisited;
+  sc->matched = 0;
+  return ret;
+}
+
+/* Position the scan on the next entry matching the query without consuming
+ * it, so a suspended scan resumes from it. Returns its id, or NULL at the end
+ * of the scan */
+SIId scan_peek(void *ctx, void **key) {
+  ciScanCtx *sc = ctx;
+  SIMultiKey *mk;
+  SIId id;
   SICmpFuncVector fv = {.cmpFuncs = sc->idx->cmpFuncs,
                         .numFuncs = sc->idx->numFuncs};
 
+  if (sc->suspended) {
+    scan_resume(sc);
+  }
+
   while (sc->currentScanRange < sc->plan->numRanges) {
-    while (NULL != (n = skiplistIteratorCurrent(&sc->it))) {
+    while (NULL != (mk = SIDeltaIterator_Current(&sc->it, &id))) {
       // if we have filters beyond the min/max range, we need to explicitly
       // filter each of them
-      SIMultiKey *mk = n->obj;
-
-      int ok = 1;
-      if (sc->plan->filterTree) {
-        ok = evalKey(sc->plan->filterTree, mk, &fv);
+      if (!sc->matched && sc->plan->filterTree &&
+          !evalKey(sc->plan->filterTree, mk, &fv, &sc->stats->comparisons)) {
+        sc->stats->rowsFiltered++;
+        scan_advance(sc);
+        continue;
       }
-
-      // advance the iterator by one - but only return the value if the filter
-      // eval was successful
-      void *nextval = skiplistIterator_Next(&sc->it);
-      if (ok) {
-        return nextval;
+      sc->matched = 1;
+      if (key) {
+        *key = mk;
       }
-      // otherwise we just continue to the next node
+      return id;
     }
 
     // If we are here - the current range iteration is over. let's see if we can
     // find a new range
     sc->currentScanRange++;
-    siPlanRange *cr = scanCtx_CurrentRange(sc);
-    // start iterating the new range
-    if (cr) {
-      sc->it = skiplistIterateRange(sc->idx->sl, cr->min, cr->max,
-                                    cr->minExclusive, cr->maxExclusive);
+    if (sc->currentScanRange == sc->plan->numRanges &&
+        sc->plan->strategy == QP_SKIPSCAN) {
+      // in skip scans we restart the ranges with the next leading value
+      scanCtx_NextLeadingValue(sc);
+    } else {
+      scanCtx_StartRange(sc);
     }
   }
 
   return NULL;
 }
 
+SIId scan_next(void *ctx) {
+  ciScanCtx *sc = ctx;
+  if (!scan_peek(sc, NULL)) {
+    return NULL;
+  }
+  sc->stats->rowsReturned++;
+  return scan_advance(sc);
+}
+
+/* Trigram scans - verify the next candidates against the filter tree, which
+ * includes the LIKE predicate itself. Candidates are looked up in the reverse
+ * index on every call, so ids deleted while the scan was suspended are skipped
+ */
+SIId trigramScan_next(void *ctx) {
+  ciScanCtx *sc = ctx;
+  SICmpFuncVector fv = {.cmpFuncs = sc->idx->cmpFuncs,
+                        .numFuncs = sc->idx->numFuncs};
+
+  while (sc->candidatePos < sc->numCandidates) {
+    SIId id = sc->candidates[sc->candidatePos++];
+    SIMultiKey *mk;
+    if (!SIReverseIndex_Exists(sc->idx->ri, id, &mk)) {
+      continue;
+    }
+    sc->stats->nodesVisited++;
+    if (evalKey(sc->plan->filterTree, mk, &fv, &sc->stats->comparisons)) {
+      sc->stats->rowsReturned++;
+      return id;
+    }
+    sc->stats->rowsFiltered++;
+  }
+  return NULL;
+}
+
+/* Trigram scans hold copies of their candidates, and don't need to save
+ * anything to be resumed */
+void trigramScan_suspend(void *ctx) {}
+
 void ciScanCtx_free(void *ctx) {
   ciScanCtx *sctx = ctx;
+  if (sctx->pinned) {
+    if (sctx->snapDelta) {
+      SIDelta_Free(sctx->snapDelta);
+    }
+    // the next change to the index merges its buffer if this was the last one
+    __atomic_sub_fetch(&sctx->idx->pins, 1, __ATOMIC_RELEASE);
+  }
+  // the probe holds a value borrowed from the leading value
+  sctx->probe->keys[0] = SI_NullVal();
+  SIMultiKey_Free(sctx->probe);
   SIQueryPlan_Free(sctx->plan);
+  SIValue_Free(&sctx->leading);
+  if (sctx->resumeKey) {
+    SIMultiKey_Free(sctx->resumeKey);
+    free(sctx->resumeId);
+  }
+  for (size_t i = 0; i < sctx->numCandidates; i++) {
+    free(sctx->candidates[i]);
+  }
+  free(sctx->candidates);
   free(sctx);
 }
 
@@ -324,23 +998,59 @@ SICursor *compoundIndex_Find(void *ctx, SIQuery *q) {
     goto error;
   }
 
-  SIQueryPlan *plan = SI_BuildQueryPlan(q, &idx->spec);
+  double start = SI_Clock();
+  pthread_mutex_lock(&idx->planLock);
+  SIQueryPlan *plan = SI_BuildQueryPlan(q, &idx->spec, idx->stats, idx->trigrams);
+  pthread_mutex_unlock(&idx->planLock);
+  c->stats.planTime = SI_Clock() - start;
   if (!plan) {
     goto error;
   }
+  c->stats.estimatedCost = plan->cost;
+  c->stats.estimatedRows = plan->estimatedRows;
 
   ciScanCtx *sctx = malloc(sizeof(ciScanCtx));
   sctx->currentScanRange = 0;
   sctx->plan = plan;
   sctx->idx = idx;
-  siPlanRange *cr = scanCtx_CurrentRange(sctx);
-  if (cr) {
-    sctx->it = skiplistIterateRange(sctx->idx->sl, cr->min, cr->max,
-                                    cr->minExclusive, cr->maxExclusive);
-  }
+  sctx->stats = &c->stats;
+  sctx->leading = SI_NullVal();
+  sctx->matched = 0;
+  sctx->pinned = 0;
+  sctx->snapDelta = NULL;
+  sctx->suspended = 0;
+  sctx->version = idx->version;
+  sctx->resumeKey = NULL;
+  sctx->resumeId = NULL;
+  sctx->candidates = NULL;
+  sctx->numCandidates = 0;
+  sctx->candidatePos = 0;
+  sctx->probe = malloc(sizeof(SIMultiKey) + sizeof(SIValue));
+  sctx->probe->size = 1;
+  sctx->probe->keys[0] = SI_NullVal();
   c->ctx = sctx;
-  c->Next = scan_next;
   c->Release = ciScanCtx_free;
+  if (plan->strategy == QP_TRIGRAM) {
+    SIPredicate *like = plan->trigramPred;
+    sctx->candidates =
+        SITrigramIndex_Candidates(idx->trigrams[like->propId],
+                                  &like->like.pattern.stringval,
+                                  &sctx->numCandidates);
+    c->Next = trigramScan_next;
+    c->Suspend = trigramScan_suspend;
+    return c;
+  }
+
+  if (plan->strategy == QP_SKIPSCAN) {
+    scanCtx_NextLeadingValue(sctx);
+  } else {
+    scanCtx_StartRange(sctx);
+  }
+  c->Next = scan_next;
+  // the ranges of a plan are not sorted, so only single range scans return
+  // their ids in key order
+  c->Peek = plan->numRanges <= 1 ? scan_peek : NULL;
+  c->Suspend = scan_suspend;
   return c;
 
 error:
@@ -348,18 +1058,163 @@ error:
   return c;
 }
 
-void compoundIndex_Traverse(void *ctx, IndexVisitor cb, void *visitCtx) {
+SIQueryPlan *compoundIndex_Explain(void *ctx, SIQuery *q) {
   compoundIndex *idx = ctx;
+  if (q->numPredicates == 0) {
+    return NULL;
+  }
+  pthread_mutex_lock(&idx->planLock);
+  SIQueryPlan *plan = SI_BuildQueryPlan(q, &idx->spec, idx->stats, idx->trigrams);
+  pthread_mutex_unlock(&idx->planLock);
+  return plan;
+}
 
-  skiplistIterator it = skiplistIterateAll(idx->sl);
-  skiplistNode *n;
+/* Pin the index for a scan, which reads the index as it is now from then on,
+ * without the read lock. The main skiplist stays as it is while it's pinned,
+ * and the scan gets a copy of the delta buffer if it has changes. Trigram scans
+ * verify their candidates against the current reverse index, and can't be
+ * pinned */
+int compoundIndex_Snapshot(void *ctx, SICursor *c) {
+  compoundIndex *idx = ctx;
+  if (c->Next != scan_next) {
+    return 0;
+  }
+  ciScanCtx *sc = c->ctx;
+  if (sc->pinned) {
+    return 1;
+  }
 
-  while (NULL != (n = skiplistIteratorCurrent(&it))) {
-    for (u_int i = 0; i < n->numVals; i++) {
-      cb(n->vals[i], n->obj, visitCtx);
+  pthread_rwlock_wrlock(&idx->lock);
+  // the buffer may be merged below, so the scan's position is saved first
+  scan_suspend(sc);
+  if (!compoundIndex_isPinned(idx) && idx->delta && idx->delta->numChanges) {
+    compoundIndex_mergeDelta(idx);
+  }
+  if (idx->delta && idx->delta->numChanges) {
+    sc->snapDelta = SIDelta_Copy(idx->delta, idx->sl);
+  }
+  // changes are buffered from now on, in indexes without a buffer too
+  if (!idx->delta) {
+    idx->delta = SI_NewDelta(idx->sl);
+  }
+  __atomic_add_fetch(&idx->pins, 1, __ATOMIC_RELAXED);
+  sc->pinned = 1;
+  sc->suspended = 0;
+  scan_seekSaved(sc);
+  pthread_rwlock_unlock(&idx->lock);
+  return 1;
+}
+
+typedef struct {
+  compoundIndex *idx;
+  IndexVisitor cb;
+  void *cbCtx;
+  long num;
+} ciDeleteCtx;
+
+/* Drop the ids of a node unlinked by a range deletion from the rest of the
+ * index, and free them with the node's key */
+void compoundIndex_onRangeDelete(skiplistNode *n, void *ctx) {
+  ciDeleteCtx *dc = ctx;
+  compoundIndex *idx = dc->idx;
+  for (unsigned int i = 0; i < n->numVals; i++) {
+    SIIndexStats_Remove(idx->stats, n->obj);
+    compoundIndex_updateTrigrams(idx, n->vals[i], n->obj, 0);
+    SIReverseIndex_Delete(idx->ri, n->vals[i]);
+    if (dc->cb) {
+      dc->cb(n->vals[i], n->obj, dc->cbCtx);
+    }
+    free(n->vals[i]);
+  }
+  idx->length -= n->numVals;
+  dc->num += n->numVals;
+  SIMultiKey_Free(n->obj);
+}
+
+/* Delete the ids a cursor returns one by one. The ids are collected first,
+ * since the scan can't go on over deleted nodes */
+void compoundIndex_deleteFound(compoundIndex *idx, SICursor *c,
+                               ciDeleteCtx *dc) {
+  size_t num = 0, cap = 16;
+  SIId *ids = malloc(cap * sizeof(SIId));
+  SIId id;
+  while (NULL != (id = c->Next(c->ctx))) {
+    if (num == cap) {
+      cap *= 2;
+      ids = realloc(ids, cap * sizeof(SIId));
     }
+    ids[num++] = strdup(id);
+  }
 
-    skiplistIterator_Next(&it);
+  for (size_t i = 0; i < num; i++) {
+    SIMultiKey *key;
+    if (dc->cb && SIReverseIndex_Exists(idx->ri, ids[i], &key)) {
+      dc->cb(ids[i], key, dc->cbCtx);
+    }
+    if (compoundIndex_applyDel(idx, (SIChange){.type = SI_CHDEL,
+                                               .id = ids[i]}) == SI_INDEX_OK) {
+      dc->num++;
+    }
+    free(ids[i]);
+  }
+  free(ids);
+}
+
+long compoundIndex_DeleteWhere(void *ctx, SIQuery *q, IndexVisitor cb,
+                               void *visitCtx) {
+  compoundIndex *idx = ctx;
+  ciDeleteCtx dc = {.idx = idx, .cb = cb, .cbCtx = visitCtx, .num = 0};
+
+  pthread_rwlock_wrlock(&idx->lock);
+  // range deletions only see the main skiplist, which can't change while it's
+  // pinned
+  int pinned = compoundIndex_isPinned(idx);
+  if (!pinned && idx->delta && idx->delta->numChanges) {
+    compoundIndex_mergeDelta(idx);
+  }
+
+  SICursor *c = compoundIndex_Find(idx, q);
+  if (c->error != SI_CURSOR_OK) {
+    SICursor_Free(c);
+    pthread_rwlock_unlock(&idx->lock);
+    return -1;
+  }
+
+  // when the ranges select exactly the matching rows, each of them is a
+  // contiguous run of nodes that is unlinked at once
+  SIQueryPlan *plan = ((ciScanCtx *)c->ctx)->plan;
+  if (!pinned && plan->strategy == QP_RANGE && !plan->filterTree) {
+    for (int i = 0; i < plan->numRanges; i++) {
+      siPlanRange *rng;
+      Vector_Get(plan->ranges, i, &rng);
+      skiplistDeleteRange(idx->sl, rng->min, rng->max, rng->minExclusive,
+                          rng->maxExclusive, compoundIndex_onRangeDelete, &dc);
+    }
+  } else {
+    compoundIndex_deleteFound(idx, c, &dc);
+  }
+  SICursor_Free(c);
+
+  if (dc.num) {
+    ++idx->version;
+  }
+  compoundIndex_maybeRebuildStats(idx);
+  compoundIndex_maybeMergeDelta(idx, dc.num);
+  pthread_rwlock_unlock(&idx->lock);
+  return dc.num;
+}
+
+void compoundIndex_Traverse(void *ctx, IndexVisitor cb, void *visitCtx) {
+  compoundIndex *idx = ctx;
+
+  // the entries of the delta buffer are visited in order with the main ones
+  SIDeltaIterator it =
+      SIDelta_IterateRange(idx->delta, idx->sl, NULL, NULL, 0, 0);
+  SIId id;
+  SIMultiKey *key;
+  while (NULL != (key = SIDeltaIterator_Current(&it, &id))) {
+    cb(id, key, visitCtx);
+    SIDeltaIterator_Next(&it);
   }
 }
 
@@ -368,19 +1223,31 @@ void compoundIndex_Free(void *ctx) {
 
   SIReverseIndex_Free(idx->ri);
 
-  // free up all keys in the skiplist
-  skiplistIterator it = skiplistIterateAll(idx->sl);
-  skiplistNode *n;
+  // free up all keys in the skiplist. we walk the nodes directly since the
+  // iterator visits a node once per value
+  skiplistNode *n = idx->sl->header->level[0].forward;
 
-  while (NULL != (n = skiplistIteratorCurrent(&it))) {
+  while (n) {
     for (u_int i = 0; i < n->numVals; i++) {
       free(n->vals[i]);
     }
     if (n->obj)
       SIMultiKey_Free(n->obj);
 
-    skiplistIterator_Next(&it);
+    n = n->level[0].forward;
   }
   skiplistFree(idx->sl);
+  if (idx->delta) {
+    SIDelta_Free(idx->delta);
+  }
+  SIIndexStats_Free(idx->stats);
+  for (int i = 0; i < idx->spec.numProps; i++) {
+    if (idx->trigrams[i]) {
+      SITrigramIndex_Free(idx->trigrams[i]);
+    }
+  }
+  free(idx->trigrams);
+  pthread_rwlock_destroy(&idx->lock);
+  pthread_mutex_destroy(&idx->planLock);
   free(idx);
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "value.h"
 #include "changeset.h"
 #include "spec.h"
+#include "key.h"
 
 #define SI_INDEX_OK 0
 #define SI_INDEX_ERROR -1
@@ -16,30 +17,161 @@
 #define SI_CURSOR_OK 0
 #define SI_CURSOR_ERROR 1
 
+/* Execution statistics collected by a cursor while it is being consumed */
+typedef struct {
+  // time spent building the query plan, in microseconds
+  double planTime;
+  size_t rangesScanned;
+  // index nodes visited, and key comparisons made while seeking, iterating and
+  // filtering
+  size_t nodesVisited;
+  size_t comparisons;
+  // rows rejected by the filter tree, and rows returned to the caller
+  size_t rowsFiltered;
+  size_t rowsReturned;
+  // the planner's cost estimate for the query, and the number of rows it
+  // expects the query to return
+  double estimatedCost;
+  double estimatedRows;
+} SICursorStats;
+
 typedef struct {
   size_t offset;
   size_t total;
   int error;
+  SICursorStats stats;
   void *ctx;
   SIId (*Next)(void *ctx);
+  // called when the cursor is paused and the index might change before the
+  // next call to Next. The cursor saves its position in order to resume from
+  // it. May be NULL
+  void (*Suspend)(void *ctx);
+  // for cursors returning ids in key order - return the id the next call to
+  // Next will return, and set key to its key, without consuming it. The key
+  // belongs to the index. May be NULL
+  SIId (*Peek)(void *ctx, void **key);
   void (*Release)(void *vtx);
 } SICursor;
 
 void SICursor_Free(SICursor *c);
 SICursor *SI_NewCursor(void *ctx);
 
+/* Combine cursors, possibly of different indexes, into a cursor returning the
+ * ids matched by all of them (intersection) or by any of them (union), sorted
+ * by id. The merged cursor takes ownership of the given cursors and reads them
+ * on its first call to Next. The cursor expected to return the fewest rows
+ * drives an intersection, and the other cursors only filter its ids. Merged cursors
+ * can't be suspended */
+SICursor *SI_NewIntersectCursor(SICursor **cursors, int num);
+SICursor *SI_NewUnionCursor(SICursor **cursors, int num);
+
 typedef void (*IndexVisitor)(SIId id, void *key, void *ctx);
 
+/* A record of a saved index, with its key already built and collated */
+typedef struct {
+  SIId id;
+  SIMultiKey *key;
+} SILoadEntry;
+
+/* A run of saved records, sorted by key and id before it's loaded. The run
+ * owns the ids and keys of its entries until an index adopts them */
 typedef struct {
+  SILoadEntry *ents;
+  size_t num;
+  size_t cap;
+} SILoadRun;
+
+SILoadRun SI_NewLoadRun(size_t cap);
+
+/* Add a copy of a record to a run, with its key collated for the spec */
+void SILoadRun_Add(SILoadRun *run, SIId id, SIValue *vals, SISpec *spec);
+
+/* Sort a run by key and id. Runs read in index order are only checked */
+void SILoadRun_Sort(SILoadRun *run, SISpec *spec);
+
+/* Free the entries left in a run, and the run */
+void SILoadRun_Free(SILoadRun *run);
+
+struct siQueryPlan;
+
+/* Indexes may be read by multiple threads, while changes are applied by one
+ * writer thread. Apply, Load and DeleteWhere take the index's write lock by
+ * themselves. Other threads must hold the read lock while calling Find or
+ * reading a cursor, and suspend the cursor before releasing it - unless the
+ * cursor was pinned with Snapshot */
+typedef struct SIIndex {
   void *ctx;
 
   int (*Apply)(void *ctx, SIChangeSet cs);
+  // insert a sorted run of records of a saved index with distinct ids,
+  // adopting their ids and keys. The caller frees the run, with whatever
+  // entries were not loaded
+  int (*Load)(void *ctx, SILoadRun *run);
+  // delete all the ids matching a query, calling cb on each one before it is
+  // removed. Returns the number of ids deleted, or -1 on error
+  long (*DeleteWhere)(void *ctx, SIQuery *q, IndexVisitor cb, void *visitCtx);
   SICursor *(*Find)(void *ctx, SIQuery *q);
+  // build the plan Find would execute for a query, without executing it
+  struct siQueryPlan *(*Explain)(void *ctx, SIQuery *q);
+  // pin the index as it is for a cursor just returned by Find. The cursor
+  // then reads that snapshot without the read lock and without suspending,
+  // while changes go on being applied, and the index reclaims what they
+  // replaced once it's released. Takes the write lock, so it must not be
+  // called holding the read lock. Returns 0 if the cursor can't be pinned
+  int (*Snapshot)(void *ctx, SICursor *c);
   void (*Traverse)(void *ctx, IndexVisitor cb, void *visitCtx);
   size_t (*Len)(void *ctx);
+  // returns 1 if an id is in the index. Called by the writer thread only,
+  // without a lock, since the reverse index only changes on that thread
+  int (*Contains)(void *ctx, SIId id);
+  // the number of changes waiting in delta buffers to be merged into the main
+  // skiplist
+  size_t (*Buffered)(void *ctx);
+  void (*ReadLock)(void *ctx);
+  void (*Unlock)(void *ctx);
   void (*Free)(void *ctx);
+
+  // the sub-indexes of a partitioned index, which have their own locks and
+  // can be scanned in parallel. NULL if the index is not partitioned
+  struct SIIndex *partitions;
+  int numPartitions;
 } SIIndex;
 
 SIIndex SI_NewCompoundIndex(SISpec spec);
 
+/* An index sharded into numPartitions compound indexes by the hash of the
+ * ids. Changes are routed to the partition of their id. Queries are planned by
+ * every partition, and the partitions' results are merged in key order - or
+ * one partition after the other for scans that are not in key order. The
+ * write lock of each partition is only taken for the changes routed to it, and
+ * the read lock is the read lock of all the partitions. Unique indexes can't
+ * be partitioned, since equal keys of different ids may be in different
+ * partitions */
+SIIndex SI_NewPartitionedIndex(SISpec spec);
+
+/* Create the index a spec describes - partitioned if it has more than one
+ * partition */
+SIIndex SI_NewIndex(SISpec spec);
+
+/* The ids read from one partition's cursor, in the order it returned them,
+ * with copies of their keys if the cursor returns them in key order */
+typedef struct {
+  SIId *ids;
+  void **keys;
+  size_t num;
+} SIPartitionRun;
+
+/* The cursors of the partitions a cursor of a partitioned index merges, or
+ * NULL if the cursor is of another kind. They are owned by the merged cursor,
+ * and can be read on different threads, each under its partition's read lock
+ * and suspended before it's released */
+SICursor **SI_PartitionCursors(SICursor *c, int *num);
+
+/* Merge the runs read from all the partition cursors of c into out, in the
+ * order c would have returned them */
+void SI_MergePartitionRuns(SICursor *c, SIPartitionRun *runs, SIId *out);
+
+/* A monotonic clock in microseconds, used for profiling queries */
+double SI_Clock();
+
 #endif // !__SECONDARY_H__
\ No newline at end of file
@@ -1,7 +1,12 @@
+#include <pthread.h>
 #include "redismodule.h"
 #include "index.h"
 #include "key.h"
 #include "index_type.h"
+#include "cursor_registry.h"
+#include "hash_index.h"
+#include "thread_pool.h"
+#include "block_codec.h"
 #include "rmutil/util.h"
 #include "rmutil/vector.h"
 #include "rmutil/alloc.h"
@@ -9,6 +14,12 @@
 
 RedisModuleType *IndexType;
 
+// frees big indexes in the background. NULL if its thread could not be started
+static SIThreadPool *lazyfreePool = NULL;
+// decodes the records of indexes loaded from rdb. NULL if they are decoded on
+// the loading thread
+static SIThreadPool *loadPool = NULL;
+
 /* Serialize the index spec into an rdb/replication buffer */
 void __redisIndex_SaveSpec(RedisIndex *idx, RedisModuleIO *io) {
   RedisModule_SaveUnsigned(io, (u_int64_t)idx->spec.flags);
@@ -28,10 +39,11 @@ void __redisIndex_SaveSpec(RedisIndex *idx, RedisModuleIO *io) {
     RedisModule_SaveSigned(io, (int)idx->spec.properties[i].type);
     RedisModule_SaveSigned(io, (int)idx->spec.properties[i].flags);
   }
+  RedisModule_SaveUnsigned(io, (u_int64_t)idx->spec.numPartitions);
 }
 
 /* Load the index spec from an rdb/replication buffer */
-void __redisIndex_LoadSpec(RedisIndex *idx, RedisModuleIO *io) {
+void __redisIndex_LoadSpec(RedisIndex *idx, RedisModuleIO *io, int encver) {
   idx->spec.flags = RedisModule_LoadUnsigned(io);
   idx->spec.numProps = RedisModule_LoadUnsigned(io);
   idx->spec.properties = calloc(idx->spec.numProps, sizeof(SIIndexProperty));
@@ -47,6 +59,13 @@ void __redisIndex_LoadSpec(RedisIndex *idx, RedisModuleIO *io) {
     // printf("loaded prop type %d flags %x\n", idx->spec.properties[i].type,
     //        idx->spec.properties[i].flags);
   }
+  // version 5 added partitioned indexes
+  idx->spec.numPartitions = 0;
+  if (encver >= 5) {
+    u_int64_t num = RedisModule_LoadUnsigned(io);
+    idx->spec.numPartitions =
+        num > SI_MAX_PARTITIONS ? SI_MAX_PARTITIONS : (int)num;
+  }
 }
 
 /* Read a single SIValue from a redis io buffer. Returns NULL value if the value
@@ -89,43 +108,6 @@ SIValue __readValue(RedisModuleIO *rdb) {
   return v;
 }
 
-/* Write a single SIValue's data into an rdb/replication buffer */
-void __writeValue(void *v, SIType t, RedisModuleIO *rdb) {
-  RedisModule_SaveUnsigned(rdb, t);
-  switch (t) {
-    case T_STRING: {
-      SIString *s = v;
-      RedisModule_SaveStringBuffer(rdb, s->str, s->len);
-      break;
-    }
-    case T_INT32:
-      RedisModule_SaveSigned(rdb, *(int32_t *)v);
-      break;
-    case T_INT64:
-      RedisModule_SaveSigned(rdb, *(int64_t *)v);
-      break;
-    case T_UINT:
-      RedisModule_SaveUnsigned(rdb, *(u_int64_t *)v);
-      break;
-    case T_BOOL:
-      RedisModule_SaveUnsigned(rdb, *(int32_t *)v);
-      break;
-    case T_FLOAT:
-      RedisModule_SaveDouble(rdb, *(float *)v);
-      break;
-    case T_DOUBLE:
-      RedisModule_SaveDouble(rdb, *(double *)v);
-      break;
-    case T_TIME:
-      RedisModule_SaveSigned(rdb, *(time_t *)v);
-      break;
-    case T_NULL:
-    default:
-      // NULL value for all unsupported stuff.
-      break;
-  }
-}
-
 /* The context for visitor callback functions traversing an index for
  * persistence */
 typedef struct {
@@ -133,22 +115,34 @@ typedef struct {
   RedisIndex *idx;
   int num;
   RedisModuleString *indexKey;
-
+  // the block of records being encoded for rdb
+  SIBlockWriter *block;
+  // the arguments of the rows of the next AOF command
+  RedisModuleString **args;
+  int numArgs;
 } __redisIndexVisitorCtx;
 
+/* Write the records encoded so far as a block - their number and the encoded
+ * buffer */
+void __redisIndex_SaveBlock(__redisIndexVisitorCtx *vx) {
+  size_t len;
+  RedisModule_SaveUnsigned(vx->w, vx->block->numRecords);
+  const char *buf = SIBlockWriter_Flush(vx->block, &len);
+  RedisModule_SaveStringBuffer(vx->w, buf, len);
+}
+
 /* a visitor callback for saving an index's records to RDB */
 void __redisIndex_RdbVisitor(SIId id, void *key, void *ctx) {
   __redisIndexVisitorCtx *vx = ctx;
-  SIMultiKey *mk = key;
-  RedisModule_SaveStringBuffer(vx->w, id, strlen(id));
-
-  for (int i = 0; i < vx->idx->spec.numProps; i++) {
-    __writeValue(&mk->keys[i], mk->keys[i].type, vx->w);
-    vx->num++;
+  SIBlockWriter_Add(vx->block, id, key);
+  vx->num++;
+  if (vx->block->numRecords == SI_BLOCK_SIZE) {
+    __redisIndex_SaveBlock(vx);
   }
 }
 
-/* Serialize an index's records into an rdb buffer */
+/* Serialize an index's records into an rdb buffer. The records are saved in
+ * index order, in column encoded blocks */
 void __redisIndex_SaveIndex(RedisIndex *idx, RedisModuleIO *w) {
   size_t len = idx->idx.Len(idx->idx.ctx);
   RedisModuleCtx *ctx = RedisModule_GetContextFromIO(w);
@@ -157,21 +151,154 @@ void __redisIndex_SaveIndex(RedisIndex *idx, RedisModuleIO *w) {
   // save the number of elements in the indes
   RedisModule_SaveUnsigned(w, (u_int64_t)len);
 
-  __redisIndexVisitorCtx vx = {w, idx, 0, NULL};
+  __redisIndexVisitorCtx vx = {.w = w,
+                               .idx = idx,
+                               .num = 0,
+                               .indexKey = NULL,
+                               .block = SI_NewBlockWriter(&idx->spec)};
 
   idx->idx.Traverse(idx->idx.ctx, __redisIndex_RdbVisitor, &vx);
-  printf("saved %d elemets\n", vx.num);
+  if (vx.block->numRecords) {
+    __redisIndex_SaveBlock(&vx);
+  }
+  SIBlockWriter_Free(vx.block);
+}
+
+/* A block of records read from rdb, decoded into a sorted run of ready keys
+ * either on the loading thread or on one of the load pool's threads */
+typedef struct {
+  SISpec *spec;
+  char *buf;
+  size_t len;
+  u_int64_t num;
+  SILoadRun run;
+  int ok;
+  // set once the block is decoded, under the lock of its loader
+  int done;
+  struct __redisIndexLoader *loader;
+} __redisIndexBlockJob;
+
+/* Blocks decoded in the background, in the order they were read */
+typedef struct __redisIndexLoader {
+  __redisIndexBlockJob jobs[SI_LOAD_MAX_BLOCKS];
+  // the next block to load into the index, and the next one to read
+  size_t head, tail;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} __redisIndexLoader;
+
+/* Decode a block into a run of the index keys of its records, copied since
+ * the reader's strings only live until its next record, and sort it. The
+ * index adopts the keys as they are, so the loading thread only inserts them
+ */
+void __redisIndex_DecodeBlock(__redisIndexBlockJob *job) {
+  SIValue vals[job->spec->numProps];
+  SIBlockReader *r = SI_NewBlockReader(job->spec, job->buf, job->len, job->num);
+
+  job->run = SI_NewLoadRun(job->num);
+  SIId id;
+  while (SIBlockReader_Next(r, &id, vals)) {
+    SILoadRun_Add(&job->run, id, vals, job->spec);
+  }
+  job->ok = !r->error && job->run.num == job->num;
+  SIBlockReader_Free(r);
+  if (job->ok) {
+    SILoadRun_Sort(&job->run, job->spec);
+  }
+}
+
+/* Runs on a load pool thread */
+static void __redisIndex_DecodeJob(void *arg) {
+  __redisIndexBlockJob *job = arg;
+  __redisIndex_DecodeBlock(job);
+
+  pthread_mutex_lock(&job->loader->lock);
+  job->done = 1;
+  pthread_cond_broadcast(&job->loader->cond);
+  pthread_mutex_unlock(&job->loader->lock);
+}
+
+/* Wait for the oldest block being decoded, and take it off the queue */
+__redisIndexBlockJob *__redisIndex_NextDecoded(__redisIndexLoader *ld) {
+  __redisIndexBlockJob *job = &ld->jobs[ld->head++ % SI_LOAD_MAX_BLOCKS];
+  pthread_mutex_lock(&ld->lock);
+  while (!job->done) {
+    pthread_cond_wait(&ld->cond, &ld->lock);
+  }
+  pthread_mutex_unlock(&ld->lock);
+  return job;
+}
+
+/* Free a block, with the ids and keys of the records that were not loaded */
+void __redisIndex_FreeBlockJob(__redisIndexBlockJob *job) {
+  SILoadRun_Free(&job->run);
+  RedisModule_Free(job->buf);
+}
+
+/* Load the records of an index saved in blocks. Returns REDISMODULE_ERR if a
+ * block is corrupt. The rdb is read on the loading thread, while the load pool
+ * decodes the blocks read ahead of the one being loaded into sorted runs of
+ * index keys. The blocks were saved in index order, so loading them in that
+ * order appends every run to the previous one */
+int __redisIndex_LoadBlocks(RedisIndex *idx, RedisModuleIO *rdb,
+                            u_int64_t elements) {
+  __redisIndexLoader ld = {.head = 0, .tail = 0};
+  pthread_mutex_init(&ld.lock, NULL);
+  pthread_cond_init(&ld.cond, NULL);
+
+  int ok = 1;
+  while (ok && (elements || ld.head < ld.tail)) {
+    // read ahead as long as there are free slots
+    if (elements && ld.tail - ld.head < SI_LOAD_MAX_BLOCKS) {
+      __redisIndexBlockJob *job = &ld.jobs[ld.tail++ % SI_LOAD_MAX_BLOCKS];
+      *job = (__redisIndexBlockJob){.spec = &idx->spec, .loader = &ld};
+      job->num = RedisModule_LoadUnsigned(rdb);
+      job->buf = RedisModule_LoadStringBuffer(rdb, &job->len);
+      if (!job->num || job->num > elements) {
+        job->run = SI_NewLoadRun(0);
+        job->done = 1;
+        ok = 0;
+        break;
+      }
+      elements -= job->num;
+
+      if (loadPool) {
+        SIThreadPool_Push(loadPool, __redisIndex_DecodeJob, job);
+      } else {
+        __redisIndex_DecodeBlock(job);
+        job->done = 1;
+      }
+      continue;
+    }
+
+    __redisIndexBlockJob *job = __redisIndex_NextDecoded(&ld);
+    ok = job->ok && idx->idx.Load(idx->idx.ctx, &job->run) == SI_INDEX_OK;
+    __redisIndex_FreeBlockJob(job);
+  }
+
+  // the blocks still being decoded refer to the loader, and the decoded ones
+  // own the records that were not loaded
+  while (ld.head < ld.tail) {
+    __redisIndex_FreeBlockJob(__redisIndex_NextDecoded(&ld));
+  }
+  pthread_cond_destroy(&ld.cond);
+  pthread_mutex_destroy(&ld.lock);
+  return ok ? REDISMODULE_OK : REDISMODULE_ERR;
 }
 
 /* Load all the index's data from an rdb buffer */
-int __redisIndex_LoadIndex(RedisIndex *idx, RedisModuleIO *rdb) {
+int __redisIndex_LoadIndex(RedisIndex *idx, RedisModuleIO *rdb, int encver) {
   // 1. create an index
   // TODO: Check idx kind for multiple kind support
-  idx->idx = SI_NewCompoundIndex(idx->spec);
+  idx->idx = SI_NewIndex(idx->spec);
 
   // read the total number of elements in the index
   u_int64_t elements = RedisModule_LoadUnsigned(rdb);
-  printf("oading index len %zd\n", elements);
+
+  // version 3 saves the records in blocks
+  if (encver >= 3) {
+    return __redisIndex_LoadBlocks(idx, rdb, elements);
+  }
   // create a mock changeset
   SIChangeSet cs;
 
@@ -184,7 +311,6 @@ int __redisIndex_LoadIndex(RedisIndex *idx, RedisModuleIO *rdb) {
     // create an ADD change
     size_t idlen;
     char *id = RedisModule_LoadStringBuffer(rdb, &idlen);
-    printf("inserting id %s\n", id);
     cs.changes[0].id = id;
     cs.changes[0].v.len = 0;
     for (int i = 0; i < idx->spec.numProps; i++) {
@@ -199,13 +325,14 @@ int __redisIndex_LoadIndex(RedisIndex *idx, RedisModuleIO *rdb) {
   return REDISMODULE_OK;
 }
 
-/* IDX.CREATE {name} [TYPE [HASH|STRING]] [UNIQUE] SCHEMA [{t}... ]|[{p1} {t1}]
+/* IDX.CREATE {name} [TYPE [HASH|STRING] [PREFIX {p}]] [UNIQUE] [DELTA] [PARTITIONS {n}] SCHEMA [{t}... ]|[{p1} {t1}]
   Create an index according to its spec string
 */
 int SI_ParseSpec(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
-                 SISpec *spec, SIIndexKind *kind) {
+                 SISpec *spec, SIIndexKind *kind, char **prefix) {
   // the index kind
   *kind = SI_AbstractIndex;
+  *prefix = NULL;
 
   // is the schema named or not
   int named = 0;
@@ -229,14 +356,67 @@ int SI_ParseSpec(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
     return REDISMODULE_ERR;
   }
 
+  // hash indexes can follow all the hashes with a key prefix
+  RedisModuleString *prefixStr = NULL;
+  RMUtil_ParseArgsAfter("PREFIX", argv, schemaPos, "s", &prefixStr);
+  if (prefixStr != NULL) {
+    if (*kind != SI_HashIndex) {
+      RedisModule_Log(ctx, "warning", "PREFIX requires TYPE HASH");
+      return REDISMODULE_ERR;
+    }
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(prefixStr, &len);
+    *prefix = strndup(p, len);
+  }
+
+  // buffer writes in a delta merged into the index in bulk
+  int delta = RMUtil_ArgExists("DELTA", argv, schemaPos, 2);
+
+  // only the keys matching a prefix can be found again to rebuild the index
+  int specOnly = RMUtil_ArgExists("SPECONLY", argv, schemaPos, 2);
+  if (specOnly && !*prefix) {
+    RedisModule_Log(ctx, "warning", "SPECONLY requires a PREFIX");
+    return REDISMODULE_ERR;
+  }
+
+  // shard the index by the hash of the ids. equal keys of different ids may be
+  // in different partitions, so uniqueness can't be enforced
+  long long partitions = 0;
+  int partitionsPos = RMUtil_ArgExists("PARTITIONS", argv, schemaPos, 2);
+  if (partitionsPos) {
+    if (RMUtil_ParseArgs(argv, schemaPos, partitionsPos + 1, "l",
+                         &partitions) == REDISMODULE_ERR ||
+        partitions < 1 || partitions > SI_MAX_PARTITIONS) {
+      RedisModule_Log(ctx, "warning", "PARTITIONS must be between 1 and %d",
+                      SI_MAX_PARTITIONS);
+      free(*prefix);
+      *prefix = NULL;
+      return REDISMODULE_ERR;
+    }
+    if (unique && partitions > 1) {
+      RedisModule_Log(ctx, "warning", "UNIQUE indexes can't be partitioned");
+      free(*prefix);
+      *prefix = NULL;
+      return REDISMODULE_ERR;
+    }
+  }
+
+  // string properties get a trigram index for LIKE queries. the option must
+  // come before the schema, where it could be a property name
+  int trigram = RMUtil_ArgExists("TRIGRAM", argv, schemaPos, 2);
+  // string properties are compared case insensitively unless set otherwise
+  int caseSensitive = RMUtil_ArgExists("CASESENSITIVE", argv, schemaPos, 2) ||
+                      RMUtil_ArgExists("BINARY", argv, schemaPos, 2);
+
   if (named && (argc - (schemaPos + 1)) % 2 != 0) {
     RedisModule_Log(ctx, "warning", "Invalid schema argument count");
     return REDISMODULE_ERR;
   }
 
-  spec->flags =
-      0 | (unique ? SI_INDEX_UNIQUE : 0) | (named ? SI_INDEX_NAMED : 0);
-  printf("flags: %x\n", spec->flags);
+  spec->flags = 0 | (unique ? SI_INDEX_UNIQUE : 0) |
+                (named ? SI_INDEX_NAMED : 0) | (delta ? SI_INDEX_DELTA : 0) |
+                (specOnly ? SI_INDEX_SPECONLY : 0);
+  spec->numPartitions = partitions;
   spec->numProps =
       named ? (argc - (schemaPos + 1)) / 2 : argc - (schemaPos + 1);
   spec->properties = calloc(spec->numProps, sizeof(SIIndexProperty));
@@ -256,6 +436,12 @@ int SI_ParseSpec(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
     for (int t = 0; types[t] != NULL; t++) {
       if (strlen(types[t]) == len && !strncasecmp(str, types[t], len)) {
         spec->properties[p].type = typeEnums[t];
+        if (trigram && typeEnums[t] == T_STRING) {
+          spec->properties[p].flags |= SI_PROP_TRIGRAM;
+        }
+        if (caseSensitive && typeEnums[t] == T_STRING) {
+          spec->properties[p].flags |= SI_PROP_CASESENSITIVE;
+        }
         ok = 1;
         break;
       }
@@ -264,6 +450,8 @@ int SI_ParseSpec(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
     if (!ok) {
       RedisModule_Log(ctx, "warning", "could not parse %.*s", (int)len, str);
       SISpec_Free(spec);
+      free(*prefix);
+      *prefix = NULL;
       return REDISMODULE_ERR;
     }
     p++;
@@ -278,27 +466,86 @@ void *NewRedisIndex(SIIndexKind kind, u_int32_t flags, SISpec spec) {
   idx->kind = kind;
   idx->flags = flags;
   idx->spec = spec;
-  idx->idx = SI_NewCompoundIndex(idx->spec);
+  idx->idx = SI_NewIndex(idx->spec);
+  idx->refcount = 1;
+  idx->dropped = 0;
+  idx->prefix = NULL;
+  idx->keyName = NULL;
+  idx->backfilling = 0;
+  idx->backfillKeys = 0;
 
   return idx;
 }
 
+/* Save a string that may be NULL, as an empty string */
+void __saveOptionalString(RedisModuleIO *rdb, const char *str) {
+  RedisModule_SaveStringBuffer(rdb, str ? str : "", str ? strlen(str) : 0);
+}
+
+/* Load a string saved by __saveOptionalString */
+char *__loadOptionalString(RedisModuleIO *rdb) {
+  size_t len;
+  char *buf = RedisModule_LoadStringBuffer(rdb, &len);
+  char *ret = len ? strndup(buf, len) : NULL;
+  RedisModule_Free(buf);
+  return ret;
+}
+
 /* Load the index's spec and data from rdb */
 void *RedisIndex_RdbLoad(RedisModuleIO *rdb, int encver) {
-  if (encver != 0) {
+  if (encver > SI_INDEX_ENCVER) {
     return NULL;
   }
 
   RedisIndex *idx = malloc(sizeof(RedisIndex));
   idx->kind = RedisModule_LoadUnsigned(rdb);
   idx->flags = RedisModule_LoadUnsigned(rdb);
+  idx->refcount = 1;
+  idx->dropped = 0;
+  idx->prefix = NULL;
+  idx->keyName = NULL;
+  idx->backfilling = 0;
+  idx->backfillKeys = 0;
+  // version 1 added key prefixes
+  if (encver >= 1) {
+    idx->prefix = __loadOptionalString(rdb);
+    idx->keyName = __loadOptionalString(rdb);
+  }
+  // version 2 added the state of the backfill of prefix indexes
+  if (encver >= 2) {
+    idx->backfilling = RedisModule_LoadUnsigned(rdb);
+    idx->backfillKeys = RedisModule_LoadUnsigned(rdb);
+  }
 
   // read the spec
-  __redisIndex_LoadSpec(idx, rdb);
-
-  // create and populat the index
-  __redisIndex_LoadIndex(idx, rdb);
+  __redisIndex_LoadSpec(idx, rdb, encver);
+
+  // version 4 added indexes saved without their data, that are populated again
+  // by a backfill of their prefix
+  if (idx->spec.flags & SI_INDEX_SPECONLY) {
+    idx->idx = SI_NewIndex(idx->spec);
+    idx->backfilling = 1;
+    idx->backfillKeys = 0;
+  } else if (__redisIndex_LoadIndex(idx, rdb, encver) == REDISMODULE_ERR) {
+    RedisModuleCtx *ctx = RedisModule_GetContextFromIO(rdb);
+    RedisModule_Log(ctx, "warning", "Could not load corrupt index data");
+    idx->idx.Free(idx->idx.ctx);
+    free(idx->prefix);
+    free(idx->keyName);
+    free(idx);
+    return NULL;
+  }
 
+  // hash indexes saved before their key name was kept can't be tracked
+  if (idx->keyName) {
+    HashIndex_Track(idx);
+  }
+  if (idx->prefix) {
+    // an index saved in the middle of its backfill scans the keyspace again
+    if (idx->backfilling && HashIndex_StartBackfill(idx) == REDISMODULE_ERR) {
+      idx->backfilling = 0;
+    }
+  }
   return idx;
 }
 
@@ -307,12 +554,18 @@ void RedisIndex_RdbSave(RedisModuleIO *rdb, void *value) {
   RedisIndex *idx = value;
   RedisModule_SaveUnsigned(rdb, idx->kind);
   RedisModule_SaveUnsigned(rdb, idx->flags);
+  __saveOptionalString(rdb, idx->prefix);
+  __saveOptionalString(rdb, idx->keyName);
+  RedisModule_SaveUnsigned(rdb, idx->backfilling);
+  RedisModule_SaveUnsigned(rdb, idx->backfillKeys);
 
   // save the spec
   __redisIndex_SaveSpec(idx, rdb);
 
-  // save the index data
-  __redisIndex_SaveIndex(idx, rdb);
+  // save the index data, unless it's rebuilt from the keyspace
+  if (!(idx->spec.flags & SI_INDEX_SPECONLY)) {
+    __redisIndex_SaveIndex(idx, rdb);
+  }
 }
 
 #define __vpushStr(v, ctx, str) \
@@ -324,27 +577,42 @@ RedisModuleString *siValueToRMString(RedisModuleCtx *ctx, SIValue v) {
   if (v.type == T_STRING) {
     return RedisModule_CreateString(ctx, v.stringval.str, v.stringval.len);
   }
-  static char buf[128];
-  SIValue_ToString(v, buf, 128);
+  char buf[128];
+  SIValue_ToString(v, buf, sizeof(buf));
   return RedisModule_CreateString(ctx, buf, strlen(buf));
 }
 
+/* Emit the rows collected so far as one IDX.MINSERT command. Their strings
+ * are freed right away, rather than piling up in the auto memory pool until
+ * the whole index is rewritten */
+void __redisIndex_EmitRows(__redisIndexVisitorCtx *vx) {
+  if (!vx->numArgs) {
+    return;
+  }
+  RedisModule_EmitAOF(vx->w, "IDX.MINSERT", "sv", vx->indexKey, vx->args,
+                      (size_t)vx->numArgs);
+
+  RedisModuleCtx *rctx = RedisModule_GetContextFromIO(vx->w);
+  for (int i = 0; i < vx->numArgs; i++) {
+    RedisModule_FreeString(rctx, vx->args[i]);
+  }
+  vx->numArgs = 0;
+}
+
 /* Visitor callback for AOF rewriting */
 void __redisIndex_AofVisitor(SIId id, void *key, void *ctx) {
   __redisIndexVisitorCtx *vx = ctx;
   SIMultiKey *mk = key;
 
-  Vector *args = NewVector(RedisModuleString *, vx->idx->spec.numProps + 1);
   RedisModuleCtx *rctx = RedisModule_GetContextFromIO(vx->w);
-  Vector_Push(args, RedisModule_CreateString(rctx, id, strlen(id)));
-
+  vx->args[vx->numArgs++] = RedisModule_CreateString(rctx, id, strlen(id));
   for (int i = 0; i < vx->idx->spec.numProps; i++) {
-    Vector_Push(args, siValueToRMString(rctx, mk->keys[i]));
+    vx->args[vx->numArgs++] = siValueToRMString(rctx, mk->keys[i]);
   }
 
-  RedisModule_EmitAOF(vx->w, "IDX.INSERT", "sv", vx->indexKey,
-                      (RedisModuleString *)args->data, Vector_Size(args));
-  Vector_Free(args);
+  if (++vx->num % SI_AOF_REWRITE_BATCH == 0) {
+    __redisIndex_EmitRows(vx);
+  }
 }
 
 void RedisIndex_AofRewrite(RedisModuleIO *aof, RedisModuleString *key,
@@ -359,6 +627,36 @@ void RedisIndex_AofRewrite(RedisModuleIO *aof, RedisModuleString *key,
     __vpushStr(args, ctx, "TYPE");
     __vpushStr(args, ctx, "HASH");
   }
+  if (idx->prefix) {
+    __vpushStr(args, ctx, "PREFIX");
+    __vpushStr(args, ctx, idx->prefix);
+  }
+  if (idx->spec.flags & SI_INDEX_UNIQUE) {
+    __vpushStr(args, ctx, "UNIQUE");
+  }
+  if (idx->spec.flags & SI_INDEX_DELTA) {
+    __vpushStr(args, ctx, "DELTA");
+  }
+  if (idx->spec.flags & SI_INDEX_SPECONLY) {
+    __vpushStr(args, ctx, "SPECONLY");
+  }
+  if (idx->spec.numPartitions > 1) {
+    __vpushStr(args, ctx, "PARTITIONS");
+    Vector_Push(args, RedisModule_CreateStringFromLongLong(
+                          ctx, idx->spec.numPartitions));
+  }
+  // index options are stored as flags of the STRING properties
+  for (int i = 0; i < idx->spec.numProps; i++) {
+    if (idx->spec.properties[i].type == T_STRING) {
+      if (idx->spec.properties[i].flags & SI_PROP_TRIGRAM) {
+        __vpushStr(args, ctx, "TRIGRAM");
+      }
+      if (idx->spec.properties[i].flags & SI_PROP_CASESENSITIVE) {
+        __vpushStr(args, ctx, "CASESENSITIVE");
+      }
+      break;
+    }
+  }
 
   __vpushStr(args, ctx, "SCHEMA");
   for (int i = 0; i < idx->spec.numProps; i++) {
@@ -373,26 +671,88 @@ void RedisIndex_AofRewrite(RedisModuleIO *aof, RedisModuleString *key,
 
   Vector_Free(args);
 
-  __redisIndexVisitorCtx vx = {.w = aof, .idx = idx, .num = 0, .indexKey = key};
+  // the index is rebuilt by the backfill IDX.CREATE starts
+  if (idx->spec.flags & SI_INDEX_SPECONLY) {
+    return;
+  }
+
+  // the records are replayed in batches, that are applied in index order
+  __redisIndexVisitorCtx vx = {
+      .w = aof,
+      .idx = idx,
+      .num = 0,
+      .indexKey = key,
+      .args = malloc(SI_AOF_REWRITE_BATCH * (idx->spec.numProps + 1) *
+                     sizeof(RedisModuleString *)),
+      .numArgs = 0};
 
   idx->idx.Traverse(idx->idx.ctx, __redisIndex_AofVisitor, &vx);
+  __redisIndex_EmitRows(&vx);
+  free(vx.args);
 }
 
 void RedisIndex_Digest(RedisModuleDigest *digest, void *value) {}
 
-void RedisIndex_Free(void *value) {
-  RedisIndex *idx = value;
+void RedisIndex_IncRef(RedisIndex *idx) {
+  __atomic_add_fetch(&idx->refcount, 1, __ATOMIC_RELAXED);
+}
+
+static void redisIndex_FreeNow(void *arg) {
+  RedisIndex *idx = arg;
   idx->idx.Free(idx->idx.ctx);
+  free(idx->prefix);
+  free(idx->keyName);
   free(idx);
 }
 
-int RedisIndex_Register(RedisModuleCtx *ctx) {
+void RedisIndex_DecRef(RedisIndex *idx) {
+  if (__atomic_sub_fetch(&idx->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+    // nothing else can reach the index anymore, so walking and freeing all its
+    // nodes can be done without blocking the server
+    if (lazyfreePool &&
+        idx->idx.Len(idx->idx.ctx) >= SI_INDEX_LAZYFREE_THRESHOLD) {
+      SIThreadPool_Push(lazyfreePool, redisIndex_FreeNow, idx);
+      return;
+    }
+    redisIndex_FreeNow(idx);
+  }
+}
+
+void RedisIndex_Free(void *value) {
+  RedisIndex *idx = value;
+  // called on the lazy free thread by FLUSHALL ASYNC, so open cursors can't be
+  // freed here. they hold references that keep the index alive until then
+  __atomic_store_n(&idx->dropped, 1, __ATOMIC_RELEASE);
+  RedisCursor_IndexDropped();
+  if (idx->keyName) {
+    HashIndex_Untrack(idx);
+  }
+  RedisIndex_DecRef(idx);
+}
+
+int RedisIndex_Register(RedisModuleCtx *ctx, int numThreads) {
   IndexType = RedisModule_CreateDataType(
-      ctx, "indextype", 0, RedisIndex_RdbLoad, RedisIndex_RdbSave,
+      ctx, "indextype", SI_INDEX_ENCVER, RedisIndex_RdbLoad, RedisIndex_RdbSave,
       RedisIndex_AofRewrite, RedisIndex_Digest, RedisIndex_Free);
   if (IndexType == NULL) {
     return REDISMODULE_ERR;
   }
 
+  lazyfreePool = SI_NewThreadPool(1);
+  if (lazyfreePool == NULL) {
+    RedisModule_Log(ctx, "warning",
+                    "could not start the lazy free thread, indexes will be "
+                    "freed synchronously");
+  }
+
+  if (numThreads > 0) {
+    loadPool = SI_NewThreadPool(numThreads);
+    if (loadPool == NULL) {
+      RedisModule_Log(ctx, "warning",
+                      "could not start the load threads, indexes will be "
+                      "decoded on the loading thread");
+    }
+  }
+
   return REDISMODULE_OK;
 }
@@ -4,6 +4,21 @@
 #include "index.h"
 
 extern RedisModuleType *IndexType;
+
+// the rdb encoding version of indexes
+#define SI_INDEX_ENCVER 5
+
+// indexes with at least this many rows are freed on a background thread once
+// their key is deleted, so DEL, UNLINK and FLUSHALL don't block on them
+#define SI_INDEX_LAZYFREE_THRESHOLD 1024
+
+// the number of records in each IDX.MINSERT command of an AOF rewrite
+#define SI_AOF_REWRITE_BATCH 64
+
+// the number of record blocks read ahead of the one loaded from rdb, while they
+// are decoded in the background
+#define SI_LOAD_MAX_BLOCKS 16
+
 typedef enum { SI_AbstractIndex, SI_HashIndex } SIIndexKind;
 
 typedef struct {
@@ -11,6 +26,23 @@ typedef struct {
   u_int32_t flags;
   SISpec spec;
   SIIndex idx;
+  // references held by the key, and by the cursors, background queries and
+  // backfills running on the index. changed atomically, since the server may
+  // release the key's reference on its lazy free thread
+  int refcount;
+  // set once the key of the index is deleted. cursors still open on the index
+  // are freed the next time cursors are accessed, on the main thread
+  int dropped;
+  // hash indexes with a key prefix index the hashes whose keys start with it
+  // automatically. NULL for indexes updated by commands only
+  char *prefix;
+  // the key the index is stored at, to find it from keyspace events
+  char *keyName;
+  // set while the hashes that existed when a prefix index was created are
+  // indexed in the background. until then queries return partial results
+  int backfilling;
+  // the number of existing hashes indexed by the backfill so far
+  size_t backfillKeys;
 } RedisIndex;
 
 void *RedisIndex_RdbLoad(RedisModuleIO *rdb, int encver);
@@ -21,9 +53,18 @@ void RedisIndex_AofRewrite(RedisModuleIO *aof, RedisModuleString *key,
 void RedisIndex_Digest(RedisModuleDigest *digest, void *value);
 void RedisIndex_Free(void *value);
 
+/* Take a reference to an index, keeping it alive after its key was deleted */
+void RedisIndex_IncRef(RedisIndex *idx);
+/* Release a reference to an index, freeing it if it was the last one. Big
+ * indexes are freed in the background */
+void RedisIndex_DecRef(RedisIndex *idx);
+
 int SI_ParseSpec(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
-                 SISpec *spec, SIIndexKind *kind);
+                 SISpec *spec, SIIndexKind *kind, char **prefix);
 
 void *NewRedisIndex(SIIndexKind kind, u_int32_t flags, SISpec spec);
-int RedisIndex_Register(RedisModuleCtx *ctx);
+
+/* Register the index type. Index records are decoded on numThreads threads
+ * when they are loaded from rdb, or on the loading thread if it's 0 */
+int RedisIndex_Register(RedisModuleCtx *ctx, int numThreads);
 #endif  // !__SI_INDEX_TYPE_
\ No newline at end of file
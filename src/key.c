@@ -1,6 +1,7 @@
 #include "value.h"
 #include "key.h"
 #include <stdio.h>
+#include <ctype.h>
 #include <sys/param.h>
 #include "rmutil/alloc.h"
 
@@ -29,9 +30,10 @@ int si_cmp_string(void *p1, void *p2, void *ctx) {
   if (SIValue_IsInf(v2) || SIValue_IsNegativeInf(v1)) return -1;
 
   // compare the longest length possible, which is the shortest length of the
-  // two strings
-  int cmp = strncasecmp(v1->stringval.str, v2->stringval.str,
-                        MIN(v2->stringval.len, v1->stringval.len));
+  // two strings. case insensitive values are folded when they are indexed and
+  // queried, so this is always a binary comparison
+  int cmp = memcmp(v1->stringval.str, v2->stringval.str,
+                   MIN(v2->stringval.len, v1->stringval.len));
 
   // if the strings are equal at the common length but are not of the same
   // length, the longer string wins
@@ -42,6 +44,28 @@ int si_cmp_string(void *p1, void *p2, void *ctx) {
   return cmp;
 }
 
+SIKeyCmpFunc SI_KeyCmpFunc(SIType t) {
+  switch (t) {
+  case T_STRING:
+    return si_cmp_string;
+  case T_INT32:
+  case T_BOOL:
+    return si_cmp_int;
+  case T_INT64:
+    return si_cmp_long;
+  case T_FLOAT:
+    return si_cmp_float;
+  case T_DOUBLE:
+    return si_cmp_double;
+  case T_TIME:
+    return si_cmp_time;
+  case T_UINT:
+    return si_cmp_uint;
+  default: // TODO - implement all other types here
+    return NULL;
+  }
+}
+
 SIMultiKey *SI_NewMultiKey(SIValue *vals, u_int8_t numvals) {
   SIMultiKey *k = malloc(sizeof(SIMultiKey) + numvals * sizeof(SIValue));
   k->size = numvals;
@@ -56,6 +80,32 @@ SIMultiKey *SI_NewMultiKey(SIValue *vals, u_int8_t numvals) {
   return k;
 }
 
+static void foldString(SIString *s) {
+  for (size_t i = 0; i < s->len; i++) {
+    s->str[i] = tolower((unsigned char)s->str[i]);
+  }
+}
+
+void SIValue_FoldCase(SIValue *v) {
+  if (v->type != T_STRING) {
+    return;
+  }
+  // the string might be shared, so we fold a copy
+  SIString s = SIString_Copy(v->stringval);
+  foldString(&s);
+  SIValue_Free(v);
+  *v = SI_StringVal(s);
+}
+
+void SIMultiKey_Collate(SIMultiKey *k, SISpec *spec) {
+  for (u_int8_t i = 0; i < k->size; i++) {
+    if (k->keys[i].type == T_STRING && SISpec_IsCaseFolded(spec, i)) {
+      // the key owns copies of its strings
+      foldString(&k->keys[i].stringval);
+    }
+  }
+}
+
 void SIMultiKey_Print(SIMultiKey *mk) {
   static char buf[1024];
   for (int i = 0; i < mk->size; i++) {
@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include "value.h"
+#include "spec.h"
 
 typedef int (*SIKeyCmpFunc)(void *p1, void *p2, void *ctx);
 
@@ -31,6 +32,10 @@ GENERIC_CMP_FUNC_DECL(si_cmp_double);
 GENERIC_CMP_FUNC_DECL(si_cmp_uint);
 GENERIC_CMP_FUNC_DECL(si_cmp_time);
 
+/* The comparison function of the values of a type, or NULL if the type can't
+ * be indexed */
+SIKeyCmpFunc SI_KeyCmpFunc(SIType t);
+
 typedef struct {
   SIKeyCmpFunc cmpFunc;
   void *ctx;
@@ -48,6 +53,14 @@ typedef struct {
 
 void SIMultiKey_Print(SIMultiKey *mk);
 
+/* Replace a string value with a case folded copy of it */
+void SIValue_FoldCase(SIValue *v);
+
+/* Case fold the string values of a key in place, for the properties of the
+ * spec that are not case sensitive. Folding keys once when they are indexed
+ * lets all comparisons be binary */
+void SIMultiKey_Collate(SIMultiKey *k, SISpec *spec);
+
 void *__valueToKey(SIValue *v);
 SIMultiKey *SI_NewMultiKey(SIValue *vals, u_int8_t numvals);
 void SIMultiKey_Free(SIMultiKey *k);
@@ -1,8 +1,16 @@
 #include "index_type.h"
 #include "redismodule.h"
 #include "rmutil/util.h"
+#include "rmutil/vector.h"
 #include "rmutil/alloc.h"
 #include "hash_index.h"
+#include "query_plan.h"
+#include "cursor_registry.h"
+#include "background_query.h"
+// whether the server delivers keyspace events to modules, which hash indexes
+// with a key PREFIX rely on
+static int keyspaceEventsEnabled = 0;
+
 /*
 * IDX.CREATE <index_name> {options} SCHEMA
 * [[STRING|INT32|INT64|UINT|BOOL|FLOAT|DOUBLE|TIME] ...]
@@ -16,9 +24,17 @@ int CreateIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
 
   SISpec spec;
   SIIndexKind kind;
-  if (SI_ParseSpec(ctx, argv, argc, &spec, &kind) == REDISMODULE_ERR) {
+  char *prefix;
+  if (SI_ParseSpec(ctx, argv, argc, &spec, &kind, &prefix) ==
+      REDISMODULE_ERR) {
     return RedisModule_ReplyWithError(ctx, "Invalid schema");
   }
+  if (prefix && !keyspaceEventsEnabled) {
+    SISpec_Free(&spec);
+    free(prefix);
+    return RedisModule_ReplyWithError(
+        ctx, "PREFIX requires keyspace notifications for modules");
+  }
 
   // Open the index key
   RedisModuleKey *key =
@@ -31,15 +47,56 @@ int CreateIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
   RedisIndex *idx = NewRedisIndex(kind, 0, spec);
   RedisModule_ModuleTypeSetValue(key, IndexType, idx);
 
+  if (kind == SI_HashIndex) {
+    size_t len;
+    const char *name = RedisModule_StringPtrLen(argv[1], &len);
+    idx->keyName = strndup(name, len);
+    HashIndex_Track(idx);
+  }
+
+  // follow the hashes with the prefix from now on, and index the existing ones
+  if (prefix) {
+    idx->prefix = prefix;
+    if (HashIndex_StartBackfill(idx) == REDISMODULE_ERR) {
+      return RedisModule_ReplyWithError(ctx, "Could not index existing keys");
+    }
+  }
+
   return RedisModule_ReplyWithSimpleString(ctx, "OK");
 }
 
+/* Parse a row of values given as command arguments, by the types of the
+ * index's schema. Returns 0 if any value can't be parsed, or there are more
+ * values than properties */
+int parseRowValues(RedisModuleCtx *ctx, RedisIndex *idx,
+                   RedisModuleString **argv, int argc, SIValueVector *vals) {
+  *vals = SI_NewValueVector(argc);
+  for (int i = 0; i < argc; i++) {
+    if (i == idx->spec.numProps) {
+      SIValueVector_Free(vals);
+      return 0;
+    }
+
+    size_t vlen;
+    const char *vstr = RedisModule_StringPtrLen(argv[i], &vlen);
+    SIValue val = {.type = idx->spec.properties[i].type};
+    if (!SI_ParseValue(&val, (char *)vstr, vlen)) {
+      SIValueVector_Free(vals);
+      RedisModule_Log(ctx, "error", "Could not parse %.*s\n", (int)vlen, vstr);
+      return 0;
+    }
+    SIValueVector_Append(vals, val);
+  }
+  return 1;
+}
+
 /* IDX.ADD <index_name> <id> val1 ... */
 int IndexAddCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
   if (argc < 4)
     return RedisModule_WrongArity(ctx);
+  RedisCursor_ExpireIdle();
 
   RedisModuleKey *key =
       RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
@@ -52,28 +109,15 @@ int IndexAddCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
   RedisIndex *idx = RedisModule_ModuleTypeGetValue(key);
 
+  SIValueVector vals;
+  if (!parseRowValues(ctx, idx, &argv[3], argc - 3, &vals)) {
+    return RedisModule_ReplyWithError(ctx, "Invalid value given");
+  }
+
   size_t len;
   char *id = (char *)RedisModule_StringPtrLen(argv[2], &len);
   id = strndup(id, len);
 
-  SIValueVector vals = SI_NewValueVector(argc - 3);
-  for (int i = 0; i < argc - 3; i++) {
-    if (i == idx->spec.numProps) {
-      SIValueVector_Free(&vals);
-      return RedisModule_ReplyWithError(ctx, "Invalid value given");
-    }
-
-    size_t vlen;
-    const char *vstr = RedisModule_StringPtrLen(argv[i + 3], &vlen);
-    SIValue val = {.type = idx->spec.properties[i].type};
-    if (!SI_ParseValue(&val, (char *)vstr, vlen)) {
-      SIValueVector_Free(&vals);
-      RedisModule_Log(ctx, "error", "Could not parse %.*s\n", (int)vlen, vstr);
-      return RedisModule_ReplyWithError(ctx, "Invalid value given");
-    }
-    SIValueVector_Append(&vals, val);
-  }
-
   SIChange ch = (SIChange){.type = SI_CHADD, .id = (SIId)id, .v = vals};
 
   SIChangeSet cs = SI_NewChangeSet(1);
@@ -88,12 +132,74 @@ int IndexAddCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   return RedisModule_ReplyWithSimpleString(ctx, "OK");
 }
 
+/* IDX.MINSERT <index_name> <id> val1 ... [<id> val1 ...]
+ *
+ * Insert multiple rows in one change set. Each row must have a value for every
+ * property of the index. The rows are applied sorted by key, so each insert
+ * into the index continues from the position of the previous one */
+int IndexMultiAddCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
+                         int argc) {
+  RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+
+  if (argc < 4)
+    return RedisModule_WrongArity(ctx);
+  RedisCursor_ExpireIdle();
+
+  RedisModuleKey *key =
+      RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+
+  // make sure it's an index key
+  if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY ||
+      RedisModule_ModuleTypeGetType(key) != IndexType) {
+    return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+  }
+
+  RedisIndex *idx = RedisModule_ModuleTypeGetValue(key);
+  int rowLen = idx->spec.numProps + 1;
+  if ((argc - 2) % rowLen != 0) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  int numRows = (argc - 2) / rowLen;
+  SIChangeSet cs = SI_NewChangeSet(numRows);
+  for (int i = 0; i < numRows; i++) {
+    RedisModuleString **row = &argv[2 + i * rowLen];
+    SIValueVector vals;
+    if (!parseRowValues(ctx, idx, &row[1], rowLen - 1, &vals)) {
+      for (int j = 0; j < cs.numChanges; j++) {
+        free(cs.changes[j].id);
+        SIValueVector_Free(&cs.changes[j].v);
+      }
+      SIChangeSet_Free(&cs);
+      return RedisModule_ReplyWithError(ctx, "Invalid value given");
+    }
+
+    size_t len;
+    const char *id = RedisModule_StringPtrLen(row[0], &len);
+    SIChangeSet_AddCahnge(&cs, (SIChange){.type = SI_CHADD,
+                                          .id = (SIId)strndup(id, len),
+                                          .v = vals});
+  }
+
+  int rc = idx->idx.Apply(idx->idx.ctx, cs);
+  for (int i = 0; i < cs.numChanges; i++) {
+    SIValueVector_Free(&cs.changes[i].v);
+  }
+  SIChangeSet_Free(&cs);
+  if (rc != SI_INDEX_OK) {
+    return RedisModule_ReplyWithError(ctx, "Could not apply change to index");
+  }
+
+  return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
 /* IDX.DEL <index_name> <id> [<id> ...] */
 int IndexDelCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
   if (argc < 3)
     return RedisModule_WrongArity(ctx);
+  RedisCursor_ExpireIdle();
 
   RedisModuleKey *key =
       RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
@@ -121,6 +227,93 @@ int IndexDelCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   return RedisModule_ReplyWithSimpleString(ctx, "OK");
 }
 
+// the number of keys deleted by each DEL call of IDX.DELWHERE ... DELKEYS
+#define SI_DELWHERE_KEYS_BATCH 1000
+
+/* Collects the ids deleted by IDX.DELWHERE, to delete their keys afterwards */
+void collectDeletedId(SIId id, void *key, void *ctx) {
+  Vector *ids = ctx;
+  Vector_Push(ids, strdup(id));
+}
+
+/* IDX.DELWHERE <index_name> WHERE <predicates> [DELKEYS] */
+int IndexDelWhereCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
+                         int argc) {
+  RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+
+  if (argc < 4 || argc > 5)
+    return RedisModule_WrongArity(ctx);
+  RedisCursor_ExpireIdle();
+
+  RedisModuleKey *key =
+      RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+
+  // make sure it's an index key
+  if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY ||
+      RedisModule_ModuleTypeGetType(key) != IndexType) {
+    return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+  }
+
+  RedisIndex *idx = RedisModule_ModuleTypeGetValue(key);
+
+  if (strcasecmp(RedisModule_StringPtrLen(argv[2], NULL), "WHERE")) {
+    return RedisModule_ReplyWithError(ctx, "No Where clause given");
+  }
+  int delKeys = 0;
+  if (argc == 5) {
+    if (strcasecmp(RedisModule_StringPtrLen(argv[4], NULL), "DELKEYS")) {
+      return RedisModule_ReplyWithError(ctx, "Unknown option");
+    }
+    delKeys = 1;
+  }
+
+  size_t len;
+  char *qstr = (char *)RedisModule_StringPtrLen(argv[3], &len);
+  char *parseError = NULL;
+
+  SIQuery q = SI_NewQuery();
+  if (!SI_ParseQuery(&q, qstr, len, &idx->spec, &parseError)) {
+    RedisModule_ReplyWithError(
+        ctx, parseError ? parseError : "Error parsing WHERE query string");
+    if (parseError) {
+      free(parseError);
+    }
+    return REDISMODULE_OK;
+  }
+
+  Vector *ids = delKeys ? NewVector(char *, 16) : NULL;
+  long num = idx->idx.DeleteWhere(idx->idx.ctx, &q,
+                                  delKeys ? collectDeletedId : NULL, ids);
+  SIQuery_Free(&q);
+  if (num < 0) {
+    if (ids) Vector_Free(ids);
+    return RedisModule_ReplyWithError(ctx, "Error executing query");
+  }
+
+  // the keys are deleted once the index is unlocked, since deleting them
+  // may update it again through keyspace events
+  if (ids) {
+    size_t n = Vector_Size(ids);
+    RedisModuleString **keys =
+        malloc(SI_DELWHERE_KEYS_BATCH * sizeof(RedisModuleString *));
+    for (size_t i = 0; i < n; i += SI_DELWHERE_KEYS_BATCH) {
+      size_t batch = n - i < SI_DELWHERE_KEYS_BATCH ? n - i
+                                                     : SI_DELWHERE_KEYS_BATCH;
+      for (size_t j = 0; j < batch; j++) {
+        char *id;
+        Vector_Get(ids, i + j, &id);
+        keys[j] = RedisModule_CreateString(ctx, id, strlen(id));
+        free(id);
+      }
+      RedisModule_Call(ctx, "DEL", "v", keys, batch);
+    }
+    free(keys);
+    Vector_Free(ids);
+  }
+
+  return RedisModule_ReplyWithLongLong(ctx, num);
+}
+
 /* IDX.CARD <index_name> */
 int IndexCardinalityCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
                             int argc) {
@@ -146,38 +339,169 @@ int IndexCardinalityCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
   return RedisModule_ReplyWithLongLong(ctx, idx->idx.Len(idx->idx.ctx));
 }
 
-/* IDX.SELECT <index_name> WHERE <predicates> [LIMIT offset num] */
-int IndexSelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
-                       int argc) {
+/* IDX.INFO <index_name>
+ * Reply with the index's options, schema and size, and the progress of its
+ * backfill */
+int IndexInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
 
-  if (argc < 4)
+  if (argc != 2)
     return RedisModule_WrongArity(ctx);
 
   RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+  if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+    return RedisModule_ReplyWithError(ctx, "Index does not exist");
+  }
+  if (RedisModule_ModuleTypeGetType(key) != IndexType) {
+    return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+  }
+
+  RedisIndex *idx = RedisModule_ModuleTypeGetValue(key);
+
+  RedisModule_ReplyWithArray(ctx, 18);
+  RedisModule_ReplyWithSimpleString(ctx, "type");
+  RedisModule_ReplyWithSimpleString(ctx, idx->kind == SI_HashIndex ? "HASH"
+                                                                   : "RAW");
+  RedisModule_ReplyWithSimpleString(ctx, "prefix");
+  if (idx->prefix) {
+    RedisModule_ReplyWithStringBuffer(ctx, idx->prefix, strlen(idx->prefix));
+  } else {
+    RedisModule_ReplyWithNull(ctx);
+  }
+  RedisModule_ReplyWithSimpleString(ctx, "unique");
+  RedisModule_ReplyWithLongLong(ctx, (idx->spec.flags & SI_INDEX_UNIQUE) != 0);
+  RedisModule_ReplyWithSimpleString(ctx, "partitions");
+  RedisModule_ReplyWithLongLong(
+      ctx, idx->idx.numPartitions ? idx->idx.numPartitions : 1);
+
+  RedisModule_ReplyWithSimpleString(ctx, "schema");
+  int named = idx->spec.flags & SI_INDEX_NAMED;
+  RedisModule_ReplyWithArray(ctx, idx->spec.numProps * (named ? 2 : 1));
+  for (int i = 0; i < idx->spec.numProps; i++) {
+    if (named) {
+      RedisModule_ReplyWithSimpleString(ctx, idx->spec.properties[i].name);
+    }
+    RedisModule_ReplyWithSimpleString(ctx,
+                                      types[idx->spec.properties[i].type]);
+  }
+
+  RedisModule_ReplyWithSimpleString(ctx, "rows");
+  RedisModule_ReplyWithLongLong(ctx, idx->idx.Len(idx->idx.ctx));
+  RedisModule_ReplyWithSimpleString(ctx, "buffered_changes");
+  RedisModule_ReplyWithLongLong(ctx, idx->idx.Buffered(idx->idx.ctx));
+  RedisModule_ReplyWithSimpleString(ctx, "backfilling");
+  RedisModule_ReplyWithLongLong(ctx, idx->backfilling);
+  RedisModule_ReplyWithSimpleString(ctx, "backfill_keys");
+  RedisModule_ReplyWithLongLong(ctx, idx->backfillKeys);
+  return REDISMODULE_OK;
+}
+
+/* Open an index and parse a WHERE query on it for the read only query
+ * commands. Returns NULL and replies with an error if something went wrong */
+static RedisIndex *openQueryIndex(RedisModuleCtx *ctx,
+                                  RedisModuleString *keyName,
+                                  RedisModuleString *where, SIQuery *q) {
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, REDISMODULE_READ);
 
   // make sure it's an index key
   if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY ||
       RedisModule_ModuleTypeGetType(key) != IndexType) {
-    return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+    RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+    return NULL;
   }
   RedisIndex *idx = RedisModule_ModuleTypeGetValue(key);
 
   size_t len;
-  char *qstr = (char *)RedisModule_StringPtrLen(argv[3], &len);
+  char *qstr = (char *)RedisModule_StringPtrLen(where, &len);
   char *parseError = NULL;
-  SIQuery q = SI_NewQuery();
-  if (!SI_ParseQuery(&q, qstr, len, &idx->spec, &parseError)) {
+  *q = SI_NewQuery();
+  if (!SI_ParseQuery(q, qstr, len, &idx->spec, &parseError)) {
     RedisModule_ReplyWithError(ctx, parseError ? parseError
                                                : "Error parsing query string");
     if (parseError) {
       free(parseError);
     }
+    return NULL;
+  }
+  return idx;
+}
+
+/* Reply with the next batch of up to count ids of a cursor, and the cursor id
+ * to continue reading from, or 0 if the cursor is exhausted and was freed */
+static int replyCursorBatch(RedisModuleCtx *ctx, RedisCursor *rc,
+                            size_t count) {
+  RedisModule_ReplyWithArray(ctx, 2);
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  SIId id = NULL;
+  size_t i = 0;
+  while (i < count && NULL != (id = rc->c->Next(rc->c->ctx))) {
+    i++;
+    RedisModule_ReplyWithStringBuffer(ctx, id, strlen(id));
+  }
+  RedisModule_ReplySetArrayLength(ctx, i);
+
+  if (i < count) {
+    RedisModule_ReplyWithLongLong(ctx, 0);
+    RedisCursor_Free(rc);
+    return REDISMODULE_OK;
+  }
+  // the index may change until the next read, let the cursor save its place
+  if (rc->c->Suspend) {
+    rc->c->Suspend(rc->c->ctx);
+  }
+  return RedisModule_ReplyWithLongLong(ctx, rc->id);
+}
+
+/* IDX.SELECT <index_name> WHERE <predicates> [WITHCURSOR [COUNT n] [MAXIDLE
+ * ms] [SNAPSHOT]] */
+int IndexSelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
+                       int argc) {
+  RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+
+  if (argc < 4)
+    return RedisModule_WrongArity(ctx);
+
+  long long count = SI_CURSOR_DEFAULT_COUNT, maxIdle = SI_CURSOR_DEFAULT_MAXIDLE;
+  int withCursor = RMUtil_ArgExists("WITHCURSOR", argv, argc, 4);
+  int snapshot = 0;
+  if (withCursor) {
+    snapshot = RMUtil_ArgExists("SNAPSHOT", argv, argc, withCursor);
+    int pos = RMUtil_ArgExists("COUNT", argv, argc, withCursor);
+    if (pos && (RMUtil_ParseArgs(argv, argc, pos + 1, "l", &count) ==
+                    REDISMODULE_ERR ||
+                count <= 0)) {
+      return RedisModule_ReplyWithError(ctx, "Invalid cursor COUNT");
+    }
+    pos = RMUtil_ArgExists("MAXIDLE", argv, argc, withCursor);
+    if (pos && (RMUtil_ParseArgs(argv, argc, pos + 1, "l", &maxIdle) ==
+                    REDISMODULE_ERR ||
+                maxIdle <= 0)) {
+      return RedisModule_ReplyWithError(ctx, "Invalid cursor MAXIDLE");
+    }
+  }
+
+  SIQuery q;
+  RedisIndex *idx = openQueryIndex(ctx, argv[1], argv[3], &q);
+  if (!idx) {
     return REDISMODULE_OK;
   }
 
   SICursor *c = idx->idx.Find(idx->idx.ctx, &q);
-  if (c->error == SI_CURSOR_OK) {
+  if (c->error != SI_CURSOR_OK) {
+    RedisModule_ReplyWithError(ctx, "Error performing query");
+  } else if (snapshot && !idx->idx.Snapshot(idx->idx.ctx, c)) {
+    RedisModule_ReplyWithError(ctx, "Query can't be read from a snapshot");
+  } else if (withCursor) {
+    // the cursor owns the query and the scan from now on
+    RedisCursor *rc = RedisCursor_New(idx, q, c, count, maxIdle);
+    if (rc) {
+      return replyCursorBatch(ctx, rc, rc->count);
+    }
+    RedisModule_ReplyWithError(ctx, "Too many open cursors");
+  } else if (BackgroundQuery_Eligible(ctx, c)) {
+    // the background query owns the query and the scan from now on
+    return BackgroundQuery_Run(ctx, idx, q, c, 0);
+  } else {
     RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
     SIId id;
     int i = 0;
@@ -186,8 +510,6 @@ int IndexSelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
       RedisModule_ReplyWithStringBuffer(ctx, id, strlen(id));
     }
     RedisModule_ReplySetArrayLength(ctx, i);
-  } else {
-    RedisModule_ReplyWithError(ctx, "Error performing query");
   }
 
   SIQuery_Free(&q);
@@ -196,6 +518,236 @@ int IndexSelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
   return REDISMODULE_OK;
 }
 
+/* IDX.CURSOR READ <cursor_id> [COUNT n]
+ * IDX.CURSOR DEL <cursor_id> */
+int IndexCursorCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
+                       int argc) {
+  RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+
+  if (argc < 3)
+    return RedisModule_WrongArity(ctx);
+
+  const char *sub = RedisModule_StringPtrLen(argv[1], NULL);
+  int del = !strcasecmp(sub, "DEL");
+  if (!del && strcasecmp(sub, "READ")) {
+    return RedisModule_ReplyWithError(ctx, "Unknown cursor subcommand");
+  }
+  if (del ? argc != 3 : argc != 3 && argc != 5)
+    return RedisModule_WrongArity(ctx);
+
+  long long cid;
+  if (RedisModule_StringToLongLong(argv[2], &cid) == REDISMODULE_ERR) {
+    return RedisModule_ReplyWithError(ctx, "Invalid cursor id");
+  }
+  RedisCursor *rc = RedisCursor_Get((u_int64_t)cid);
+  if (!rc) {
+    return RedisModule_ReplyWithError(ctx, "Cursor not found");
+  }
+
+  if (del) {
+    RedisCursor_Free(rc);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
+
+  long long count = rc->count;
+  if (argc == 5 && (RMUtil_ParseArgsAfter("COUNT", argv, argc, "l", &count) ==
+                        REDISMODULE_ERR ||
+                    count <= 0)) {
+    return RedisModule_ReplyWithError(ctx, "Invalid cursor COUNT");
+  }
+  return replyCursorBatch(ctx, rc, count);
+}
+
+/* IDX.MSELECT {AND|OR} <index_name> WHERE <predicates> [<index_name> WHERE
+ * <predicates> ...]
+ * Select the ids matching the queries of all the indexes (AND) or of any of
+ * them (OR) */
+int IndexMultiSelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
+                            int argc) {
+  RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+
+  if (argc < 5 || (argc - 2) % 3)
+    return RedisModule_WrongArity(ctx);
+
+  const char *op = RedisModule_StringPtrLen(argv[1], NULL);
+  int isUnion = !strcasecmp(op, "OR");
+  if (!isUnion && strcasecmp(op, "AND")) {
+    return RedisModule_ReplyWithError(ctx, "Expected AND or OR");
+  }
+
+  int num = (argc - 2) / 3;
+  SIQuery *queries = calloc(num, sizeof(SIQuery));
+  SICursor **cursors = calloc(num, sizeof(SICursor *));
+  int n, ok = 1;
+  for (n = 0; n < num && ok; n++) {
+    RedisModuleString **args = &argv[2 + n * 3];
+    if (strcasecmp(RedisModule_StringPtrLen(args[1], NULL), "WHERE")) {
+      RedisModule_ReplyWithError(ctx, "Expected WHERE clause");
+      break;
+    }
+    RedisIndex *idx = openQueryIndex(ctx, args[0], args[2], &queries[n]);
+    if (!idx) {
+      break;
+    }
+    cursors[n] = idx->idx.Find(idx->idx.ctx, &queries[n]);
+    if (cursors[n]->error != SI_CURSOR_OK) {
+      RedisModule_ReplyWithError(ctx, "Error performing query");
+      ok = 0;
+    }
+  }
+
+  if (n == num && ok) {
+    // the merged cursor owns the index cursors from now on
+    SICursor *c = isUnion ? SI_NewUnionCursor(cursors, num)
+                          : SI_NewIntersectCursor(cursors, num);
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    SIId id;
+    int i = 0;
+    while (NULL != (id = c->Next(c->ctx))) {
+      i++;
+      RedisModule_ReplyWithStringBuffer(ctx, id, strlen(id));
+    }
+    RedisModule_ReplySetArrayLength(ctx, i);
+    SICursor_Free(c);
+  } else {
+    for (int i = 0; i < n; i++) {
+      if (cursors[i]) {
+        SICursor_Free(cursors[i]);
+      }
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    SIQuery_Free(&queries[i]);
+  }
+  free(queries);
+  free(cursors);
+  return REDISMODULE_OK;
+}
+
+/* IDX.EXPLAIN <index_name> WHERE <predicates>
+ * Reply with the query plan for the predicates, without executing it */
+int IndexExplainCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
+                        int argc) {
+  RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+
+  if (argc != 4)
+    return RedisModule_WrongArity(ctx);
+
+  SIQuery q;
+  RedisIndex *idx = openQueryIndex(ctx, argv[1], argv[3], &q);
+  if (!idx) {
+    return REDISMODULE_OK;
+  }
+
+  SIQueryPlan *plan = idx->idx.Explain(idx->idx.ctx, &q);
+  if (!plan) {
+    SIQuery_Free(&q);
+    return RedisModule_ReplyWithError(ctx, "Error building query plan");
+  }
+
+  static const char *strategies[] = {
+      [QP_RANGE] = "RANGE", [QP_SKIPSCAN] = "SKIPSCAN",
+      [QP_FULLSCAN] = "FULLSCAN", [QP_TRIGRAM] = "TRIGRAM",
+  };
+
+  RedisModule_ReplyWithArray(ctx, 12);
+  RedisModule_ReplyWithSimpleString(ctx, "strategy");
+  RedisModule_ReplyWithSimpleString(ctx, strategies[plan->strategy]);
+  RedisModule_ReplyWithSimpleString(ctx, "estimated_rows");
+  RedisModule_ReplyWithDouble(ctx, plan->estimatedRows);
+  RedisModule_ReplyWithSimpleString(ctx, "cost");
+  RedisModule_ReplyWithDouble(ctx, plan->cost);
+
+  RedisModule_ReplyWithSimpleString(ctx, "ranges");
+  RedisModule_ReplyWithArray(ctx, plan->numRanges);
+  for (int i = 0; i < plan->numRanges; i++) {
+    siPlanRange *rng;
+    Vector_Get(plan->ranges, i, &rng);
+    sds s = SIPlanRange_ToString(rng, sdsempty());
+    RedisModule_ReplyWithStringBuffer(ctx, s, sdslen(s));
+    sdsfree(s);
+  }
+
+  RedisModule_ReplyWithSimpleString(ctx, "filter");
+  if (plan->filterTree) {
+    sds s = SIQueryNode_ToString(plan->filterTree, sdsempty());
+    RedisModule_ReplyWithStringBuffer(ctx, s, sdslen(s));
+    sdsfree(s);
+  } else {
+    RedisModule_ReplyWithNull(ctx);
+  }
+  // results are partial until the index's backfill is done
+  RedisModule_ReplyWithSimpleString(ctx, "partial");
+  RedisModule_ReplyWithLongLong(ctx, idx->backfilling);
+
+  SIQueryPlan_Free(plan);
+  SIQuery_Free(&q);
+  return REDISMODULE_OK;
+}
+
+/* IDX.PROFILE <index_name> WHERE <predicates>
+ * Execute a query, and reply with its results and execution statistics */
+int IndexProfileCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
+                        int argc) {
+  RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+
+  if (argc != 4)
+    return RedisModule_WrongArity(ctx);
+
+  double start = SI_Clock();
+  SIQuery q;
+  RedisIndex *idx = openQueryIndex(ctx, argv[1], argv[3], &q);
+  if (!idx) {
+    return REDISMODULE_OK;
+  }
+  double parseTime = SI_Clock() - start;
+
+  start = SI_Clock();
+  SICursor *c = idx->idx.Find(idx->idx.ctx, &q);
+  if (c->error != SI_CURSOR_OK) {
+    SIQuery_Free(&q);
+    SICursor_Free(c);
+    return RedisModule_ReplyWithError(ctx, "Error performing query");
+  }
+
+  RedisModule_ReplyWithArray(ctx, 2);
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  SIId id;
+  int i = 0;
+  while (NULL != (id = c->Next(c->ctx))) {
+    i++;
+    RedisModule_ReplyWithStringBuffer(ctx, id, strlen(id));
+  }
+  RedisModule_ReplySetArrayLength(ctx, i);
+  // the scan time includes building the plan, we report it separately
+  double scanTime = SI_Clock() - start - c->stats.planTime;
+
+  RedisModule_ReplyWithArray(ctx, 18);
+  RedisModule_ReplyWithSimpleString(ctx, "parse_time_us");
+  RedisModule_ReplyWithDouble(ctx, parseTime);
+  RedisModule_ReplyWithSimpleString(ctx, "plan_time_us");
+  RedisModule_ReplyWithDouble(ctx, c->stats.planTime);
+  RedisModule_ReplyWithSimpleString(ctx, "scan_time_us");
+  RedisModule_ReplyWithDouble(ctx, scanTime);
+  RedisModule_ReplyWithSimpleString(ctx, "ranges_scanned");
+  RedisModule_ReplyWithLongLong(ctx, c->stats.rangesScanned);
+  RedisModule_ReplyWithSimpleString(ctx, "nodes_visited");
+  RedisModule_ReplyWithLongLong(ctx, c->stats.nodesVisited);
+  RedisModule_ReplyWithSimpleString(ctx, "comparisons");
+  RedisModule_ReplyWithLongLong(ctx, c->stats.comparisons);
+  RedisModule_ReplyWithSimpleString(ctx, "rows_filtered");
+  RedisModule_ReplyWithLongLong(ctx, c->stats.rowsFiltered);
+  RedisModule_ReplyWithSimpleString(ctx, "rows_returned");
+  RedisModule_ReplyWithLongLong(ctx, c->stats.rowsReturned);
+  RedisModule_ReplyWithSimpleString(ctx, "partial");
+  RedisModule_ReplyWithLongLong(ctx, idx->backfilling);
+
+  SIQuery_Free(&q);
+  SICursor_Free(c);
+  return REDISMODULE_OK;
+}
+
 /* IDX.FROM {index_name} WHERE {predicates} ANY REDIS READ COMMAND */
 int IndexFromCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
@@ -231,8 +783,21 @@ int IndexFromCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     }
     return REDISMODULE_OK;
   }
-  int rc = HashIndex_ExecuteReadCommand(ctx, idx, &q, &argv[wherePos + 2],
+  SICursor *c = idx->idx.Find(idx->idx.ctx, &q);
+  if (c->error != SI_CURSOR_OK) {
+    SIQuery_Free(&q);
+    SICursor_Free(c);
+    // TODO: proper error reporting in cursor
+    return RedisModule_ReplyWithError(ctx, "Error executing query");
+  }
+
+  if (BackgroundQuery_Eligible(ctx, c)) {
+    return BackgroundQuery_Run(ctx, idx, q, c, wherePos + 2);
+  }
+
+  int rc = HashIndex_ExecuteReadCommand(ctx, c, &argv[wherePos + 2],
                                         argc - (wherePos + 2));
+  SICursor_Free(c);
   SIQuery_Free(&q);
   return rc;
 }
@@ -312,15 +877,37 @@ cleanup:
   return REDISMODULE_OK;
 }
 
-int RedisModule_OnLoad(RedisModuleCtx *ctx) {
+/* loadmodule secondary.so [THREADS n] */
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv,
+                       int argc) {
   // LOGGING_INIT(0xFFFFFFFF);
   if (RedisModule_Init(ctx, "idx", 1, REDISMODULE_APIVER_1) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
+  long long numThreads = SI_DEFAULT_THREADS;
+  if (argc > 0 &&
+      (argc != 2 ||
+       strcasecmp(RedisModule_StringPtrLen(argv[0], NULL), "THREADS") ||
+       RedisModule_StringToLongLong(argv[1], &numThreads) == REDISMODULE_ERR ||
+       numThreads < 0)) {
+    RedisModule_Log(ctx, "warning", "Invalid module arguments, expected "
+                                    "THREADS <n>");
+    return REDISMODULE_ERR;
+  }
+  if (BackgroundQuery_Init(numThreads) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
   // register index type
-  if (RedisIndex_Register(ctx) == REDISMODULE_ERR)
+  if (RedisIndex_Register(ctx, numThreads) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
+  keyspaceEventsEnabled =
+      HashIndex_SubscribeKeyspaceEvents(ctx) == REDISMODULE_OK;
+  if (!keyspaceEventsEnabled) {
+    RedisModule_Log(ctx, "warning", "Keyspace notifications are not "
+                                    "supported, PREFIX indexes are disabled");
+  }
+
   if (RedisModule_CreateCommand(ctx, "idx.create", CreateIndexCommand,
                                 "write deny-oom no-cluster", 1, 1,
                                 1) == REDISMODULE_ERR)
@@ -331,21 +918,56 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx) {
                                 1) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
+  if (RedisModule_CreateCommand(ctx, "idx.minsert", IndexMultiAddCommand,
+                                "write deny-oom no-cluster", 1, 1,
+                                1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
   if (RedisModule_CreateCommand(ctx, "idx.del", IndexDelCommand,
                                 "write deny-oom no-cluster", 1, 1,
                                 1) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
+  if (RedisModule_CreateCommand(ctx, "idx.delwhere", IndexDelWhereCommand,
+                                "write deny-oom no-cluster", 1, 1,
+                                1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
   if (RedisModule_CreateCommand(ctx, "idx.select", IndexSelectCommand,
                                 "readonly no-cluster", 1, 1,
                                 1) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
+  if (RedisModule_CreateCommand(ctx, "idx.cursor", IndexCursorCommand,
+                                "readonly no-cluster", 0, 0,
+                                0) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  if (RedisModule_CreateCommand(ctx, "idx.mselect", IndexMultiSelectCommand,
+                                "readonly no-cluster", 2, -1,
+                                3) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  if (RedisModule_CreateCommand(ctx, "idx.explain", IndexExplainCommand,
+                                "readonly no-cluster", 1, 1,
+                                1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  if (RedisModule_CreateCommand(ctx, "idx.profile", IndexProfileCommand,
+                                "readonly no-cluster", 1, 1,
+                                1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
   if (RedisModule_CreateCommand(ctx, "idx.from", IndexFromCommand,
                                 "readonly no-cluster", 1, 1,
                                 1) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
+  if (RedisModule_CreateCommand(ctx, "idx.info", IndexInfoCommand,
+                                "readonly no-cluster", 1, 1,
+                                1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
   // TODO: this is not a "key at 1" command - needs better handling
   if (RedisModule_CreateCommand(ctx, "idx.into", IndexIntoCommand,
                                 "write deny-oom no-cluster", 1, 1,
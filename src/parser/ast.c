@@ -16,6 +16,7 @@ void ParseNode_Free(ParseNode *pn) {
       }
       break;
     case N_COND:
+    case N_NOT:
       ParseNode_Free(pn->cn.left);
       ParseNode_Free(pn->cn.right);
   }
@@ -34,6 +35,12 @@ ParseNode *NewConditionNode(ParseNode *left, int op, ParseNode *right) {
   return n;
 }
 
+ParseNode *NewNotNode(ParseNode *child) {
+  ParseNode *n = NewConditionNode(child, 0, NULL);
+  n->t = N_NOT;
+  return n;
+}
+
 ParseNode *NewPredicateNode(property p, int op, SIValue v) {
   ParseNode *n = malloc(sizeof(ParseNode));
   n->t = N_PRED;
@@ -139,6 +146,10 @@ void ParseNode_print(ParseNode *n, int depth) {
     case N_COND:
       conditionNode_print(&(n->cn), depth + 1);
       break;
+    case N_NOT:
+      printf("NOT");
+      conditionNode_print(&(n->cn), depth + 1);
+      break;
     case N_PRED:
       predicateNode_print(&(n->pn), depth + 1);
       break;
@@ -12,6 +12,8 @@
 typedef enum {
   N_PRED,
   N_COND,
+  // negation of a sub expression, held in cn.left
+  N_NOT,
 } ParseNodeType;
 
 struct parseNode;
@@ -46,6 +48,7 @@ typedef struct parseNode {
 
 void ParseNode_Free(ParseNode *pn);
 ParseNode *NewConditionNode(ParseNode *left, int op, ParseNode *right);
+ParseNode *NewNotNode(ParseNode *child);
 ParseNode *NewPredicateNode(property p, int op, SIValue v);
 ParseNode *NewInPredicateNode(property p, int op, SIValueVector v);
 void ParseNode_print(ParseNode *n, int depth);
@@ -369,8 +369,8 @@ static void yy_fatal_error (yyconst char msg[]  );
 	*yy_cp = '\0'; \
 	(yy_c_buf_p) = yy_cp;
 
-#define YY_NUM_RULES 33
-#define YY_END_OF_BUFFER 34
+#define YY_NUM_RULES 34
+#define YY_END_OF_BUFFER 35
 /* This struct is not used in this scanner,
    but its presence is necessary. */
 struct yy_trans_info
@@ -378,20 +378,20 @@ struct yy_trans_info
 	flex_int32_t yy_verify;
 	flex_int32_t yy_nxt;
 	};
-static yyconst flex_int16_t yy_accept[109] =
+static yyconst flex_int16_t yy_accept[110] =
     {   0,
-        0,    0,   34,   33,   32,   33,   33,   33,   33,   16,
-       17,   33,   18,   33,    8,   15,   10,   14,   31,   31,
-       31,   31,   31,   31,   31,   31,   31,   31,   31,   31,
-       31,   32,   11,    0,    9,    0,    6,    0,    0,    0,
-        8,    7,   13,   12,   31,   31,   31,   31,   31,    3,
-       19,   31,   31,   31,   31,    2,   31,   31,   31,   31,
-       31,    0,    9,    0,    0,    9,    0,    1,   31,   31,
-       31,   31,   31,   22,   31,   31,   31,   31,   31,   31,
-       27,   31,   31,   21,   31,   20,   31,   31,   31,    4,
-       30,    5,   28,   31,   31,   31,   23,   31,   31,   31,
-
-       31,   29,   26,   31,   31,   24,   25,    0
+        0,    0,   35,   34,   33,   34,   34,   34,   34,   16,
+       17,   34,   18,   34,    8,   15,   10,   14,   32,   32,
+       32,   32,   32,   32,   32,   32,   32,   32,   32,   32,
+       32,   33,   11,    0,    9,    0,    6,    0,    0,    0,
+        8,    7,   13,   12,   32,   32,   32,   32,   32,    3,
+       19,   32,   32,   32,   32,    2,   32,   32,   32,   32,
+       32,    0,    9,    0,    0,    9,    0,    1,   32,   32,
+       32,   32,   32,   23,   32,   32,   32,   32,   32,   32,
+       28,   32,   32,   21,   32,   20,   32,   32,   32,    4,
+       31,    5,   29,   32,   32,   32,   24,   32,   32,   32,
+
+       32,   30,   27,   32,   32,   25,   26,   22,    0
     } ;
 
 static yyconst flex_int32_t yy_ec[256] =
@@ -436,41 +436,41 @@ static yyconst flex_int32_t yy_meta[60] =
         2,    2,    2,    2,    2,    2,    2,    2,    2
     } ;
 
-static yyconst flex_int16_t yy_base[114] =
+static yyconst flex_int16_t yy_base[115] =
     {   0,
-        0,    0,  210,  234,   58,  194,   57,  195,   56,  234,
-      234,   52,  234,  194,   54,  189,  234,  187,   39,    0,
+        0,    0,  210,  259,   58,  194,   57,  195,   56,  259,
+      259,   52,  259,  194,   54,  189,  259,  187,   39,    0,
        52,   53,   44,   46,   51,   52,   49,   49,   60,   78,
-       55,   69,  234,   77,  234,   82,  234,   79,  104,  188,
-       76,  187,  234,  234,    0,   71,   73,   85,   79,    0,
-        0,   90,   89,   84,   94,    0,  103,   96,  106,   94,
+       55,   69,  259,   77,  259,   82,  259,   79,  104,  188,
+       76,  187,  259,  259,    0,   71,   73,   85,   79,    0,
+        0,   90,   89,  201,   94,    0,  103,   96,  106,   94,
       104,  118,  122,  134,  126,  129,  141,    0,  115,  120,
       122,  133,  124,    0,  132,  131,  134,  145,  142,  129,
         0,  145,  136,    0,  137,    0,  142,  118,  136,    0,
         0,    0,    0,  155,  162,  171,    0,  152,  159,  174,
 
-      162,    0,    0,  177,  180,    0,    0,  234,  225,  227,
-       71,  229,  231
+      162,    0,    0,  177,  180,    0,    0,    0,  259,  225,
+      227,   71,  229,  231
     } ;
 
-static yyconst flex_int16_t yy_def[114] =
+static yyconst flex_int16_t yy_def[115] =
     {   0,
-      108,    1,  108,  108,  108,  108,  109,  108,  110,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  111,  111,
-      111,  111,  111,  111,  111,  111,  111,  111,  111,  111,
-      111,  108,  108,  109,  108,  112,  108,  110,  113,  108,
-      108,  108,  108,  108,  111,  111,  111,  111,  111,  111,
-      111,  111,  111,  111,  111,  111,  111,  111,  111,  111,
-      111,  109,  109,  112,  110,  110,  113,  111,  111,  111,
-      111,  111,  111,  111,  111,  111,  111,  111,  111,  111,
-      111,  111,  111,  111,  111,  111,  111,  111,  111,  111,
-      111,  111,  111,  111,  111,  111,  111,  111,  111,  111,
-
-      111,  111,  111,  111,  111,  111,  111,    0,  108,  108,
-      108,  108,  108
+      109,    1,  109,  109,  109,  109,  110,  109,  111,  109,
+      109,  109,  109,  109,  109,  109,  109,  109,  112,  112,
+      112,  112,  112,  112,  112,  112,  112,  112,  112,  112,
+      112,  109,  109,  110,  109,  113,  109,  111,  114,  109,
+      109,  109,  109,  109,  112,  112,  112,  112,  112,  112,
+      112,  112,  112,  112,  112,  112,  112,  112,  112,  112,
+      112,  110,  110,  113,  111,  111,  114,  112,  112,  112,
+      112,  112,  112,  112,  112,  112,  112,  112,  112,  112,
+      112,  112,  112,  112,  112,  112,  112,  112,  112,  112,
+      112,  112,  112,  112,  112,  112,  112,  112,  112,  112,
+
+      112,  112,  112,  112,  112,  112,  112,  112,    0,  109,
+      109,  109,  109,  109
     } ;
 
-static yyconst flex_int16_t yy_nxt[294] =
+static yyconst flex_int16_t yy_nxt[319] =
     {   0,
         4,    5,    5,    6,    7,    8,    9,   10,   11,   12,
        13,   14,   15,   16,   17,   18,   19,   20,   20,   21,
@@ -484,30 +484,32 @@ static yyconst flex_int16_t yy_nxt[294] =
        68,   47,   48,   39,   36,   49,   50,   52,   53,   51,
 
        54,   56,   58,   57,   55,   61,   38,   59,   60,   69,
-       66,   70,   71,   68,   36,   72,   39,   73,   74,   64,
+       66,   70,   71,   68,   36,   72,   39,   73,    0,   64,
        75,   76,   35,   77,   58,   78,   35,   79,   80,   59,
        60,   69,   35,   70,   71,   35,   34,   72,   63,   73,
-       74,   67,   75,   38,   76,   77,   81,   66,   78,   79,
+        0,   67,   75,   38,   76,   77,   81,   66,   78,   79,
        80,   82,   83,   84,   88,   36,   96,   85,   86,   36,
        87,   89,   90,   39,   91,   92,   39,   93,   81,   94,
        95,   64,   97,   82,   83,   98,   84,   88,   67,   85,
        86,   99,   87,  102,   89,   90,   91,  100,   92,   93,
       103,   94,   95,  104,   97,  105,  106,  107,   98,   42,
 
-       42,   44,  101,   43,   99,  102,   42,   37,   33,  108,
-      100,  108,  103,  108,  108,  108,  104,  105,  108,  106,
-      107,  108,  108,  108,  101,   34,   34,   38,   38,   62,
-       62,   65,   65,    3,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108
-
+       42,   44,  101,   43,   99,  102,   42,   37,   33,  109,
+      100,  109,  103,  109,  109,  109,  104,  105,  109,  106,
+      107,  109,  109,  109,  101,   34,   34,   38,   38,   62,
+       62,   65,   65,  108,    0,   74,    0,    0,    0,    0,
+        0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+        0,    0,    0,    0,    0,  108,    0,   74,    3,  109,
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+      109,  109,  109,  109,  109,  109,  109,  109
     } ;
 
-static yyconst flex_int16_t yy_chk[294] =
+static yyconst flex_int16_t yy_chk[319] =
     {   0,
         1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
         1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
@@ -516,15 +518,15 @@ static yyconst flex_int16_t yy_chk[294] =
         1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
         1,    1,    1,    1,    1,    1,    1,    1,    1,    5,
         5,    7,    9,   12,   12,   15,   15,   19,   21,   22,
-       32,   32,  111,   23,   24,   25,   26,   24,   27,   28,
+       32,   32,  112,   23,   24,   25,   26,   24,   27,   28,
        29,   34,   27,   31,   36,   38,   36,   41,   41,   19,
        46,   21,   22,    9,    7,   23,   24,   25,   26,   24,
 
        27,   28,   30,   29,   27,   31,   39,   30,   30,   47,
-       39,   48,   49,   46,   34,   52,   38,   53,   54,   36,
+       39,   48,   49,   46,   34,   52,   38,   53,    0,   36,
        55,   57,   62,   58,   30,   59,   63,   60,   61,   30,
        30,   47,   65,   48,   49,   66,   64,   52,   64,   53,
-       54,   39,   55,   67,   57,   58,   69,   67,   59,   60,
+        0,   39,   55,   67,   57,   58,   69,   67,   59,   60,
        61,   70,   71,   72,   77,   62,   88,   73,   75,   63,
        76,   78,   79,   65,   80,   82,   66,   83,   69,   85,
        87,   64,   89,   70,   71,   94,   72,   77,   67,   73,
@@ -533,15 +535,17 @@ static yyconst flex_int16_t yy_chk[294] =
 
        40,   18,   96,   16,   95,   98,   14,    8,    6,    3,
        96,    0,   99,    0,    0,    0,  100,  101,    0,  104,
-      105,    0,    0,    0,   96,  109,  109,  110,  110,  112,
-      112,  113,  113,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108,  108,  108,  108,  108,  108,  108,  108,
-      108,  108,  108
-
+      105,    0,    0,    0,   96,  110,  110,  111,  111,  113,
+      113,  114,  114,   54,    0,   54,    0,    0,    0,    0,
+        0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+        0,    0,    0,    0,    0,   54,    0,   54,  109,  109,
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+
+      109,  109,  109,  109,  109,  109,  109,  109,  109,  109,
+      109,  109,  109,  109,  109,  109,  109,  109
     } ;
 
 static yy_state_type yy_last_accepting_state;
@@ -569,7 +573,7 @@ char *yytext;
 
 Token tok;
 
-#line 573 "lex.yy.c"
+#line 577 "lex.yy.c"
 
 #define INITIAL 0
 
@@ -786,7 +790,7 @@ YY_DECL
 #line 13 "tokenizer.l"
 
 
-#line 790 "lex.yy.c"
+#line 794 "lex.yy.c"
 
 	while ( 1 )		/* loops until end-of-file is reached */
 		{
@@ -813,13 +817,13 @@ yy_match:
 			while ( yy_chk[yy_base[yy_current_state] + yy_c] != yy_current_state )
 				{
 				yy_current_state = (int) yy_def[yy_current_state];
-				if ( yy_current_state >= 109 )
+				if ( yy_current_state >= 110 )
 					yy_c = yy_meta[(unsigned int) yy_c];
 				}
 			yy_current_state = yy_nxt[yy_base[yy_current_state] + (unsigned int) yy_c];
 			++yy_cp;
 			}
-		while ( yy_base[yy_current_state] != 234 );
+		while ( yy_base[yy_current_state] != 259 );
 
 yy_find_action:
 		yy_act = yy_accept[yy_current_state];
@@ -966,69 +970,74 @@ YY_RULE_SETUP
 	YY_BREAK
 case 22:
 YY_RULE_SETUP
-#line 61 "tokenizer.l"
-{ return NOW; }
+#line 59 "tokenizer.l"
+{ return NOT; }
 	YY_BREAK
 case 23:
 YY_RULE_SETUP
 #line 62 "tokenizer.l"
-{ return TODAY; }
+{ return NOW; }
 	YY_BREAK
 case 24:
 YY_RULE_SETUP
 #line 63 "tokenizer.l"
-{ return TIME_ADD; }
+{ return TODAY; }
 	YY_BREAK
 case 25:
 YY_RULE_SETUP
 #line 64 "tokenizer.l"
-{ return TIME_SUB; }
+{ return TIME_ADD; }
 	YY_BREAK
 case 26:
 YY_RULE_SETUP
 #line 65 "tokenizer.l"
-{ return SECONDS; } 
+{ return TIME_SUB; }
 	YY_BREAK
 case 27:
 YY_RULE_SETUP
 #line 66 "tokenizer.l"
-{ return DAYS; }
+{ return SECONDS; } 
 	YY_BREAK
 case 28:
 YY_RULE_SETUP
 #line 67 "tokenizer.l"
-{ return HOURS; }
+{ return DAYS; }
 	YY_BREAK
 case 29:
 YY_RULE_SETUP
 #line 68 "tokenizer.l"
-{ return MINUTES; }
+{ return HOURS; }
 	YY_BREAK
 case 30:
 YY_RULE_SETUP
 #line 69 "tokenizer.l"
-{ return UNIXTIME; }
+{ return MINUTES; }
 	YY_BREAK
 case 31:
 YY_RULE_SETUP
-#line 71 "tokenizer.l"
+#line 70 "tokenizer.l"
+{ return UNIXTIME; }
+	YY_BREAK
+case 32:
+YY_RULE_SETUP
+#line 72 "tokenizer.l"
 {	
   	tok.strval = strdup(yytext);
   	return IDENT;
 }
 	YY_BREAK
-case 32:
-/* rule 32 can match eol */
+case 33:
+/* rule 33 can match eol */
 YY_RULE_SETUP
-#line 76 "tokenizer.l"
+#line 77 "tokenizer.l"
 /* ignore whitespace */
 	YY_BREAK
-case 33:
+case 34:
 YY_RULE_SETUP
-#line 77 "tokenizer.l"
+#line 78 "tokenizer.l"
 ECHO;
 	YY_BREAK
-#line 1032 "lex.yy.c"
+#line 1041 "lex.yy.c"
 case YY_STATE_EOF(INITIAL):
 	yyterminate();
 
@@ -1321,7 +1330,7 @@ static int yy_get_next_buffer (void)
 		while ( yy_chk[yy_base[yy_current_state] + yy_c] != yy_current_state )
 			{
 			yy_current_state = (int) yy_def[yy_current_state];
-			if ( yy_current_state >= 109 )
+			if ( yy_current_state >= 110 )
 				yy_c = yy_meta[(unsigned int) yy_c];
 			}
 		yy_current_state = yy_nxt[yy_base[yy_current_state] + (unsigned int) yy_c];
@@ -1349,11 +1358,11 @@ static int yy_get_next_buffer (void)
 	while ( yy_chk[yy_base[yy_current_state] + yy_c] != yy_current_state )
 		{
 		yy_current_state = (int) yy_def[yy_current_state];
-		if ( yy_current_state >= 109 )
+		if ( yy_current_state >= 110 )
 			yy_c = yy_meta[(unsigned int) yy_c];
 		}
 	yy_current_state = yy_nxt[yy_base[yy_current_state] + (unsigned int) yy_c];
-	yy_is_jam = (yy_current_state == 108);
+	yy_is_jam = (yy_current_state == 109);
 
 		return yy_is_jam ? 0 : yy_current_state;
 }
@@ -4,7 +4,7 @@
 /* First off, code is included that follows the "include" declaration
 ** in the input grammar file. */
 #include <stdio.h>
-#line 24 "parser.y"
+#line 25 "parser.y"
    
 
 #include <stdlib.h>
@@ -80,18 +80,18 @@ void yyerror(char *s);
 **                       defined, then do no error processing.
 */
 #define YYCODETYPE unsigned char
-#define YYNOCODE 44
+#define YYNOCODE 45
 #define YYACTIONTYPE unsigned char
 #define ParseTOKENTYPE Token
 typedef union {
   int yyinit;
   ParseTOKENTYPE yy0;
-  ParseNode* yy8;
+  int yy20;
   SIValue yy22;
-  time_t yy23;
-  SIValueVector yy27;
-  property yy44;
-  int yy64;
+  SIValueVector yy33;
+  property yy54;
+  time_t yy67;
+  ParseNode* yy88;
 } YYMINORTYPE;
 #ifndef YYSTACKDEPTH
 #define YYSTACKDEPTH 100
@@ -100,8 +100,8 @@ typedef union {
 #define ParseARG_PDECL , parseCtx *ctx 
 #define ParseARG_FETCH  parseCtx *ctx  = yypParser->ctx 
 #define ParseARG_STORE yypParser->ctx  = ctx 
-#define YYNSTATE 78
-#define YYNRULE 35
+#define YYNSTATE 85
+#define YYNRULE 38
 #define YY_NO_ACTION      (YYNSTATE+YYNRULE+2)
 #define YY_ACCEPT_ACTION  (YYNSTATE+YYNRULE+1)
 #define YY_ERROR_ACTION   (YYNSTATE+YYNRULE)
@@ -170,63 +170,66 @@ static const YYMINORTYPE yyzerominor = { 0 };
 **                     shifting non-terminals after a reduce.
 **  yy_default[]       Default action for each state.
 */
-#define YY_ACTTAB_COUNT (111)
+#define YY_ACTTAB_COUNT (121)
 static const YYACTIONTYPE yy_action[] = {
- /*     0 */    64,   43,   69,   78,    7,    5,   70,   68,   67,   66,
- /*    10 */    42,    7,    5,   63,   44,   41,   38,   23,   77,   72,
- /*    20 */    76,   73,   75,   74,   13,   19,   48,   20,   64,   35,
- /*    30 */    32,   29,   26,   18,   62,   65,   16,   39,   33,    6,
- /*    40 */    54,   63,   44,   41,   38,   23,   46,   45,  114,   15,
- /*    50 */    51,    8,   40,   10,   17,    3,    8,   14,   47,    8,
- /*    60 */     8,   61,   60,   71,   50,   65,   65,   49,   12,   65,
- /*    70 */    34,   30,   59,   31,   27,   58,   28,   24,   57,   25,
- /*    80 */    53,   56,    9,    5,   11,   55,    1,   52,    4,    2,
- /*    90 */   115,   36,   21,   37,  115,  115,  115,  115,  115,  115,
- /*   100 */   115,  115,  115,  115,  115,  115,  115,  115,  115,  115,
- /*   110 */    22,
+ /*     0 */    71,   47,   76,   85,    8,    6,   77,   75,   74,   73,
+ /*    10 */    19,   46,    9,   70,   48,   45,   42,   27,   22,   84,
+ /*    20 */    79,   83,   80,   82,   81,   14,   18,    7,   24,   71,
+ /*    30 */    39,   36,   33,   30,    8,    6,   20,   23,   72,   17,
+ /*    40 */     5,   44,   70,   48,   45,   42,   27,   51,   50,   60,
+ /*    50 */    52,  124,   16,   56,    9,   53,   69,    9,    3,   49,
+ /*    60 */    43,    9,   15,   68,    9,   11,   78,   55,   72,   72,
+ /*    70 */    54,   67,   72,   13,   38,   37,   66,   35,   34,   65,
+ /*    80 */    32,   31,   64,   29,   28,   63,   10,   61,   62,   59,
+ /*    90 */    21,   12,   58,    6,    2,   57,    1,  125,  125,   40,
+ /*   100 */   125,  125,  125,  125,  125,  125,  125,  125,  125,  125,
+ /*   110 */   125,  125,  125,  125,  125,  125,  125,   41,   25,    4,
+ /*   120 */    26,
 };
 static const YYCODETYPE yy_lookahead[] = {
- /*     0 */    11,   15,   13,    0,    1,    2,   17,   18,   19,   20,
- /*    10 */    17,    1,    2,   24,   25,   26,   27,   28,    3,    4,
- /*    20 */     5,    6,    7,    8,    9,   10,   16,   12,   11,   29,
- /*    30 */    30,   31,   32,   38,   16,   40,   41,   17,   17,   15,
- /*    40 */    13,   24,   25,   26,   27,   28,   22,   23,   34,   35,
- /*    50 */    16,   37,   15,   15,   35,   21,   37,   35,   35,   37,
- /*    60 */    37,   16,   16,   38,   38,   40,   40,   38,   21,   40,
- /*    70 */    15,   17,   16,   15,   17,   16,   15,   17,   16,   15,
- /*    80 */    14,   16,   15,    2,   21,   16,   15,   39,   36,   21,
- /*    90 */    43,   42,   42,   40,   43,   43,   43,   43,   43,   43,
- /*   100 */    43,   43,   43,   43,   43,   43,   43,   43,   43,   43,
- /*   110 */    40,
+ /*     0 */    12,   16,   14,    0,    1,    2,   18,   19,   20,   21,
+ /*    10 */    36,   18,   38,   25,   26,   27,   28,   29,    3,    4,
+ /*    20 */     5,    6,    7,    8,    9,   10,   11,    3,   13,   12,
+ /*    30 */    30,   31,   32,   33,    1,    2,   39,    3,   41,   42,
+ /*    40 */    16,   16,   25,   26,   27,   28,   29,   23,   24,   15,
+ /*    50 */    17,   35,   36,   17,   38,   36,   17,   38,   22,   36,
+ /*    60 */    18,   38,   36,   17,   38,   16,   39,   39,   41,   41,
+ /*    70 */    39,   17,   41,   22,   16,   18,   17,   16,   18,   17,
+ /*    80 */    16,   18,   17,   16,   18,   17,   16,   14,   17,   15,
+ /*    90 */    13,   22,   14,    2,   22,   40,   16,   44,   44,   43,
+ /*   100 */    44,   44,   44,   44,   44,   44,   44,   44,   44,   44,
+ /*   110 */    44,   44,   44,   44,   44,   44,   44,   41,   43,   37,
+ /*   120 */    41,
 };
-#define YY_SHIFT_USE_DFLT (-15)
-#define YY_SHIFT_COUNT (44)
-#define YY_SHIFT_MIN   (-14)
-#define YY_SHIFT_MAX   (81)
+#define YY_SHIFT_USE_DFLT (-16)
+#define YY_SHIFT_COUNT (48)
+#define YY_SHIFT_MIN   (-15)
+#define YY_SHIFT_MAX   (91)
 static const signed char yy_shift_ofst[] = {
- /*     0 */    24,  -11,  -11,  -11,  -11,   24,   24,   24,   15,   17,
- /*    10 */    17,    0,    0,   71,   10,    3,   34,   81,   68,   66,
- /*    20 */    27,   69,   63,   67,   65,   60,   64,   62,   57,   61,
- /*    30 */    59,   54,   58,   56,   21,   55,   46,   47,   38,   45,
- /*    40 */    20,   37,   18,   -7,  -14,
+ /*     0 */    24,  -12,  -12,  -12,  -12,   24,   24,   24,   24,   15,
+ /*    10 */    17,   17,    0,    0,   80,   33,    3,   36,   34,   91,
+ /*    20 */    72,   78,   77,   74,   73,   71,   69,   70,   68,   66,
+ /*    30 */    67,   65,   63,   64,   62,   60,   61,   59,   57,   58,
+ /*    40 */    54,   51,   49,   46,   42,   25,   39,   -7,  -15,
 };
-#define YY_REDUCE_USE_DFLT (-6)
-#define YY_REDUCE_COUNT (13)
-#define YY_REDUCE_MIN   (-5)
-#define YY_REDUCE_MAX   (70)
+#define YY_REDUCE_USE_DFLT (-27)
+#define YY_REDUCE_COUNT (14)
+#define YY_REDUCE_MIN   (-26)
+#define YY_REDUCE_MAX   (82)
 static const signed char yy_reduce_ofst[] = {
- /*     0 */    14,   -5,   29,   26,   25,   23,   22,   19,   52,   70,
- /*    10 */    53,   50,   49,   48,
+ /*     0 */    16,   -3,   31,   28,   27,   26,   23,   19,  -26,   82,
+ /*    10 */    79,   76,   75,   56,   55,
 };
 static const YYACTIONTYPE yy_default[] = {
- /*     0 */   113,  113,  113,  113,  113,  113,  113,  113,  113,  113,
- /*    10 */   113,  113,  113,  113,  113,  113,  113,   90,  113,  113,
- /*    20 */   113,  113,  113,  113,  113,  113,  113,  113,  113,  113,
- /*    30 */   113,  113,  113,  113,  113,  113,  113,  113,  113,  113,
- /*    40 */   113,  113,  113,  113,  113,  102,  101,   91,   89,   99,
- /*    50 */   100,   98,   88,   87,   86,  108,  112,  111,  110,  109,
- /*    60 */   107,  106,  105,  104,  103,   97,   96,   95,   94,   93,
- /*    70 */    92,   85,   84,   83,   82,   81,   80,   79,
+ /*     0 */   123,  123,  123,  123,  123,  123,  123,  123,  123,  123,
+ /*    10 */   123,  123,  123,  123,  123,  123,  123,  123,  123,  100,
+ /*    20 */   123,  123,  123,  123,  123,  123,  123,  123,  123,  123,
+ /*    30 */   123,  123,  123,  123,  123,  123,  123,  123,  123,  123,
+ /*    40 */   123,  123,  123,  123,  123,  123,  123,  123,  123,  101,
+ /*    50 */   112,  111,   99,   97,  109,  110,  108,   98,   95,   96,
+ /*    60 */    94,   93,  118,  122,  121,  120,  119,  117,  116,  115,
+ /*    70 */   114,  113,  107,  106,  105,  104,  103,  102,   92,   91,
+ /*    80 */    90,   89,   88,   87,   86,
 };
 
 /* The next table maps tokens into fallback tokens.  If a construct
@@ -319,17 +322,17 @@ void ParseTrace(FILE *TraceFILE, char *zTracePrompt){
 /* For tracing shifts, the names of all terminals and nonterminals
 ** are required.  The following table supplies these names */
 static const char *const yyTokenName[] = { 
-  "$",             "AND",           "OR",            "EQ",          
-  "NE",            "GT",            "GE",            "LT",          
-  "LE",            "IN",            "IS",            "NOW",         
-  "LIKE",          "STRING",        "TK_NULL",       "LP",          
-  "RP",            "INTEGER",       "FLOAT",         "TRUE",        
-  "FALSE",         "COMMA",         "ENUMERATOR",    "IDENT",       
-  "TODAY",         "TIME",          "UNIXTIME",      "TIME_ADD",    
-  "TIME_SUB",      "DAYS",          "HOURS",         "MINUTES",     
-  "SECONDS",       "error",         "query",         "cond",        
-  "op",            "prop",          "value",         "vallist",     
-  "timestamp",     "multivals",     "duration",    
+  "$",             "AND",           "OR",            "NOT",         
+  "EQ",            "NE",            "GT",            "GE",          
+  "LT",            "LE",            "IN",            "IS",          
+  "NOW",           "LIKE",          "STRING",        "TK_NULL",     
+  "LP",            "RP",            "INTEGER",       "FLOAT",       
+  "TRUE",          "FALSE",         "COMMA",         "ENUMERATOR",  
+  "IDENT",         "TODAY",         "TIME",          "UNIXTIME",    
+  "TIME_ADD",      "TIME_SUB",      "DAYS",          "HOURS",       
+  "MINUTES",       "SECONDS",       "error",         "query",       
+  "cond",          "op",            "prop",          "value",       
+  "vallist",       "timestamp",     "multivals",     "duration",    
 };
 #endif /* NDEBUG */
 
@@ -347,31 +350,34 @@ static const char *const yyRuleName[] = {
  /*   7 */ "cond ::= prop op value",
  /*   8 */ "cond ::= prop LIKE STRING",
  /*   9 */ "cond ::= prop IS TK_NULL",
- /*  10 */ "cond ::= prop IN vallist",
- /*  11 */ "cond ::= LP cond RP",
- /*  12 */ "cond ::= cond AND cond",
- /*  13 */ "cond ::= cond OR cond",
- /*  14 */ "value ::= INTEGER",
- /*  15 */ "value ::= STRING",
- /*  16 */ "value ::= FLOAT",
- /*  17 */ "value ::= TRUE",
- /*  18 */ "value ::= FALSE",
- /*  19 */ "value ::= timestamp",
- /*  20 */ "vallist ::= LP multivals RP",
- /*  21 */ "multivals ::= value COMMA value",
- /*  22 */ "multivals ::= multivals COMMA value",
- /*  23 */ "prop ::= ENUMERATOR",
- /*  24 */ "prop ::= IDENT",
- /*  25 */ "timestamp ::= NOW",
- /*  26 */ "timestamp ::= TODAY",
- /*  27 */ "timestamp ::= TIME LP INTEGER RP",
- /*  28 */ "timestamp ::= UNIXTIME LP INTEGER RP",
- /*  29 */ "timestamp ::= TIME_ADD LP timestamp COMMA duration RP",
- /*  30 */ "timestamp ::= TIME_SUB LP timestamp COMMA duration RP",
- /*  31 */ "duration ::= DAYS LP INTEGER RP",
- /*  32 */ "duration ::= HOURS LP INTEGER RP",
- /*  33 */ "duration ::= MINUTES LP INTEGER RP",
- /*  34 */ "duration ::= SECONDS LP INTEGER RP",
+ /*  10 */ "cond ::= prop NOT LIKE STRING",
+ /*  11 */ "cond ::= prop IS NOT TK_NULL",
+ /*  12 */ "cond ::= NOT cond",
+ /*  13 */ "cond ::= prop IN vallist",
+ /*  14 */ "cond ::= LP cond RP",
+ /*  15 */ "cond ::= cond AND cond",
+ /*  16 */ "cond ::= cond OR cond",
+ /*  17 */ "value ::= INTEGER",
+ /*  18 */ "value ::= STRING",
+ /*  19 */ "value ::= FLOAT",
+ /*  20 */ "value ::= TRUE",
+ /*  21 */ "value ::= FALSE",
+ /*  22 */ "value ::= timestamp",
+ /*  23 */ "vallist ::= LP multivals RP",
+ /*  24 */ "multivals ::= value COMMA value",
+ /*  25 */ "multivals ::= multivals COMMA value",
+ /*  26 */ "prop ::= ENUMERATOR",
+ /*  27 */ "prop ::= IDENT",
+ /*  28 */ "timestamp ::= NOW",
+ /*  29 */ "timestamp ::= TODAY",
+ /*  30 */ "timestamp ::= TIME LP INTEGER RP",
+ /*  31 */ "timestamp ::= UNIXTIME LP INTEGER RP",
+ /*  32 */ "timestamp ::= TIME_ADD LP timestamp COMMA duration RP",
+ /*  33 */ "timestamp ::= TIME_SUB LP timestamp COMMA duration RP",
+ /*  34 */ "duration ::= DAYS LP INTEGER RP",
+ /*  35 */ "duration ::= HOURS LP INTEGER RP",
+ /*  36 */ "duration ::= MINUTES LP INTEGER RP",
+ /*  37 */ "duration ::= SECONDS LP INTEGER RP",
 };
 #endif /* NDEBUG */
 
@@ -450,32 +456,32 @@ static void yy_destructor(
     ** which appear on the RHS of the rule, but which are not used
     ** inside the C code.
     */
-    case 35: /* cond */
+    case 36: /* cond */
 {
-#line 64 "parser.y"
- ParseNode_Free((yypminor->yy8)); 
-#line 458 "parser.c"
+#line 65 "parser.y"
+ ParseNode_Free((yypminor->yy88)); 
+#line 464 "parser.c"
 }
       break;
-    case 37: /* prop */
+    case 38: /* prop */
 {
-#line 131 "parser.y"
+#line 144 "parser.y"
 
      
-    if ((yypminor->yy44).name != NULL) { 
-        free((yypminor->yy44).name); 
-        (yypminor->yy44).name = NULL;
+    if ((yypminor->yy54).name != NULL) { 
+        free((yypminor->yy54).name); 
+        (yypminor->yy54).name = NULL;
     } 
 
-#line 471 "parser.c"
+#line 477 "parser.c"
 }
       break;
-    case 39: /* vallist */
-    case 41: /* multivals */
+    case 40: /* vallist */
+    case 42: /* multivals */
 {
-#line 111 "parser.y"
-SIValueVector_Free(&(yypminor->yy27));
-#line 479 "parser.c"
+#line 124 "parser.y"
+SIValueVector_Free(&(yypminor->yy33));
+#line 485 "parser.c"
 }
       break;
     default:  break;   /* If no destructor action specified: do nothing */
@@ -713,41 +719,44 @@ static const struct {
   YYCODETYPE lhs;         /* Symbol on the left-hand side of the rule */
   unsigned char nrhs;     /* Number of right-hand side symbols in the rule */
 } yyRuleInfo[] = {
-  { 34, 1 },
-  { 36, 1 },
-  { 36, 1 },
-  { 36, 1 },
-  { 36, 1 },
-  { 36, 1 },
-  { 36, 1 },
-  { 35, 3 },
-  { 35, 3 },
-  { 35, 3 },
-  { 35, 3 },
-  { 35, 3 },
-  { 35, 3 },
-  { 35, 3 },
-  { 38, 1 },
-  { 38, 1 },
-  { 38, 1 },
-  { 38, 1 },
-  { 38, 1 },
-  { 38, 1 },
-  { 39, 3 },
-  { 41, 3 },
-  { 41, 3 },
+  { 35, 1 },
   { 37, 1 },
   { 37, 1 },
-  { 40, 1 },
-  { 40, 1 },
-  { 40, 4 },
-  { 40, 4 },
-  { 40, 6 },
-  { 40, 6 },
-  { 42, 4 },
-  { 42, 4 },
-  { 42, 4 },
-  { 42, 4 },
+  { 37, 1 },
+  { 37, 1 },
+  { 37, 1 },
+  { 37, 1 },
+  { 36, 3 },
+  { 36, 3 },
+  { 36, 3 },
+  { 36, 4 },
+  { 36, 4 },
+  { 36, 2 },
+  { 36, 3 },
+  { 36, 3 },
+  { 36, 3 },
+  { 36, 3 },
+  { 39, 1 },
+  { 39, 1 },
+  { 39, 1 },
+  { 39, 1 },
+  { 39, 1 },
+  { 39, 1 },
+  { 40, 3 },
+  { 42, 3 },
+  { 42, 3 },
+  { 38, 1 },
+  { 38, 1 },
+  { 41, 1 },
+  { 41, 1 },
+  { 41, 4 },
+  { 41, 4 },
+  { 41, 6 },
+  { 41, 6 },
+  { 43, 4 },
+  { 43, 4 },
+  { 43, 4 },
+  { 43, 4 },
 };
 
 static void yy_accept(yyParser*);  /* Forward Declaration */
@@ -803,220 +812,241 @@ static void yy_reduce(
   **     break;
   */
       case 0: /* query ::= cond */
-#line 53 "parser.y"
-{ ctx->root = yymsp[0].minor.yy8; }
-#line 809 "parser.c"
+#line 54 "parser.y"
+{ ctx->root = yymsp[0].minor.yy88; }
+#line 818 "parser.c"
         break;
       case 1: /* op ::= EQ */
-#line 56 "parser.y"
-{ yygotominor.yy64 = EQ; }
-#line 814 "parser.c"
+#line 57 "parser.y"
+{ yygotominor.yy20 = EQ; }
+#line 823 "parser.c"
         break;
       case 2: /* op ::= GT */
-#line 57 "parser.y"
-{ yygotominor.yy64 = GT; }
-#line 819 "parser.c"
+#line 58 "parser.y"
+{ yygotominor.yy20 = GT; }
+#line 828 "parser.c"
         break;
       case 3: /* op ::= LT */
-#line 58 "parser.y"
-{ yygotominor.yy64 = LT; }
-#line 824 "parser.c"
+#line 59 "parser.y"
+{ yygotominor.yy20 = LT; }
+#line 833 "parser.c"
         break;
       case 4: /* op ::= LE */
-#line 59 "parser.y"
-{ yygotominor.yy64 = LE; }
-#line 829 "parser.c"
+#line 60 "parser.y"
+{ yygotominor.yy20 = LE; }
+#line 838 "parser.c"
         break;
       case 5: /* op ::= GE */
-#line 60 "parser.y"
-{ yygotominor.yy64 = GE; }
-#line 834 "parser.c"
+#line 61 "parser.y"
+{ yygotominor.yy20 = GE; }
+#line 843 "parser.c"
         break;
       case 6: /* op ::= NE */
-#line 61 "parser.y"
-{ yygotominor.yy64 = NE; }
-#line 839 "parser.c"
+#line 62 "parser.y"
+{ yygotominor.yy20 = NE; }
+#line 848 "parser.c"
         break;
       case 7: /* cond ::= prop op value */
-#line 66 "parser.y"
+#line 67 "parser.y"
 { 
     /* Terminal condition of a single predicate */
-    yygotominor.yy8 = NewPredicateNode(yymsp[-2].minor.yy44, yymsp[-1].minor.yy64, yymsp[0].minor.yy22);
+    yygotominor.yy88 = NewPredicateNode(yymsp[-2].minor.yy54, yymsp[-1].minor.yy20, yymsp[0].minor.yy22);
 }
-#line 847 "parser.c"
+#line 856 "parser.c"
         break;
       case 8: /* cond ::= prop LIKE STRING */
-#line 72 "parser.y"
+#line 73 "parser.y"
 { 
-    yygotominor.yy8 = NewPredicateNode(yymsp[-2].minor.yy44, LIKE, SI_StringValC(strdup(yymsp[0].minor.yy0.strval)));
+    yygotominor.yy88 = NewPredicateNode(yymsp[-2].minor.yy54, LIKE, SI_StringValC(strdup(yymsp[0].minor.yy0.strval)));
 }
-#line 854 "parser.c"
+#line 863 "parser.c"
         break;
       case 9: /* cond ::= prop IS TK_NULL */
-#line 77 "parser.y"
+#line 78 "parser.y"
 { 
-    yygotominor.yy8 = NewPredicateNode(yymsp[-2].minor.yy44, IS, SI_NullVal());
+    yygotominor.yy88 = NewPredicateNode(yymsp[-2].minor.yy54, IS, SI_NullVal());
 }
-#line 861 "parser.c"
+#line 870 "parser.c"
         break;
-      case 10: /* cond ::= prop IN vallist */
-#line 81 "parser.y"
+      case 10: /* cond ::= prop NOT LIKE STRING */
+#line 82 "parser.y"
 { 
-    /* Terminal condition of a single IN predicate */
-    yygotominor.yy8 = NewInPredicateNode(yymsp[-2].minor.yy44, IN, yymsp[0].minor.yy27);
+    yygotominor.yy88 = NewNotNode(NewPredicateNode(yymsp[-3].minor.yy54, LIKE, SI_StringValC(strdup(yymsp[0].minor.yy0.strval))));
 }
-#line 869 "parser.c"
+#line 877 "parser.c"
         break;
-      case 11: /* cond ::= LP cond RP */
+      case 11: /* cond ::= prop IS NOT TK_NULL */
 #line 86 "parser.y"
 { 
-  yygotominor.yy8 = yymsp[-1].minor.yy8;
+    yygotominor.yy88 = NewNotNode(NewPredicateNode(yymsp[-3].minor.yy54, IS, SI_NullVal()));
 }
-#line 876 "parser.c"
+#line 884 "parser.c"
         break;
-      case 12: /* cond ::= cond AND cond */
+      case 12: /* cond ::= NOT cond */
 #line 90 "parser.y"
-{
-  yygotominor.yy8 = NewConditionNode(yymsp[-2].minor.yy8, AND, yymsp[0].minor.yy8);
+{ 
+  yygotominor.yy88 = NewNotNode(yymsp[0].minor.yy88);
 }
-#line 883 "parser.c"
+#line 891 "parser.c"
         break;
-      case 13: /* cond ::= cond OR cond */
+      case 13: /* cond ::= prop IN vallist */
 #line 94 "parser.y"
+{ 
+    /* Terminal condition of a single IN predicate */
+    yygotominor.yy88 = NewInPredicateNode(yymsp[-2].minor.yy54, IN, yymsp[0].minor.yy33);
+}
+#line 899 "parser.c"
+        break;
+      case 14: /* cond ::= LP cond RP */
+#line 99 "parser.y"
+{ 
+  yygotominor.yy88 = yymsp[-1].minor.yy88;
+}
+#line 906 "parser.c"
+        break;
+      case 15: /* cond ::= cond AND cond */
+#line 103 "parser.y"
+{
+  yygotominor.yy88 = NewConditionNode(yymsp[-2].minor.yy88, AND, yymsp[0].minor.yy88);
+}
+#line 913 "parser.c"
+        break;
+      case 16: /* cond ::= cond OR cond */
+#line 107 "parser.y"
 {
-  yygotominor.yy8 = NewConditionNode(yymsp[-2].minor.yy8, OR, yymsp[0].minor.yy8);
+  yygotominor.yy88 = NewConditionNode(yymsp[-2].minor.yy88, OR, yymsp[0].minor.yy88);
 }
-#line 890 "parser.c"
+#line 920 "parser.c"
         break;
-      case 14: /* value ::= INTEGER */
-#line 102 "parser.y"
+      case 17: /* value ::= INTEGER */
+#line 115 "parser.y"
 {  yygotominor.yy22 = SI_LongVal(yymsp[0].minor.yy0.intval); }
-#line 895 "parser.c"
+#line 925 "parser.c"
         break;
-      case 15: /* value ::= STRING */
-#line 103 "parser.y"
+      case 18: /* value ::= STRING */
+#line 116 "parser.y"
 {  yygotominor.yy22 = SI_StringValC(strdup(yymsp[0].minor.yy0.strval)); }
-#line 900 "parser.c"
+#line 930 "parser.c"
         break;
-      case 16: /* value ::= FLOAT */
-#line 104 "parser.y"
+      case 19: /* value ::= FLOAT */
+#line 117 "parser.y"
 {  yygotominor.yy22 = SI_DoubleVal(yymsp[0].minor.yy0.dval); }
-#line 905 "parser.c"
+#line 935 "parser.c"
         break;
-      case 17: /* value ::= TRUE */
-#line 105 "parser.y"
+      case 20: /* value ::= TRUE */
+#line 118 "parser.y"
 { yygotominor.yy22 = SI_BoolVal(1); }
-#line 910 "parser.c"
+#line 940 "parser.c"
         break;
-      case 18: /* value ::= FALSE */
-#line 106 "parser.y"
+      case 21: /* value ::= FALSE */
+#line 119 "parser.y"
 { yygotominor.yy22 = SI_BoolVal(0); }
-#line 915 "parser.c"
+#line 945 "parser.c"
         break;
-      case 19: /* value ::= timestamp */
-#line 107 "parser.y"
-{ yygotominor.yy22 = SI_TimeVal(yymsp[0].minor.yy23); }
-#line 920 "parser.c"
+      case 22: /* value ::= timestamp */
+#line 120 "parser.y"
+{ yygotominor.yy22 = SI_TimeVal(yymsp[0].minor.yy67); }
+#line 950 "parser.c"
         break;
-      case 20: /* vallist ::= LP multivals RP */
-#line 114 "parser.y"
+      case 23: /* vallist ::= LP multivals RP */
+#line 127 "parser.y"
 {
-    yygotominor.yy27 = yymsp[-1].minor.yy27;
+    yygotominor.yy33 = yymsp[-1].minor.yy33;
     
 }
-#line 928 "parser.c"
+#line 958 "parser.c"
         break;
-      case 21: /* multivals ::= value COMMA value */
-#line 118 "parser.y"
+      case 24: /* multivals ::= value COMMA value */
+#line 131 "parser.y"
 {
-      yygotominor.yy27 = SI_NewValueVector(2);
-      SIValueVector_Append(&yygotominor.yy27, yymsp[-2].minor.yy22);
-      SIValueVector_Append(&yygotominor.yy27, yymsp[0].minor.yy22);
+      yygotominor.yy33 = SI_NewValueVector(2);
+      SIValueVector_Append(&yygotominor.yy33, yymsp[-2].minor.yy22);
+      SIValueVector_Append(&yygotominor.yy33, yymsp[0].minor.yy22);
 }
-#line 937 "parser.c"
+#line 967 "parser.c"
         break;
-      case 22: /* multivals ::= multivals COMMA value */
-#line 124 "parser.y"
+      case 25: /* multivals ::= multivals COMMA value */
+#line 137 "parser.y"
 {
-    SIValueVector_Append(&yymsp[-2].minor.yy27, yymsp[0].minor.yy22);
-    yygotominor.yy27 = yymsp[-2].minor.yy27;
+    SIValueVector_Append(&yymsp[-2].minor.yy33, yymsp[0].minor.yy22);
+    yygotominor.yy33 = yymsp[-2].minor.yy33;
 }
-#line 945 "parser.c"
+#line 975 "parser.c"
         break;
-      case 23: /* prop ::= ENUMERATOR */
-#line 139 "parser.y"
-{ yygotominor.yy44.id = yymsp[0].minor.yy0.intval; yygotominor.yy44.name = NULL;  }
-#line 950 "parser.c"
+      case 26: /* prop ::= ENUMERATOR */
+#line 152 "parser.y"
+{ yygotominor.yy54.id = yymsp[0].minor.yy0.intval; yygotominor.yy54.name = NULL;  }
+#line 980 "parser.c"
         break;
-      case 24: /* prop ::= IDENT */
-#line 140 "parser.y"
-{ yygotominor.yy44.name = yymsp[0].minor.yy0.strval; yygotominor.yy44.id = 0;  }
-#line 955 "parser.c"
+      case 27: /* prop ::= IDENT */
+#line 153 "parser.y"
+{ yygotominor.yy54.name = yymsp[0].minor.yy0.strval; yygotominor.yy54.id = 0;  }
+#line 985 "parser.c"
         break;
-      case 25: /* timestamp ::= NOW */
-#line 144 "parser.y"
+      case 28: /* timestamp ::= NOW */
+#line 157 "parser.y"
 {
-    yygotominor.yy23 = time(NULL);
+    yygotominor.yy67 = time(NULL);
 }
-#line 962 "parser.c"
+#line 992 "parser.c"
         break;
-      case 26: /* timestamp ::= TODAY */
-#line 148 "parser.y"
+      case 29: /* timestamp ::= TODAY */
+#line 161 "parser.y"
 {
     time_t t = time(NULL);
-    yygotominor.yy23 = t - t % 86400;
+    yygotominor.yy67 = t - t % 86400;
 }
-#line 970 "parser.c"
+#line 1000 "parser.c"
         break;
-      case 27: /* timestamp ::= TIME LP INTEGER RP */
-      case 28: /* timestamp ::= UNIXTIME LP INTEGER RP */ yytestcase(yyruleno==28);
-#line 153 "parser.y"
+      case 30: /* timestamp ::= TIME LP INTEGER RP */
+      case 31: /* timestamp ::= UNIXTIME LP INTEGER RP */ yytestcase(yyruleno==31);
+#line 166 "parser.y"
 {
-    yygotominor.yy23 = (time_t)yymsp[-1].minor.yy0.intval;
+    yygotominor.yy67 = (time_t)yymsp[-1].minor.yy0.intval;
 }
-#line 978 "parser.c"
+#line 1008 "parser.c"
         break;
-      case 29: /* timestamp ::= TIME_ADD LP timestamp COMMA duration RP */
-#line 161 "parser.y"
+      case 32: /* timestamp ::= TIME_ADD LP timestamp COMMA duration RP */
+#line 174 "parser.y"
 {
-    yygotominor.yy23 = yymsp[-3].minor.yy23 + yymsp[-1].minor.yy64;
+    yygotominor.yy67 = yymsp[-3].minor.yy67 + yymsp[-1].minor.yy20;
 }
-#line 985 "parser.c"
+#line 1015 "parser.c"
         break;
-      case 30: /* timestamp ::= TIME_SUB LP timestamp COMMA duration RP */
-#line 165 "parser.y"
+      case 33: /* timestamp ::= TIME_SUB LP timestamp COMMA duration RP */
+#line 178 "parser.y"
 {
-    yygotominor.yy23 = yymsp[-3].minor.yy23 - yymsp[-1].minor.yy64;
+    yygotominor.yy67 = yymsp[-3].minor.yy67 - yymsp[-1].minor.yy20;
 }
-#line 992 "parser.c"
+#line 1022 "parser.c"
         break;
-      case 31: /* duration ::= DAYS LP INTEGER RP */
-#line 171 "parser.y"
+      case 34: /* duration ::= DAYS LP INTEGER RP */
+#line 184 "parser.y"
 {
-    yygotominor.yy64 = yymsp[-1].minor.yy0.intval * 86400;
+    yygotominor.yy20 = yymsp[-1].minor.yy0.intval * 86400;
 }
-#line 999 "parser.c"
+#line 1029 "parser.c"
         break;
-      case 32: /* duration ::= HOURS LP INTEGER RP */
-#line 174 "parser.y"
+      case 35: /* duration ::= HOURS LP INTEGER RP */
+#line 187 "parser.y"
 {
-    yygotominor.yy64 = yymsp[-1].minor.yy0.intval * 3600;
+    yygotominor.yy20 = yymsp[-1].minor.yy0.intval * 3600;
 }
-#line 1006 "parser.c"
+#line 1036 "parser.c"
         break;
-      case 33: /* duration ::= MINUTES LP INTEGER RP */
-#line 177 "parser.y"
+      case 36: /* duration ::= MINUTES LP INTEGER RP */
+#line 190 "parser.y"
 {
-    yygotominor.yy64 = yymsp[-1].minor.yy0.intval * 60;
+    yygotominor.yy20 = yymsp[-1].minor.yy0.intval * 60;
 }
-#line 1013 "parser.c"
+#line 1043 "parser.c"
         break;
-      case 34: /* duration ::= SECONDS LP INTEGER RP */
-#line 180 "parser.y"
+      case 37: /* duration ::= SECONDS LP INTEGER RP */
+#line 193 "parser.y"
 {
-    yygotominor.yy64 = yymsp[-1].minor.yy0.intval;
+    yygotominor.yy20 = yymsp[-1].minor.yy0.intval;
 }
-#line 1020 "parser.c"
+#line 1050 "parser.c"
         break;
       default:
         break;
@@ -1078,7 +1108,7 @@ static void yy_syntax_error(
 ){
   ParseARG_FETCH;
 #define TOKEN (yyminor.yy0)
-#line 11 "parser.y"
+#line 12 "parser.y"
   
 
     //yyerror(yytext);
@@ -1090,7 +1120,7 @@ static void yy_syntax_error(
 
     ctx->ok = 0;
     ctx->errorMsg = strdup(msg);
-#line 1094 "parser.c"
+#line 1124 "parser.c"
   ParseARG_STORE; /* Suppress warning about unused %extra_argument variable */
 }
 
@@ -1281,7 +1311,7 @@ void Parse(
   }while( yymajor!=YYNOCODE && yypParser->yyidx>=0 );
   return;
 }
-#line 184 "parser.y"
+#line 197 "parser.y"
 
 
   /* Definitions of flex stuff */
@@ -1320,4 +1350,4 @@ ParseNode *ParseQuery(const char *c, size_t len, char **err)  {
    
 
 
-#line 1324 "parser.c"
+#line 1354 "parser.c"
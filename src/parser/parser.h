@@ -1,32 +1,33 @@
 #define AND                              1
 #define OR                               2
-#define EQ                               3
-#define NE                               4
-#define GT                               5
-#define GE                               6
-#define LT                               7
-#define LE                               8
-#define IN                               9
-#define IS                              10
-#define NOW                             11
-#define LIKE                            12
-#define STRING                          13
-#define TK_NULL                         14
-#define LP                              15
-#define RP                              16
-#define INTEGER                         17
-#define FLOAT                           18
-#define TRUE                            19
-#define FALSE                           20
-#define COMMA                           21
-#define ENUMERATOR                      22
-#define IDENT                           23
-#define TODAY                           24
-#define TIME                            25
-#define UNIXTIME                        26
-#define TIME_ADD                        27
-#define TIME_SUB                        28
-#define DAYS                            29
-#define HOURS                           30
-#define MINUTES                         31
-#define SECONDS                         32
+#define NOT                              3
+#define EQ                               4
+#define NE                               5
+#define GT                               6
+#define GE                               7
+#define LT                               8
+#define LE                               9
+#define IN                              10
+#define IS                              11
+#define NOW                             12
+#define LIKE                            13
+#define STRING                          14
+#define TK_NULL                         15
+#define LP                              16
+#define RP                              17
+#define INTEGER                         18
+#define FLOAT                           19
+#define TRUE                            20
+#define FALSE                           21
+#define COMMA                           22
+#define ENUMERATOR                      23
+#define IDENT                           24
+#define TODAY                           25
+#define TIME                            26
+#define UNIXTIME                        27
+#define TIME_ADD                        28
+#define TIME_SUB                        29
+#define DAYS                            30
+#define HOURS                           31
+#define MINUTES                         32
+#define SECONDS                         33
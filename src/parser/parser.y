@@ -1,6 +1,7 @@
 
 %left AND.
 %left OR.
+%right NOT.
 %nonassoc EQ NE GT GE LT LE IN IS NOW.
 //%left PLUS MINUS.
 //%right EXP NOT.
@@ -78,6 +79,18 @@ cond(A) ::= prop(B) IS TK_NULL. {
     A = NewPredicateNode(B, IS, SI_NullVal());
 }
 
+cond(A) ::= prop(B) NOT LIKE STRING(C). { 
+    A = NewNotNode(NewPredicateNode(B, LIKE, SI_StringValC(strdup(C.strval))));
+}
+
+cond(A) ::= prop(B) IS NOT TK_NULL. { 
+    A = NewNotNode(NewPredicateNode(B, IS, SI_NullVal()));
+}
+
+cond(A) ::= NOT cond(B). { 
+  A = NewNotNode(B);
+}
+
 cond(A) ::= prop(B) IN vallist(D). { 
     /* Terminal condition of a single IN predicate */
     A = NewInPredicateNode(B, IN, D);
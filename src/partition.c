@@ -0,0 +1,505 @@
+#include <string.h>
+#include "index.h"
+#include "key.h"
+#include "rmutil/alloc.h"
+
+typedef struct {
+  SISpec spec;
+  SIIndex *parts;
+  int num;
+  // compares the keys of the partitions, to merge their scans
+  SICmpFuncVector fv;
+} partitionedIndex;
+
+/* The partition of an id, by its FNV-1a hash */
+static int partitionOf(partitionedIndex *pi, SIId id) {
+  u_int32_t h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)id; *p; p++) {
+    h ^= *p;
+    h *= 16777619u;
+  }
+  return h % pi->num;
+}
+
+/* Split a change set into a change set per partition, keeping the order of the
+ * changes. The change sets share the ids and values of the original */
+static void splitChanges(partitionedIndex *pi, SIChangeSet cs,
+                         SIChangeSet *out) {
+  for (int i = 0; i < pi->num; i++) {
+    out[i] = (SIChangeSet){.changes = NULL, .numChanges = 0, .cap = 0};
+  }
+  for (size_t i = 0; i < cs.numChanges; i++) {
+    SIChangeSet *p = &out[partitionOf(pi, cs.changes[i].id)];
+    if (p->numChanges == p->cap) {
+      p->cap = p->cap ? p->cap * 2 : 16;
+      p->changes = realloc(p->changes, p->cap * sizeof(SIChange));
+    }
+    p->changes[p->numChanges++] = cs.changes[i];
+  }
+}
+
+int partitionedIndex_Apply(void *ctx, SIChangeSet cs) {
+  partitionedIndex *pi = ctx;
+  // values that don't fit the index fail the whole change set, before any of
+  // the partitions is changed
+  for (size_t i = 0; i < cs.numChanges; i++) {
+    if (cs.changes[i].type == SI_CHADD &&
+        cs.changes[i].v.len != pi->spec.numProps) {
+      return SI_INDEX_ERROR;
+    }
+  }
+
+  SIChangeSet parts[pi->num];
+  splitChanges(pi, cs, parts);
+  int rc = SI_INDEX_OK;
+  for (int i = 0; i < pi->num; i++) {
+    if (parts[i].numChanges) {
+      SIIndex *p = &pi->parts[i];
+      int prc = p->Apply(p->ctx, parts[i]);
+      if (rc == SI_INDEX_OK) {
+        rc = prc;
+      }
+    }
+    free(parts[i].changes);
+  }
+  return rc;
+}
+
+/* Every partition gets the entries of a sorted run that are routed to it, which
+ * are a sorted run too */
+int partitionedIndex_Load(void *ctx, SILoadRun *run) {
+  partitionedIndex *pi = ctx;
+  for (size_t i = 0; i < run->num; i++) {
+    if (run->ents[i].key->size != pi->spec.numProps) {
+      return SI_INDEX_ERROR;
+    }
+  }
+
+  SILoadRun parts[pi->num];
+  for (int i = 0; i < pi->num; i++) {
+    parts[i] = SI_NewLoadRun(0);
+  }
+  for (size_t i = 0; i < run->num; i++) {
+    SILoadRun *p = &parts[partitionOf(pi, run->ents[i].id)];
+    if (p->num == p->cap) {
+      p->cap = p->cap ? p->cap * 2 : 16;
+      p->ents = realloc(p->ents, p->cap * sizeof(SILoadEntry));
+    }
+    p->ents[p->num++] = run->ents[i];
+  }
+  // the partitions own the entries now
+  run->num = 0;
+
+  int rc = SI_INDEX_OK;
+  for (int i = 0; i < pi->num; i++) {
+    if (parts[i].num && rc == SI_INDEX_OK) {
+      rc = pi->parts[i].Load(pi->parts[i].ctx, &parts[i]);
+    }
+    SILoadRun_Free(&parts[i]);
+  }
+  return rc;
+}
+
+long partitionedIndex_DeleteWhere(void *ctx, SIQuery *q, IndexVisitor cb,
+                                  void *visitCtx) {
+  partitionedIndex *pi = ctx;
+  long ret = 0;
+  for (int i = 0; i < pi->num; i++) {
+    // planning changes the query, so every partition plans a copy of it
+    SIQuery pq = SIQuery_Copy(q);
+    long n = pi->parts[i].DeleteWhere(pi->parts[i].ctx, &pq, cb, visitCtx);
+    SIQuery_Free(&pq);
+    if (n < 0) {
+      return -1;
+    }
+    ret += n;
+  }
+  return ret;
+}
+
+/* A heap of partitions, ordered by their next entries */
+typedef struct {
+  int *parts;
+  int size;
+  // the next id and key of every partition
+  SIId *ids;
+  void **keys;
+  SICmpFuncVector *fv;
+  size_t numCmps;
+} piHeap;
+
+static int piHeap_less(piHeap *h, int a, int b) {
+  h->numCmps++;
+  int c = SICmpMultiKey(h->keys[a], h->keys[b], h->fv);
+  if (c) {
+    return c < 0;
+  }
+  return strcmp(h->ids[a], h->ids[b]) < 0;
+}
+
+static void piHeap_down(piHeap *h, int pos) {
+  for (;;) {
+    int min = pos, l = 2 * pos + 1, r = l + 1;
+    if (l < h->size && piHeap_less(h, h->parts[l], h->parts[min])) {
+      min = l;
+    }
+    if (r < h->size && piHeap_less(h, h->parts[r], h->parts[min])) {
+      min = r;
+    }
+    if (min == pos) {
+      return;
+    }
+    int tmp = h->parts[pos];
+    h->parts[pos] = h->parts[min];
+    h->parts[min] = tmp;
+    pos = min;
+  }
+}
+
+static void piHeap_build(piHeap *h) {
+  for (int i = h->size / 2 - 1; i >= 0; i--) {
+    piHeap_down(h, i);
+  }
+}
+
+/* Replace the next entry of the partition at the top of the heap, or remove it
+ * if it has no entries left */
+static void piHeap_replaceTop(piHeap *h, SIId id, void *key) {
+  int p = h->parts[0];
+  if (id) {
+    h->ids[p] = id;
+    h->keys[p] = key;
+  } else {
+    h->parts[0] = h->parts[--h->size];
+  }
+  piHeap_down(h, 0);
+}
+
+typedef struct {
+  partitionedIndex *idx;
+  // the query planned by every partition - their plans point into them
+  SIQuery *queries;
+  SICursor **cursors;
+  int num;
+  SICursorStats *stats;
+
+  // set if all the partitions scan in key order, and their ids are merged by
+  // key. Otherwise the partitions are read one after the other
+  int merge;
+  int current;
+  // the partitions with entries left. It's rebuilt after the cursor is
+  // suspended, since the next entries may have changed
+  piHeap heap;
+  int heapValid;
+} piCursorCtx;
+
+/* The stats of a partitioned cursor are the sums of its partitions' */
+static void piCursor_sumStats(piCursorCtx *pc) {
+  SICursorStats *s = pc->stats;
+  s->rangesScanned = s->nodesVisited = s->rowsFiltered = s->rowsReturned = 0;
+  s->comparisons = pc->heap.numCmps;
+  for (int i = 0; i < pc->num; i++) {
+    SICursorStats *ps = &pc->cursors[i]->stats;
+    s->rangesScanned += ps->rangesScanned;
+    s->nodesVisited += ps->nodesVisited;
+    s->comparisons += ps->comparisons;
+    s->rowsFiltered += ps->rowsFiltered;
+    s->rowsReturned += ps->rowsReturned;
+  }
+}
+
+static void piCursor_fillHeap(piCursorCtx *pc) {
+  piHeap *h = &pc->heap;
+  h->size = 0;
+  for (int i = 0; i < pc->num; i++) {
+    SICursor *c = pc->cursors[i];
+    if ((h->ids[i] = c->Peek(c->ctx, &h->keys[i]))) {
+      h->parts[h->size++] = i;
+    }
+  }
+  piHeap_build(h);
+  pc->heapValid = 1;
+}
+
+SIId piCursor_peek(void *ctx, void **key) {
+  piCursorCtx *pc = ctx;
+  if (!pc->heapValid) {
+    piCursor_fillHeap(pc);
+  }
+  if (!pc->heap.size) {
+    return NULL;
+  }
+  int p = pc->heap.parts[0];
+  if (key) {
+    *key = pc->heap.keys[p];
+  }
+  return pc->heap.ids[p];
+}
+
+SIId piCursor_next(void *ctx) {
+  piCursorCtx *pc = ctx;
+  SIId ret = NULL;
+
+  if (!pc->merge) {
+    while (pc->current < pc->num && !ret) {
+      SICursor *c = pc->cursors[pc->current];
+      if (!(ret = c->Next(c->ctx))) {
+        pc->current++;
+      }
+    }
+  } else if (piCursor_peek(pc, NULL)) {
+    SICursor *c = pc->cursors[pc->heap.parts[0]];
+    ret = c->Next(c->ctx);
+    void *key;
+    SIId id = c->Peek(c->ctx, &key);
+    piHeap_replaceTop(&pc->heap, id, key);
+  }
+
+  if (!ret) {
+    piCursor_sumStats(pc);
+  }
+  return ret;
+}
+
+void piCursor_suspend(void *ctx) {
+  piCursorCtx *pc = ctx;
+  for (int i = 0; i < pc->num; i++) {
+    if (pc->cursors[i]->Suspend) {
+      pc->cursors[i]->Suspend(pc->cursors[i]->ctx);
+    }
+  }
+  pc->heapValid = 0;
+  piCursor_sumStats(pc);
+}
+
+void piCursor_free(void *ctx) {
+  piCursorCtx *pc = ctx;
+  for (int i = 0; i < pc->num; i++) {
+    SICursor_Free(pc->cursors[i]);
+    SIQuery_Free(&pc->queries[i]);
+  }
+  free(pc->cursors);
+  free(pc->queries);
+  free(pc->heap.parts);
+  free(pc->heap.ids);
+  free(pc->heap.keys);
+  free(pc);
+}
+
+SICursor *partitionedIndex_Find(void *ctx, SIQuery *q) {
+  partitionedIndex *pi = ctx;
+  SICursor *c = SI_NewCursor(NULL);
+
+  piCursorCtx *pc = malloc(sizeof(piCursorCtx));
+  pc->idx = pi;
+  pc->num = pi->num;
+  pc->queries = malloc(pi->num * sizeof(SIQuery));
+  pc->cursors = malloc(pi->num * sizeof(SICursor *));
+  pc->stats = &c->stats;
+  pc->merge = 1;
+  pc->current = 0;
+  pc->heap = (piHeap){.parts = malloc(pi->num * sizeof(int)),
+                      .size = 0,
+                      .ids = malloc(pi->num * sizeof(SIId)),
+                      .keys = malloc(pi->num * sizeof(void *)),
+                      .fv = &pi->fv,
+                      .numCmps = 0};
+  pc->heapValid = 0;
+
+  for (int i = 0; i < pi->num; i++) {
+    pc->queries[i] = SIQuery_Copy(q);
+    SICursor *sub = pi->parts[i].Find(pi->parts[i].ctx, &pc->queries[i]);
+    pc->cursors[i] = sub;
+    c->stats.planTime += sub->stats.planTime;
+    c->stats.estimatedCost += sub->stats.estimatedCost;
+    c->stats.estimatedRows += sub->stats.estimatedRows;
+    if (sub->error != SI_CURSOR_OK) {
+      c->error = sub->error;
+    }
+    if (!sub->Peek) {
+      pc->merge = 0;
+    }
+  }
+
+  c->ctx = pc;
+  c->Next = piCursor_next;
+  c->Suspend = piCursor_suspend;
+  c->Peek = pc->merge ? piCursor_peek : NULL;
+  c->Release = piCursor_free;
+  return c;
+}
+
+/* Pin every partition for its cursor. Each partition is pinned as it is at
+ * the time, like changes are applied to one partition at a time. The cursor is
+ * pinned only if all of them are - partitions may plan a query differently */
+int partitionedIndex_Snapshot(void *ctx, SICursor *c) {
+  partitionedIndex *pi = ctx;
+  piCursorCtx *pc = c->ctx;
+  int ret = 1;
+  for (int i = 0; i < pc->num; i++) {
+    SICursor *sub = pc->cursors[i];
+    if (!pi->parts[i].Snapshot(pi->parts[i].ctx, sub)) {
+      ret = 0;
+    }
+  }
+  pc->heapValid = 0;
+  return ret;
+}
+
+SICursor **SI_PartitionCursors(SICursor *c, int *num) {
+  if (c->Release != piCursor_free) {
+    return NULL;
+  }
+  piCursorCtx *pc = c->ctx;
+  *num = pc->num;
+  return pc->cursors;
+}
+
+void SI_MergePartitionRuns(SICursor *c, SIPartitionRun *runs, SIId *out) {
+  piCursorCtx *pc = c->ctx;
+  size_t n = 0;
+
+  if (!pc->merge) {
+    for (int i = 0; i < pc->num; i++) {
+      memcpy(out + n, runs[i].ids, runs[i].num * sizeof(SIId));
+      n += runs[i].num;
+    }
+  } else {
+    int parts[pc->num];
+    SIId ids[pc->num];
+    void *keys[pc->num];
+    size_t pos[pc->num];
+    piHeap h = {.parts = parts, .size = 0, .ids = ids, .keys = keys,
+                .fv = &pc->idx->fv, .numCmps = 0};
+    for (int i = 0; i < pc->num; i++) {
+      pos[i] = 0;
+      if (runs[i].num) {
+        ids[i] = runs[i].ids[0];
+        keys[i] = runs[i].keys[0];
+        parts[h.size++] = i;
+      }
+    }
+    piHeap_build(&h);
+
+    while (h.size) {
+      int p = parts[0];
+      out[n++] = runs[p].ids[pos[p]++];
+      if (pos[p] < runs[p].num) {
+        piHeap_replaceTop(&h, runs[p].ids[pos[p]], runs[p].keys[pos[p]]);
+      } else {
+        piHeap_replaceTop(&h, NULL, NULL);
+      }
+    }
+    pc->heap.numCmps += h.numCmps;
+  }
+  piCursor_sumStats(pc);
+}
+
+/* Plans are built by the largest partition, which has the most representative
+ * statistics */
+struct siQueryPlan *partitionedIndex_Explain(void *ctx, SIQuery *q) {
+  partitionedIndex *pi = ctx;
+  int largest = 0;
+  for (int i = 1; i < pi->num; i++) {
+    if (pi->parts[i].Len(pi->parts[i].ctx) >
+        pi->parts[largest].Len(pi->parts[largest].ctx)) {
+      largest = i;
+    }
+  }
+  return pi->parts[largest].Explain(pi->parts[largest].ctx, q);
+}
+
+/* Visit the partitions one after the other, each in its own order */
+void partitionedIndex_Traverse(void *ctx, IndexVisitor cb, void *visitCtx) {
+  partitionedIndex *pi = ctx;
+  for (int i = 0; i < pi->num; i++) {
+    pi->parts[i].Traverse(pi->parts[i].ctx, cb, visitCtx);
+  }
+}
+
+size_t partitionedIndex_Len(void *ctx) {
+  partitionedIndex *pi = ctx;
+  size_t ret = 0;
+  for (int i = 0; i < pi->num; i++) {
+    ret += pi->parts[i].Len(pi->parts[i].ctx);
+  }
+  return ret;
+}
+
+int partitionedIndex_Contains(void *ctx, SIId id) {
+  partitionedIndex *pi = ctx;
+  SIIndex *p = &pi->parts[partitionOf(pi, id)];
+  return p->Contains(p->ctx, id);
+}
+
+size_t partitionedIndex_Buffered(void *ctx) {
+  partitionedIndex *pi = ctx;
+  size_t ret = 0;
+  for (int i = 0; i < pi->num; i++) {
+    ret += pi->parts[i].Buffered(pi->parts[i].ctx);
+  }
+  return ret;
+}
+
+void partitionedIndex_ReadLock(void *ctx) {
+  partitionedIndex *pi = ctx;
+  for (int i = 0; i < pi->num; i++) {
+    pi->parts[i].ReadLock(pi->parts[i].ctx);
+  }
+}
+
+void partitionedIndex_Unlock(void *ctx) {
+  partitionedIndex *pi = ctx;
+  for (int i = pi->num - 1; i >= 0; i--) {
+    pi->parts[i].Unlock(pi->parts[i].ctx);
+  }
+}
+
+void partitionedIndex_Free(void *ctx) {
+  partitionedIndex *pi = ctx;
+  for (int i = 0; i < pi->num; i++) {
+    pi->parts[i].Free(pi->parts[i].ctx);
+  }
+  free(pi->parts);
+  free(pi->fv.cmpFuncs);
+  free(pi);
+}
+
+SIIndex SI_NewPartitionedIndex(SISpec spec) {
+  partitionedIndex *pi = malloc(sizeof(partitionedIndex));
+  pi->spec = spec;
+  pi->num = spec.numPartitions > 1 ? spec.numPartitions : 1;
+  pi->parts = malloc(pi->num * sizeof(SIIndex));
+  for (int i = 0; i < pi->num; i++) {
+    pi->parts[i] = SI_NewCompoundIndex(spec);
+  }
+  pi->fv.cmpFuncs = calloc(spec.numProps, sizeof(SIKeyCmpFunc));
+  pi->fv.numFuncs = spec.numProps;
+  for (size_t i = 0; i < spec.numProps; i++) {
+    pi->fv.cmpFuncs[i] = SI_KeyCmpFunc(spec.properties[i].type);
+  }
+
+  SIIndex ret;
+  ret.ctx = pi;
+  ret.Find = partitionedIndex_Find;
+  ret.Explain = partitionedIndex_Explain;
+  ret.Snapshot = partitionedIndex_Snapshot;
+  ret.Apply = partitionedIndex_Apply;
+  ret.DeleteWhere = partitionedIndex_DeleteWhere;
+  ret.Load = partitionedIndex_Load;
+  ret.Len = partitionedIndex_Len;
+  ret.Contains = partitionedIndex_Contains;
+  ret.Buffered = partitionedIndex_Buffered;
+  ret.Traverse = partitionedIndex_Traverse;
+  ret.ReadLock = partitionedIndex_ReadLock;
+  ret.Unlock = partitionedIndex_Unlock;
+  ret.Free = partitionedIndex_Free;
+  ret.partitions = pi->parts;
+  ret.numPartitions = pi->num;
+  return ret;
+}
+
+SIIndex SI_NewIndex(SISpec spec) {
+  return spec.numPartitions > 1 ? SI_NewPartitionedIndex(spec)
+                                : SI_NewCompoundIndex(spec);
+}
@@ -1,4 +1,5 @@
 #include "query.h"
+#include "key.h"
 #include "rmutil/alloc.h"
 
 SIQueryNode *__newQueryNode(SIQueryNodeType t) {
@@ -12,6 +13,13 @@ SIQueryNode *SI_PredEquals(SIValue v) {
   return ret;
 }
 
+SIQueryNode *SI_PredNotEquals(SIValue v) {
+  SIQueryNode *ret = __newQueryNode(QN_PRED);
+  ret->pred =
+      (SIPredicate){.ne = (SINotEquals){SIValue_Copy(v)}, .t = PRED_NE};
+  return ret;
+}
+
 SIQueryNode *SI_PredBetween(SIValue min, SIValue max, int minExclusive,
                             int maxExclusive) {
   SIQueryNode *ret = __newQueryNode(QN_PRED);
@@ -38,6 +46,44 @@ SIQueryNode *SI_PredIn(SIValueVector v) {
   return ret;
 }
 
+SIQueryNode *SI_PredLike(SIValue pattern) {
+  SIQueryNode *ret = __newQueryNode(QN_PRED);
+  ret->pred = (SIPredicate){
+      .like = (SILike){.pattern = SIValue_Copy(pattern), .negated = 0},
+      .t = PRED_LIKE};
+  return ret;
+}
+
+int SI_LikeMatch(SIString *s, SIString *pattern) {
+  const char *p = pattern->str;
+  size_t si = 0, pi = 0;
+  // the position after the last '%' we've seen, and the string position it was
+  // matched against, to backtrack to on a mismatch
+  size_t star = 0, mark = 0;
+  int hasStar = 0;
+
+  while (si < s->len) {
+    if (pi < pattern->len && (p[pi] == '_' || p[pi] == s->str[si])) {
+      si++;
+      pi++;
+    } else if (pi < pattern->len && p[pi] == '%') {
+      hasStar = 1;
+      star = ++pi;
+      mark = si;
+    } else if (hasStar) {
+      // let the last '%' swallow one more character
+      pi = star;
+      si = ++mark;
+    } else {
+      return 0;
+    }
+  }
+  while (pi < pattern->len && p[pi] == '%') {
+    pi++;
+  }
+  return pi == pattern->len;
+}
+
 SIQueryNode *SI_PredIsNull() {
   SIQueryNode *ret = __newQueryNode(QN_PRED);
   ret->pred.t = PRED_ISNULL;
@@ -45,6 +91,101 @@ SIQueryNode *SI_PredIsNull() {
   return ret;
 }
 
+/* Combine two optional nodes with a logic operator, if both exist */
+SIQueryNode *__combineNodes(SIQueryNode *left, SILogicOperator op,
+                            SIQueryNode *right) {
+  if (!left) return right;
+  if (!right) return left;
+  return SIQuery_NewLogicNode(left, op, right);
+}
+
+SIQueryNode *__negatePredicate(SIQueryNode *n) {
+  SIPredicate *p = &n->pred;
+  SIQueryNode *ret = NULL;
+
+  switch (p->t) {
+    case PRED_EQ: {
+      SIValue v = p->eq.v;
+      p->ne.v = v;
+      p->t = PRED_NE;
+      return n;
+    }
+    case PRED_NE: {
+      SIValue v = p->ne.v;
+      p->eq.v = v;
+      p->t = PRED_EQ;
+      return n;
+    }
+    case PRED_LIKE:
+      p->like.negated = !p->like.negated;
+      return n;
+
+    case PRED_ISNULL:
+      // anything that is not NULL. NULL sorts after +inf, so it's out of range
+      ret = SI_PredBetween(SI_NegativeInfVal(), SI_InfVal(), 0, 0);
+      ret->pred.propId = p->propId;
+      break;
+
+    case PRED_RNG: {
+      // the values below the minimum or above the maximum
+      SIQueryNode *below = NULL, *above = NULL;
+      if (p->rng.min.type != T_NEGINF) {
+        below = SI_PredBetween(SI_NegativeInfVal(), p->rng.min, 0,
+                               !p->rng.minExclusive);
+        below->pred.propId = p->propId;
+      }
+      if (p->rng.max.type != T_INF) {
+        above = SI_PredBetween(p->rng.max, SI_InfVal(), !p->rng.maxExclusive,
+                               0);
+        above->pred.propId = p->propId;
+      }
+      ret = __combineNodes(below, OP_OR, above);
+      // an unbounded range matches every value, so its negation is NULL
+      if (!ret) {
+        ret = SI_PredIsNull();
+        ret->pred.propId = p->propId;
+      }
+      break;
+    }
+
+    case PRED_IN:
+      // different from all the values
+      for (int i = 0; i < p->in.numvals; i++) {
+        SIQueryNode *ne = SI_PredNotEquals(p->in.vals[i]);
+        ne->pred.propId = p->propId;
+        ret = __combineNodes(ret, OP_AND, ne);
+      }
+      if (!ret) {
+        ret = SI_PredBetween(SI_NegativeInfVal(), SI_InfVal(), 0, 0);
+        ret->pred.propId = p->propId;
+      }
+      break;
+
+    default:
+      return n;
+  }
+
+  SIQueryNode_Free(n);
+  return ret;
+}
+
+SIQueryNode *SIQueryNode_Negate(SIQueryNode *n) {
+  if (!n) return NULL;
+
+  switch (n->type) {
+    case QN_LOGIC:
+      // NOT (a AND b) => NOT a OR NOT b, and vice versa
+      n->op.op = n->op.op == OP_AND ? OP_OR : OP_AND;
+      n->op.left = SIQueryNode_Negate(n->op.left);
+      n->op.right = SIQueryNode_Negate(n->op.right);
+      return n;
+    case QN_PRED:
+      return __negatePredicate(n);
+    default:
+      return n;
+  }
+}
+
 SIQuery SI_NewQuery() {
   return (SIQuery){.root = NULL, .offset = 0, .num = 0, .numPredicates = 0};
 }
@@ -82,6 +223,9 @@ void __freePredicate(SIPredicate *p) {
     case PRED_NE:
       SIValue_Free(&p->ne.v);
       break;
+    case PRED_LIKE:
+      SIValue_Free(&p->like.pattern);
+      break;
     case PRED_ISNULL:
     default:
       break;
@@ -106,9 +250,104 @@ void SIQueryNode_Free(SIQueryNode *n) {
   free(n);
 }
 
+SIQueryNode *SIQueryNode_Copy(SIQueryNode *n) {
+  if (!n) return NULL;
+
+  SIQueryNode *ret = __newQueryNode(n->type);
+  *ret = *n;
+  switch (n->type & ~QN_PASSTHRU) {
+    case QN_LOGIC:
+      ret->op.left = SIQueryNode_Copy(n->op.left);
+      ret->op.right = SIQueryNode_Copy(n->op.right);
+      break;
+    case QN_PRED: {
+      SIPredicate *p = &ret->pred;
+      switch (p->t) {
+        case PRED_EQ:
+          SIValue_IncRef(&p->eq.v);
+          break;
+        case PRED_NE:
+          SIValue_IncRef(&p->ne.v);
+          break;
+        case PRED_RNG:
+          SIValue_IncRef(&p->rng.min);
+          SIValue_IncRef(&p->rng.max);
+          break;
+        case PRED_IN:
+          p->in.vals = calloc(p->in.numvals, sizeof(SIValue));
+          memcpy(p->in.vals, n->pred.in.vals, p->in.numvals * sizeof(SIValue));
+          for (int i = 0; i < p->in.numvals; i++) {
+            SIValue_IncRef(&p->in.vals[i]);
+          }
+          break;
+        case PRED_LIKE:
+          SIValue_IncRef(&p->like.pattern);
+          break;
+        default:
+          break;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return ret;
+}
+
+SIQuery SIQuery_Copy(SIQuery *q) {
+  SIQuery ret = *q;
+  ret.root = SIQueryNode_Copy(q->root);
+  return ret;
+}
+
 void SIQuery_Free(SIQuery *q) {
   if (q->root) {
     SIQueryNode_Free(q->root);
     q->root = NULL;
   }
-}
\ No newline at end of file
+}
+
+static void collatePredicate(SIPredicate *p, SISpec *spec) {
+  if (!SISpec_IsCaseFolded(spec, p->propId)) {
+    return;
+  }
+  switch (p->t) {
+    case PRED_EQ:
+      SIValue_FoldCase(&p->eq.v);
+      break;
+    case PRED_NE:
+      SIValue_FoldCase(&p->ne.v);
+      break;
+    case PRED_RNG:
+      SIValue_FoldCase(&p->rng.min);
+      SIValue_FoldCase(&p->rng.max);
+      break;
+    case PRED_IN:
+      for (int i = 0; i < p->in.numvals; i++) {
+        SIValue_FoldCase(&p->in.vals[i]);
+      }
+      break;
+    case PRED_LIKE:
+      SIValue_FoldCase(&p->like.pattern);
+      break;
+    default:
+      break;
+  }
+}
+
+static void collateNode(SIQueryNode *n, SISpec *spec) {
+  if (!n) return;
+  switch (n->type & ~QN_PASSTHRU) {
+    case QN_LOGIC:
+      collateNode(n->op.left, spec);
+      collateNode(n->op.right, spec);
+      break;
+    case QN_PRED:
+      collatePredicate(&n->pred, spec);
+      break;
+    default:
+      break;
+  }
+}
+
+void SIQuery_Collate(SIQuery *q, SISpec *spec) { collateNode(q->root, spec); }
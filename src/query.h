@@ -2,6 +2,7 @@
 #define __SECONDARY_QUERY_H__
 #include "value.h"
 #include "spec.h"
+#include "rmutil/sds.h"
 
 typedef enum {
   PRED_EQ,
@@ -9,6 +10,7 @@ typedef enum {
   PRED_RNG,
   PRED_IN,
   PRED_ISNULL,
+  PRED_LIKE,
 } SIPredicateType;
 
 // query validation errors
@@ -57,6 +59,14 @@ typedef struct {
   size_t numvals;
 } SIIn;
 
+/* LIKE pattern predicate, for patterns that can't be expressed as a range.
+ * '%' matches any sequence of characters and '_' any single character */
+typedef struct {
+  SIValue pattern;
+  // NOT LIKE - matches the strings the pattern doesn't match
+  int negated;
+} SILike;
+
 /* Predicate union, will add more predicates later */
 typedef struct {
   union {
@@ -64,6 +74,7 @@ typedef struct {
     SIRange rng;
     SINotEquals ne;
     SIIn in;
+    SILike like;
   };
   /* the ordinal id of the propery being accessed in the index */
   int propId;
@@ -91,10 +102,22 @@ typedef struct queryNode {
 
 SIQueryNode *SI_PredIsNull();
 SIQueryNode *SI_PredEquals(SIValue v);
+SIQueryNode *SI_PredNotEquals(SIValue v);
 SIQueryNode *SI_PredBetween(SIValue min, SIValue max, int minExclusive,
                             int maxExclusive);
 
 SIQueryNode *SI_PredIn(SIValueVector v);
+SIQueryNode *SI_PredLike(SIValue pattern);
+
+/* Negate a query tree, returning its new root. Predicates are rewritten into
+ * their complements (EQ <-> NE, a range into the ranges around it etc.) and
+ * logic nodes are flipped using De Morgan's laws, so the result can still be
+ * planned as index ranges. As in SQL, a negated predicate never matches NULL
+ * values, except for NOT (x IS NULL) */
+SIQueryNode *SIQueryNode_Negate(SIQueryNode *n);
+
+/* Match a string against a LIKE pattern. Returns 1 if it matches */
+int SI_LikeMatch(SIString *s, SIString *pattern);
 
 /** An abstract query object, not dependant of syntax */
 typedef struct {
@@ -113,6 +136,10 @@ void __freePredicate(SIPredicate *p);
 SIQuery SI_NewQuery();
 
 void SIQuery_Free(SIQuery *q);
+
+/* Copy a query, for planning it more than once - planning changes the query
+ * tree. The copy shares the string values of the original */
+SIQuery SIQuery_Copy(SIQuery *q);
 SIQueryNode *SIQuery_SetRoot(SIQuery *q, SIQueryNode *n);
 
 SIQueryNode *SIQuery_NewLogicNode(SIQueryNode *left, SILogicOperator op,
@@ -120,10 +147,19 @@ SIQueryNode *SIQuery_NewLogicNode(SIQueryNode *left, SILogicOperator op,
 
 SIQueryError SIQuery_Normalize(SIQuery *q, SISpec *spec);
 
+/* Case fold the values of the predicates on case insensitive properties, so
+ * they can be compared to the index's folded keys */
+void SIQuery_Collate(SIQuery *q, SISpec *spec);
+
 int SI_ParseQuery(SIQuery *query, const char *q, size_t len, SISpec *spec,
                   char **err);
 void SIQueryNode_Print(SIQueryNode *n, int depth);
 
+/* Append a single line, human readable representation of a query tree to s.
+ * Passthru nodes already satisfied by the query plan are omitted */
+sds SIQueryNode_ToString(SIQueryNode *n, sds s);
+
 void SIQueryNode_Free(SIQueryNode *n);
+SIQueryNode *SIQueryNode_Copy(SIQueryNode *n);
 
 #endif  // !__SECONDARY_QUERY_H__
\ No newline at end of file
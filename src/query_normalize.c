@@ -111,6 +111,9 @@ SIQueryError validatePredicate(SIPredicate *pred, SISpec *spec) {
   case PRED_NE:
     typeMatch = castPredicateValue(&pred->ne.v, propType);
     break;
+  case PRED_LIKE:
+    typeMatch = propType == T_STRING && pred->like.pattern.type == T_STRING;
+    break;
   }
 
   if (!typeMatch) {
@@ -8,6 +8,9 @@ SIQueryNode *toQueryNode(PredicateNode *n) {
 
       return SI_PredEquals(n->val);
 
+    case NE:
+      return SI_PredNotEquals(n->val);
+
     case GT:
     case GE:
       // > --> betweetn val and inf (NULL value), exclusive min
@@ -20,19 +23,26 @@ SIQueryNode *toQueryNode(PredicateNode *n) {
     case IN:
       return SI_PredIn(n->lst);
 
-    case LIKE:
-      // support LIKE 'fff%' wildcard
-      if (n->val.stringval.len > 0 &&
-          n->val.stringval.str[n->val.stringval.len - 1] == '%') {
+    case LIKE: {
+      SIString *p = &n->val.stringval;
+      size_t i = 0;
+      while (i < p->len && p->str[i] != '%' && p->str[i] != '_') i++;
+      // no wildcards at all
+      if (i == p->len) {
+        return SI_PredEquals(n->val);
+      }
+      // support LIKE 'fff%' wildcard as a range scan
+      if (i > 0 && i == p->len - 1 && p->str[i] == '%') {
         SIString min = n->val.stringval, max = n->val.stringval;
         // disregard the first character.
         min.len--;
 
         max.str[max.len - 1] = '\xff';
         return SI_PredBetween(SI_StringVal(min), SI_StringVal(max), 0, 0);
-      } else {
-        return SI_PredEquals(n->val);
       }
+      // anything else is matched against the pattern
+      return SI_PredLike(n->val);
+    }
 
     case IS:
 
@@ -41,7 +51,6 @@ SIQueryNode *toQueryNode(PredicateNode *n) {
       }
 
     default:
-      printf("Operator %d not supported!", n->op);
       return NULL;
   }
 }
@@ -49,7 +58,9 @@ SIQueryNode *toQueryNode(PredicateNode *n) {
 SIQueryNode *traverseNode(SIQuery *q, ParseNode *n, SISpec *spec) {
   if (!n) return NULL;
 
-  if (n->t == N_COND) {
+  if (n->t == N_NOT) {
+    return SIQueryNode_Negate(traverseNode(q, n->cn.left, spec));
+  } else if (n->t == N_COND) {
     return SIQuery_NewLogicNode(traverseNode(q, n->cn.left, spec),
                                 n->cn.op == OR ? OP_OR : OP_AND,
                                 traverseNode(q, n->cn.right, spec));
@@ -82,8 +93,6 @@ int SI_ParseQuery(SIQuery *query, const char *q, size_t len, SISpec *spec,
   if (!root) {
     return 0;
   }
-  ParseNode_print(root, 0);
-
   query->root = traverseNode(query, root, spec);
   ParseNode_Free(root);
   return 1;
@@ -142,6 +151,10 @@ void qpredicateNode_print(SIPredicate *n, int depth) {
     case PRED_ISNULL:
       printf("$%d IS NULL", n->propId);
       break;
+    case PRED_LIKE:
+      SIValue_ToString(n->like.pattern, buf, 1024);
+      printf("$%d %sLIKE %s", n->propId, n->like.negated ? "NOT " : "", buf);
+      break;
   }
 }
 
@@ -160,4 +173,74 @@ void SIQueryNode_Print(SIQueryNode *n, int depth) {
       printf("NOOP");
   }
   printf(")\n");
-}
\ No newline at end of file
+}
+
+sds qpredicateNode_ToString(SIPredicate *n, sds s) {
+  char buf[1024];
+  switch (n->t) {
+    case PRED_EQ:
+    case PRED_NE:
+      SIValue_ToString(n->eq.v, buf, 1024);
+      s = sdscatprintf(s, "$%d %s %s", n->propId + 1,
+                       n->t == PRED_EQ ? "=" : "!=", buf);
+      break;
+    case PRED_RNG:
+      // open ended ranges are written as a single comparison
+      if (n->rng.min.type == T_NEGINF && n->rng.max.type == T_INF) {
+        s = sdscatprintf(s, "$%d IS NOT NULL", n->propId + 1);
+      } else if (n->rng.min.type == T_NEGINF) {
+        SIValue_ToString(n->rng.max, buf, 1024);
+        s = sdscatprintf(s, "$%d %s %s", n->propId + 1,
+                         n->rng.maxExclusive ? "<" : "<=", buf);
+      } else if (n->rng.max.type == T_INF) {
+        SIValue_ToString(n->rng.min, buf, 1024);
+        s = sdscatprintf(s, "$%d %s %s", n->propId + 1,
+                         n->rng.minExclusive ? ">" : ">=", buf);
+      } else {
+        SIValue_ToString(n->rng.min, buf, 1024);
+        s = sdscatprintf(s, "%s %s $%d", buf, n->rng.minExclusive ? "<" : "<=",
+                         n->propId + 1);
+        SIValue_ToString(n->rng.max, buf, 1024);
+        s = sdscatprintf(s, " %s %s", n->rng.maxExclusive ? "<" : "<=", buf);
+      }
+      break;
+    case PRED_IN:
+      s = sdscatprintf(s, "$%d IN (", n->propId + 1);
+      for (int i = 0; i < n->in.numvals; i++) {
+        SIValue_ToString(n->in.vals[i], buf, 1024);
+        s = sdscatprintf(s, "%s%s", buf, i < n->in.numvals - 1 ? ", " : "");
+      }
+      s = sdscat(s, ")");
+      break;
+    case PRED_ISNULL:
+      s = sdscatprintf(s, "$%d IS NULL", n->propId + 1);
+      break;
+    case PRED_LIKE:
+      SIValue_ToString(n->like.pattern, buf, 1024);
+      s = sdscatprintf(s, "$%d %sLIKE %s", n->propId + 1,
+                       n->like.negated ? "NOT " : "", buf);
+      break;
+  }
+  return s;
+}
+
+sds SIQueryNode_ToString(SIQueryNode *n, sds s) {
+  if (!n || n->type & QN_PASSTHRU) {
+    return sdscat(s, "TRUE");
+  }
+  if (n->type == QN_PRED) {
+    return qpredicateNode_ToString(&n->pred, s);
+  }
+
+  // passthru children of logic nodes have already been consumed by the scan
+  if (n->op.left->type & QN_PASSTHRU) {
+    return SIQueryNode_ToString(n->op.right, s);
+  } else if (n->op.right->type & QN_PASSTHRU) {
+    return SIQueryNode_ToString(n->op.left, s);
+  }
+  s = sdscat(s, "(");
+  s = SIQueryNode_ToString(n->op.left, s);
+  s = sdscat(s, n->op.op == OP_AND ? " AND " : " OR ");
+  s = SIQueryNode_ToString(n->op.right, s);
+  return sdscat(s, ")");
+}
@@ -1,11 +1,12 @@
 #include "query_plan.h"
 #include "rmutil/vector.h"
 #include <stdio.h>
+#include <math.h>
 #include "rmutil/alloc.h"
 
-/* Get the most relevant predicate for the current leftmost property id. Returns
- * NULL if no such predicate exists */
-SIPredicate *getPredicate(SIQueryNode *node, int propId) {
+/* Get the most relevant predicate node for the current leftmost property id.
+ * Returns NULL if no such predicate exists */
+SIQueryNode *getPredicate(SIQueryNode *node, int propId) {
   if (!node || node->type & QN_PASSTHRU) {
     return NULL;
   }
@@ -15,13 +16,13 @@ SIPredicate *getPredicate(SIQueryNode *node, int propId) {
     // filter tree
     if (node->pred.propId == propId) {
       node->type |= QN_PASSTHRU;
-      return &node->pred;
+      return node;
     }
     break;
   case QN_LOGIC:
     // we only use AND nodes in building scan ranges
     if (node->op.op == OP_AND) {
-      SIPredicate *p = getPredicate(node->op.left, propId);
+      SIQueryNode *p = getPredicate(node->op.left, propId);
 
       // no predicate from the left node means it's probably a passthru
       // so let's try the right now
@@ -75,6 +76,21 @@ siPlanRangeKey *predicateToRanges(SIPredicate *pred, size_t *numRanges,
     break;
   }
 
+  case PRED_NE: {
+    // the two complementary ranges on both sides of the value
+    static SIValue negInf = {.type = T_NEGINF}, inf = {.type = T_INF};
+    ret = calloc(2, sizeof(siPlanRangeKey));
+    *numRanges = 2;
+    ret[0].min = &negInf;
+    ret[0].max = &pred->ne.v;
+    ret[0].maxExclusive = 1;
+    ret[1].min = &pred->ne.v;
+    ret[1].max = &inf;
+    ret[1].minExclusive = 1;
+    *isLast = 1;
+    break;
+  }
+
   case PRED_IN: {
     ret = calloc(pred->in.numvals, sizeof(siPlanRangeKey));
     *numRanges = pred->in.numvals;
@@ -93,26 +109,35 @@ siPlanRangeKey *predicateToRanges(SIPredicate *pred, size_t *numRanges,
   return ret;
 }
 
+/* Build the cartesian product of all the range keys into scan ranges. The first
+ * skip columns of each range are left as placeholders to be filled during a
+ * skip scan */
 void buildKey(siPlanRangeKey **keys, size_t *keyNums, size_t *stack,
-              int numKeys, int keyIdx, Vector *result) {
+              int numKeys, int keyIdx, int skip, Vector *result) {
   // if possible - recursive reentry into the next level
   if (keyIdx < numKeys) {
     for (int i = 0; i < keyNums[keyIdx]; i++) {
       stack[keyIdx] = i;
-      buildKey(keys, keyNums, stack, numKeys, keyIdx + 1, result);
+      buildKey(keys, keyNums, stack, numKeys, keyIdx + 1, skip, result);
     }
     return;
   }
 
   // if not - we're at the end, let's build the scan range up until here
   siPlanRange *rng = malloc(sizeof(siPlanRange));
-  rng->min = malloc(sizeof(SIMultiKey) + numKeys * sizeof(SIValue));
-  rng->min->size = numKeys;
-  rng->max = malloc(sizeof(SIMultiKey) + numKeys * sizeof(SIValue));
-  rng->max->size = numKeys;
+  rng->min = malloc(sizeof(SIMultiKey) + (skip + numKeys) * sizeof(SIValue));
+  rng->min->size = skip + numKeys;
+  rng->max = malloc(sizeof(SIMultiKey) + (skip + numKeys) * sizeof(SIValue));
+  rng->max->size = skip + numKeys;
+  rng->minExclusive = 0;
+  rng->maxExclusive = 0;
+  for (int i = 0; i < skip; i++) {
+    rng->min->keys[i] = SI_NegativeInfVal();
+    rng->max->keys[i] = SI_InfVal();
+  }
   for (int i = 0; i < numKeys; i++) {
-    rng->min->keys[i] = SIValue_Copy(*keys[i][stack[i]].min);
-    rng->max->keys[i] = SIValue_Copy(*keys[i][stack[i]].max);
+    rng->min->keys[skip + i] = SIValue_Copy(*keys[i][stack[i]].min);
+    rng->max->keys[skip + i] = SIValue_Copy(*keys[i][stack[i]].max);
     rng->minExclusive = keys[i][stack[i]].minExclusive;
     rng->maxExclusive = keys[i][stack[i]].maxExclusive;
   }
@@ -147,60 +172,187 @@ void cleanQueryNode(SIQueryNode **pn) {
   }
 }
 
-SIQueryPlan *SI_BuildQueryPlan(SIQuery *q, SISpec *spec) {
-  printf("spec %p\n", spec);
-  siPlanRangeKey *keys[q->numPredicates];
-  memset(keys, 0, q->numPredicates * sizeof(siPlanRangeKey *));
-  size_t keyNums[q->numPredicates];
+/* Estimate the fraction of records a (residual) query tree lets through */
+double estimateSelectivity(SIQueryNode *n, SIIndexStats *stats) {
+  if (!n || n->type & QN_PASSTHRU) {
+    return 1;
+  }
+  if (n->type == QN_PRED) {
+    return SIIndexStats_Selectivity(stats, &n->pred);
+  }
+  double l = estimateSelectivity(n->op.left, stats);
+  double r = estimateSelectivity(n->op.right, stats);
+  return n->op.op == OP_AND ? l * r : l + r - l * r;
+}
 
-  // extract an array of all key ranges we need to traverse from this tree
-  int propId = 0;
-  SIPredicate *pred = NULL;
+/* Find the LIKE predicate with the fewest trigram candidates among the ANDed
+ * predicates of a query. Returns NULL if no trigram index can serve any */
+SIQueryNode *getTrigramPredicate(SIQueryNode *node, SISpec *spec,
+                                 SITrigramIndex **trigrams, long *candidates) {
+  if (!node || node->type & QN_PASSTHRU) {
+    return NULL;
+  }
+  if (node->type == QN_PRED) {
+    SIPredicate *pred = &node->pred;
+    if (pred->t != PRED_LIKE || pred->like.negated || pred->propId < 0 ||
+        pred->propId >= spec->numProps || !trigrams[pred->propId]) {
+      return NULL;
+    }
+    *candidates = SITrigramIndex_EstimateCandidates(
+        trigrams[pred->propId], &pred->like.pattern.stringval);
+    return *candidates >= 0 ? node : NULL;
+  }
+  if (node->type != QN_LOGIC || node->op.op != OP_AND) {
+    return NULL;
+  }
+
+  long lc = 0, rc = 0;
+  SIQueryNode *l = getTrigramPredicate(node->op.left, spec, trigrams, &lc);
+  SIQueryNode *r = getTrigramPredicate(node->op.right, spec, trigrams, &rc);
+  if (l && (!r || lc <= rc)) {
+    *candidates = lc;
+    return l;
+  }
+  *candidates = rc;
+  return r;
+}
+
+SIQueryPlan *SI_BuildQueryPlan(SIQuery *q, SISpec *spec, SIIndexStats *stats,
+                               SITrigramIndex **trigrams) {
+  SIQuery_Collate(q, spec);
 
-  while (propId < spec->numProps &&
-         NULL != (pred = getPredicate(q->root, propId))) {
+  siPlanRangeKey *keys[spec->numProps];
+  memset(keys, 0, spec->numProps * sizeof(siPlanRangeKey *));
+  size_t keyNums[spec->numProps];
+  SIQueryNode *nodes[spec->numProps];
+
+  // if there is no predicate on the first column, we can only skip scan over
+  // the following ones - and we need stats to know if it's worth it
+  int skip = 0;
+  if (stats && spec->numProps > 1 && q->root &&
+      !(q->root->type & QN_PASSTHRU)) {
+    SIQueryNode *first = getPredicate(q->root, 0);
+    if (first) {
+      first->type &= ~QN_PASSTHRU;
+    } else {
+      skip = 1;
+    }
+  }
+
+  // extract an array of all key ranges we could traverse from this tree,
+  // starting from the leftmost column
+  int numKeys = 0;
+  SIQueryNode *pn = NULL;
+  while (skip + numKeys < spec->numProps &&
+         NULL != (pn = getPredicate(q->root, skip + numKeys))) {
     int isLast = 0;
-    siPlanRangeKey *ka = predicateToRanges(pred, &(keyNums[propId]), &isLast);
+    siPlanRangeKey *ka =
+        predicateToRanges(&pn->pred, &(keyNums[numKeys]), &isLast);
     if (!ka) {
-      keys[propId] = NULL;
+      pn->type &= ~QN_PASSTHRU;
       break;
     }
-
-    keys[propId++] = ka;
+    nodes[numKeys] = pn;
+    keys[numKeys++] = ka;
 
     if (isLast) {
       break;
     }
   }
 
-  // we couldn't compose a single scan range... let's disqualify the query
-  if (propId == 0) {
-    return NULL;
+  // decide how many of the key columns we turn into scan ranges. Without
+  // stats we take as many as we can, as long as the cartesian product of the
+  // ranges is not too big
+  double numRows = stats ? stats->numRows : 0;
+  double seekCost = log2(numRows + 2);
+  double multiplier = skip ? SIIndexStats_Distinct(stats, 0) : 1;
+  int useKeys = 0;
+  double bestCost = numRows + seekCost;
+  double ranges = 1, sel = 1, usedSel = 1;
+  for (int i = 0; i < numKeys; i++) {
+    ranges *= keyNums[i];
+    if (ranges > SI_PLAN_MAX_RANGES) {
+      break;
+    }
+    if (!stats) {
+      useKeys = i + 1;
+      continue;
+    }
+    sel *= SIIndexStats_Selectivity(stats, &nodes[i]->pred);
+    double cost = multiplier * ranges * seekCost + numRows * sel;
+    if (cost < bestCost) {
+      bestCost = cost;
+      usedSel = sel;
+      useKeys = i + 1;
+    }
   }
 
-  // convert this array into a list of ranges that is basically the cartesian
-  // product of all the possible keys
-  Vector *scanKeys = NewVector(siPlanRange *, q->numPredicates);
-  size_t stack[propId];
-  buildKey(keys, keyNums, stack, propId, 0, scanKeys);
+  // a LIKE pattern on a column with a trigram index might be cheaper to answer
+  // by verifying the ids that contain all of its trigrams
+  long candidates = 0;
+  SIQueryNode *like =
+      trigrams ? getTrigramPredicate(q->root, spec, trigrams, &candidates)
+               : NULL;
+  if (like) {
+    double cost = candidates * SI_PLAN_TRIGRAM_CANDIDATE_COST;
+    if (stats ? cost < bestCost : useKeys == 0) {
+      bestCost = cost;
+      usedSel = 1;
+      useKeys = 0;
+    } else {
+      like = NULL;
+    }
+  }
+
+  // the predicates we do not use for scan ranges are evaluated as filters
+  for (int i = useKeys; i < numKeys; i++) {
+    nodes[i]->type &= ~QN_PASSTHRU;
+  }
 
   SIQueryPlan *pln = malloc(sizeof(SIQueryPlan));
+  Vector *scanKeys = NewVector(siPlanRange *, q->numPredicates);
+  if (useKeys) {
+    // convert the keys into a list of ranges that is basically the cartesian
+    // product of all the possible keys
+    size_t stack[useKeys];
+    buildKey(keys, keyNums, stack, useKeys, 0, skip, scanKeys);
+    pln->strategy = skip ? QP_SKIPSCAN : QP_RANGE;
+  } else if (like) {
+    // no scan ranges, the LIKE predicate stays in the filter tree to verify the
+    // candidates
+    pln->strategy = QP_TRIGRAM;
+  } else {
+    // a full scan is a single range from -inf with no upper bound, so records
+    // with NULL values are also included
+    siPlanRange *rng = malloc(sizeof(siPlanRange));
+    rng->min = malloc(sizeof(SIMultiKey) + sizeof(SIValue));
+    rng->min->size = 1;
+    rng->min->keys[0] = SI_NegativeInfVal();
+    rng->max = NULL;
+    rng->minExclusive = 0;
+    rng->maxExclusive = 0;
+    Vector_Push(scanKeys, rng);
+    pln->strategy = QP_FULLSCAN;
+  }
+  pln->cost = bestCost;
+  pln->trigramPred = like ? &like->pred : NULL;
+
   if (q->root->type & QN_PASSTHRU) {
     pln->filterTree = NULL;
   } else {
-    SIQueryNode_Print(q->root, 0);
     cleanQueryNode(&q->root);
-    pln->filterTree = q->root;
+    pln->filterTree = q->root->type & QN_PASSTHRU ? NULL : q->root;
   }
 
+  pln->estimatedRows =
+      numRows * usedSel * estimateSelectivity(pln->filterTree, stats);
+
   // copy the ranges from the vector
   pln->ranges = scanKeys;
   pln->numRanges = Vector_Size(scanKeys);
 
-  for (int i = 0; i < q->numPredicates; i++) {
-    if (keys[i] != NULL) {
-      free(keys[i]);
-    }
+  for (int i = 0; i < numKeys; i++) {
+    free(keys[i]);
   }
 
   return pln;
@@ -211,6 +363,11 @@ void SIQueryPlan_Free(SIQueryPlan *plan) {
     siPlanRange *rng = NULL;
     for (int i = 0; i < plan->numRanges; i++) {
       Vector_Get(plan->ranges, i, &rng);
+      // skip scan placeholders hold values borrowed from the index
+      if (plan->strategy == QP_SKIPSCAN) {
+        rng->min->keys[0] = SI_NullVal();
+        rng->max->keys[0] = SI_NullVal();
+      }
       if (rng->min) {
         SIMultiKey_Free(rng->min);
       }
@@ -225,4 +382,23 @@ void SIQueryPlan_Free(SIQueryPlan *plan) {
   }
 
   free(plan);
-}
\ No newline at end of file
+}
+
+sds SIPlanRange_ToString(siPlanRange *rng, sds s) {
+  char buf[1024];
+  s = sdscat(s, rng->minExclusive ? "(" : "[");
+  for (int i = 0; i < rng->min->size; i++) {
+    SIValue_ToString(rng->min->keys[i], buf, 1024);
+    s = sdscatprintf(s, "%s%s", buf, i < rng->min->size - 1 ? "::" : "");
+  }
+  s = sdscat(s, ", ");
+  // a NULL max means the range is open ended
+  if (!rng->max) {
+    s = sdscat(s, "+inf");
+  }
+  for (int i = 0; rng->max && i < rng->max->size; i++) {
+    SIValue_ToString(rng->max->keys[i], buf, 1024);
+    s = sdscatprintf(s, "%s%s", buf, i < rng->max->size - 1 ? "::" : "");
+  }
+  return sdscat(s, rng->maxExclusive ? ")" : "]");
+}
@@ -1,9 +1,34 @@
 #ifndef __SI_QUERY_PLAN
+#define __SI_QUERY_PLAN
 
 #include "key.h"
 #include "query.h"
 #include "index.h"
+#include "stats.h"
+#include "trigram.h"
 #include "rmutil/vector.h"
+#include "rmutil/sds.h"
+
+/* The maximal number of scan ranges we allow a plan to expand to when taking
+ * the cartesian product of IN predicates. Above that we stop extending the
+ * range prefix and filter the rest of the predicates */
+#define SI_PLAN_MAX_RANGES 1024
+
+/* The relative cost of looking up and verifying a single trigram candidate,
+ * compared to visiting an index node in a scan */
+#define SI_PLAN_TRIGRAM_CANDIDATE_COST 2
+
+typedef enum {
+  // scan ranges on a prefix of the index columns, filtering the rest
+  QP_RANGE,
+  // scan ranges on the columns following the first one, for every distinct
+  // value of the first column
+  QP_SKIPSCAN,
+  // scan the entire index, filtering every record
+  QP_FULLSCAN,
+  // filter the ids whose values contain the trigrams of a LIKE pattern
+  QP_TRIGRAM,
+} SIPlanStrategy;
 
 typedef struct {
   SIMultiKey *min;
@@ -24,20 +49,36 @@ typedef struct {
 * It includes at least one range and 0 or more filters that are matched on each
 * iteration of the ranges
 */
-typedef struct {
+typedef struct siQueryPlan {
   Vector *ranges;
   int numRanges;
 
   SIQueryNode *filterTree;
 
+  SIPlanStrategy strategy;
+  // for trigram plans - the LIKE predicate in the filter tree to get the
+  // candidate ids for
+  SIPredicate *trigramPred;
+  // the estimated number of rows the plan will return, and its relative cost
+  double estimatedRows;
+  double cost;
 } SIQueryPlan;
 
 /*
 * Build a query plan from a parsed/composed query tree.
-* Returns 1 if successful, 0 if an error occured
+* If stats are given, they are used to choose between a range scan, a skip scan
+* and a full scan, and how many prefix columns to turn into scan ranges.
+* If trigrams is given, it holds the trigram index of each column or NULL, and
+* LIKE predicates on those columns can be answered from their trigram index.
+* Returns NULL if an error occured
 */
-SIQueryPlan *SI_BuildQueryPlan(SIQuery *q, SISpec *spec);
+SIQueryPlan *SI_BuildQueryPlan(SIQuery *q, SISpec *spec, SIIndexStats *stats,
+                               SITrigramIndex **trigrams);
 
 void SIQueryPlan_Free(SIQueryPlan *plan);
 
+/* Append a human readable description of a scan range to s, in interval
+ * notation. e.g. ["foo"::1, "foo"::+inf) */
+sds SIPlanRange_ToString(siPlanRange *rng, sds s);
+
 #endif
@@ -58,6 +58,26 @@
 #define REDISMODULE_HASH_CFIELDS (1 << 2)
 #define REDISMODULE_HASH_EXISTS (1 << 3)
 
+/* Context flags, as returned by RedisModule_GetContextFlags() */
+#define REDISMODULE_CTX_FLAGS_LUA (1 << 0)   /* running in a Lua script */
+#define REDISMODULE_CTX_FLAGS_MULTI (1 << 1) /* running in a transaction */
+
+/* Keyspace changes notification classes. Every class is associated with a
+ * character for configuration purposes. */
+#define REDISMODULE_NOTIFY_GENERIC (1 << 2) /* g */
+#define REDISMODULE_NOTIFY_STRING (1 << 3)  /* $ */
+#define REDISMODULE_NOTIFY_LIST (1 << 4)    /* l */
+#define REDISMODULE_NOTIFY_SET (1 << 5)     /* s */
+#define REDISMODULE_NOTIFY_HASH (1 << 6)    /* h */
+#define REDISMODULE_NOTIFY_ZSET (1 << 7)    /* z */
+#define REDISMODULE_NOTIFY_EXPIRED (1 << 8) /* x */
+#define REDISMODULE_NOTIFY_EVICTED (1 << 9) /* e */
+#define REDISMODULE_NOTIFY_ALL                                      \
+  (REDISMODULE_NOTIFY_GENERIC | REDISMODULE_NOTIFY_STRING |         \
+   REDISMODULE_NOTIFY_LIST | REDISMODULE_NOTIFY_SET |               \
+   REDISMODULE_NOTIFY_HASH | REDISMODULE_NOTIFY_ZSET |              \
+   REDISMODULE_NOTIFY_EXPIRED | REDISMODULE_NOTIFY_EVICTED) /* A */
+
 /* A special pointer that we can use between the core and the module to signal
  * field deletion, and that is impossible to be a valid pointer. */
 #define REDISMODULE_HASH_DELETE ((RedisModuleString *)(long)1)
@@ -95,6 +115,12 @@ typedef void (*RedisModuleTypeDigestFunc)(RedisModuleDigest *digest,
                                           void *value);
 typedef void (*RedisModuleTypeFreeFunc)(void *value);
 
+typedef struct RedisModuleBlockedClient RedisModuleBlockedClient;
+
+typedef int (*RedisModuleNotificationFunc)(RedisModuleCtx *ctx, int type,
+                                           const char *event,
+                                           RedisModuleString *key);
+
 #define REDISMODULE_GET_API(name) \
   RedisModule_GetApi("RedisModule_" #name, ((void **)&RedisModule_##name))
 
@@ -285,6 +311,34 @@ int REDISMODULE_API_FUNC(RedisModule_StringCompare)(RedisModuleString *a,
 RedisModuleCtx *REDISMODULE_API_FUNC(RedisModule_GetContextFromIO)(
     RedisModuleIO *io);
 
+/* Experimental APIs */
+#ifdef REDISMODULE_EXPERIMENTAL_API
+RedisModuleBlockedClient *REDISMODULE_API_FUNC(RedisModule_BlockClient)(
+    RedisModuleCtx *ctx, RedisModuleCmdFunc reply_callback,
+    RedisModuleCmdFunc timeout_callback, void (*free_privdata)(void *),
+    long long timeout_ms);
+int REDISMODULE_API_FUNC(RedisModule_UnblockClient)(
+    RedisModuleBlockedClient *bc, void *privdata);
+int REDISMODULE_API_FUNC(RedisModule_IsBlockedReplyRequest)(
+    RedisModuleCtx *ctx);
+int REDISMODULE_API_FUNC(RedisModule_IsBlockedTimeoutRequest)(
+    RedisModuleCtx *ctx);
+void *REDISMODULE_API_FUNC(RedisModule_GetBlockedClientPrivateData)(
+    RedisModuleCtx *ctx);
+int REDISMODULE_API_FUNC(RedisModule_AbortBlock)(RedisModuleBlockedClient *bc);
+RedisModuleCtx *REDISMODULE_API_FUNC(RedisModule_GetThreadSafeContext)(
+    RedisModuleBlockedClient *bc);
+void REDISMODULE_API_FUNC(RedisModule_FreeThreadSafeContext)(
+    RedisModuleCtx *ctx);
+void REDISMODULE_API_FUNC(RedisModule_ThreadSafeContextLock)(
+    RedisModuleCtx *ctx);
+void REDISMODULE_API_FUNC(RedisModule_ThreadSafeContextUnlock)(
+    RedisModuleCtx *ctx);
+int REDISMODULE_API_FUNC(RedisModule_SubscribeToKeyspaceEvents)(
+    RedisModuleCtx *ctx, int types, RedisModuleNotificationFunc cb);
+int REDISMODULE_API_FUNC(RedisModule_GetContextFlags)(RedisModuleCtx *ctx);
+#endif
+
 /* This is included inline inside each Redis module. */
 static int RedisModule_Init(RedisModuleCtx *ctx, const char *name, int ver,
                             int apiver) __attribute__((unused));
@@ -390,6 +444,21 @@ static int RedisModule_Init(RedisModuleCtx *ctx, const char *name, int ver,
   REDISMODULE_GET_API(GetContextFromIO);
   //    REDISMODULE_GET_API(FreeIOContext);
 
+#ifdef REDISMODULE_EXPERIMENTAL_API
+  REDISMODULE_GET_API(BlockClient);
+  REDISMODULE_GET_API(UnblockClient);
+  REDISMODULE_GET_API(IsBlockedReplyRequest);
+  REDISMODULE_GET_API(IsBlockedTimeoutRequest);
+  REDISMODULE_GET_API(GetBlockedClientPrivateData);
+  REDISMODULE_GET_API(AbortBlock);
+  REDISMODULE_GET_API(GetThreadSafeContext);
+  REDISMODULE_GET_API(FreeThreadSafeContext);
+  REDISMODULE_GET_API(ThreadSafeContextLock);
+  REDISMODULE_GET_API(ThreadSafeContextUnlock);
+  REDISMODULE_GET_API(SubscribeToKeyspaceEvents);
+  REDISMODULE_GET_API(GetContextFlags);
+#endif
+
   RedisModule_SetModuleAttribs(ctx, name, ver, apiver);
   return REDISMODULE_OK;
 }
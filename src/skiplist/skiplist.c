@@ -46,6 +46,7 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <stdio.h>
+#include <string.h>
 
 #define zmalloc malloc
 #define zfree free
@@ -69,18 +70,38 @@ skiplistNode *skiplistCreateNode(int level, void *obj, void *val) {
   return zn;
 }
 
+/* Find the position of a value in a node's sorted value list. Returns the
+ * offset of the first value not lower than val */
+static unsigned int skiplistNodeFindValue(skiplistNode *n, void *val,
+                                          skiplistValCmpFunc cmp) {
+  unsigned int lo = 0, hi = n->numVals;
+  while (lo < hi) {
+    unsigned int mid = (lo + hi) / 2;
+    if (cmp(n->vals[mid], val) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Add a value to the node, keeping the values sorted so iterations over them
+ * can be resumed. Returns NULL if the value already exists in the node */
 skiplistNode *skiplistNodeAppendValue(skiplistNode *n, void *val,
                                       skiplistValCmpFunc cmp) {
 
   // prevent insertion of duplicate vals (ids) to the same key
-  for (int i = 0; i < n->numVals; i++) {
-    if (!cmp(n->vals[i], val)) {
-      return NULL;
-    }
+  unsigned int pos = skiplistNodeFindValue(n, val, cmp);
+  if (pos < n->numVals && !cmp(n->vals[pos], val)) {
+    return NULL;
   }
 
   n->vals = realloc(n->vals, ++n->numVals * sizeof(void *));
-  n->vals[n->numVals - 1] = val;
+  memmove(&n->vals[pos + 1], &n->vals[pos],
+          (n->numVals - pos - 1) * sizeof(void *));
+  n->vals[pos] = val;
+  return n;
 }
 
 /* Create a new skip list with the specified function used in order to
@@ -104,6 +125,7 @@ skiplist *skiplistCreate(skiplistCmpFunc cmp, void *cmpCtx,
   sl->compare = cmp;
   sl->cmpCtx = cmpCtx;
   sl->valcmp = vcmp;
+  sl->fingerValid = 0;
 
   return sl;
 }
@@ -139,33 +161,86 @@ int skiplistRandomLevel(void) {
   return (level < SKIPLIST_MAXLEVEL) ? level : SKIPLIST_MAXLEVEL;
 }
 
-/* Insert the specified object, return NULL if the element already
- * exists. */
-skiplistNode *skiplistInsert(skiplist *sl, void *obj, void *val) {
-  skiplistNode *update[SKIPLIST_MAXLEVEL], *x;
-  unsigned int rank[SKIPLIST_MAXLEVEL];
-  int i, level;
+/* Find the last node lower than obj at each level, and its rank. If the
+ * finger of the last insert is lower than obj, we climb from the bottom level
+ * until the finger's successor is not lower than obj - the finger is the
+ * insert position from that level up - and only descend from there. Inserting
+ * ascending keys takes O(1) comparisons on average this way, instead of
+ * O(log N). Returns the finger's node if it is equal to obj */
+static skiplistNode *skiplistFindInsertPos(skiplist *sl, void *obj,
+                                           skiplistNode **update,
+                                           unsigned int *rank) {
+  skiplistNode *x = sl->header;
+  unsigned int r = 0;
+  int i, top = sl->level;
+  int useFinger = 0;
+
+  if (sl->fingerValid) {
+    int c = sl->finger[0] == sl->header
+                ? -1
+                : sl->compare(sl->finger[0]->obj, obj, sl->cmpCtx);
+    if (c == 0) {
+      return sl->finger[0];
+    }
+    useFinger = c < 0;
+  }
 
-  x = sl->header;
-  for (i = sl->level - 1; i >= 0; i--) {
+  if (useFinger) {
+    for (top = 0; top < sl->level; top++) {
+      skiplistNode *next = sl->finger[top]->level[top].forward;
+      if (!next || sl->compare(next->obj, obj, sl->cmpCtx) >= 0) {
+        break;
+      }
+    }
+    for (i = sl->level - 1; i >= top; i--) {
+      update[i] = sl->finger[i];
+      rank[i] = sl->fingerRank[i];
+    }
+    if (top < sl->level) {
+      x = sl->finger[top];
+      r = sl->fingerRank[top];
+    }
+  }
+
+  for (i = top - 1; i >= 0; i--) {
+    // the finger may already be further ahead than the node we descended to
+    if (useFinger && sl->fingerRank[i] > r) {
+      x = sl->finger[i];
+      r = sl->fingerRank[i];
+    }
     /* store rank that is crossed to reach the insert position */
-    rank[i] = i == (sl->level - 1) ? 0 : rank[i + 1];
     while (x->level[i].forward &&
            sl->compare(x->level[i].forward->obj, obj, sl->cmpCtx) < 0) {
-      rank[i] += x->level[i].span;
+      r += x->level[i].span;
       x = x->level[i].forward;
     }
     update[i] = x;
+    rank[i] = r;
   }
+  return NULL;
+}
 
-  /* If the element is already inside, append the value to the element. */
-  if (x->level[0].forward &&
-      sl->compare(x->level[0].forward->obj, obj, sl->cmpCtx) == 0) {
-    return skiplistNodeAppendValue(x->level[0].forward, val, sl->valcmp);
+/* Keep the position of the node we've just inserted into, for the next insert.
+ * At each level the finger is the node itself or the last node before it */
+static void skiplistSetFinger(skiplist *sl, skiplistNode *n,
+                              skiplistNode **update, unsigned int *rank) {
+  for (int i = 0; i < sl->level; i++) {
+    if (update[i]->level[i].forward == n) {
+      sl->finger[i] = n;
+      sl->fingerRank[i] = rank[0] + 1;
+    } else {
+      sl->finger[i] = update[i];
+      sl->fingerRank[i] = rank[i];
+    }
   }
+  sl->fingerValid = 1;
+}
 
-  /* Add a new node with a random number of levels. */
-  level = skiplistRandomLevel();
+/* Link a node with the given number of levels at the insert position found
+ * by skiplistFindInsertPos */
+static void skiplistLinkNode(skiplist *sl, skiplistNode *x, int level,
+                             skiplistNode **update, unsigned int *rank) {
+  int i;
   if (level > sl->level) {
     for (i = sl->level; i < level; i++) {
       rank[i] = 0;
@@ -174,7 +249,6 @@ skiplistNode *skiplistInsert(skiplist *sl, void *obj, void *val) {
     }
     sl->level = level;
   }
-  x = skiplistCreateNode(level, obj, val);
   for (i = 0; i < level; i++) {
     x->level[i].forward = update[i]->level[i].forward;
     update[i]->level[i].forward = x;
@@ -195,6 +269,33 @@ skiplistNode *skiplistInsert(skiplist *sl, void *obj, void *val) {
   else
     sl->tail = x;
   sl->length++;
+  skiplistSetFinger(sl, x, update, rank);
+}
+
+/* Insert the specified object, return NULL if the element already
+ * exists. */
+skiplistNode *skiplistInsert(skiplist *sl, void *obj, void *val) {
+  skiplistNode *update[SKIPLIST_MAXLEVEL], *x;
+  unsigned int rank[SKIPLIST_MAXLEVEL];
+  int level;
+
+  x = skiplistFindInsertPos(sl, obj, update, rank);
+  if (x) {
+    return skiplistNodeAppendValue(x, val, sl->valcmp);
+  }
+  x = update[0];
+
+  /* If the element is already inside, append the value to the element. */
+  if (x->level[0].forward &&
+      sl->compare(x->level[0].forward->obj, obj, sl->cmpCtx) == 0) {
+    skiplistSetFinger(sl, x->level[0].forward, update, rank);
+    return skiplistNodeAppendValue(x->level[0].forward, val, sl->valcmp);
+  }
+
+  /* Add a new node with a random number of levels. */
+  level = skiplistRandomLevel();
+  x = skiplistCreateNode(level, obj, val);
+  skiplistLinkNode(sl, x, level, update, rank);
   return x;
 }
 
@@ -219,10 +320,27 @@ void skiplistDeleteNode(skiplist *sl, skiplistNode *x, skiplistNode **update) {
   while (sl->level > 1 && sl->header->level[sl->level - 1].forward == NULL)
     sl->level--;
   sl->length--;
+  sl->fingerValid = 0;
 }
 
-/* Delete an element from the skiplist. If the element was found and deleted
- * 1 is returned, otherwise if the element was not there, 0 is returned. */
+/* Remove a value from a node, keeping the rest sorted. Returns 1 if it was
+ * there */
+static int skiplistNodeRemoveValue(skiplistNode *x, void *val,
+                                   skiplistValCmpFunc cmp) {
+  unsigned int i = skiplistNodeFindValue(x, val, cmp);
+  if (i < x->numVals && !cmp(val, x->vals[i])) {
+    memmove(&x->vals[i], &x->vals[i + 1],
+            (x->numVals - i - 1) * sizeof(void *));
+    x->numVals--;
+    return 1;
+  }
+  return 0;
+}
+
+/* Delete an element from the skiplist. If the element was not there,
+ * SKIPLIST_NOTFOUND is returned. If it was found, SKIPLIST_DELETED_VAL is
+ * returned, or SKIPLIST_DELETED_NODE if the node was removed as it has no more
+ * values left. */
 int skiplistDelete(skiplist *sl, void *obj, void *val) {
   skiplistNode *update[SKIPLIST_MAXLEVEL], *x;
   int i;
@@ -238,29 +356,66 @@ int skiplistDelete(skiplist *sl, void *obj, void *val) {
   x = x->level[0].forward;
   if (x && sl->compare(x->obj, obj, sl->cmpCtx) == 0) {
 
-    if (val) {
-      // try to delete the value itself from the vallist
-      for (int i = 0; i < x->numVals; i++) {
-        // found the value - let's delete it
-        if (!sl->valcmp(val, x->vals[i])) {
-
-          // switch the found value with the top value
-          if (i < x->numVals - 1) {
-            x->vals[i] = x->vals[x->numVals - 1];
-          }
-          x->numVals--;
-          break;
-        }
-      }
+    // try to delete the value itself from the vallist
+    if (val && !skiplistNodeRemoveValue(x, val, sl->valcmp)) {
+      return SKIPLIST_NOTFOUND;
     }
 
     if (!val || x->numVals == 0) {
       skiplistDeleteNode(sl, x, update);
       skiplistFreeNode(x);
+      return SKIPLIST_DELETED_NODE;
     }
-    return 1;
+    return SKIPLIST_DELETED_VAL;
   }
-  return 0; /* not found */
+  return SKIPLIST_NOTFOUND;
+}
+
+/* Remove every node whose key is between min and max, each bound inclusive
+ * unless its exclusive flag is set. A NULL max removes everything from min on.
+ * The skiplist only frees its nodes and their value arrays - the keys and the
+ * values (ids) are passed to cb, which owns freeing them. Returns the number of
+ * nodes removed. */
+unsigned long skiplistDeleteRange(skiplist *sl, void *min, void *max,
+                                  int minExclusive, int maxExclusive,
+                                  skiplistNodeFunc cb, void *ctx) {
+  skiplistNode *update[SKIPLIST_MAXLEVEL], *x;
+  int i;
+
+  x = sl->header;
+  for (i = sl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward) {
+      int rc = sl->compare(x->level[i].forward->obj, min, sl->cmpCtx);
+      if (rc < 0 || (rc == 0 && minExclusive)) {
+        x = x->level[i].forward;
+      } else {
+        break;
+      }
+    }
+    update[i] = x;
+  }
+  x = x->level[0].forward;
+
+  // the predecessors of the first node stay the predecessors of every node
+  // that follows it in the range, once the ones before were removed
+  unsigned long removed = 0;
+  while (x) {
+    if (max) {
+      int rc = sl->compare(x->obj, max, sl->cmpCtx);
+      if (rc > 0 || (rc == 0 && maxExclusive)) {
+        break;
+      }
+    }
+    skiplistNode *next = x->level[0].forward;
+    skiplistDeleteNode(sl, x, update);
+    if (cb) {
+      cb(x, ctx);
+    }
+    skiplistFreeNode(x);
+    removed++;
+    x = next;
+  }
+  return removed;
 }
 
 /* Search for the element in the skip list, if found the
@@ -284,9 +439,125 @@ void *skiplistFind(skiplist *sl, void *obj) {
   }
 }
 
+/* Add val under obj, moving it from oldobj if it's not NULL, while descending
+ * the skiplist as few times as possible. The insert position of obj is found
+ * once, and tells us whether obj is already in the skiplist. If it's not and
+ * val has a node of its own, the node is moved there and takes obj:
+ *
+ * - if the node is next to the insert position, its object is just replaced.
+ * - otherwise it's found with a second descent, unlinked and linked again at
+ *   the insert position, adjusting the update vector for its removal.
+ *
+ * In unique skiplists val is rejected if obj is held by another value.
+ * Returns SKIPLIST_UPSERT_DUPLICATE in that case, SKIPLIST_UPSERT_RELEASED if
+ * no node points to oldobj anymore, or SKIPLIST_UPSERT_OK. If node is not NULL
+ * it's set to the node now holding val, whose object may be an existing object
+ * equal to obj */
+int skiplistUpsert(skiplist *sl, void *obj, void *oldobj, void *val,
+                   int unique, skiplistNode **node) {
+  skiplistNode *update[SKIPLIST_MAXLEVEL], *x;
+  unsigned int rank[SKIPLIST_MAXLEVEL];
+  int rc = SKIPLIST_UPSERT_OK;
+
+  x = skiplistFindInsertPos(sl, obj, update, rank);
+  if (!x && update[0]->level[0].forward &&
+      sl->compare(update[0]->level[0].forward->obj, obj, sl->cmpCtx) == 0) {
+    x = update[0]->level[0].forward;
+  }
+
+  // obj is already in the skiplist - attach val to its node
+  if (x) {
+    unsigned int pos = skiplistNodeFindValue(x, val, sl->valcmp);
+    if (pos < x->numVals && !sl->valcmp(x->vals[pos], val)) {
+      if (node) *node = x;
+      return SKIPLIST_UPSERT_OK;
+    }
+    if (unique && x->numVals > 0) {
+      return SKIPLIST_UPSERT_DUPLICATE;
+    }
+    if (oldobj &&
+        skiplistDelete(sl, oldobj, val) == SKIPLIST_DELETED_NODE) {
+      rc = SKIPLIST_UPSERT_RELEASED;
+    }
+    skiplistNodeAppendValue(x, val, sl->valcmp);
+    if (node) *node = x;
+    return rc;
+  }
+
+  // the node of val is right before or after the insert position, so it
+  // doesn't need to move
+  skiplistNode *old = NULL;
+  if (oldobj) {
+    if (update[0] != sl->header && update[0]->obj == oldobj) {
+      old = update[0];
+    } else if (update[0]->level[0].forward &&
+               update[0]->level[0].forward->obj == oldobj) {
+      old = update[0]->level[0].forward;
+    }
+  }
+  if (old && old->numVals == 1 && !sl->valcmp(old->vals[0], val)) {
+    old->obj = obj;
+    if (node) *node = old;
+    return SKIPLIST_UPSERT_RELEASED;
+  }
+
+  if (oldobj) {
+    skiplistNode *oldUpdate[SKIPLIST_MAXLEVEL];
+    unsigned int oldRank[SKIPLIST_MAXLEVEL];
+    unsigned int r = 0;
+    old = sl->header;
+    for (int i = sl->level - 1; i >= 0; i--) {
+      while (old->level[i].forward &&
+             sl->compare(old->level[i].forward->obj, oldobj, sl->cmpCtx) < 0) {
+        r += old->level[i].span;
+        old = old->level[i].forward;
+      }
+      oldUpdate[i] = old;
+      oldRank[i] = r;
+    }
+    old = old->level[0].forward;
+
+    if (old && sl->compare(old->obj, oldobj, sl->cmpCtx) == 0 &&
+        skiplistNodeRemoveValue(old, val, sl->valcmp) && old->numVals == 0) {
+      int level = 0;
+      while (level < sl->level &&
+             oldUpdate[level]->level[level].forward == old) {
+        level++;
+      }
+      int slLevel = sl->level;
+      skiplistDeleteNode(sl, old, oldUpdate);
+
+      // the insert position's predecessors lose the node, and the ones after
+      // it move one rank back
+      for (int i = 0; i < slLevel; i++) {
+        if (update[i] == old) {
+          update[i] = oldUpdate[i];
+          rank[i] = oldRank[i];
+        } else if (rank[i] > r) {
+          rank[i]--;
+        }
+      }
+
+      old->obj = obj;
+      old->vals[old->numVals++] = val;
+      skiplistLinkNode(sl, old, level, update, rank);
+      if (node) *node = old;
+      return SKIPLIST_UPSERT_RELEASED;
+    }
+  }
+
+  int level = skiplistRandomLevel();
+  x = skiplistCreateNode(level, obj, val);
+  skiplistLinkNode(sl, x, level, update, rank);
+  if (node) *node = x;
+  return rc;
+}
+
 /* Search for the element in the skip list, if found the
- * node pointer is returned, otherwise the next pointer is returned. */
-void *skiplistFindAtLeast(skiplist *sl, void *obj, int exclusive) {
+ * node pointer is returned, otherwise the next pointer is returned.
+ * The number of comparisons performed is added to numCmps. */
+static void *skiplistFindAtLeast(skiplist *sl, void *obj, int exclusive,
+                                 unsigned long *numCmps) {
   skiplistNode *x;
   int i;
 
@@ -294,6 +565,7 @@ void *skiplistFindAtLeast(skiplist *sl, void *obj, int exclusive) {
   for (i = sl->level - 1; i >= 0; i--) {
     while (x->level[i].forward) {
       int rc = sl->compare(x->level[i].forward->obj, obj, sl->cmpCtx);
+      ++*numCmps;
       if (rc < 0 || (rc == 0 && exclusive)) {
         x = x->level[i].forward;
       } else {
@@ -335,11 +607,13 @@ unsigned long skiplistLength(skiplist *sl) { return sl->length; }
 
 skiplistIterator skiplistIterateRange(skiplist *sl, void *min, void *max,
                                       int minExclusive, int maxExclusive) {
-  skiplistNode *n = skiplistFindAtLeast(sl, min, minExclusive);
+  unsigned long numCmps = 0;
+  skiplistNode *n = skiplistFindAtLeast(sl, min, minExclusive, &numCmps);
   if (n && max) {
 
     // make sure the first item of the range is not already above the range end
     int c = sl->compare(n->obj, max, sl->cmpCtx);
+    numCmps++;
     // TODO: Fix comparisons to work with null functions
     if (c > 0 || (c == 0 && maxExclusive)) {
       n = NULL;
@@ -351,7 +625,40 @@ skiplistIterator skiplistIterateRange(skiplist *sl, void *min, void *max,
                             .rangeMax = max,
                             .maxExclusive = maxExclusive,
                             .currentValOffset = 0,
-                            .sl = sl};
+                            .sl = sl,
+                            .numCmps = numCmps,
+                            .numVisited = n ? 1 : 0};
+}
+
+/* Reposition an iterator on the first node not lower than obj, and in it on the
+ * first value not lower than val, staying within the iterator's range. This is
+ * used to resume an iteration after the skiplist was modified */
+void skiplistIterator_Seek(skiplistIterator *it, void *obj, void *val) {
+  skiplist *sl = it->sl;
+  skiplistNode *n = skiplistFindAtLeast(sl, obj, 0, &it->numCmps);
+  it->currentValOffset = 0;
+  if (n && val) {
+    it->numCmps++;
+    if (sl->compare(n->obj, obj, sl->cmpCtx) == 0) {
+      it->currentValOffset = skiplistNodeFindValue(n, val, sl->valcmp);
+      // all the values of the node were already consumed
+      if (it->currentValOffset == n->numVals) {
+        it->currentValOffset = 0;
+        n = n->level[0].forward;
+      }
+    }
+  }
+  if (n && it->rangeMax) {
+    int c = sl->compare(n->obj, it->rangeMax, sl->cmpCtx);
+    it->numCmps++;
+    if (c > 0 || (c == 0 && it->maxExclusive)) {
+      n = NULL;
+    }
+  }
+  if (n) {
+    it->numVisited++;
+  }
+  it->current = n;
 }
 
 skiplistIterator skiplistIterateAll(skiplist *sl) {
@@ -362,7 +669,9 @@ skiplistIterator skiplistIterateAll(skiplist *sl) {
                             .rangeMax = NULL,
                             .maxExclusive = 0,
                             .sl = sl,
-                            .currentValOffset = 0};
+                            .currentValOffset = 0,
+                            .numCmps = 0,
+                            .numVisited = 0};
 }
 
 skiplistNode *skiplistIteratorCurrent(skiplistIterator *it) {
@@ -382,10 +691,14 @@ void *skiplistIterator_Next(skiplistIterator *it) {
   if (it->currentValOffset == it->current->numVals) {
     it->current = it->current->level[0].forward;
     it->currentValOffset = 0;
+    if (it->current) {
+      it->numVisited++;
+    }
 
     // make sure we don't pass the range max. NULL means +inf
     if (it->current && it->rangeMax) {
       int c = it->sl->compare(it->current->obj, it->rangeMax, it->sl->cmpCtx);
+      it->numCmps++;
       if (c > 0 || (c == 0 && it->maxExclusive)) {
         it->current = NULL;
       }
@@ -34,6 +34,19 @@
 #define SKIPLIST_MAXLEVEL 32 /* Should be enough for 2^32 elements */
 #define SKIPLIST_P 0.25      /* Skiplist P = 1/4 */
 
+/* skiplistDelete return codes */
+#define SKIPLIST_NOTFOUND 0
+#define SKIPLIST_DELETED_VAL 1
+// the node itself was removed, its object can be freed
+#define SKIPLIST_DELETED_NODE 2
+
+/* skiplistUpsert return codes */
+// the key is held by another value of a unique skiplist
+#define SKIPLIST_UPSERT_DUPLICATE 0
+#define SKIPLIST_UPSERT_OK 1
+// the value was moved, and no node points to its old object anymore
+#define SKIPLIST_UPSERT_RELEASED 2
+
 typedef struct skiplistNode {
   void *obj;
   void **vals;
@@ -57,6 +70,13 @@ typedef struct skiplist {
   void *cmpCtx;
   unsigned long length;
   int level;
+
+  // the nodes preceding the last inserted key at each level, and their ranks.
+  // Inserts of ascending keys start searching from there (finger search).
+  // Node deletions invalidate it
+  struct skiplistNode *finger[SKIPLIST_MAXLEVEL];
+  unsigned int fingerRank[SKIPLIST_MAXLEVEL];
+  int fingerValid;
 } skiplist;
 
 skiplist *skiplistCreate(skiplistCmpFunc cmp, void *cmpCtx,
@@ -66,6 +86,19 @@ void skiplistFree(skiplist *sl);
 skiplistNode *skiplistInsert(skiplist *sl, void *obj, void *val);
 int skiplistDelete(skiplist *sl, void *obj, void *val);
 void *skiplistFind(skiplist *sl, void *obj);
+int skiplistUpsert(skiplist *sl, void *obj, void *oldobj, void *val,
+                   int unique, skiplistNode **node);
+
+/* Called on each node removed by skiplistDeleteRange, after it was unlinked
+ * and before it is freed */
+typedef void (*skiplistNodeFunc)(skiplistNode *n, void *ctx);
+
+/* Unlink the contiguous run of nodes in a range in a single pass - one descent
+ * to the start of the range, and constant work per node removed. A NULL max
+ * removes everything from min on. Returns the number of nodes removed */
+unsigned long skiplistDeleteRange(skiplist *sl, void *min, void *max,
+                                  int minExclusive, int maxExclusive,
+                                  skiplistNodeFunc cb, void *ctx);
 void *skiplistPopHead(skiplist *sl);
 void *skiplistPopTail(skiplist *sl);
 unsigned long skiplistLength(skiplist *sl);
@@ -79,11 +112,16 @@ typedef struct {
   int maxExclusive;
   skiplist *sl;
 
+  // the number of comparisons and nodes visited by the iterator so far
+  unsigned long numCmps;
+  unsigned long numVisited;
 } skiplistIterator;
 
 skiplistIterator skiplistIterateRange(skiplist *sl, void *min, void *max,
                                       int minExclusive, int maxExclusive);
 
+void skiplistIterator_Seek(skiplistIterator *it, void *obj, void *val);
+
 skiplistIterator skiplistIterateAll(skiplist *sl);
 void *skiplistIterator_Next(skiplistIterator *it);
 skiplistNode *skiplistIteratorCurrent(skiplistIterator *it);
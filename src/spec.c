@@ -5,7 +5,8 @@
 SISpec SI_NewSpec(int numProps, u_int32_t flags) {
   return (SISpec){.properties = calloc(numProps, sizeof(SIIndexProperty)),
                   .numProps = numProps,
-                  .flags = flags};
+                  .flags = flags,
+                  .numPartitions = 0};
 }
 
 void SISpec_Free(SISpec *sp) {
@@ -29,4 +30,10 @@ SIIndexProperty *SISpec_PropertyByName(SISpec *spec, const char *name,
     }
   }
   return NULL;
+}
+
+int SISpec_IsCaseFolded(SISpec *spec, int propId) {
+  return propId >= 0 && propId < spec->numProps &&
+         spec->properties[propId].type == T_STRING &&
+         !(spec->properties[propId].flags & SI_PROP_CASESENSITIVE);
 }
\ No newline at end of file
@@ -11,11 +11,29 @@ typedef struct {
 #define SI_INDEX_DEFAULT = 0x00
 #define SI_INDEX_NAMED 0x1
 #define SI_INDEX_UNIQUE 0x2
+// buffer changes in a delta skiplist merged into the index in bulk
+#define SI_INDEX_DELTA 0x4
+// persist only the spec of a prefix index, and rebuild it from the keyspace
+// when it's loaded
+#define SI_INDEX_SPECONLY 0x8
+
+/* property flags */
+// keep a trigram index for LIKE pattern queries on a STRING property
+#define SI_PROP_TRIGRAM 0x1
+// compare the values of a STRING property as binary strings. Without it they
+// are case folded when indexed and queried
+#define SI_PROP_CASESENSITIVE 0x2
+
+// the maximal number of partitions of an index
+#define SI_MAX_PARTITIONS 256
 
 typedef struct {
   SIIndexProperty *properties;
   size_t numProps;
   u_int32_t flags;
+  // the number of partitions the index is sharded into. 0 or 1 for a single
+  // index
+  int numPartitions;
 } SISpec;
 
 /* Create a new spec, allocate the properties array, and set the flags */
@@ -29,4 +47,7 @@ void SISpec_Free(SISpec *sp);
  * spec is not named */
 SIIndexProperty *SISpec_PropertyByName(SISpec *spec, const char *name, int *id);
 
+/* Returns 1 if the values of a property are case folded strings */
+int SISpec_IsCaseFolded(SISpec *spec, int propId);
+
 #endif
\ No newline at end of file
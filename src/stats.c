@@ -0,0 +1,405 @@
+#include "stats.h"
+#include <math.h>
+#include <stdio.h>
+#include <sys/param.h>
+#include "rmutil/alloc.h"
+
+// fallback selectivities when we have no sample to estimate from
+#define SI_STATS_DEFAULT_EQ 0.005
+#define SI_STATS_DEFAULT_RNG 0.33
+
+/* A simple xorshift generator for the reservoir, so we don't mess with the
+ * global random() state used by the skiplist */
+static u_int32_t stats_rand(SIIndexStats *st) {
+  u_int32_t x = st->rnd;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return st->rnd = x;
+}
+
+/* FNV-1a over a buffer */
+static u_int64_t fnv1a(u_int64_t h, const char *buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)buf[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* Hash a value for distinct counting. Keys are collated when they are built, so
+ * strings are hashed as they are compared in the index - byte by byte */
+static u_int64_t hashValue(SIValue *v) {
+  u_int64_t h = 14695981039346656037ULL;
+  switch (v->type) {
+  case T_STRING:
+    h = fnv1a(h, v->stringval.str, v->stringval.len);
+    break;
+  case T_INT32:
+  case T_BOOL:
+    h = fnv1a(h, (char *)&v->intval, sizeof(v->intval));
+    break;
+  case T_INT64:
+  case T_UINT:
+    h = fnv1a(h, (char *)&v->longval, sizeof(v->longval));
+    break;
+  case T_TIME:
+    h = fnv1a(h, (char *)&v->timeval, sizeof(v->timeval));
+    break;
+  case T_FLOAT:
+    h = fnv1a(h, (char *)&v->floatval, sizeof(v->floatval));
+    break;
+  case T_DOUBLE:
+    h = fnv1a(h, (char *)&v->doubleval, sizeof(v->doubleval));
+    break;
+  default:
+    break;
+  }
+  // finalize so the register index bits are well mixed
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static void hllAdd(SIColumnStats *cs, SIValue *v) {
+  u_int64_t h = hashValue(v);
+  u_int32_t reg = h >> (64 - SI_STATS_HLL_BITS);
+  u_int64_t rest = h << SI_STATS_HLL_BITS;
+  u_int8_t rank = 1;
+  while (rank <= 64 - SI_STATS_HLL_BITS && !(rest & (1ULL << 63))) {
+    rank++;
+    rest <<= 1;
+  }
+  if (rank > cs->hll[reg]) {
+    cs->hll[reg] = rank;
+  }
+}
+
+static double hllCount(SIColumnStats *cs) {
+  double m = SI_STATS_HLL_REGISTERS, sum = 0;
+  int zeros = 0;
+  for (int i = 0; i < SI_STATS_HLL_REGISTERS; i++) {
+    sum += ldexp(1.0, -cs->hll[i]);
+    if (cs->hll[i] == 0)
+      zeros++;
+  }
+  double est = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+  // small range correction
+  if (est <= 2.5 * m && zeros) {
+    est = m * log(m / zeros);
+  }
+  return est;
+}
+
+SIIndexStats *SI_NewIndexStats(SISpec *spec, SIKeyCmpFunc *cmpFuncs) {
+  SIIndexStats *st = malloc(sizeof(SIIndexStats));
+  st->numCols = spec->numProps;
+  st->numRows = 0;
+  st->numRemoved = 0;
+  st->rnd = 2463534242;
+  st->cols = calloc(spec->numProps, sizeof(SIColumnStats));
+  for (size_t i = 0; i < spec->numProps; i++) {
+    st->cols[i].type = spec->properties[i].type;
+    st->cols[i].cmp = cmpFuncs[i];
+    st->cols[i].sample = calloc(SI_STATS_SAMPLE_SIZE, sizeof(SIValue));
+  }
+  return st;
+}
+
+void SIIndexStats_Add(SIIndexStats *st, SIMultiKey *key) {
+  st->numRows++;
+  for (size_t i = 0; i < st->numCols && i < key->size; i++) {
+    SIColumnStats *cs = &st->cols[i];
+    cs->seen++;
+    cs->dirty++;
+    hllAdd(cs, &key->keys[i]);
+
+    // reservoir sampling - fill up the sample, then replace with decreasing
+    // probability
+    if (cs->sampleLen < SI_STATS_SAMPLE_SIZE) {
+      cs->sample[cs->sampleLen++] = SIValue_Copy(key->keys[i]);
+    } else {
+      u_int64_t j = stats_rand(st) % cs->seen;
+      if (j < SI_STATS_SAMPLE_SIZE) {
+        SIValue_Free(&cs->sample[j]);
+        cs->sample[j] = SIValue_Copy(key->keys[i]);
+      }
+    }
+  }
+}
+
+void SIIndexStats_Remove(SIIndexStats *st, SIMultiKey *key) {
+  if (st->numRows > 0)
+    st->numRows--;
+  st->numRemoved++;
+  for (size_t i = 0; i < st->numCols && i < key->size; i++) {
+    SIColumnStats *cs = &st->cols[i];
+    cs->dirty++;
+    if (cs->seen > 0)
+      cs->seen--;
+    // equal values are interchangeable for estimates, so drop any sampled one
+    for (size_t j = 0; j < cs->sampleLen; j++) {
+      if (cs->cmp(&cs->sample[j], &key->keys[i], NULL) == 0) {
+        SIValue_Free(&cs->sample[j]);
+        cs->sample[j] = cs->sample[--cs->sampleLen];
+        break;
+      }
+    }
+  }
+}
+
+int SIIndexStats_NeedsRebuild(SIIndexStats *st) {
+  if (st->numRemoved == 0)
+    return 0;
+  if (st->numRemoved > st->numRows / 2)
+    return 1;
+  if (st->numRemoved < st->numRows / 8)
+    return 0;
+  size_t target = MIN(st->numRows, SI_STATS_SAMPLE_SIZE);
+  for (size_t i = 0; i < st->numCols; i++) {
+    if (st->cols[i].sampleLen < target / 2)
+      return 1;
+  }
+  return 0;
+}
+
+static void mergeSort(SIValue *vals, SIValue *tmp, size_t n, SIKeyCmpFunc cmp) {
+  if (n < 2)
+    return;
+  size_t mid = n / 2;
+  mergeSort(vals, tmp, mid, cmp);
+  mergeSort(vals + mid, tmp, n - mid, cmp);
+
+  size_t i = 0, j = mid, k = 0;
+  while (i < mid && j < n) {
+    tmp[k++] = cmp(&vals[j], &vals[i], NULL) < 0 ? vals[j++] : vals[i++];
+  }
+  while (i < mid)
+    tmp[k++] = vals[i++];
+  while (j < n)
+    tmp[k++] = vals[j++];
+  memcpy(vals, tmp, n * sizeof(SIValue));
+}
+
+static void freeHistogram(SIColumnStats *cs) {
+  for (size_t i = 0; i < cs->numBuckets; i++) {
+    SIValue_Free(&cs->buckets[i].lo);
+    SIValue_Free(&cs->buckets[i].hi);
+  }
+  free(cs->buckets);
+  cs->buckets = NULL;
+  cs->numBuckets = 0;
+  cs->histogramLen = 0;
+}
+
+void SIIndexStats_Clear(SIIndexStats *st) {
+  st->numRows = 0;
+  st->numRemoved = 0;
+  for (size_t i = 0; i < st->numCols; i++) {
+    SIColumnStats *cs = &st->cols[i];
+    for (size_t j = 0; j < cs->sampleLen; j++) {
+      SIValue_Free(&cs->sample[j]);
+    }
+    cs->sampleLen = 0;
+    cs->seen = 0;
+    memset(cs->hll, 0, sizeof(cs->hll));
+    freeHistogram(cs);
+    cs->dirty = 0;
+  }
+}
+
+/* Build an equi-depth histogram from the sorted sample. Equal values never
+ * span two buckets, so a heavy hitter ends up as the upper bound of its bucket
+ * with a big eqCount */
+static void buildHistogram(SIColumnStats *cs) {
+  freeHistogram(cs);
+  size_t n = cs->sampleLen;
+  cs->dirty = 0;
+  if (n == 0)
+    return;
+
+  SIValue *sorted = malloc(n * sizeof(SIValue));
+  SIValue *tmp = malloc(n * sizeof(SIValue));
+  memcpy(sorted, cs->sample, n * sizeof(SIValue));
+  mergeSort(sorted, tmp, n, cs->cmp);
+  free(tmp);
+
+  size_t depth = (n + SI_STATS_MAX_BUCKETS - 1) / SI_STATS_MAX_BUCKETS;
+  cs->buckets = calloc(SI_STATS_MAX_BUCKETS, sizeof(siHistogramBucket));
+
+  size_t i = 0;
+  while (i < n) {
+    siHistogramBucket *b = &cs->buckets[cs->numBuckets++];
+    size_t start = i;
+    b->distinct = 0;
+    while (i < n) {
+      // count the run of equal values starting at i
+      size_t run = 1;
+      while (i + run < n && cs->cmp(&sorted[i], &sorted[i + run], NULL) == 0) {
+        run++;
+      }
+      b->distinct++;
+      b->eqCount = run;
+      i += run;
+      if (i - start >= depth && cs->numBuckets < SI_STATS_MAX_BUCKETS) {
+        break;
+      }
+    }
+    b->count = i - start;
+    b->lo = SIValue_Copy(sorted[start]);
+    b->hi = SIValue_Copy(sorted[i - 1]);
+  }
+  cs->histogramLen = n;
+  free(sorted);
+}
+
+static SIColumnStats *columnStats(SIIndexStats *st, int col) {
+  if (!st || col < 0 || col >= st->numCols)
+    return NULL;
+  SIColumnStats *cs = &st->cols[col];
+  // rebuild the histogram if the sample has grown or has changed enough
+  if (cs->histogramLen != cs->sampleLen ||
+      cs->dirty > MAX(cs->sampleLen / 8, 1)) {
+    buildHistogram(cs);
+  }
+  return cs->histogramLen ? cs : NULL;
+}
+
+double SIIndexStats_Distinct(SIIndexStats *st, int col) {
+  if (!st || col < 0 || col >= st->numCols)
+    return 1;
+  double est = hllCount(&st->cols[col]);
+  if (est > st->numRows)
+    est = st->numRows;
+  return est < 1 ? 1 : est;
+}
+
+/* Estimate the fraction of sampled values within a range. NULL min or max
+ * means the range is unbounded at that side */
+static double estimateRange(SIColumnStats *cs, SIValue *min, int minExclusive,
+                            SIValue *max, int maxExclusive) {
+  double matched = 0;
+  for (size_t i = 0; i < cs->numBuckets; i++) {
+    siHistogramBucket *b = &cs->buckets[i];
+
+    // is the bucket's upper bound itself in the range?
+    int minc = min ? cs->cmp(&b->hi, min, NULL) : 1;
+    int maxc = max ? cs->cmp(&b->hi, max, NULL) : -1;
+    if ((minc > 0 || (minc == 0 && !minExclusive)) &&
+        (maxc < 0 || (maxc == 0 && !maxExclusive))) {
+      matched += b->eqCount;
+    }
+
+    // does the range overlap the bucket's interior [lo, hi)?
+    size_t interior = b->count - b->eqCount;
+    if (interior) {
+      int startsBefore = !min || cs->cmp(min, &b->lo, NULL) <= 0;
+      int endsAfter = !max || cs->cmp(max, &b->hi, NULL) >= 0;
+      int overlaps = (!min || cs->cmp(min, &b->hi, NULL) < 0) &&
+                     (!max || cs->cmp(max, &b->lo, NULL) >= 0);
+      if (startsBefore && endsAfter) {
+        matched += interior;
+      } else if (overlaps) {
+        // we don't know how values are spread inside the bucket
+        matched += interior / 2.0;
+      }
+    }
+  }
+  return matched / cs->histogramLen;
+}
+
+static double estimateEquals(SIColumnStats *cs, SIValue *v) {
+  for (size_t i = 0; i < cs->numBuckets; i++) {
+    siHistogramBucket *b = &cs->buckets[i];
+    int c = cs->cmp(v, &b->hi, NULL);
+    if (c == 0) {
+      return (double)b->eqCount / cs->histogramLen;
+    }
+    if (c < 0) {
+      // the value is inside the bucket - spread the interior values evenly
+      // between the distinct values we've seen there
+      size_t interior = b->count - b->eqCount;
+      if (b->distinct > 1 && interior) {
+        return (double)interior / (b->distinct - 1) / cs->histogramLen;
+      }
+      break;
+    }
+  }
+  // not in the sample
+  return 0;
+}
+
+double SIIndexStats_Selectivity(SIIndexStats *st, SIPredicate *pred) {
+  SIColumnStats *cs = columnStats(st, pred->propId);
+  double sel;
+  if (!cs) {
+    switch (pred->t) {
+    case PRED_EQ:
+    case PRED_ISNULL:
+      return SI_STATS_DEFAULT_EQ;
+    case PRED_IN:
+      return MIN(1, SI_STATS_DEFAULT_EQ * pred->in.numvals);
+    case PRED_NE:
+      return 1 - SI_STATS_DEFAULT_EQ;
+    default:
+      return SI_STATS_DEFAULT_RNG;
+    }
+  }
+
+  // values not in the sample still get half a sampled value's weight
+  double minSel = 0.5 / cs->histogramLen;
+
+  switch (pred->t) {
+  case PRED_EQ:
+  case PRED_ISNULL:
+    sel = MAX(estimateEquals(cs, &pred->eq.v), minSel);
+    break;
+  case PRED_NE:
+    sel = 1 - estimateEquals(cs, &pred->ne.v);
+    break;
+  case PRED_IN:
+    sel = 0;
+    for (size_t i = 0; i < pred->in.numvals; i++) {
+      sel += MAX(estimateEquals(cs, &pred->in.vals[i]), minSel);
+    }
+    break;
+  case PRED_RNG:
+    sel = MAX(estimateRange(cs, &pred->rng.min, pred->rng.minExclusive,
+                            &pred->rng.max, pred->rng.maxExclusive),
+              minSel);
+    break;
+  case PRED_LIKE: {
+    // patterns can't be estimated from the histogram, but they can be matched
+    // against the sample itself
+    size_t matches = 0;
+    for (size_t i = 0; i < cs->sampleLen; i++) {
+      if (cs->sample[i].type == T_STRING &&
+          SI_LikeMatch(&cs->sample[i].stringval, &pred->like.pattern.stringval)) {
+        matches++;
+      }
+    }
+    if (pred->like.negated) {
+      matches = cs->sampleLen - matches;
+    }
+    sel = MAX((double)matches / cs->sampleLen, minSel);
+    break;
+  }
+  default:
+    sel = 1;
+  }
+  return MIN(sel, 1);
+}
+
+void SIIndexStats_Free(SIIndexStats *st) {
+  for (size_t i = 0; i < st->numCols; i++) {
+    SIColumnStats *cs = &st->cols[i];
+    freeHistogram(cs);
+    for (size_t j = 0; j < cs->sampleLen; j++) {
+      SIValue_Free(&cs->sample[j]);
+    }
+    free(cs->sample);
+  }
+  free(st->cols);
+  free(st);
+}
@@ -0,0 +1,100 @@
+#ifndef __SI_STATS_H__
+#define __SI_STATS_H__
+
+#include <stdlib.h>
+#include "value.h"
+#include "key.h"
+#include "spec.h"
+#include "query.h"
+
+/* Per column statistics used by the query planner for cardinality estimation.
+ *
+ * Each column keeps a fixed size reservoir sample of its values, and a small
+ * HyperLogLog sketch for distinct value estimation. Both are updated
+ * incrementally on every change applied to the index. An equi-depth histogram
+ * is built lazily from the sorted sample when the planner asks for an estimate
+ * and enough changes happened since the last build.
+ *
+ * Removed values are dropped from the sample, but can't be taken out of the
+ * sketch, whose count is only an upper bound once rows were removed. The index
+ * rebuilds the statistics from its rows once enough of them were removed -
+ * which also refills the sample uniformly, instead of with the latest values
+ * only. */
+
+#define SI_STATS_SAMPLE_SIZE 512
+#define SI_STATS_MAX_BUCKETS 32
+#define SI_STATS_HLL_BITS 8
+#define SI_STATS_HLL_REGISTERS (1 << SI_STATS_HLL_BITS)
+
+/* A single equi-depth histogram bucket. It holds all the sampled values
+ * greater than the previous bucket's upper bound, from lo up to (and
+ * including) hi */
+typedef struct {
+  SIValue lo;
+  SIValue hi;
+  // number of sampled values in the bucket
+  size_t count;
+  // number of sampled values equal to hi - used to detect heavy hitters
+  size_t eqCount;
+  // number of distinct sampled values in the bucket
+  size_t distinct;
+} siHistogramBucket;
+
+typedef struct {
+  SIType type;
+  SIKeyCmpFunc cmp;
+
+  // reservoir sample of the column's values
+  SIValue *sample;
+  size_t sampleLen;
+  // total number of values offered to the reservoir
+  u_int64_t seen;
+
+  u_int8_t hll[SI_STATS_HLL_REGISTERS];
+
+  siHistogramBucket *buckets;
+  size_t numBuckets;
+  // number of sampled values the histogram was built from
+  size_t histogramLen;
+  // number of changes since the last histogram build
+  size_t dirty;
+} SIColumnStats;
+
+typedef struct {
+  SIColumnStats *cols;
+  size_t numCols;
+  // the number of rows currently in the index
+  size_t numRows;
+  // the number of rows removed since the statistics were last built
+  size_t numRemoved;
+  // state for the reservoir's random generator
+  u_int32_t rnd;
+} SIIndexStats;
+
+/* Create statistics for an index with the given spec and comparators */
+SIIndexStats *SI_NewIndexStats(SISpec *spec, SIKeyCmpFunc *cmpFuncs);
+
+/* Account for a new key tuple inserted into the index */
+void SIIndexStats_Add(SIIndexStats *st, SIMultiKey *key);
+
+/* Account for a key tuple removed from the index */
+void SIIndexStats_Remove(SIIndexStats *st, SIMultiKey *key);
+
+/* Returns 1 if removals made the statistics stale enough to be rebuilt: more
+ * than half the rows were removed since they were built, or a sample shrank to
+ * less than half of what the index could fill. Rebuilding them after at least
+ * a fraction of the rows were removed keeps its amortized cost constant */
+int SIIndexStats_NeedsRebuild(SIIndexStats *st);
+
+/* Forget all the rows, before adding the rows of the index again */
+void SIIndexStats_Clear(SIIndexStats *st);
+
+/* Estimate the number of distinct values of a column */
+double SIIndexStats_Distinct(SIIndexStats *st, int col);
+
+/* Estimate the fraction of rows matching a predicate, between 0 and 1 */
+double SIIndexStats_Selectivity(SIIndexStats *st, SIPredicate *pred);
+
+void SIIndexStats_Free(SIIndexStats *st);
+
+#endif
@@ -0,0 +1,91 @@
+#include "thread_pool.h"
+#include <pthread.h>
+#include "rmutil/alloc.h"
+
+typedef struct poolJob {
+  SIThreadPoolJob fn;
+  void *arg;
+  struct poolJob *next;
+} poolJob;
+
+struct SIThreadPool {
+  pthread_t *threads;
+  int numThreads;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  poolJob *head, *tail;
+  int stopping;
+};
+
+static void *poolWorker(void *arg) {
+  SIThreadPool *p = arg;
+  for (;;) {
+    pthread_mutex_lock(&p->lock);
+    while (!p->head && !p->stopping) {
+      pthread_cond_wait(&p->cond, &p->lock);
+    }
+    // we only stop once the queue is drained
+    if (!p->head) {
+      pthread_mutex_unlock(&p->lock);
+      return NULL;
+    }
+    poolJob *j = p->head;
+    p->head = j->next;
+    if (!p->head) {
+      p->tail = NULL;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    j->fn(j->arg);
+    free(j);
+  }
+}
+
+SIThreadPool *SI_NewThreadPool(int numThreads) {
+  SIThreadPool *p = calloc(1, sizeof(SIThreadPool));
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  p->threads = calloc(numThreads, sizeof(pthread_t));
+
+  for (int i = 0; i < numThreads; i++) {
+    if (pthread_create(&p->threads[i], NULL, poolWorker, p) != 0) {
+      SIThreadPool_Free(p);
+      return NULL;
+    }
+    p->numThreads++;
+  }
+  return p;
+}
+
+void SIThreadPool_Push(SIThreadPool *p, SIThreadPoolJob fn, void *arg) {
+  poolJob *j = malloc(sizeof(poolJob));
+  j->fn = fn;
+  j->arg = arg;
+  j->next = NULL;
+
+  pthread_mutex_lock(&p->lock);
+  if (p->tail) {
+    p->tail->next = j;
+  } else {
+    p->head = j;
+  }
+  p->tail = j;
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+}
+
+void SIThreadPool_Free(SIThreadPool *p) {
+  pthread_mutex_lock(&p->lock);
+  p->stopping = 1;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+
+  for (int i = 0; i < p->numThreads; i++) {
+    pthread_join(p->threads[i], NULL);
+  }
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->cond);
+  free(p->threads);
+  free(p);
+}
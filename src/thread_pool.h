@@ -0,0 +1,20 @@
+#ifndef __SI_THREAD_POOL_H__
+#define __SI_THREAD_POOL_H__
+
+/* A fixed size pool of worker threads, executing jobs from a FIFO queue */
+
+typedef void (*SIThreadPoolJob)(void *arg);
+
+typedef struct SIThreadPool SIThreadPool;
+
+/* Create a thread pool with the given number of threads. Returns NULL if the
+ * threads could not be started */
+SIThreadPool *SI_NewThreadPool(int numThreads);
+
+/* Queue a job to be executed by one of the pool's threads */
+void SIThreadPool_Push(SIThreadPool *p, SIThreadPoolJob job, void *arg);
+
+/* Wait for all the queued jobs to finish, stop the threads and free the pool */
+void SIThreadPool_Free(SIThreadPool *p);
+
+#endif
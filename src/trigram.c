@@ -0,0 +1,264 @@
+#include "trigram.h"
+#include "util/khash.h"
+#include "rmutil/alloc.h"
+
+typedef struct {
+  u_int32_t *docs;
+  size_t len;
+  size_t cap;
+} siPostings;
+
+KHASH_MAP_INIT_INT(siTrigram, siPostings *);
+KHASH_MAP_INIT_STR(siTrigramDoc, u_int32_t);
+
+struct SITrigramIndex {
+  khash_t(siTrigram) * postings;
+  // id to document number, keyed by our copies of the ids in docIds
+  khash_t(siTrigramDoc) * docs;
+  char **docIds;
+  size_t numDocs;
+  size_t cap;
+  // document numbers of deleted ids, reused for new ones
+  u_int32_t *freeDocs;
+  size_t numFree;
+  size_t freeCap;
+};
+
+/* Extract the distinct trigrams of a string into an allocated array. Literal
+ * parts of LIKE patterns are separated by wildcards when isPattern is set */
+static u_int32_t *extractTrigrams(SIString *s, int isPattern, size_t *num) {
+  *num = 0;
+  if (s->len < 3) {
+    return NULL;
+  }
+  u_int32_t *ret = malloc((s->len - 2) * sizeof(u_int32_t));
+  for (size_t i = 0; i + 2 < s->len; i++) {
+    unsigned char *p = (unsigned char *)s->str + i;
+    if (isPattern && (p[0] == '%' || p[0] == '_' || p[1] == '%' ||
+                      p[1] == '_' || p[2] == '%' || p[2] == '_')) {
+      continue;
+    }
+    u_int32_t t = p[0] << 16 | p[1] << 8 | p[2];
+    int dup = 0;
+    for (size_t j = 0; j < *num && !dup; j++) {
+      dup = ret[j] == t;
+    }
+    if (!dup) {
+      ret[(*num)++] = t;
+    }
+  }
+  return ret;
+}
+
+/* Binary search a document in a posting list. Returns its position, or the
+ * position it should be inserted at */
+static size_t postings_find(siPostings *p, u_int32_t doc, int *found) {
+  size_t lo = 0, hi = p->len;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (p->docs[mid] < doc) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *found = lo < p->len && p->docs[lo] == doc;
+  return lo;
+}
+
+SITrigramIndex *SI_NewTrigramIndex() {
+  SITrigramIndex *ti = calloc(1, sizeof(SITrigramIndex));
+  ti->postings = kh_init(siTrigram);
+  ti->docs = kh_init(siTrigramDoc);
+  return ti;
+}
+
+/* Get the document number of an id, assigning a new one if needed */
+static u_int32_t trigramIndex_getDoc(SITrigramIndex *ti, SIId id) {
+  khiter_t k = kh_get(siTrigramDoc, ti->docs, id);
+  if (k != kh_end(ti->docs)) {
+    return kh_val(ti->docs, k);
+  }
+
+  u_int32_t doc;
+  if (ti->numFree) {
+    doc = ti->freeDocs[--ti->numFree];
+  } else {
+    if (ti->numDocs == ti->cap) {
+      ti->cap = ti->cap ? ti->cap * 2 : 64;
+      ti->docIds = realloc(ti->docIds, ti->cap * sizeof(char *));
+    }
+    doc = ti->numDocs++;
+  }
+  ti->docIds[doc] = strdup(id);
+
+  int rc;
+  k = kh_put(siTrigramDoc, ti->docs, ti->docIds[doc], &rc);
+  kh_val(ti->docs, k) = doc;
+  return doc;
+}
+
+void SITrigramIndex_Add(SITrigramIndex *ti, SIId id, SIString *s) {
+  size_t num;
+  u_int32_t *trigrams = extractTrigrams(s, 0, &num);
+  if (!num) {
+    free(trigrams);
+    return;
+  }
+
+  u_int32_t doc = trigramIndex_getDoc(ti, id);
+  for (size_t i = 0; i < num; i++) {
+    int rc;
+    khiter_t k = kh_put(siTrigram, ti->postings, trigrams[i], &rc);
+    if (rc != 0) {
+      kh_val(ti->postings, k) = calloc(1, sizeof(siPostings));
+    }
+    siPostings *p = kh_val(ti->postings, k);
+
+    int found;
+    size_t pos = postings_find(p, doc, &found);
+    if (found) {
+      continue;
+    }
+    if (p->len == p->cap) {
+      p->cap = p->cap ? p->cap * 2 : 4;
+      p->docs = realloc(p->docs, p->cap * sizeof(u_int32_t));
+    }
+    memmove(&p->docs[pos + 1], &p->docs[pos],
+            (p->len - pos) * sizeof(u_int32_t));
+    p->docs[pos] = doc;
+    p->len++;
+  }
+  free(trigrams);
+}
+
+void SITrigramIndex_Remove(SITrigramIndex *ti, SIId id, SIString *s) {
+  khiter_t dk = kh_get(siTrigramDoc, ti->docs, id);
+  if (dk == kh_end(ti->docs)) {
+    return;
+  }
+  u_int32_t doc = kh_val(ti->docs, dk);
+
+  size_t num;
+  u_int32_t *trigrams = extractTrigrams(s, 0, &num);
+  for (size_t i = 0; i < num; i++) {
+    khiter_t k = kh_get(siTrigram, ti->postings, trigrams[i]);
+    if (k == kh_end(ti->postings)) {
+      continue;
+    }
+    siPostings *p = kh_val(ti->postings, k);
+    int found;
+    size_t pos = postings_find(p, doc, &found);
+    if (!found) {
+      continue;
+    }
+    memmove(&p->docs[pos], &p->docs[pos + 1],
+            (p->len - pos - 1) * sizeof(u_int32_t));
+    if (--p->len == 0) {
+      free(p->docs);
+      free(p);
+      kh_del(siTrigram, ti->postings, k);
+    }
+  }
+  free(trigrams);
+
+  kh_del(siTrigramDoc, ti->docs, dk);
+  free(ti->docIds[doc]);
+  ti->docIds[doc] = NULL;
+  if (ti->numFree == ti->freeCap) {
+    ti->freeCap = ti->freeCap ? ti->freeCap * 2 : 16;
+    ti->freeDocs = realloc(ti->freeDocs, ti->freeCap * sizeof(u_int32_t));
+  }
+  ti->freeDocs[ti->numFree++] = doc;
+}
+
+/* Get the posting lists of a pattern's trigrams, sorted by length. Returns the
+ * number of trigrams, or -1 if one of them has no postings at all */
+static long trigramIndex_patternPostings(SITrigramIndex *ti, SIString *pattern,
+                                         siPostings ***lists) {
+  size_t num;
+  u_int32_t *trigrams = extractTrigrams(pattern, 1, &num);
+  *lists = malloc((num + 1) * sizeof(siPostings *));
+  for (size_t i = 0; i < num; i++) {
+    khiter_t k = kh_get(siTrigram, ti->postings, trigrams[i]);
+    if (k == kh_end(ti->postings)) {
+      free(trigrams);
+      return -1;
+    }
+    // insertion sort, patterns only have a few trigrams
+    siPostings *p = kh_val(ti->postings, k);
+    size_t j = i;
+    while (j > 0 && (*lists)[j - 1]->len > p->len) {
+      (*lists)[j] = (*lists)[j - 1];
+      j--;
+    }
+    (*lists)[j] = p;
+  }
+  free(trigrams);
+  return num;
+}
+
+long SITrigramIndex_EstimateCandidates(SITrigramIndex *ti, SIString *pattern) {
+  siPostings **lists;
+  long num = trigramIndex_patternPostings(ti, pattern, &lists);
+  long ret = num < 0 ? 0 : (num == 0 ? -1 : (long)lists[0]->len);
+  free(lists);
+  return ret;
+}
+
+SIId *SITrigramIndex_Candidates(SITrigramIndex *ti, SIString *pattern,
+                                size_t *num) {
+  *num = 0;
+  siPostings **lists;
+  long numLists = trigramIndex_patternPostings(ti, pattern, &lists);
+  if (numLists <= 0) {
+    free(lists);
+    return NULL;
+  }
+
+  // the shortest list drives the intersection, the others are probed with a
+  // binary search since they are usually much longer
+  size_t len = lists[0]->len;
+  u_int32_t *docs = malloc(len * sizeof(u_int32_t));
+  memcpy(docs, lists[0]->docs, len * sizeof(u_int32_t));
+  for (long i = 1; i < numLists && len; i++) {
+    size_t n = 0;
+    for (size_t j = 0; j < len; j++) {
+      int found;
+      postings_find(lists[i], docs[j], &found);
+      if (found) {
+        docs[n++] = docs[j];
+      }
+    }
+    len = n;
+  }
+  free(lists);
+
+  SIId *ret = malloc((len + 1) * sizeof(SIId));
+  for (size_t i = 0; i < len; i++) {
+    ret[i] = strdup(ti->docIds[docs[i]]);
+  }
+  free(docs);
+  *num = len;
+  return ret;
+}
+
+void SITrigramIndex_Free(SITrigramIndex *ti) {
+  for (khiter_t k = kh_begin(ti->postings); k != kh_end(ti->postings); ++k) {
+    if (kh_exist(ti->postings, k)) {
+      siPostings *p = kh_val(ti->postings, k);
+      free(p->docs);
+      free(p);
+    }
+  }
+  kh_destroy(siTrigram, ti->postings);
+  kh_destroy(siTrigramDoc, ti->docs);
+  for (size_t i = 0; i < ti->numDocs; i++) {
+    if (ti->docIds[i]) {
+      free(ti->docIds[i]);
+    }
+  }
+  free(ti->docIds);
+  free(ti->freeDocs);
+  free(ti);
+}
@@ -0,0 +1,39 @@
+#ifndef __SI_TRIGRAM_H__
+#define __SI_TRIGRAM_H__
+
+#include <stdlib.h>
+#include "value.h"
+
+/* A trigram index over the values of a STRING column, used to find candidate
+ * ids for LIKE patterns that can't be turned into a scan range, e.g.
+ * '%foo%' or '%foo'.
+ *
+ * Each id is given a small document number, and is posted under every
+ * distinct 3 byte sequence of its value. Posting lists are sorted arrays of
+ * document numbers. A value can only match a pattern if it contains all the
+ * trigrams of the pattern's literal parts, so intersecting their posting lists
+ * gives a superset of the matching ids, that must still be verified against the
+ * pattern itself */
+typedef struct SITrigramIndex SITrigramIndex;
+
+SITrigramIndex *SI_NewTrigramIndex();
+
+/* Post an id under the trigrams of its value */
+void SITrigramIndex_Add(SITrigramIndex *ti, SIId id, SIString *s);
+
+/* Remove an id from the postings of its value's trigrams */
+void SITrigramIndex_Remove(SITrigramIndex *ti, SIId id, SIString *s);
+
+/* Estimate the number of candidates of a LIKE pattern, as the length of the
+ * shortest posting list of its trigrams. Returns -1 if the pattern has no
+ * trigrams, and the index can't be used for it */
+long SITrigramIndex_EstimateCandidates(SITrigramIndex *ti, SIString *pattern);
+
+/* Get the ids whose values contain all the trigrams of a LIKE pattern. The ids
+ * are copies, and the array and the ids should be freed by the caller */
+SIId *SITrigramIndex_Candidates(SITrigramIndex *ti, SIString *pattern,
+                                size_t *num);
+
+void SITrigramIndex_Free(SITrigramIndex *ti);
+
+#endif
@@ -28,7 +28,6 @@ SIValue SI_TimeVal(time_t t) { return (SIValue){.timeval = t, .type = T_TIME}; }
 inline SIString SI_WrapString(const char *s) {
   int *rc = malloc(sizeof(int));
   *rc = 1;
-  printf("wrapping string %s\n", s);
   return (SIString){(char *)s, strlen(s), rc};
 }
 
@@ -53,7 +52,7 @@ SIString SIString_Copy(SIString s) {
 }
 
 SIString SIString_IncRef(SIString s) {
-  (*s.refcount)++;
+  __atomic_add_fetch(s.refcount, 1, __ATOMIC_RELAXED);
   return s;
 }
 
@@ -84,9 +83,8 @@ inline int SIValue_IsNullPtr(SIValue *v) {
 }
 
 void SIString_Free(SIString *s) {
-  --*(s->refcount);
-  // printf("string %p (%s) refcount %d\n", s->str, s->str, *(s->refcount));
-  if (*s->refcount == 0) {
+  // copies of a string may be freed by different threads
+  if (__atomic_sub_fetch(s->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
     free(s->str);
     free(s->refcount);
 
@@ -0,0 +1,390 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../src/value.h"
+#include "../src/key.h"
+#include "../src/index.h"
+#include "../src/query.h"
+#include "../src/query_plan.h"
+#include "../src/stats.h"
+#include "../src/skiplist/skiplist.h"
+#include "../src/redismodule.h"
+
+/* Microbenchmarks of the index core, without Redis.
+ *
+ * The index library is built with REDIS_MODULE_TARGET, so it allocates through
+ * the RedisModule_Alloc family of functions, which count the allocations here.
+ * Allocations made by the benchmark itself, outside the library, are not
+ * counted.
+ *
+ * Every benchmark prints the number of operations it timed, the time per
+ * operation, the operations per second and the allocations per operation */
+
+// room for "id" and any long
+#define BENCH_ID_LEN 24
+// room for any value literal, quoted strings included
+#define BENCH_LITERAL_LEN 32
+
+typedef struct {
+  SIType type;
+  int numCols;
+  // the number of distinct values of each column
+  long card;
+  long num;
+} benchConfig;
+
+static size_t numAllocs = 0;
+
+static void *countAlloc(size_t n) {
+  numAllocs++;
+  return malloc(n);
+}
+
+static void *countCalloc(size_t n, size_t size) {
+  numAllocs++;
+  return calloc(n, size);
+}
+
+static void *countRealloc(void *p, size_t n) {
+  numAllocs++;
+  return realloc(p, n);
+}
+
+static char *countStrdup(const char *s) {
+  numAllocs++;
+  return strdup(s);
+}
+
+/* The time and allocations of the operations of one benchmark. Only the code
+ * between benchTimer_Start and benchTimer_Stop is measured, so the input of the
+ * operations can be prepared in between */
+typedef struct {
+  double start, elapsed;
+  size_t allocsStart, allocs;
+} benchTimer;
+
+static void benchTimer_Start(benchTimer *t) {
+  t->allocsStart = numAllocs;
+  t->start = SI_Clock();
+}
+
+static void benchTimer_Stop(benchTimer *t) {
+  t->elapsed += SI_Clock() - t->start;
+  t->allocs += numAllocs - t->allocsStart;
+}
+
+static void benchReport(const char *name, benchTimer *t, size_t ops) {
+  if (!ops) {
+    ops = 1;
+  }
+  // SI_Clock is in microseconds
+  double nsPerOp = t->elapsed * 1000 / ops;
+  printf("%-20s %10zu %12.1f %14.0f %12.2f\n", name, ops, nsPerOp,
+         nsPerOp > 0 ? 1e9 / nsPerOp : 0, (double)t->allocs / ops);
+}
+
+/* A value of the configured type, from a number below the cardinality */
+static SIValue benchValue(benchConfig *cfg, long n) {
+  switch (cfg->type) {
+  case T_INT64:
+    return SI_LongVal(n);
+  case T_DOUBLE:
+    return SI_DoubleVal(n + 0.5);
+  case T_STRING: {
+    char *s = malloc(BENCH_LITERAL_LEN);
+    snprintf(s, BENCH_LITERAL_LEN, "val%08ld", n);
+    return SI_StringValC(s);
+  }
+  default:
+    return SI_IntVal(n);
+  }
+}
+
+/* Write a value the way it's written in a query */
+static void benchLiteral(benchConfig *cfg, long n, char *buf) {
+  switch (cfg->type) {
+  case T_DOUBLE:
+    snprintf(buf, BENCH_LITERAL_LEN, "%ld.5", n);
+    break;
+  case T_STRING:
+    snprintf(buf, BENCH_LITERAL_LEN, "'val%08ld'", n);
+    break;
+  default:
+    snprintf(buf, BENCH_LITERAL_LEN, "%ld", n);
+  }
+}
+
+/* The values of a row */
+static void benchRow(benchConfig *cfg, SIValue *vals) {
+  for (int i = 0; i < cfg->numCols; i++) {
+    vals[i] = benchValue(cfg, random() % cfg->card);
+  }
+}
+
+static SIMultiKey *benchKey(benchConfig *cfg) {
+  SIValue vals[cfg->numCols];
+  benchRow(cfg, vals);
+  // string values are copied into the key
+  SIMultiKey *k = SI_NewMultiKey(vals, cfg->numCols);
+  for (int i = 0; i < cfg->numCols; i++) {
+    SIValue_Free(&vals[i]);
+  }
+  return k;
+}
+
+static int benchCmpIds(void *a, void *b) { return strcmp(a, b); }
+
+/* Insert, find and iterate a skiplist of multi keys, like the index's */
+static void benchSkiplist(benchConfig *cfg, SISpec *spec) {
+  SICmpFuncVector fv = {.cmpFuncs = malloc(cfg->numCols * sizeof(SIKeyCmpFunc)),
+                        .numFuncs = cfg->numCols};
+  for (int i = 0; i < cfg->numCols; i++) {
+    fv.cmpFuncs[i] = SI_KeyCmpFunc(spec->properties[i].type);
+  }
+  skiplist *sl = skiplistCreate(SICmpMultiKey, &fv, benchCmpIds);
+  SIMultiKey **keys = malloc(cfg->num * sizeof(SIMultiKey *));
+  char **ids = malloc(cfg->num * sizeof(char *));
+  for (long i = 0; i < cfg->num; i++) {
+    keys[i] = benchKey(cfg);
+    ids[i] = malloc(BENCH_ID_LEN);
+    snprintf(ids[i], BENCH_ID_LEN, "id%ld", i);
+  }
+
+  benchTimer t = {0};
+  benchTimer_Start(&t);
+  for (long i = 0; i < cfg->num; i++) {
+    skiplistNode *n = skiplistInsert(sl, keys[i], ids[i]);
+    // equal keys share the node of the first one
+    if (n && n->obj != keys[i]) {
+      SIMultiKey_Free(keys[i]);
+      keys[i] = n->obj;
+    }
+  }
+  benchTimer_Stop(&t);
+  benchReport("skiplist_insert", &t, cfg->num);
+
+  t = (benchTimer){0};
+  benchTimer_Start(&t);
+  for (long i = 0; i < cfg->num; i++) {
+    if (!skiplistFind(sl, keys[(i * 7919) % cfg->num])) {
+      fprintf(stderr, "key not found\n");
+      exit(1);
+    }
+  }
+  benchTimer_Stop(&t);
+  benchReport("skiplist_find", &t, cfg->num);
+
+  // ranges of 100 entries from random keys
+  long numRanges = cfg->num / 100 ? cfg->num / 100 : 1;
+  t = (benchTimer){0};
+  benchTimer_Start(&t);
+  for (long i = 0; i < numRanges; i++) {
+    skiplistIterator it =
+        skiplistIterateRange(sl, keys[random() % cfg->num], NULL, 0, 0);
+    for (int j = 0; j < 100 && skiplistIterator_Next(&it); j++)
+      ;
+  }
+  benchTimer_Stop(&t);
+  benchReport("skiplist_range100", &t, numRanges);
+
+  for (skiplistNode *n = sl->header->level[0].forward; n;
+       n = n->level[0].forward) {
+    SIMultiKey_Free(n->obj);
+  }
+  skiplistFree(sl);
+  for (long i = 0; i < cfg->num; i++) {
+    free(ids[i]);
+  }
+  free(ids);
+  free(keys);
+  free(fv.cmpFuncs);
+}
+
+/* Build a change set of rows with the ids from first to first + num */
+static SIChangeSet benchChanges(benchConfig *cfg, long first, long num) {
+  SIChangeSet cs = SI_NewChangeSet(num);
+  for (long i = first; i < first + num; i++) {
+    char *id = malloc(BENCH_ID_LEN);
+    snprintf(id, BENCH_ID_LEN, "id%ld", i);
+    SIChange ch = SI_NewEmptyAddChange(id, cfg->numCols);
+    SIValue vals[cfg->numCols];
+    benchRow(cfg, vals);
+    for (int j = 0; j < cfg->numCols; j++) {
+      SIValueVector_Append(&ch.v, vals[j]);
+    }
+    SIChangeSet_AddCahnge(&cs, ch);
+  }
+  return cs;
+}
+
+/* The query the parsing, planning and scan benchmarks run: a range on the
+ * first column, and a filter on the last one */
+static void benchQueryString(benchConfig *cfg, char *buf, size_t len) {
+  char lo[BENCH_LITERAL_LEN], hi[BENCH_LITERAL_LEN], ne[BENCH_LITERAL_LEN];
+  benchLiteral(cfg, cfg->card / 4, lo);
+  benchLiteral(cfg, cfg->card * 3 / 4, hi);
+  benchLiteral(cfg, 0, ne);
+  snprintf(buf, len, "$1 >= %s AND $1 < %s AND $%d != %s", lo, hi, cfg->numCols,
+           ne);
+}
+
+/* Apply changes to a compound index, then parse, plan and run queries on it */
+static void benchIndex(benchConfig *cfg, SISpec *spec) {
+  SIIndex idx = SI_NewCompoundIndex(*spec);
+
+  benchTimer t = {0};
+  for (long i = 0; i < cfg->num; i += 1000) {
+    long n = cfg->num - i < 1000 ? cfg->num - i : 1000;
+    SIChangeSet cs = benchChanges(cfg, i, n);
+    benchTimer_Start(&t);
+    if (idx.Apply(idx.ctx, cs) != SI_INDEX_OK) {
+      fprintf(stderr, "failed applying changes\n");
+      exit(1);
+    }
+    benchTimer_Stop(&t);
+    for (size_t j = 0; j < cs.numChanges; j++) {
+      SIValueVector_Free(&cs.changes[j].v);
+    }
+    SIChangeSet_Free(&cs);
+  }
+  benchReport("index_apply", &t, cfg->num);
+
+  char str[256];
+  benchQueryString(cfg, str, sizeof(str));
+  int numQueries = 10000;
+
+  SIQuery *queries = malloc(numQueries * sizeof(SIQuery));
+  for (int i = 0; i < numQueries; i++) {
+    queries[i] = SI_NewQuery();
+  }
+  t = (benchTimer){0};
+  benchTimer_Start(&t);
+  for (int i = 0; i < numQueries; i++) {
+    if (!SI_ParseQuery(&queries[i], str, strlen(str), spec, NULL)) {
+      fprintf(stderr, "failed parsing %s\n", str);
+      exit(1);
+    }
+  }
+  benchTimer_Stop(&t);
+  benchReport("parse_query", &t, numQueries);
+  for (int i = 1; i < numQueries; i++) {
+    SIQuery_Free(&queries[i]);
+  }
+  SIQuery q = queries[0];
+  free(queries);
+
+  // the statistics of the same rows the index has
+  SIKeyCmpFunc cmpFuncs[cfg->numCols];
+  for (int i = 0; i < cfg->numCols; i++) {
+    cmpFuncs[i] = SI_KeyCmpFunc(spec->properties[i].type);
+  }
+  SIIndexStats *stats = SI_NewIndexStats(spec, cmpFuncs);
+  for (long i = 0; i < cfg->num; i++) {
+    SIMultiKey *k = benchKey(cfg);
+    SIIndexStats_Add(stats, k);
+    SIMultiKey_Free(k);
+  }
+  // the first plan builds the histograms of the sample
+  SIQueryPlan_Free(SI_BuildQueryPlan(&q, spec, stats, NULL));
+  t = (benchTimer){0};
+  benchTimer_Start(&t);
+  for (int i = 0; i < numQueries; i++) {
+    SIQueryPlan *plan = SI_BuildQueryPlan(&q, spec, stats, NULL);
+    SIQueryPlan_Free(plan);
+  }
+  benchTimer_Stop(&t);
+  benchReport("build_plan", &t, numQueries);
+  SIIndexStats_Free(stats);
+
+  // the scan is measured per row returned, reading the whole result
+  size_t rows = 0;
+  int numScans = 5;
+  t = (benchTimer){0};
+  benchTimer_Start(&t);
+  for (int i = 0; i < numScans; i++) {
+    SICursor *c = idx.Find(idx.ctx, &q);
+    while (c->Next(c->ctx)) {
+      rows++;
+    }
+    SICursor_Free(c);
+  }
+  benchTimer_Stop(&t);
+  benchReport("scan_filter_row", &t, rows);
+  SIQuery_Free(&q);
+
+  idx.Free(idx.ctx);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-t int32|int64|double|string] [-c columns] "
+          "[-k cardinality] [-n rows]\n",
+          name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  RedisModule_Alloc = countAlloc;
+  RedisModule_Calloc = countCalloc;
+  RedisModule_Realloc = countRealloc;
+  RedisModule_Free = free;
+  RedisModule_Strdup = countStrdup;
+
+  benchConfig cfg = {.type = T_INT32, .numCols = 2, .card = 1000,
+                     .num = 100000};
+  int opt;
+  while ((opt = getopt(argc, argv, "t:c:k:n:")) != -1) {
+    switch (opt) {
+    case 't':
+      if (!strcmp(optarg, "int32")) {
+        cfg.type = T_INT32;
+      } else if (!strcmp(optarg, "int64")) {
+        cfg.type = T_INT64;
+      } else if (!strcmp(optarg, "double")) {
+        cfg.type = T_DOUBLE;
+      } else if (!strcmp(optarg, "string")) {
+        cfg.type = T_STRING;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'c':
+      cfg.numCols = atoi(optarg);
+      break;
+    case 'k':
+      cfg.card = atol(optarg);
+      break;
+    case 'n':
+      cfg.num = atol(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (cfg.numCols < 1 || cfg.numCols > 255 || cfg.card < 4 ||
+      cfg.num < 1) {
+    usage(argv[0]);
+  }
+
+  SIIndexProperty props[cfg.numCols];
+  memset(props, 0, sizeof(props));
+  for (int i = 0; i < cfg.numCols; i++) {
+    props[i].type = cfg.type;
+  }
+  SISpec spec = {.properties = props, .numProps = cfg.numCols};
+
+  printf("type=%s columns=%d cardinality=%ld rows=%ld\n",
+         cfg.type == T_INT64    ? "int64"
+         : cfg.type == T_DOUBLE ? "double"
+         : cfg.type == T_STRING ? "string"
+                                : "int32",
+         cfg.numCols, cfg.card, cfg.num);
+  printf("%-20s %10s %12s %14s %12s\n", "benchmark", "ops", "ns/op", "ops/s",
+         "allocs/op");
+  srandom(1337);
+  benchSkiplist(&cfg, &spec);
+  benchIndex(&cfg, &spec);
+  return 0;
+}
@@ -1,4 +1,5 @@
 from rmtest import ModuleTestCase
+import time
 import redis
 import unittest
 from redis.exceptions import RedisError
@@ -71,6 +72,255 @@ class SecondaryTestCase(ModuleTestCase('../../build/src/libmodule.so')):
                              self.execFromWhere(r, "idx", "name = 'name12'", 'hget $ name'))
             self.assertEqual(99, r.execute_command('idx.card', 'idx'))
 
+    def testPrefixIndex(self):
+
+        with self.redis() as r:
+
+            for i in xrange(10):
+                r.execute_command('HSET', 'user:%d' % i, 'age', 20 + i)
+            r.execute_command('HSET', 'other:1', 'age', 20)
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'type', 'hash', 'prefix', 'user:', 'schema', 'age', 'int32'))
+            # existing keys are indexed by the backfill
+            for _ in xrange(100):
+                info = r.execute_command('idx.info', 'idx')
+                info = dict(zip(info[::2], info[1::2]))
+                if not info['backfilling']:
+                    break
+                time.sleep(0.01)
+            self.assertEqual(0, info['backfilling'])
+            self.assertEqual(10, info['backfill_keys'])
+            self.assertEqual('user:', info['prefix'])
+            self.assertEqual(['age', 'INT32'], info['schema'])
+            self.assertEqual(10, r.execute_command('idx.card', 'idx'))
+
+            # plain writes are followed without IDX.INTO
+            r.execute_command('HSET', 'user:10', 'age', 30)
+            r.execute_command('HSET', 'user:0', 'age', 31)
+            self.assertEqual(11, r.execute_command('idx.card', 'idx'))
+            self.assertEqual(['user:0', '31'], self.execFromWhere(
+                r, "idx", "age = 31", 'hget $ age'))
+            self.assertEqual([], self.execFromWhere(
+                r, "idx", "age = 20", 'hget $ age'))
+
+            r.execute_command('HDEL', 'user:1', 'age')
+            self.assertEqual(['user:1', None], self.execFromWhere(
+                r, "idx", "age IS NULL", 'hget $ age'))
+
+            r.execute_command('DEL', 'user:2')
+            self.assertEqual(10, r.execute_command('idx.card', 'idx'))
+
+            # renaming out of the prefix removes the key
+            r.execute_command('RENAME', 'user:3', 'other:3')
+            self.assertEqual(9, r.execute_command('idx.card', 'idx'))
+            r.execute_command('RENAME', 'other:3', 'user:3')
+            self.assertEqual(10, r.execute_command('idx.card', 'idx'))
+
+            r.execute_command('PEXPIRE', 'user:4', 1)
+            time.sleep(0.1)
+            self.assertEqual(None, r.execute_command('HGET', 'user:4', 'age'))
+            self.assertEqual(9, r.execute_command('idx.card', 'idx'))
+
+            # a hash overwritten by another type leaves the index
+            r.execute_command('SET', 'user:5', 'foo')
+            self.assertEqual(8, r.execute_command('idx.card', 'idx'))
+
+            # restored hashes are indexed
+            dump = r.execute_command('DUMP', 'user:6')
+            r.execute_command('DEL', 'user:6')
+            self.assertEqual(7, r.execute_command('idx.card', 'idx'))
+            r.execute_command('RESTORE', 'user:6', 0, dump)
+            self.assertEqual(8, r.execute_command('idx.card', 'idx'))
+            self.assertEqual(['user:6', '26'], self.execFromWhere(
+                r, "idx", "age = 26", 'hget $ age'))
+
+            # the index key itself can be renamed
+            r.execute_command('RENAME', 'idx', 'idx2')
+            r.execute_command('HSET', 'user:11', 'age', 50)
+            self.assertEqual(9, r.execute_command('idx.card', 'idx2'))
+
+    def testSpecOnly(self):
+
+        with self.redis() as r:
+
+            # only prefix indexes can be rebuilt from the keyspace
+            self.assertRaises(RedisError, r.execute_command, 'idx.create', 'idx',
+                              'type', 'hash', 'speconly', 'schema', 'age', 'int32')
+
+            for i in xrange(10):
+                r.execute_command('HSET', 'user:%d' % i, 'age', 20 + i)
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'type', 'hash', 'prefix', 'user:', 'speconly',
+                'schema', 'age', 'int32'))
+
+            # the index is saved without its records, and backfilled on load
+            self.assertOk(r.execute_command('DEBUG', 'RELOAD'))
+            for _ in xrange(100):
+                info = r.execute_command('idx.info', 'idx')
+                info = dict(zip(info[::2], info[1::2]))
+                if not info['backfilling']:
+                    break
+                time.sleep(0.01)
+            self.assertEqual(0, info['backfilling'])
+            # the count starts over with the scan
+            self.assertEqual(10, info['backfill_keys'])
+            self.assertEqual(10, r.execute_command('idx.card', 'idx'))
+            self.assertEqual(['user:5', '25'], self.execFromWhere(
+                r, "idx", "age = 25", 'hget $ age'))
+
+    def testRdbLoad(self):
+
+        with self.redis() as r:
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'schema', 'string', 'int32'))
+            for i in xrange(5000):
+                r.execute_command('idx.insert', 'idx', 'id%d' % i, 'foo%d' % (i % 7), i)
+
+            # the records are decoded in the background, and loaded in order
+            self.assertOk(r.execute_command('DEBUG', 'RELOAD'))
+            self.assertEqual(5000, r.execute_command('idx.card', 'idx'))
+            self.assertEqual(['id8', 'id15'], r.execute_command(
+                'idx.select', 'idx', 'where', "$1 = 'foo1' AND $2 > 1 AND $2 < 20"))
+
+    def testPartitions(self):
+
+        with self.redis() as r:
+
+            # uniqueness can't be enforced across partitions
+            self.assertRaises(RedisError, r.execute_command, 'idx.create', 'idx',
+                              'unique', 'partitions', 4, 'schema', 'int32')
+            self.assertRaises(RedisError, r.execute_command, 'idx.create', 'idx',
+                              'partitions', 0, 'schema', 'int32')
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'partitions', 4, 'schema', 'int32'))
+            self.assertOk(r.execute_command(
+                'idx.create', 'ref', 'schema', 'int32'))
+            for i in xrange(5000):
+                r.execute_command('idx.insert', 'idx', 'id%d' % i, i % 100)
+                r.execute_command('idx.insert', 'ref', 'id%d' % i, i % 100)
+            info = r.execute_command('idx.info', 'idx')
+            info = dict(zip(info[::2], info[1::2]))
+            self.assertEqual(4, info['partitions'])
+
+            # the partitions are merged in key order, in the background too
+            for q in ("$1 >= 0", "$1 = 7", "$1 > 20 AND $1 < 30"):
+                self.assertEqual(r.execute_command('idx.select', 'ref', 'where', q),
+                                 r.execute_command('idx.select', 'idx', 'where', q))
+
+            # clients can't be blocked in transactions and scripts, so their
+            # queries run on the main thread
+            expected = r.execute_command('idx.select', 'ref', 'where', '$1 >= 0')
+            p = r.pipeline(transaction=True)
+            p.execute_command('idx.select', 'idx', 'where', '$1 >= 0')
+            self.assertEqual(expected, p.execute()[0])
+            self.assertEqual(expected, r.eval(
+                "return redis.call('idx.select', 'idx', 'where', '$1 >= 0')", 0))
+            self.assertEqual(50, r.execute_command(
+                'idx.delwhere', 'idx', 'WHERE', '$1 = 3'))
+
+            self.assertOk(r.execute_command('DEBUG', 'RELOAD'))
+            self.assertEqual(4950, r.execute_command('idx.card', 'idx'))
+            self.assertEqual(r.execute_command('idx.select', 'ref', 'where', '$1 = 7'),
+                             r.execute_command('idx.select', 'idx', 'where', '$1 = 7'))
+
+    def testAofRewrite(self):
+
+        with self.redis() as r:
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'schema', 'string', 'int32'))
+            for i in xrange(200):
+                r.execute_command('idx.insert', 'idx', 'id%d' % i, 'foo%d' % (i % 7), i)
+
+            # the records are rewritten in batches, and replayed as batches
+            self.assertOk(r.execute_command('CONFIG', 'SET', 'appendonly', 'yes'))
+            for _ in xrange(100):
+                info = r.execute_command('INFO', 'persistence')
+                if not info['aof_rewrite_in_progress'] and not info['aof_rewrite_scheduled']:
+                    break
+                time.sleep(0.05)
+            self.assertOk(r.execute_command('DEBUG', 'LOADAOF'))
+            self.assertEqual(200, r.execute_command('idx.card', 'idx'))
+            self.assertEqual(['id8', 'id15'], r.execute_command(
+                'idx.select', 'idx', 'where', "$1 = 'foo1' AND $2 > 1 AND $2 < 20"))
+            self.assertOk(r.execute_command('CONFIG', 'SET', 'appendonly', 'no'))
+
+    def testDelWhere(self):
+
+        with self.redis() as r:
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'type', 'hash', 'schema', 'age', 'int32'))
+            for i in xrange(10):
+                r.execute_command('idx.into', 'idx', 'HSET',
+                                  'user:%d' % i, 'age', 20 + i)
+
+            self.assertEqual(3, r.execute_command(
+                'idx.delwhere', 'idx', 'WHERE', 'age < 23'))
+            self.assertEqual(7, r.execute_command('idx.card', 'idx'))
+            # the keys are kept unless DELKEYS is given
+            self.assertEqual(1, r.execute_command('EXISTS', 'user:0'))
+
+            self.assertEqual(2, r.execute_command(
+                'idx.delwhere', 'idx', 'WHERE', 'age IN (24, 26)', 'DELKEYS'))
+            self.assertEqual(5, r.execute_command('idx.card', 'idx'))
+            self.assertEqual(0, r.execute_command('EXISTS', 'user:4'))
+            self.assertEqual(0, r.execute_command('EXISTS', 'user:6'))
+            self.assertEqual(0, r.execute_command(
+                'idx.delwhere', 'idx', 'WHERE', 'age > 100'))
+
+    def testExpiredHashes(self):
+
+        with self.redis() as r:
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'type', 'hash', 'schema', 'age', 'int32'))
+            for i in xrange(3):
+                r.execute_command('idx.into', 'idx', 'HSET',
+                                  'user:%d' % i, 'age', 20 + i)
+            self.assertEqual(3, r.execute_command('idx.card', 'idx'))
+
+            # expired hashes leave the index without a command naming them
+            r.execute_command('PEXPIRE', 'user:1', 1)
+            time.sleep(0.1)
+            self.assertEqual(0, r.execute_command('EXISTS', 'user:1'))
+            self.assertEqual(2, r.execute_command('idx.card', 'idx'))
+            self.assertEqual(['user:0', '20', 'user:2', '22'], self.execFromWhere(
+                r, "idx", "age >= 20", 'hget $ age'))
+
+            # so do hashes deleted directly, which is how replicas see the
+            # expirations of their master
+            self.assertEqual(1, r.execute_command('DEL', 'user:2'))
+            self.assertEqual(1, r.execute_command('idx.card', 'idx'))
+            self.assertEqual(1, r.execute_command('UNLINK', 'user:0'))
+            self.assertEqual(0, r.execute_command('idx.card', 'idx'))
+
+    def testLazyFree(self):
+
+        with self.redis() as r:
+
+            for name in ('idx1', 'idx2'):
+                self.assertOk(r.execute_command(
+                    'idx.create', name, 'schema', 'int32'))
+                for i in xrange(5000):
+                    r.execute_command('idx.insert', name, 'id%d' % i, i)
+                self.assertEqual(5000, r.execute_command('idx.card', name))
+
+            # big indexes are freed in the background
+            self.assertEqual(1, r.execute_command('UNLINK', 'idx1'))
+            self.assertEqual(0, r.execute_command('EXISTS', 'idx1'))
+            self.assertOk(r.execute_command('FLUSHALL', 'ASYNC'))
+            self.assertEqual(0, r.execute_command('EXISTS', 'idx2'))
+
+            # the freed indexes' keys can be reused right away
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx1', 'schema', 'int32'))
+            r.execute_command('idx.insert', 'idx1', 'id1', 1)
+            self.assertEqual(1, r.execute_command('idx.card', 'idx1'))
+
     def testRawIndex(self):
 
         with self.redis() as r:
@@ -99,6 +349,31 @@ class SecondaryTestCase(ModuleTestCase('../../build/src/libmodule.so')):
 
             self.assertEqual(97, r.execute_command('idx.card', 'idx'))
 
+    def testMultiInsert(self):
+
+        with self.redis() as r:
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'schema', 'string',  'int32'))
+
+            args = []
+            for i in reversed(range(100)):
+                args += ['id%d' % i, 'str%d' % i, i]
+            self.assertOk(r.execute_command('idx.minsert', 'idx', *args))
+            self.assertEqual(100, r.execute_command('idx.card', 'idx'))
+
+            # the last row of an id wins
+            self.assertOk(r.execute_command('idx.minsert', 'idx', 'id1',
+                                            'foo', 1, 'id1', 'bar', 1))
+            self.assertEqual(['id1'],  r.execute_command(
+                'idx.select', 'idx', 'WHERE', "$1 = 'bar'"))
+
+            # rows must have a value for every property
+            self.assertRaises(RedisError, r.execute_command,
+                              'idx.minsert', 'idx', 'id1', 'foo', 1, 'id2')
+            self.assertRaises(RedisError, r.execute_command,
+                              'idx.minsert', 'idx', 'id1', 'foo', 'bar')
+
     def testUniqueIndex(self):
 
         with self.redis() as r:
@@ -118,6 +393,160 @@ class SecondaryTestCase(ModuleTestCase('../../build/src/libmodule.so')):
 
             self.assertEqual(2, r.execute_command('idx.card', 'idx'))
 
+    def testExplainProfile(self):
+
+        with self.redis() as r:
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'schema', 'string',  'int32'))
+
+            for i in range(100):
+                self.assertOk(r.execute_command('idx.insert', 'idx', 'id%d' %
+                                                i, 'str%d' % (i % 10), i))
+
+            res = r.execute_command(
+                'idx.explain', 'idx', 'WHERE', "$1 = 'str1' AND $2 > 50 AND $2 < 80")
+            plan = dict(zip(res[::2], res[1::2]))
+            self.assertEqual('RANGE', plan['strategy'])
+            self.assertEqual(['("str1"::50, "str1"::+inf]'], plan['ranges'])
+            self.assertEqual('$2 < 80', plan['filter'])
+
+            res = r.execute_command(
+                'idx.profile', 'idx', 'WHERE', "$1 = 'str1' AND $2 > 50 AND $2 < 80")
+            self.assertEqual(['id51', 'id61', 'id71'], res[0])
+            stats = dict(zip(res[1][::2], res[1][1::2]))
+            self.assertEqual(3, stats['rows_returned'])
+            self.assertEqual(2, stats['rows_filtered'])
+            self.assertEqual(1, stats['ranges_scanned'])
+
+    def testCursors(self):
+
+        with self.redis() as r:
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'schema', 'int32'))
+
+            for i in range(100):
+                self.assertOk(r.execute_command(
+                    'idx.insert', 'idx', 'id%02d' % i, i))
+
+            res, cid = r.execute_command(
+                'idx.select', 'idx', 'WHERE', "$1 >= 10", 'WITHCURSOR', 'COUNT', 30)
+            self.assertEqual(['id%02d' % i for i in range(10, 40)], res)
+            self.assertNotEqual(0, cid)
+
+            # changes to the index are picked up by the cursor
+            self.assertOk(r.execute_command('idx.del', 'idx', 'id40', 'id20'))
+            res, cid = r.execute_command('idx.cursor', 'read', cid)
+            self.assertEqual(['id%02d' % i for i in range(41, 71)], res)
+
+            res, cid = r.execute_command(
+                'idx.cursor', 'read', cid, 'COUNT', 100)
+            self.assertEqual(['id%02d' % i for i in range(71, 100)], res)
+            self.assertEqual(0, cid)
+            self.assertRaises(RedisError, r.execute_command,
+                              'idx.cursor', 'read', cid)
+
+            res, cid = r.execute_command(
+                'idx.select', 'idx', 'WHERE', "$1 >= 10", 'WITHCURSOR', 'COUNT', 10)
+            # each subcommand checks its own arity
+            self.assertRaises(RedisError, r.execute_command,
+                              'idx.cursor', 'del', cid, 'extra')
+            self.assertRaises(RedisError, r.execute_command,
+                              'idx.cursor', 'read', cid, 'COUNT')
+            self.assertOk(r.execute_command('idx.cursor', 'del', cid))
+            self.assertRaises(RedisError, r.execute_command,
+                              'idx.cursor', 'read', cid)
+
+            # snapshot cursors don't see the changes made after they were opened
+            res, cid = r.execute_command(
+                'idx.select', 'idx', 'WHERE', "$1 >= 10", 'WITHCURSOR', 'COUNT', 10, 'SNAPSHOT')
+            self.assertEqual(['id%02d' % i for i in range(10, 20)], res)
+            self.assertOk(r.execute_command('idx.del', 'idx', 'id30', 'id21'))
+            self.assertOk(r.execute_command('idx.insert', 'idx', 'id20', 25))
+            res, cid = r.execute_command(
+                'idx.cursor', 'read', cid, 'COUNT', 100)
+            self.assertEqual(['id%02d' % i for i in range(21, 40)] +
+                             ['id%02d' % i for i in range(41, 100)], res)
+            self.assertEqual(0, cid)
+            self.assertEqual(['id20', 'id25', 'id26'], r.execute_command(
+                'idx.select', 'idx', 'WHERE', "$1 >= 25 AND $1 <= 26"))
+
+            # an abandoned snapshot cursor is expired by the next write, which
+            # merges the changes buffered while it pinned the index
+            res, cid = r.execute_command(
+                'idx.select', 'idx', 'WHERE', "$1 >= 10", 'WITHCURSOR', 'COUNT', 10,
+                'MAXIDLE', 10, 'SNAPSHOT')
+            self.assertOk(r.execute_command('idx.insert', 'idx', 'id21', 21))
+            info = r.execute_command('idx.info', 'idx')
+            info = dict(zip(info[::2], info[1::2]))
+            self.assertEqual(1, info['buffered_changes'])
+            time.sleep(0.05)
+            self.assertOk(r.execute_command('idx.insert', 'idx', 'id30', 30))
+            info = r.execute_command('idx.info', 'idx')
+            info = dict(zip(info[::2], info[1::2]))
+            self.assertEqual(0, info['buffered_changes'])
+            self.assertRaises(RedisError, r.execute_command,
+                              'idx.cursor', 'read', cid)
+
+            # cursors die with their index, even if it's freed in the background
+            res, cid = r.execute_command(
+                'idx.select', 'idx', 'WHERE', "$1 >= 10", 'WITHCURSOR', 'COUNT', 10)
+            self.assertOk(r.execute_command('FLUSHALL', 'ASYNC'))
+            self.assertRaises(RedisError, r.execute_command,
+                              'idx.cursor', 'read', cid)
+
+    def testMultiSelect(self):
+
+        with self.redis() as r:
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'byval', 'schema', 'int32'))
+            self.assertOk(r.execute_command(
+                'idx.create', 'bymod', 'schema', 'int32'))
+
+            for i in range(100):
+                self.assertOk(r.execute_command(
+                    'idx.insert', 'byval', 'id%02d' % i, i))
+                self.assertOk(r.execute_command(
+                    'idx.insert', 'bymod', 'id%02d' % i, i % 10))
+
+            res = r.execute_command('idx.mselect', 'AND', 'byval', 'WHERE', '$1 < 50',
+                                    'bymod', 'WHERE', '$1 = 3')
+            self.assertEqual(['id%02d' % i for i in range(3, 50, 10)], res)
+
+            res = r.execute_command('idx.mselect', 'OR', 'byval', 'WHERE', '$1 < 50',
+                                    'bymod', 'WHERE', '$1 = 3')
+            self.assertEqual(sorted(['id%02d' % i for i in range(100)
+                                     if i < 50 or i % 10 == 3]), res)
+
+            self.assertRaises(RedisError, r.execute_command, 'idx.mselect', 'XOR',
+                              'byval', 'WHERE', '$1 < 50')
+            self.assertRaises(RedisError, r.execute_command, 'idx.mselect', 'AND',
+                              'byval', 'WHERE', '$1 < 50', 'bymod')
+
+    def testTrigramLike(self):
+
+        with self.redis() as r:
+
+            self.assertOk(r.execute_command(
+                'idx.create', 'idx', 'TRIGRAM', 'schema', 'string'))
+
+            for i in range(1000):
+                self.assertOk(r.execute_command(
+                    'idx.insert', 'idx', 'id%03d' % i, 'word%d' % i))
+            self.assertOk(r.execute_command(
+                'idx.insert', 'idx', 'foo', 'some food'))
+
+            res = r.execute_command('idx.explain', 'idx', 'WHERE', "$1 LIKE '%ood%'")
+            plan = dict(zip(res[::2], res[1::2]))
+            self.assertEqual('TRIGRAM', plan['strategy'])
+            res = r.execute_command('idx.select', 'idx', 'WHERE', "$1 LIKE '%ood%'")
+            self.assertEqual(['foo'], res)
+
+            res = r.execute_command('idx.select', 'idx', 'WHERE', "$1 LIKE '%d99_'")
+            self.assertEqual(sorted(['id99%d' % i for i in range(10)]), sorted(res))
+
     def testTimeFunctions(self):
         pass
 
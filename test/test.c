@@ -5,8 +5,13 @@
 
 #include "../src/value.h"
 #include "../src/index.h"
+#include "../src/delta.h"
+#include "../src/query_plan.h"
 #include "../src/query.h"
 #include "../src/reverse_index.h"
+#include "../src/skiplist/skiplist.h"
+#include "../src/thread_pool.h"
+#include "../src/block_codec.h"
 #include "../src/rmutil/alloc.h"
 
 int cmpstr(void *p1, void *p2, void *ctx) {
@@ -144,8 +149,68 @@ MU_TEST(testUniqueIndex) {
   int rc = idx.Apply(idx.ctx, cs);
   printf("%d\n", rc);
 
+  // a batch with a duplicate key is not applied at all
   mu_check(rc == SI_INDEX_DUPLICATE_KEY);
-  mu_check(idx.Len(idx.ctx) == 1);
+  mu_check(idx.Len(idx.ctx) == 0);
+
+  cs.changes[1] = SI_NewAddChange("id2", 1, SI_StringValC("bar"));
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+  mu_check(idx.Len(idx.ctx) == 2);
+
+  // taking the key of an id that isn't in the batch fails the whole batch
+  cs.changes[0] = SI_NewAddChange("id3", 1, SI_StringValC("baz"));
+  cs.changes[1] = SI_NewAddChange("id4", 1, SI_StringValC("foo"));
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_DUPLICATE_KEY);
+  mu_check(idx.Len(idx.ctx) == 2);
+
+  // but ids may swap keys in a single batch
+  cs.changes[0] = SI_NewAddChange("id1", 1, SI_StringValC("bar"));
+  cs.changes[1] = SI_NewAddChange("id2", 1, SI_StringValC("foo"));
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+  mu_check(idx.Len(idx.ctx) == 2);
+  testQuery(idx, &spec, "$1 = 'foo'", (const char *[]){"id2", NULL});
+  testQuery(idx, &spec, "$1 = 'bar'", (const char *[]){"id1", NULL});
+}
+
+/* Add rows (i % mod, i), or delete them, with ids prefix0, prefix1... */
+void applyChurn(SIIndex *idx, char *prefix, int num, int mod, int del) {
+  SIChangeSet cs = SI_NewChangeSet(num);
+  for (int i = 0; i < num; i++) {
+    char id[32];
+    sprintf(id, "%s%d", prefix, i);
+    SIChangeSet_AddCahnge(
+        &cs, del ? SI_NewDelChange(strdup(id))
+                 : SI_NewAddChange(strdup(id), 2, SI_IntVal(i % mod),
+                                   SI_IntVal(i)));
+  }
+  mu_check(idx->Apply(idx->ctx, cs) == SI_INDEX_OK);
+  SIChangeSet_Free(&cs);
+}
+
+MU_TEST(testStatsChurn) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32},
+                                                   {.type = T_INT32}},
+                 .numProps = 2};
+  SIIndex idx = SI_NewCompoundIndex(spec);
+
+  // a unique leading column is not worth skipping over
+  applyChurn(&idx, "a", 2000, 2000, 0);
+  SIQuery q = SI_NewQuery();
+  mu_check(SI_ParseQuery(&q, "$2 = 3", 6, &spec, NULL));
+  SIQueryPlan *plan = idx.Explain(idx.ctx, &q);
+  mu_check(plan->strategy == QP_FULLSCAN);
+  SIQueryPlan_Free(plan);
+
+  // once those rows are replaced by rows with few leading values, the
+  // statistics only describe the live rows
+  applyChurn(&idx, "a", 2000, 2000, 1);
+  applyChurn(&idx, "b", 2000, 10, 0);
+  plan = idx.Explain(idx.ctx, &q);
+  mu_check(plan->strategy == QP_SKIPSCAN);
+  SIQueryPlan_Free(plan);
+  SIQuery_Free(&q);
+
+  idx.Free(idx.ctx);
 }
 
 MU_TEST(testIndexingQuerying) {
@@ -226,6 +291,1276 @@ MU_TEST(testNull) {
   testQuery(idx, &spec, str, (const char *[]){"id1", "id3", NULL});
   str = "name IS NULL";
   testQuery(idx, &spec, str, (const char *[]){"id4", "id5", NULL});
+  // NULLs are never different from a value
+  str = "name != 'foo'";
+  testQuery(idx, &spec, str, (const char *[]){"id2", "id3", NULL});
+  str = "name != 'foo' AND name != 'fooz'";
+  testQuery(idx, &spec, str, (const char *[]){"id2", NULL});
+}
+
+MU_TEST(testSkipScan) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_STRING},
+                                                   {.type = T_INT32}},
+                 .numProps = 2};
+
+  SIIndex idx = SI_NewCompoundIndex(spec);
+
+  // a leading column with just a few distinct values
+  const char *names[] = {"bar", "baz", "foo"};
+  char *ids[3000];
+  SIChangeSet cs = SI_NewChangeSet(3000);
+  for (int i = 0; i < 3000; i++) {
+    ids[i] = malloc(16);
+    sprintf(ids[i], "id%d", i);
+    SIChangeSet_AddCahnge(
+        &cs, SI_NewAddChange(ids[i], 2, SI_StringValC((char *)names[i % 3]),
+                             SI_IntVal(i / 10)));
+  }
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+
+  // id1000, id1001, id1002 ... id1009
+  testQuery(idx, &spec, "$2 = 100",
+            (const char *[]){"id1000", "id1001", "id1002", "id1003", "id1004",
+                             "id1005", "id1006", "id1007", "id1008", "id1009",
+                             NULL});
+  testQuery(idx, &spec, "$2 = 100 AND $1 IN ('bar', 'baz')",
+            (const char *[]){"id1000", "id1002", "id1003", "id1005", "id1006",
+                             "id1008", "id1009", NULL});
+
+  // make sure we got all of them
+  SIQuery q = SI_NewQuery();
+  char *str = "$2 >= 10 AND $2 < 20";
+  mu_check(SI_ParseQuery(&q, str, strlen(str), &spec, NULL));
+  SICursor *c = idx.Find(idx.ctx, &q);
+  mu_check(c->error == SI_CURSOR_OK);
+  int n = 0;
+  while (NULL != c->Next(c->ctx)) {
+    n++;
+  }
+  mu_assert_int_eq(100, n);
+  SICursor_Free(c);
+  SIQuery_Free(&q);
+}
+
+MU_TEST(testCursorStats) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32},
+                                                   {.type = T_INT32}},
+                 .numProps = 2};
+
+  SIIndex idx = SI_NewCompoundIndex(spec);
+  SIChangeSet cs = SI_NewChangeSet(100);
+  for (int i = 0; i < 100; i++) {
+    char *id = malloc(16);
+    sprintf(id, "id%d", i);
+    SIChangeSet_AddCahnge(
+        &cs, SI_NewAddChange(id, 2, SI_IntVal(i), SI_IntVal(i % 2)));
+  }
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+
+  // 10 rows in the range, half of them filtered out by the second predicate
+  SIQuery q = SI_NewQuery();
+  char *str = "$1 >= 90 AND $2 = 1";
+  mu_check(SI_ParseQuery(&q, str, strlen(str), &spec, NULL));
+  SICursor *c = idx.Find(idx.ctx, &q);
+  mu_check(c->error == SI_CURSOR_OK);
+  int n = 0;
+  while (NULL != c->Next(c->ctx)) {
+    n++;
+  }
+  mu_assert_int_eq(5, n);
+  mu_assert_int_eq(5, c->stats.rowsReturned);
+  mu_assert_int_eq(5, c->stats.rowsFiltered);
+  mu_assert_int_eq(1, c->stats.rangesScanned);
+  mu_assert_int_eq(10, c->stats.nodesVisited);
+  // at least one filter comparison per row
+  mu_check(c->stats.comparisons > 10);
+  mu_check(c->stats.planTime >= 0);
+  SICursor_Free(c);
+  SIQuery_Free(&q);
+  idx.Free(idx.ctx);
+}
+
+MU_TEST(testCursorResume) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32}},
+                 .numProps = 1};
+
+  SIIndex idx = SI_NewCompoundIndex(spec);
+  SIChangeSet cs = SI_NewChangeSet(300);
+  // 10 ids per key
+  for (int i = 0; i < 300; i++) {
+    char *id = malloc(16);
+    sprintf(id, "id%03d", i);
+    SIChangeSet_AddCahnge(&cs, SI_NewAddChange(id, 1, SI_IntVal(i / 10)));
+  }
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+
+  SIQuery q = SI_NewQuery();
+  char *str = "$1 >= 0";
+  mu_check(SI_ParseQuery(&q, str, strlen(str), &spec, NULL));
+  SICursor *c = idx.Find(idx.ctx, &q);
+  mu_check(c->error == SI_CURSOR_OK);
+
+  int n = 0;
+  SIId id;
+  // suspending without changes just continues the scan
+  while (n < 50 && NULL != (id = c->Next(c->ctx))) {
+    n++;
+  }
+  c->Suspend(c->ctx);
+  while (n < 105 && NULL != (id = c->Next(c->ctx))) {
+    n++;
+  }
+  mu_check(!strcmp(id, "id104"));
+  c->Suspend(c->ctx);
+
+  // delete the next id in line, a whole key ahead of the scan, and ids behind
+  // and ahead of it. then insert ids behind and ahead of it
+  cs = SI_NewChangeSet(20);
+  SIChangeSet_AddCahnge(&cs, SI_NewDelChange("id105"));
+  SIChangeSet_AddCahnge(&cs, SI_NewDelChange("id050"));
+  SIChangeSet_AddCahnge(&cs, SI_NewDelChange("id200"));
+  for (int i = 110; i < 120; i++) {
+    char *del = malloc(16);
+    sprintf(del, "id%03d", i);
+    SIChangeSet_AddCahnge(&cs, SI_NewDelChange(del));
+  }
+  SIChangeSet_AddCahnge(&cs, SI_NewAddChange(strdup("id999"), 1, SI_IntVal(5)));
+  SIChangeSet_AddCahnge(&cs,
+                        SI_NewAddChange(strdup("id998"), 1, SI_IntVal(20)));
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+
+  int resumed = 0;
+  while (NULL != (id = c->Next(c->ctx))) {
+    int num = atoi(id + 2);
+    mu_check(num == 998 || (num > 105 && num < 300));
+    mu_check(num != 200 && (num < 110 || num >= 120));
+    resumed++;
+  }
+  // 195 ids left, 12 of them deleted and one inserted
+  mu_assert_int_eq(184, resumed);
+  SICursor_Free(c);
+  SIQuery_Free(&q);
+  idx.Free(idx.ctx);
+}
+
+MU_TEST(testMergeCursors) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32}},
+                 .numProps = 1};
+
+  // two indexes on the same ids, by value and by value mod 10
+  SIIndex byVal = SI_NewCompoundIndex(spec);
+  SIIndex byMod = SI_NewCompoundIndex(spec);
+  SIChangeSet cs1 = SI_NewChangeSet(100), cs2 = SI_NewChangeSet(100);
+  for (int i = 0; i < 100; i++) {
+    char *id = malloc(16);
+    sprintf(id, "id%02d", i);
+    SIChangeSet_AddCahnge(&cs1, SI_NewAddChange(id, 1, SI_IntVal(i)));
+    SIChangeSet_AddCahnge(&cs2,
+                          SI_NewAddChange(strdup(id), 1, SI_IntVal(i % 10)));
+  }
+  mu_check(byVal.Apply(byVal.ctx, cs1) == SI_INDEX_OK);
+  mu_check(byMod.Apply(byMod.ctx, cs2) == SI_INDEX_OK);
+
+  char *strs[] = {"$1 < 50", "$1 = 3"};
+  SIIndex *idxs[] = {&byVal, &byMod};
+  SIQuery qs[4];
+  SICursor *cs[4];
+  for (int i = 0; i < 4; i++) {
+    qs[i] = SI_NewQuery();
+    mu_check(SI_ParseQuery(&qs[i], strs[i % 2], strlen(strs[i % 2]), &spec,
+                           NULL));
+    cs[i] = idxs[i % 2]->Find(idxs[i % 2]->ctx, &qs[i]);
+    mu_check(cs[i]->error == SI_CURSOR_OK);
+  }
+
+  // the cursor expected to return fewer rows drives the intersection
+  double rows = cs[1]->stats.estimatedRows;
+  mu_check(rows > 0 && rows < cs[0]->stats.estimatedRows);
+  SICursor *c = SI_NewIntersectCursor(cs, 2);
+  mu_check(c->stats.estimatedRows == rows);
+  SIId id;
+  int n = 0;
+  while (NULL != (id = c->Next(c->ctx))) {
+    char expected[16];
+    sprintf(expected, "id%02d", n * 10 + 3);
+    mu_check(!strcmp(expected, id));
+    n++;
+  }
+  mu_assert_int_eq(5, n);
+  mu_assert_int_eq(5, c->stats.rowsReturned);
+  SICursor_Free(c);
+
+  rows = cs[2]->stats.estimatedRows + cs[3]->stats.estimatedRows;
+  c = SI_NewUnionCursor(&cs[2], 2);
+  mu_check(c->stats.estimatedRows == rows);
+  SIId prev = NULL;
+  n = 0;
+  while (NULL != (id = c->Next(c->ctx))) {
+    int num = atoi(id + 2);
+    mu_check(num < 50 || num % 10 == 3);
+    // sorted without duplicates
+    mu_check(!prev || strcmp(prev, id) < 0);
+    prev = id;
+    n++;
+  }
+  mu_assert_int_eq(55, n);
+  SICursor_Free(c);
+
+  for (int i = 0; i < 4; i++) {
+    SIQuery_Free(&qs[i]);
+  }
+  byVal.Free(byVal.ctx);
+  byMod.Free(byMod.ctx);
+}
+
+MU_TEST(testTrigramIndex) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_STRING,
+                                                    .flags = SI_PROP_TRIGRAM}},
+                 .numProps = 1};
+  SISpec plainSpec = {.properties = (SIIndexProperty[]){{.type = T_STRING}},
+                      .numProps = 1};
+
+  SIIndex idx = SI_NewCompoundIndex(spec);
+  SIIndex plain = SI_NewCompoundIndex(plainSpec);
+  // the words are mixed with many other values, so the trigram index is worth
+  // using
+  char *words[] = {"foobar", "barfoo", "football", "bar", "fo", "xfooy"};
+  for (int n = 0; n < 100; n++) {
+    SIChangeSet cs = SI_NewChangeSet(16), pcs = SI_NewChangeSet(16);
+    for (int i = 0; i < 16; i++) {
+      char *id = malloc(16), *val = malloc(16);
+      sprintf(id, "id%d_%d", n, i);
+      if (i < 6) {
+        strcpy(val, words[i]);
+      } else {
+        sprintf(val, "other%d", n * 16 + i);
+      }
+      SIChangeSet_AddCahnge(&cs, SI_NewAddChange(id, 1, SI_StringValC(val)));
+      SIChangeSet_AddCahnge(&pcs, SI_NewAddChange(strdup(id), 1,
+                                                  SI_StringValC(strdup(val))));
+    }
+    mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+    mu_check(plain.Apply(plain.ctx, pcs) == SI_INDEX_OK);
+  }
+
+  // update and delete some records, their old values must not be matched
+  SIChangeSet cs = SI_NewChangeSet(2), pcs = SI_NewChangeSet(2);
+  SIChangeSet_AddCahnge(&cs, SI_NewAddChange(strdup("id0_0"), 1,
+                                             SI_StringValC(strdup("nothing"))));
+  SIChangeSet_AddCahnge(&cs, SI_NewDelChange("id1_0"));
+  SIChangeSet_AddCahnge(&pcs, SI_NewAddChange(strdup("id0_0"), 1,
+                                              SI_StringValC(strdup("nothing"))));
+  SIChangeSet_AddCahnge(&pcs, SI_NewDelChange("id1_0"));
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+  mu_check(plain.Apply(plain.ctx, pcs) == SI_INDEX_OK);
+
+  char *strs[] = {"$1 LIKE '%foo%'", "$1 LIKE '%foo'", "$1 LIKE '%o_ba%'",
+                  "$1 LIKE '%zzz%'"};
+  int expected[] = {398, 100, 198, 0};
+  // '%o_ba%' has no trigram, and must be scanned
+  int usesTrigrams[] = {1, 1, 0, 1};
+  for (int i = 0; i < 4; i++) {
+    SIQuery q = SI_NewQuery(), pq = SI_NewQuery();
+    mu_check(SI_ParseQuery(&q, strs[i], strlen(strs[i]), &spec, NULL));
+    mu_check(SI_ParseQuery(&pq, strs[i], strlen(strs[i]), &spec, NULL));
+    SICursor *c = idx.Find(idx.ctx, &q);
+    SICursor *pc = plain.Find(plain.ctx, &pq);
+    mu_check(c->error == SI_CURSOR_OK && pc->error == SI_CURSOR_OK);
+    // trigram candidates are verified against the current index, and can't be
+    // read from a snapshot
+    mu_assert_int_eq(!usesTrigrams[i], idx.Snapshot(idx.ctx, c));
+
+    int n = 0, pn = 0;
+    while (NULL != c->Next(c->ctx)) n++;
+    while (NULL != pc->Next(pc->ctx)) pn++;
+    mu_assert_int_eq(expected[i], n);
+    mu_assert_int_eq(pn, n);
+    // the trigram index only verifies candidates, it does not scan
+    mu_check(!usesTrigrams[i] ||
+             c->stats.nodesVisited < pc->stats.nodesVisited);
+
+    SICursor_Free(c);
+    SICursor_Free(pc);
+    SIQuery_Free(&q);
+    SIQuery_Free(&pq);
+  }
+  idx.Free(idx.ctx);
+  plain.Free(plain.ctx);
+}
+
+int countResults(SIIndex *idx, SISpec *spec, char *str) {
+  SIQuery q = SI_NewQuery();
+  if (!SI_ParseQuery(&q, str, strlen(str), spec, NULL)) {
+    return -1;
+  }
+  SICursor *c = idx->Find(idx->ctx, &q);
+  int n = 0;
+  while (c->error == SI_CURSOR_OK && NULL != c->Next(c->ctx)) n++;
+  SICursor_Free(c);
+  SIQuery_Free(&q);
+  return n;
+}
+
+MU_TEST(testCollation) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_STRING}},
+                 .numProps = 1};
+  SISpec binSpec = {.properties = (SIIndexProperty[]){{
+                        .type = T_STRING, .flags = SI_PROP_CASESENSITIVE}},
+                    .numProps = 1};
+
+  SIIndex idx = SI_NewCompoundIndex(spec);
+  SIIndex bin = SI_NewCompoundIndex(binSpec);
+  char *vals[] = {"Foo", "FOO", "foobar", "bar"};
+  SIChangeSet cs = SI_NewChangeSet(4), bcs = SI_NewChangeSet(4);
+  for (int i = 0; i < 4; i++) {
+    char *id = malloc(16);
+    sprintf(id, "id%d", i);
+    SIChangeSet_AddCahnge(&cs, SI_NewAddChange(id, 1,
+                                               SI_StringValC(strdup(vals[i]))));
+    SIChangeSet_AddCahnge(&bcs, SI_NewAddChange(strdup(id), 1,
+                                                SI_StringValC(strdup(vals[i]))));
+  }
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+  mu_check(bin.Apply(bin.ctx, bcs) == SI_INDEX_OK);
+
+  // values are folded when indexed, and queries when planned
+  mu_assert_int_eq(2, countResults(&idx, &spec, "$1 = 'fOO'"));
+  mu_assert_int_eq(3, countResults(&idx, &spec, "$1 LIKE 'FOO%'"));
+  mu_assert_int_eq(2, countResults(&idx, &spec, "$1 LIKE '%BAR'"));
+  mu_assert_int_eq(3, countResults(&idx, &spec, "$1 IN ('foo', 'BAR')"));
+
+  mu_assert_int_eq(0, countResults(&bin, &binSpec, "$1 = 'fOO'"));
+  mu_assert_int_eq(1, countResults(&bin, &binSpec, "$1 = 'Foo'"));
+  mu_assert_int_eq(1, countResults(&bin, &binSpec, "$1 LIKE 'foo%'"));
+  // binary order - uppercase letters come first
+  mu_assert_int_eq(2, countResults(&bin, &binSpec, "$1 < 'a'"));
+
+  idx.Free(idx.ctx);
+  bin.Free(bin.ctx);
+}
+
+int numIntCmps = 0;
+int cmpIntPtrs(void *p1, void *p2, void *ctx) {
+  numIntCmps++;
+  intptr_t i1 = (intptr_t)p1, i2 = (intptr_t)p2;
+  return i1 < i2 ? -1 : i1 > i2;
+}
+int cmpIntVals(void *p1, void *p2) { return cmpIntPtrs(p1, p2, NULL); }
+
+/* Check the order and the spans of every level of a skiplist */
+int checkSkiplist(skiplist *sl) {
+  unsigned long len = 0;
+  for (skiplistNode *x = sl->header->level[0].forward; x;
+       x = x->level[0].forward) {
+    if (x->level[0].forward && cmpIntPtrs(x->obj, x->level[0].forward->obj,
+                                          NULL) >= 0) {
+      return 0;
+    }
+    len++;
+  }
+  if (len != sl->length) return 0;
+
+  for (int i = 0; i < sl->level; i++) {
+    unsigned long total = 0;
+    for (skiplistNode *x = sl->header; x; x = x->level[i].forward) {
+      // walking the span on the bottom level must lead to the next node
+      skiplistNode *y = x;
+      for (unsigned int j = 0; j < x->level[i].span && y; j++) {
+        y = y->level[0].forward;
+      }
+      if (x->level[i].forward && y != x->level[i].forward) return 0;
+      total += x->level[i].span;
+    }
+    if (total != sl->length) return 0;
+  }
+  return 1;
+}
+
+MU_TEST(testSkiplistFinger) {
+  int n = 10000;
+
+  // ascending inserts continue from the previous insert position
+  skiplist *sl = skiplistCreate(cmpIntPtrs, NULL, cmpIntVals);
+  numIntCmps = 0;
+  for (intptr_t i = 0; i < n; i++) {
+    skiplistInsert(sl, (void *)(i * 2), (void *)i);
+  }
+  mu_check(checkSkiplist(sl));
+  mu_check(numIntCmps < 3 * n);
+
+  // inserts before the finger, into gaps, of existing keys, and after deletes
+  for (intptr_t i = n - 1; i >= 0; i -= 7) {
+    skiplistInsert(sl, (void *)(i * 2 + 1), (void *)i);
+  }
+  mu_check(checkSkiplist(sl));
+  for (intptr_t i = 0; i < n; i += 3) {
+    skiplistInsert(sl, (void *)(i * 2), (void *)(i + 1));
+    if (i % 2) {
+      skiplistDelete(sl, (void *)(i * 2 + 2), NULL);
+    }
+  }
+  mu_check(checkSkiplist(sl));
+  for (intptr_t i = 0; i < n; i++) {
+    skiplistInsert(sl, (void *)(random() % (4 * n)), (void *)i);
+  }
+  mu_check(checkSkiplist(sl));
+  skiplistFree(sl);
+}
+
+MU_TEST(testSkiplistUpsert) {
+  int n = 1000, space = 20 * n;
+  intptr_t *keys = calloc(n + 1, sizeof(intptr_t));
+  intptr_t *owners = calloc(space, sizeof(intptr_t));
+
+  // a unique skiplist moves the values around, and rejects taken keys
+  skiplist *sl = skiplistCreate(cmpIntPtrs, NULL, cmpIntVals);
+  for (intptr_t v = 1; v <= n; v++) {
+    keys[v] = v * 10;
+    owners[keys[v]] = v;
+    mu_assert_int_eq(SKIPLIST_UPSERT_OK,
+                     skiplistUpsert(sl, (void *)keys[v], NULL, (void *)v, 1,
+                                    NULL));
+  }
+  for (int i = 0; i < 10 * n; i++) {
+    intptr_t v = 1 + random() % n, k = random() % space;
+    skiplistNode *node;
+    int rc = skiplistUpsert(sl, (void *)k, (void *)keys[v], (void *)v, 1,
+                            &node);
+    if (owners[k] && owners[k] != v) {
+      mu_assert_int_eq(SKIPLIST_UPSERT_DUPLICATE, rc);
+      continue;
+    }
+    mu_check(node->obj == (void *)k && node->numVals == 1 &&
+             node->vals[0] == (void *)v);
+    if (owners[k] == v) {
+      mu_assert_int_eq(SKIPLIST_UPSERT_OK, rc);
+      continue;
+    }
+    mu_assert_int_eq(SKIPLIST_UPSERT_RELEASED, rc);
+    owners[keys[v]] = 0;
+    owners[k] = v;
+    keys[v] = k;
+    if (i % 100 == 0) {
+      mu_check(checkSkiplist(sl));
+    }
+  }
+  mu_check(checkSkiplist(sl));
+  mu_assert_int_eq(n, skiplistLength(sl));
+  for (intptr_t v = 1; v <= n; v++) {
+    skiplistNode *node = skiplistFind(sl, (void *)keys[v]);
+    mu_check(node && node->vals[0] == (void *)v);
+  }
+  skiplistFree(sl);
+
+  // values join and leave shared nodes in a non unique skiplist
+  sl = skiplistCreate(cmpIntPtrs, NULL, cmpIntVals);
+  skiplistUpsert(sl, (void *)10, NULL, (void *)1, 0, NULL);
+  skiplistUpsert(sl, (void *)20, NULL, (void *)2, 0, NULL);
+  skiplistNode *node;
+  mu_assert_int_eq(SKIPLIST_UPSERT_RELEASED,
+                   skiplistUpsert(sl, (void *)20, (void *)10, (void *)1, 0,
+                                  &node));
+  mu_assert_int_eq(2, node->numVals);
+  mu_assert_int_eq(SKIPLIST_UPSERT_OK,
+                   skiplistUpsert(sl, (void *)5, (void *)20, (void *)2, 0,
+                                  &node));
+  mu_check(node->obj == (void *)5);
+  mu_assert_int_eq(2, skiplistLength(sl));
+  mu_check(checkSkiplist(sl));
+  skiplistFree(sl);
+
+  // unique inserts of new keys descend once instead of twice
+  sl = skiplistCreate(cmpIntPtrs, NULL, cmpIntVals);
+  skiplist *ref = skiplistCreate(cmpIntPtrs, NULL, cmpIntVals);
+  int upsertCmps = 0, refCmps = 0;
+  for (intptr_t v = 1; v <= n; v++) {
+    intptr_t k = (v * 7919) % space;
+    numIntCmps = 0;
+    skiplistUpsert(sl, (void *)k, NULL, (void *)v, 1, NULL);
+    upsertCmps += numIntCmps;
+    numIntCmps = 0;
+    if (!skiplistFind(ref, (void *)k)) {
+      skiplistInsert(ref, (void *)k, (void *)v);
+    }
+    refCmps += numIntCmps;
+  }
+  mu_check(upsertCmps * 3 < refCmps * 2);
+  skiplistFree(sl);
+  skiplistFree(ref);
+
+  free(keys);
+  free(owners);
+}
+
+MU_TEST(testUpdateInPlace) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32}},
+                 .numProps = 1};
+  SIIndex idx = SI_NewCompoundIndex(spec);
+
+  for (int i = 0; i < 3; i++) {
+    SIChangeSet cs = SI_NewChangeSet(5);
+    // unchanged, moved within its gap, moved past a neighbour, and into
+    // another id's node
+    int vals[][5] = {{10, 20, 30, 40, 50}, {10, 21, 30, 40, 50},
+                     {10, 21, 45, 40, 40}};
+    for (int j = 0; j < 5; j++) {
+      char *id = malloc(16);
+      sprintf(id, "id%d", j);
+      SIChangeSet_AddCahnge(&cs, SI_NewAddChange(id, 1, SI_IntVal(vals[i][j])));
+    }
+    mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+    mu_assert_int_eq(5, idx.Len(idx.ctx));
+    SIChangeSet_Free(&cs);
+  }
+
+  testQuery(idx, &spec, "$1 = 21", (const char *[]){"id1", NULL});
+  testQuery(idx, &spec, "$1 = 40", (const char *[]){"id3", "id4", NULL});
+  testQuery(idx, &spec, "$1 > 40", (const char *[]){"id2", NULL});
+  mu_assert_int_eq(0, countResults(&idx, &spec, "$1 = 20"));
+  mu_assert_int_eq(0, countResults(&idx, &spec, "$1 = 50"));
+  mu_assert_int_eq(5, countResults(&idx, &spec, "$1 >= 0"));
+}
+
+MU_TEST(testBatchInsert) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32},
+                                                   {.type = T_STRING}},
+                 .numProps = 2};
+  SIIndex idx = SI_NewCompoundIndex(spec);
+
+  // unordered keys, and an id changed twice in the same batch
+  int vals[] = {5, 3, 9, 1, 3, 7};
+  char *ids[] = {"id0", "id1", "id2", "id3", "id1", "id4"};
+  SIChangeSet cs = SI_NewChangeSet(6);
+  for (int i = 0; i < 6; i++) {
+    SIChangeSet_AddCahnge(
+        &cs, SI_NewAddChange(strdup(ids[i]), 2,
+                             SI_IntVal(vals[i] * (i == 4 ? 2 : 1)),
+                             SI_StringValC(strdup("foo"))));
+  }
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+  mu_assert_int_eq(5, idx.Len(idx.ctx));
+
+  testQuery(idx, &spec, "$1 >= 0",
+            (const char *[]){"id3", "id0", "id1", "id4", "id2", NULL});
+  testQuery(idx, &spec, "$1 = 3", (const char *[]){NULL});
+
+  // mismatched values fail the whole batch before applying any of it
+  SIChangeSet bad = SI_NewChangeSet(2);
+  SIChangeSet_AddCahnge(&bad, SI_NewAddChange("id5", 2, SI_IntVal(2),
+                                              SI_StringValC(strdup("foo"))));
+  SIChangeSet_AddCahnge(&bad, SI_NewAddChange("id6", 1, SI_IntVal(4)));
+  mu_check(idx.Apply(idx.ctx, bad) == SI_INDEX_ERROR);
+  mu_assert_int_eq(5, idx.Len(idx.ctx));
+
+  idx.Free(idx.ctx);
+}
+
+/* Concatenate the ids a query returns, in order */
+void queryIds(SIIndex *idx, SISpec *spec, char *str, char *buf, size_t len) {
+  SIQuery q = SI_NewQuery();
+  SI_ParseQuery(&q, str, strlen(str), spec, NULL);
+  SICursor *c = idx->Find(idx->ctx, &q);
+  SIId id;
+  buf[0] = 0;
+  while (c->error == SI_CURSOR_OK && NULL != (id = c->Next(c->ctx))) {
+    strncat(buf, id, len - strlen(buf) - 2);
+    strcat(buf, ",");
+  }
+  SICursor_Free(c);
+  SIQuery_Free(&q);
+}
+
+void traverseIds(SIId id, void *key, void *ctx) {
+  strcat(ctx, id);
+  strcat(ctx, ",");
+}
+
+MU_TEST(testDeltaIndex) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32},
+                                                   {.type = T_INT32}},
+                 .numProps = 2};
+  SISpec deltaSpec = spec;
+  deltaSpec.flags = SI_INDEX_DELTA;
+  SIIndex idx = SI_NewCompoundIndex(spec);
+  SIIndex delta = SI_NewCompoundIndex(deltaSpec);
+
+  // the same random changes applied with and without a delta buffer, through
+  // a few merges, must give the same results in the same order
+  size_t len = 64 * 1024;
+  char *expected = malloc(len), *got = malloc(len);
+  char *queries[] = {"$1 >= 0", "$2 = 3", "$1 = 7 AND $2 > 4",
+                     "$1 > 40 OR $1 < 3"};
+  for (int round = 0; round < 100; round++) {
+    // the first round fills the main skiplist, so later changes leave
+    // tombstones in the buffer
+    int num = round ? 200 : 5000;
+    SIChangeSet cs = SI_NewChangeSet(num);
+    for (int i = 0; i < num; i++) {
+      char id[16];
+      sprintf(id, "id%ld", round ? random() % 5000 : i);
+      if (round && random() % 4 == 0) {
+        SIChangeSet_AddCahnge(&cs, SI_NewDelChange(strdup(id)));
+      } else {
+        SIChangeSet_AddCahnge(&cs, SI_NewAddChange(strdup(id), 2,
+                                                   SI_IntVal(random() % 50),
+                                                   SI_IntVal(random() % 10)));
+      }
+    }
+    mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+    for (size_t i = 0; i < cs.numChanges; i++) {
+      cs.changes[i].id = strdup(cs.changes[i].id);
+    }
+    mu_check(delta.Apply(delta.ctx, cs) == SI_INDEX_OK);
+    SIChangeSet_Free(&cs);
+    mu_assert_int_eq(idx.Len(idx.ctx), delta.Len(delta.ctx));
+
+    if (round % 10 == 0) {
+      for (int i = 0; i < 4; i++) {
+        queryIds(&idx, &spec, queries[i], expected, len);
+        queryIds(&delta, &deltaSpec, queries[i], got, len);
+        mu_check(!strcmp(expected, got));
+      }
+      expected[0] = got[0] = 0;
+      idx.Traverse(idx.ctx, traverseIds, expected);
+      delta.Traverse(delta.ctx, traverseIds, got);
+      mu_check(!strcmp(expected, got));
+    }
+  }
+
+  // once the buffer is full, it's merged a bounded number of entries at a
+  // time over the following writes, until it's empty
+  size_t before = delta.Buffered(delta.ctx);
+  int drained = 0;
+  for (int i = 0; i < 2 * SI_DELTA_MAX_CHANGES && !drained; i++) {
+    char id[16];
+    sprintf(id, "new%d", i);
+    SIChangeSet cs = SI_NewChangeSet(1);
+    SIChangeSet_AddCahnge(&cs, SI_NewAddChange(strdup(id), 2, SI_IntVal(i % 50),
+                                               SI_IntVal(i % 10)));
+    mu_check(delta.Apply(delta.ctx, cs) == SI_INDEX_OK);
+    SIChangeSet_Free(&cs);
+    size_t after = delta.Buffered(delta.ctx);
+    mu_check(after + SI_DELTA_MERGE_STEP + 2 >= before + 1);
+    mu_check(after <= SI_DELTA_MAX_CHANGES);
+    drained = before > after && !after;
+    before = after;
+  }
+  mu_check(drained);
+  mu_assert_int_eq(delta.Len(delta.ctx),
+                   countResults(&delta, &deltaSpec, "$1 >= 0"));
+
+  // unique indexes see the keys in the buffer, and not the deleted ones
+  deltaSpec.flags |= SI_INDEX_UNIQUE;
+  SIIndex uniq = SI_NewCompoundIndex(deltaSpec);
+  SIChangeSet cs = SI_NewChangeSet(1);
+  SIChangeSet_AddCahnge(&cs, SI_NewAddChange(strdup("a"), 2, SI_IntVal(1),
+                                             SI_IntVal(1)));
+  mu_check(uniq.Apply(uniq.ctx, cs) == SI_INDEX_OK);
+  cs.changes[0] = SI_NewAddChange(strdup("b"), 2, SI_IntVal(1), SI_IntVal(1));
+  mu_assert_int_eq(SI_INDEX_DUPLICATE_KEY, uniq.Apply(uniq.ctx, cs));
+  cs.changes[0] = SI_NewDelChange("a");
+  mu_check(uniq.Apply(uniq.ctx, cs) == SI_INDEX_OK);
+  cs.changes[0] = SI_NewAddChange(strdup("b"), 2, SI_IntVal(1), SI_IntVal(1));
+  mu_check(uniq.Apply(uniq.ctx, cs) == SI_INDEX_OK);
+  mu_assert_int_eq(1, countResults(&uniq, &deltaSpec, "$1 = 1"));
+  SIChangeSet_Free(&cs);
+
+  free(expected);
+  free(got);
+  idx.Free(idx.ctx);
+  delta.Free(delta.ctx);
+  uniq.Free(uniq.ctx);
+}
+
+MU_TEST(testSkiplistDeleteRange) {
+  skiplist *sl = skiplistCreate(cmpIntPtrs, NULL, cmpIntVals);
+  for (intptr_t i = 0; i < 1000; i++) {
+    skiplistInsert(sl, (void *)(i * 2), (void *)i);
+  }
+
+  // a run in the middle is unlinked with one descent and a comparison per node
+  numIntCmps = 0;
+  mu_assert_int_eq(100, skiplistDeleteRange(sl, (void *)100, (void *)300, 0,
+                                            1, NULL, NULL));
+  mu_check(numIntCmps < 200);
+  mu_check(checkSkiplist(sl));
+  mu_assert_int_eq(900, skiplistLength(sl));
+  mu_check(skiplistFind(sl, (void *)98) && skiplistFind(sl, (void *)300));
+  mu_check(!skiplistFind(sl, (void *)100) && !skiplistFind(sl, (void *)298));
+
+  // exclusive bounds, empty ranges, and everything up to the tail
+  mu_assert_int_eq(1, skiplistDeleteRange(sl, (void *)300, (void *)304, 1, 1,
+                                          NULL, NULL));
+  mu_assert_int_eq(0, skiplistDeleteRange(sl, (void *)301, (void *)301, 0, 0,
+                                          NULL, NULL));
+  mu_assert_int_eq(500, skiplistDeleteRange(sl, (void *)1000, NULL, 0, 0, NULL,
+                                            NULL));
+  mu_check(checkSkiplist(sl));
+  mu_assert_int_eq(399, skiplistLength(sl));
+  mu_check(sl->tail->obj == (void *)998);
+  skiplistFree(sl);
+}
+
+/* Delete the ids a query returns one by one, and return how many there were */
+long deleteQueryIds(SIIndex *idx, SISpec *spec, char *str, char *buf,
+                    size_t len) {
+  queryIds(idx, spec, str, buf, len);
+  SIChangeSet cs = SI_NewChangeSet(16);
+  for (char *id = strtok(buf, ","); id; id = strtok(NULL, ",")) {
+    SIChangeSet_AddCahnge(&cs, SI_NewDelChange(id));
+  }
+  idx->Apply(idx->ctx, cs);
+  SIChangeSet_Free(&cs);
+  return cs.numChanges;
+}
+
+void countDeleted(SIId id, void *key, void *ctx) { ++*(long *)ctx; }
+
+MU_TEST(testDeleteWhere) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32},
+                                                   {.type = T_INT32}},
+                 .numProps = 2};
+  SISpec deltaSpec = spec;
+  deltaSpec.flags = SI_INDEX_DELTA;
+
+  // range deletions and deletions through a filter must leave the same rows
+  // as deleting every id a query returns
+  size_t len = 64 * 1024;
+  char *expected = malloc(len), *got = malloc(len);
+  char *queries[] = {"$1 < 10",          "$1 = 50 AND $2 > 1000",
+                     "$1 IN (20, 30)",   "$2 = 7",
+                     "$1 != 60",         "$1 > 1000"};
+  SISpec *specs[] = {&spec, &deltaSpec};
+  for (int s = 0; s < 2; s++) {
+    SIIndex ref = SI_NewCompoundIndex(*specs[s]);
+    SIIndex idx = SI_NewCompoundIndex(*specs[s]);
+    SIChangeSet cs = SI_NewChangeSet(2000);
+    for (int i = 0; i < 2000; i++) {
+      char id[16];
+      sprintf(id, "id%04d", i);
+      SIChangeSet_AddCahnge(&cs, SI_NewAddChange(strdup(id), 2,
+                                                 SI_IntVal(i % 100),
+                                                 SI_IntVal(i)));
+    }
+    mu_check(ref.Apply(ref.ctx, cs) == SI_INDEX_OK);
+    for (size_t i = 0; i < cs.numChanges; i++) {
+      cs.changes[i].id = strdup(cs.changes[i].id);
+    }
+    mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+    SIChangeSet_Free(&cs);
+
+    for (int i = 0; i < 6; i++) {
+      long num = deleteQueryIds(&ref, specs[s], queries[i], expected, len);
+      SIQuery q = SI_NewQuery();
+      mu_check(SI_ParseQuery(&q, queries[i], strlen(queries[i]), specs[s],
+                             NULL));
+      long visited = 0;
+      mu_assert_int_eq(num, idx.DeleteWhere(idx.ctx, &q, countDeleted,
+                                            &visited));
+      mu_assert_int_eq(num, visited);
+      SIQuery_Free(&q);
+
+      mu_assert_int_eq(ref.Len(ref.ctx), idx.Len(idx.ctx));
+      queryIds(&ref, specs[s], "$1 >= 0", expected, len);
+      queryIds(&idx, specs[s], "$1 >= 0", got, len);
+      mu_check(!strcmp(expected, got));
+      mu_assert_int_eq(0, countResults(&idx, specs[s], queries[i]));
+    }
+    mu_assert_int_eq(20, idx.Len(idx.ctx));
+    ref.Free(ref.ctx);
+    idx.Free(idx.ctx);
+  }
+  free(expected);
+  free(got);
+}
+
+/* Append the id and values of every record to a string */
+void traverseRecords(SIId id, void *key, void *ctx) {
+  sds *s = ctx;
+  SIMultiKey *mk = key;
+  char buf[64];
+  *s = sdscat(*s, id);
+  for (int i = 0; i < mk->size; i++) {
+    SIValue_ToString(mk->keys[i], buf, sizeof(buf));
+    *s = sdscatprintf(*s, ":%s", buf);
+  }
+  *s = sdscat(*s, ",");
+}
+
+typedef struct {
+  SIBlockWriter *w;
+  sds *blocks;
+  size_t *sizes;
+  int num;
+} blockSaver;
+
+void saveBlocks(SIId id, void *key, void *ctx) {
+  blockSaver *bs = ctx;
+  SIBlockWriter_Add(bs->w, id, key);
+  if (bs->w->numRecords == SI_BLOCK_SIZE) {
+    size_t len;
+    bs->sizes[bs->num] = bs->w->numRecords;
+    const char *buf = SIBlockWriter_Flush(bs->w, &len);
+    bs->blocks[bs->num++] = sdsnewlen(buf, len);
+  }
+}
+
+MU_TEST(testBlockCodec) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_STRING},
+                                                   {.type = T_INT32},
+                                                   {.type = T_INT64},
+                                                   {.type = T_UINT},
+                                                   {.type = T_BOOL},
+                                                   {.type = T_DOUBLE},
+                                                   {.type = T_FLOAT},
+                                                   {.type = T_TIME}},
+                 .numProps = 8};
+  SIIndex idx = SI_NewCompoundIndex(spec);
+  int n = 3000;
+  SIChangeSet cs = SI_NewChangeSet(n);
+  for (int i = 0; i < n; i++) {
+    char *id = malloc(16), str[32];
+    sprintf(id, "user:%d", i);
+    sprintf(str, "name%ld", random() % 500);
+    SIChangeSet_AddCahnge(
+        &cs, SI_NewAddChange(
+                 id, 8, i % 7 ? SI_StringValC(strdup(str)) : SI_NullVal(),
+                 SI_IntVal(random() % 100 - 50),
+                 SI_LongVal(i % 3 ? (int64_t)random() << 20 : INT64_MIN),
+                 SI_UintVal(i % 5 ? random() : UINT64_MAX), SI_BoolVal(i % 2),
+                 i % 11 ? SI_DoubleVal(random() / 7.0) : SI_NullVal(),
+                 SI_FloatVal(random() % 1000 / 8.0f),
+                 SI_TimeVal(1500000000 + random() % 1000)));
+  }
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+  SIChangeSet_Free(&cs);
+
+  // save the records in blocks, in index order
+  blockSaver bs = {.w = SI_NewBlockWriter(&spec), .num = 0};
+  bs.blocks = calloc(n / SI_BLOCK_SIZE + 1, sizeof(sds));
+  bs.sizes = calloc(n / SI_BLOCK_SIZE + 1, sizeof(size_t));
+  idx.Traverse(idx.ctx, saveBlocks, &bs);
+  size_t len;
+  bs.sizes[bs.num] = bs.w->numRecords;
+  const char *buf = SIBlockWriter_Flush(bs.w, &len);
+  bs.blocks[bs.num++] = sdsnewlen(buf, len);
+  SIBlockWriter_Free(bs.w);
+  mu_assert_int_eq(3, bs.num);
+
+  // and load them into a new index, that must hold the same records
+  SIIndex loaded = SI_NewCompoundIndex(spec);
+  SIValue vals[8];
+  for (int b = 0; b < bs.num; b++) {
+    SIBlockReader *r = SI_NewBlockReader(&spec, bs.blocks[b],
+                                         sdslen(bs.blocks[b]), bs.sizes[b]);
+    SILoadRun run = SI_NewLoadRun(bs.sizes[b]);
+    SIId id;
+    while (SIBlockReader_Next(r, &id, vals)) {
+      SILoadRun_Add(&run, id, vals, &spec);
+    }
+    mu_check(!r->error);
+    mu_assert_int_eq(bs.sizes[b], run.num);
+    SIBlockReader_Free(r);
+    // runs out of order are sorted back into index order
+    SILoadEntry first = run.ents[0], last = run.ents[run.num - 1];
+    if (b == 1) {
+      for (size_t i = 0; i < run.num / 2; i++) {
+        SILoadEntry e = run.ents[i];
+        run.ents[i] = run.ents[run.num - 1 - i];
+        run.ents[run.num - 1 - i] = e;
+      }
+    }
+    SILoadRun_Sort(&run, &spec);
+    mu_check(run.ents[0].id == first.id && run.ents[run.num - 1].id == last.id);
+    mu_check(loaded.Load(loaded.ctx, &run) == SI_INDEX_OK);
+    mu_assert_int_eq(0, run.num);
+    SILoadRun_Free(&run);
+  }
+  mu_assert_int_eq(n, loaded.Len(loaded.ctx));
+  sds expected = sdsempty(), got = sdsempty();
+  idx.Traverse(idx.ctx, traverseRecords, &expected);
+  loaded.Traverse(loaded.ctx, traverseRecords, &got);
+  mu_check(!strcmp(expected, got));
+  mu_assert_int_eq(n / 7 + 1, countResults(&loaded, &spec, "$1 IS NULL"));
+
+  // truncated blocks are detected
+  SIBlockReader *r = SI_NewBlockReader(&spec, bs.blocks[0],
+                                       sdslen(bs.blocks[0]) / 2, bs.sizes[0]);
+  SIId id;
+  int num = 0;
+  while (SIBlockReader_Next(r, &id, vals)) num++;
+  mu_check(r->error && num < bs.sizes[0]);
+  SIBlockReader_Free(r);
+
+  for (int b = 0; b < bs.num; b++) {
+    sdsfree(bs.blocks[b]);
+  }
+  free(bs.blocks);
+  free(bs.sizes);
+  sdsfree(expected);
+  sdsfree(got);
+  idx.Free(idx.ctx);
+  loaded.Free(loaded.ctx);
+}
+
+typedef struct {
+  SIIndex *idx;
+  SICursor *c;
+  int stable;
+} concurrentRead;
+
+// reads a cursor in small chunks, the way background queries do
+void concurrentReadJob(void *arg) {
+  concurrentRead *r = arg;
+  int done = 0;
+  while (!done) {
+    r->idx->ReadLock(r->idx->ctx);
+    for (int i = 0; i < 50; i++) {
+      SIId id = r->c->Next(r->c->ctx);
+      if (!id) {
+        done = 1;
+        break;
+      }
+      if (!strncmp(id, "id", 2)) {
+        r->stable++;
+      }
+    }
+    if (!done) {
+      r->c->Suspend(r->c->ctx);
+    }
+    r->idx->Unlock(r->idx->ctx);
+  }
+}
+
+MU_TEST(testConcurrentReads) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32}},
+                 .numProps = 1};
+
+  SIIndex idx = SI_NewCompoundIndex(spec);
+  SIChangeSet cs = SI_NewChangeSet(2000);
+  // stable rows have even values
+  for (int i = 0; i < 2000; i++) {
+    char *id = malloc(16);
+    sprintf(id, "id%04d", i);
+    SIChangeSet_AddCahnge(&cs, SI_NewAddChange(id, 1, SI_IntVal(i * 2)));
+  }
+  mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+
+  SIThreadPool *pool = SI_NewThreadPool(4);
+  mu_check(pool != NULL);
+
+  concurrentRead reads[8];
+  SIQuery queries[8];
+  char *str = "$1 >= 0";
+  for (int i = 0; i < 8; i++) {
+    queries[i] = SI_NewQuery();
+    mu_check(SI_ParseQuery(&queries[i], str, strlen(str), &spec, NULL));
+    reads[i] = (concurrentRead){.idx = &idx, .stable = 0};
+    reads[i].c = idx.Find(idx.ctx, &queries[i]);
+    mu_check(reads[i].c->error == SI_CURSOR_OK);
+    reads[i].c->Suspend(reads[i].c->ctx);
+    SIThreadPool_Push(pool, concurrentReadJob, &reads[i]);
+  }
+
+  // meanwhile, churn rows with odd values in between the stable ones
+  for (int n = 0; n < 200; n++) {
+    char *id = malloc(16);
+    sprintf(id, "churn%d", n);
+    cs = SI_NewChangeSet(1);
+    SIChangeSet_AddCahnge(&cs,
+                          SI_NewAddChange(id, 1, SI_IntVal((n * 37 % 2000) * 2 + 1)));
+    mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+    if (n % 2) {
+      cs = SI_NewChangeSet(1);
+      SIChangeSet_AddCahnge(&cs, SI_NewDelChange(id));
+      mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+    }
+  }
+
+  SIThreadPool_Free(pool);
+  for (int i = 0; i < 8; i++) {
+    // every stable row is returned exactly once
+    mu_assert_int_eq(2000, reads[i].stable);
+    SICursor_Free(reads[i].c);
+    SIQuery_Free(&queries[i]);
+  }
+  idx.Free(idx.ctx);
+}
+
+/* Read the partition cursors of a partitioned cursor one by one, the way
+ * background queries read them on different threads, and merge their runs */
+void mergePartitionIds(SIIndex *idx, SISpec *spec, char *str, char *buf,
+                       size_t len) {
+  SIQuery q = SI_NewQuery();
+  SI_ParseQuery(&q, str, strlen(str), spec, NULL);
+  SICursor *c = idx->Find(idx->ctx, &q);
+  int num;
+  SICursor **parts = SI_PartitionCursors(c, &num);
+  SIPartitionRun runs[num];
+  size_t total = 0;
+  for (int i = 0; i < num; i++) {
+    runs[i] = (SIPartitionRun){.ids = malloc(4096 * sizeof(SIId)),
+                               .keys = malloc(4096 * sizeof(void *)),
+                               .num = 0};
+    SIMultiKey *key;
+    while (parts[i]->Peek && parts[i]->Peek(parts[i]->ctx, (void **)&key)) {
+      runs[i].keys[runs[i].num] = SI_NewMultiKey(key->keys, key->size);
+      runs[i].ids[runs[i].num++] = parts[i]->Next(parts[i]->ctx);
+    }
+    SIId id;
+    while (!parts[i]->Peek && NULL != (id = parts[i]->Next(parts[i]->ctx))) {
+      runs[i].ids[runs[i].num++] = id;
+    }
+    total += runs[i].num;
+  }
+
+  SIId *ids = malloc(total * sizeof(SIId));
+  SI_MergePartitionRuns(c, runs, ids);
+  buf[0] = 0;
+  for (size_t i = 0; i < total; i++) {
+    strncat(buf, ids[i], len - strlen(buf) - 2);
+    strcat(buf, ",");
+  }
+  for (int i = 0; i < num; i++) {
+    for (size_t j = 0; parts[i]->Peek && j < runs[i].num; j++) {
+      SIMultiKey_Free(runs[i].keys[j]);
+    }
+    free(runs[i].ids);
+    free(runs[i].keys);
+  }
+  free(ids);
+  SICursor_Free(c);
+  SIQuery_Free(&q);
+}
+
+MU_TEST(testPartitionedIndex) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32},
+                                                   {.type = T_INT32}},
+                 .numProps = 2};
+  SISpec partSpec = spec;
+  partSpec.numPartitions = 4;
+  SIIndex ref = SI_NewIndex(spec);
+  SIIndex idx = SI_NewIndex(partSpec);
+  mu_check(ref.partitions == NULL);
+  mu_assert_int_eq(4, idx.numPartitions);
+
+  // the same random changes applied to a single index and a partitioned one
+  // must give the same results, in the same order for scans in key order
+  size_t len = 64 * 1024;
+  char *expected = malloc(len), *got = malloc(len);
+  char *queries[] = {"$1 >= 0", "$2 = 3", "$1 = 7 AND $2 > 4", "$1 < 10"};
+  for (int round = 0; round < 20; round++) {
+    int num = round ? 200 : 2000;
+    SIChangeSet cs = SI_NewChangeSet(num);
+    for (int i = 0; i < num; i++) {
+      char id[16];
+      sprintf(id, "id%ld", round ? random() % 2000 : i);
+      if (round && random() % 4 == 0) {
+        SIChangeSet_AddCahnge(&cs, SI_NewDelChange(strdup(id)));
+      } else {
+        SIChangeSet_AddCahnge(&cs, SI_NewAddChange(strdup(id), 2,
+                                                   SI_IntVal(random() % 50),
+                                                   SI_IntVal(random() % 10)));
+      }
+    }
+    mu_check(ref.Apply(ref.ctx, cs) == SI_INDEX_OK);
+    for (size_t i = 0; i < cs.numChanges; i++) {
+      cs.changes[i].id = strdup(cs.changes[i].id);
+    }
+    mu_check(idx.Apply(idx.ctx, cs) == SI_INDEX_OK);
+    SIChangeSet_Free(&cs);
+    mu_assert_int_eq(ref.Len(ref.ctx), idx.Len(idx.ctx));
+
+    for (int i = 0; i < 4; i++) {
+      queryIds(&ref, &spec, queries[i], expected, len);
+      queryIds(&idx, &partSpec, queries[i], got, len);
+      mu_check(!strcmp(expected, got));
+      mergePartitionIds(&idx, &partSpec, queries[i], got, len);
+      mu_check(!strcmp(expected, got));
+    }
+    // multi range scans are not in key order, and are read one partition
+    // after the other
+    mu_assert_int_eq(countResults(&ref, &spec, "$1 IN (30, 3)"),
+                     countResults(&idx, &partSpec, "$1 IN (30, 3)"));
+    // the ids are looked up in their own partition
+    for (int i = 0; i < 2000; i += 97) {
+      char id[16];
+      sprintf(id, "id%d", i);
+      mu_assert_int_eq(ref.Contains(ref.ctx, id), idx.Contains(idx.ctx, id));
+    }
+  }
+
+  // a suspended merge resumes in order, without the rows deleted meanwhile
+  SIQuery q = SI_NewQuery();
+  mu_check(SI_ParseQuery(&q, "$1 >= 0", 7, &partSpec, NULL));
+  SICursor *c = idx.Find(idx.ctx, &q);
+  mu_check(c->error == SI_CURSOR_OK && c->Peek != NULL);
+  size_t read = 0;
+  for (; read < 100; read++) {
+    mu_check(c->Next(c->ctx) != NULL);
+    if (read % 10 == 0) {
+      c->Suspend(c->ctx);
+    }
+  }
+  c->Suspend(c->ctx);
+  SIQuery del = SI_NewQuery();
+  mu_check(SI_ParseQuery(&del, "$1 = 49", 7, &partSpec, NULL));
+  long deleted = idx.DeleteWhere(idx.ctx, &del, NULL, NULL);
+  mu_check(deleted > 0);
+  SIQuery_Free(&del);
+  SIMultiKey *key, *prev = NULL;
+  SIId id;
+  while (NULL != (id = c->Peek(c->ctx, (void **)&key))) {
+    mu_check(key->keys[0].intval != 49);
+    mu_check(!prev || SICmpMultiKey(prev, key, &(SICmpFuncVector){
+                          .cmpFuncs = (SIKeyCmpFunc[]){si_cmp_int, si_cmp_int},
+                          .numFuncs = 2}) <= 0);
+    if (prev) {
+      SIMultiKey_Free(prev);
+    }
+    prev = SI_NewMultiKey(key->keys, key->size);
+    mu_check(c->Next(c->ctx) == id);
+    read++;
+  }
+  SIMultiKey_Free(prev);
+  mu_check(c->Next(c->ctx) == NULL);
+  mu_assert_int_eq(idx.Len(idx.ctx), read);
+  mu_assert_int_eq(idx.Len(idx.ctx), c->stats.rowsReturned);
+  SICursor_Free(c);
+  SIQuery_Free(&q);
+
+  // deleting by a query deletes from all the partitions
+  q = SI_NewQuery();
+  mu_check(SI_ParseQuery(&q, "$1 < 10", 7, &partSpec, NULL));
+  deleted = countResults(&idx, &partSpec, "$1 < 10");
+  size_t before = idx.Len(idx.ctx);
+  mu_assert_int_eq(deleted, idx.DeleteWhere(idx.ctx, &q, NULL, NULL));
+  mu_assert_int_eq(before - deleted, idx.Len(idx.ctx));
+  mu_assert_int_eq(0, countResults(&idx, &partSpec, "$1 < 10"));
+  SIQuery_Free(&q);
+
+  free(expected);
+  free(got);
+  ref.Free(ref.ctx);
+  idx.Free(idx.ctx);
+}
+
+/* Apply random adds, updates and deletes of ids below max to two indexes */
+void applyRandomChanges(SIIndex *a, SIIndex *b, int num, int max) {
+  SIChangeSet cs = SI_NewChangeSet(num);
+  for (int i = 0; i < num; i++) {
+    char id[16];
+    sprintf(id, "id%ld", random() % max);
+    if (random() % 4 == 0) {
+      SIChangeSet_AddCahnge(&cs, SI_NewDelChange(strdup(id)));
+    } else {
+      SIChangeSet_AddCahnge(&cs, SI_NewAddChange(strdup(id), 2,
+                                                 SI_IntVal(random() % 50),
+                                                 SI_IntVal(random() % 10)));
+    }
+  }
+  a->Apply(a->ctx, cs);
+  for (size_t i = 0; i < cs.numChanges; i++) {
+    cs.changes[i].id = strdup(cs.changes[i].id);
+  }
+  b->Apply(b->ctx, cs);
+  SIChangeSet_Free(&cs);
+}
+
+MU_TEST(testSnapshots) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_INT32},
+                                                   {.type = T_INT32}},
+                 .numProps = 2};
+  SISpec specs[] = {spec, spec, spec};
+  specs[1].flags = SI_INDEX_DELTA;
+  specs[2].numPartitions = 4;
+
+  size_t len = 64 * 1024;
+  char *expected = malloc(len), *got = malloc(len), *live = malloc(len),
+       *refLive = malloc(len);
+  for (int s = 0; s < 3; s++) {
+    SIIndex ref = SI_NewCompoundIndex(spec);
+    SIIndex idx = SI_NewIndex(specs[s]);
+    applyRandomChanges(&ref, &idx, 2000, 2000);
+
+    // a pinned cursor returns the rows as they were when it was pinned, while
+    // the index goes on changing under it
+    queryIds(&idx, &specs[s], "$1 >= 10", expected, len);
+    SIQuery q = SI_NewQuery();
+    mu_check(SI_ParseQuery(&q, "$1 >= 10", 8, &specs[s], NULL));
+    SICursor *c = idx.Find(idx.ctx, &q);
+    mu_check(c->error == SI_CURSOR_OK);
+    mu_check(idx.Snapshot(idx.ctx, c));
+    got[0] = 0;
+    SIId id;
+    for (int round = 0; round < 20; round++) {
+      for (int i = 0; i < 50 && NULL != (id = c->Next(c->ctx)); i++) {
+        strcat(got, id);
+        strcat(got, ",");
+      }
+      applyRandomChanges(&ref, &idx, 200, 2000);
+      // a second snapshot sees the changes buffered since the first one
+      if (round == 10) {
+        char *pinned = malloc(len);
+        queryIds(&idx, &specs[s], "$2 = 3", live, len);
+        SIQuery pq = SI_NewQuery();
+        mu_check(SI_ParseQuery(&pq, "$2 = 3", 6, &specs[s], NULL));
+        SICursor *pc = idx.Find(idx.ctx, &pq);
+        mu_check(idx.Snapshot(idx.ctx, pc));
+        applyRandomChanges(&ref, &idx, 200, 2000);
+        pinned[0] = 0;
+        while (NULL != (id = pc->Next(pc->ctx))) {
+          strcat(pinned, id);
+          strcat(pinned, ",");
+        }
+        mu_check(!strcmp(live, pinned));
+        SICursor_Free(pc);
+        SIQuery_Free(&pq);
+        free(pinned);
+      }
+      // deleting while pinned deletes from the buffer
+      if (round == 15) {
+        SIQuery del = SI_NewQuery();
+        mu_check(SI_ParseQuery(&del, "$1 < 5", 6, &specs[s], NULL));
+        SIQuery refDel = SIQuery_Copy(&del);
+        mu_assert_int_eq(ref.DeleteWhere(ref.ctx, &refDel, NULL, NULL),
+                         idx.DeleteWhere(idx.ctx, &del, NULL, NULL));
+        SIQuery_Free(&del);
+        SIQuery_Free(&refDel);
+      }
+      // readers that are not pinned see the changes
+      mu_assert_int_eq(ref.Len(ref.ctx), idx.Len(idx.ctx));
+      queryIds(&ref, &spec, "$1 >= 10", refLive, len);
+      queryIds(&idx, &specs[s], "$1 >= 10", live, len);
+      mu_check(!strcmp(refLive, live));
+    }
+    while (NULL != (id = c->Next(c->ctx))) {
+      strcat(got, id);
+      strcat(got, ",");
+    }
+    mu_check(!strcmp(expected, got));
+    SICursor_Free(c);
+    SIQuery_Free(&q);
+
+    // the buffered changes are merged once the snapshots are released
+    applyRandomChanges(&ref, &idx, 200, 2000);
+    queryIds(&ref, &spec, "$1 >= 0", expected, len);
+    queryIds(&idx, &specs[s], "$1 >= 0", got, len);
+    mu_check(!strcmp(expected, got));
+    expected[0] = got[0] = 0;
+    ref.Traverse(ref.ctx, traverseIds, expected);
+    // partitioned indexes are traversed one partition after the other
+    if (s < 2) {
+      idx.Traverse(idx.ctx, traverseIds, got);
+      mu_check(!strcmp(expected, got));
+    }
+    ref.Free(ref.ctx);
+    idx.Free(idx.ctx);
+  }
+  free(expected);
+  free(got);
+  free(live);
+  free(refLive);
 }
 
 ///////////////////////////////////
@@ -242,6 +1577,24 @@ int main(int argc, char **argv) {
   MU_RUN_TEST(testReverseIndex);
   MU_RUN_TEST(testUniqueIndex);
   MU_RUN_TEST(testNull);
+  MU_RUN_TEST(testSkipScan);
+  MU_RUN_TEST(testCursorStats);
+  MU_RUN_TEST(testCursorResume);
+  MU_RUN_TEST(testMergeCursors);
+  MU_RUN_TEST(testTrigramIndex);
+  MU_RUN_TEST(testCollation);
+  MU_RUN_TEST(testSkiplistFinger);
+  MU_RUN_TEST(testSkiplistUpsert);
+  MU_RUN_TEST(testBatchInsert);
+  MU_RUN_TEST(testUpdateInPlace);
+  MU_RUN_TEST(testDeltaIndex);
+  MU_RUN_TEST(testSkiplistDeleteRange);
+  MU_RUN_TEST(testDeleteWhere);
+  MU_RUN_TEST(testBlockCodec);
+  MU_RUN_TEST(testConcurrentReads);
+  MU_RUN_TEST(testPartitionedIndex);
+  MU_RUN_TEST(testSnapshots);
+  MU_RUN_TEST(testStatsChurn);
 
   MU_REPORT();
   return minunit_status;
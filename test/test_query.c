@@ -6,6 +6,8 @@
 #include "../src/index.h"
 #include "../src/query.h"
 #include "../src/query_plan.h"
+#include "../src/stats.h"
+#include "../src/key.h"
 #include "../src/rmutil/alloc.h"
 
 MU_TEST(testQueryParser) {
@@ -70,7 +72,7 @@ MU_TEST(testQueryPlan) {
   q = SI_NewQuery();
 
   mu_check(SI_ParseQuery(&q, str, strlen(str), &spec, NULL));
-  SIQueryPlan *qp = SI_BuildQueryPlan(&q, &spec);
+  SIQueryPlan *qp = SI_BuildQueryPlan(&q, &spec, NULL, NULL);
 }
 
 MU_TEST(testQueryExecution) {
@@ -84,7 +86,362 @@ MU_TEST(testQueryExecution) {
 
   mu_check(SI_ParseQuery(&q, str, strlen(str), &spec, &parseError));
 
-  SIQueryPlan *qp = SI_BuildQueryPlan(&q, &spec);
+  SIQueryPlan *qp = SI_BuildQueryPlan(&q, &spec, NULL, NULL);
+}
+
+SIQueryPlan *buildPlan(const char *str, SISpec *spec, SIIndexStats *stats,
+                       SIQuery *q) {
+  *q = SI_NewQuery();
+  if (!SI_ParseQuery(q, str, strlen(str), spec, NULL)) {
+    return NULL;
+  }
+  SIQuery_Normalize(q, spec);
+  return SI_BuildQueryPlan(q, spec, stats, NULL);
+}
+
+MU_TEST(testQueryPlanStats) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{T_INT32}, {T_INT32}},
+                 .numProps = 2};
+  SIKeyCmpFunc cmps[] = {si_cmp_int, si_cmp_int};
+  SIIndexStats *stats = SI_NewIndexStats(&spec, cmps);
+
+  // a skewed leading column with very few distinct values, and a unique
+  // second column
+  for (int i = 0; i < 10000; i++) {
+    SIValue vals[] = {SI_IntVal(i % 100 == 0 ? i % 3 + 1 : 0), SI_IntVal(i)};
+    SIMultiKey *mk = SI_NewMultiKey(vals, 2);
+    SIIndexStats_Add(stats, mk);
+    SIMultiKey_Free(mk);
+  }
+  mu_check(stats->numRows == 10000);
+  double ndv = SIIndexStats_Distinct(stats, 0);
+  mu_check(ndv >= 3 && ndv <= 5);
+  ndv = SIIndexStats_Distinct(stats, 1);
+  mu_check(ndv > 8000 && ndv <= 10000);
+
+  SIQuery q;
+  // the heavy hitter is not selective, a rare value is
+  SIQueryPlan *qp = buildPlan("$1 = 0", &spec, stats, &q);
+  mu_check(qp->estimatedRows > 9000);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+  qp = buildPlan("$1 = 2", &spec, stats, &q);
+  mu_check(qp->strategy == QP_RANGE);
+  mu_check(qp->estimatedRows < 500);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+
+  // no predicate on the leading column - skip over its few distinct values
+  qp = buildPlan("$2 = 1337", &spec, stats, &q);
+  mu_check(qp->strategy == QP_SKIPSCAN);
+  mu_check(qp->numRanges == 1);
+  mu_check(qp->filterTree == NULL);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+
+  // filtering on the heavy hitter is better than seeking on it
+  qp = buildPlan("$1 = 0 AND $2 IN (1, 2, 3, 4)", &spec, stats, &q);
+  mu_check(qp->strategy == QP_RANGE);
+  mu_check(qp->numRanges == 4);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+
+  // a range matching almost everything is better off as a full scan
+  qp = buildPlan("$1 >= 0 AND $2 > 10", &spec, stats, &q);
+  mu_check(qp->strategy == QP_FULLSCAN);
+  mu_check(qp->filterTree != NULL);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+
+  SIIndexStats_Free(stats);
+
+  // a unique leading column makes skip scans useless
+  stats = SI_NewIndexStats(&spec, cmps);
+  for (int i = 0; i < 10000; i++) {
+    SIValue vals[] = {SI_IntVal(i), SI_IntVal(i % 7)};
+    SIMultiKey *mk = SI_NewMultiKey(vals, 2);
+    SIIndexStats_Add(stats, mk);
+    SIMultiKey_Free(mk);
+  }
+  qp = buildPlan("$2 = 3", &spec, stats, &q);
+  mu_check(qp->strategy == QP_FULLSCAN);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+  SIIndexStats_Free(stats);
+}
+
+void addStatsRow(SIIndexStats *stats, int a, int b, int remove) {
+  SIValue vals[] = {SI_IntVal(a), SI_IntVal(b)};
+  SIMultiKey *mk = SI_NewMultiKey(vals, 2);
+  if (remove) {
+    SIIndexStats_Remove(stats, mk);
+  } else {
+    SIIndexStats_Add(stats, mk);
+  }
+  SIMultiKey_Free(mk);
+}
+
+MU_TEST(testStatsCaseSensitive) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{.type = T_STRING,
+                                                    .flags =
+                                                        SI_PROP_CASESENSITIVE}},
+                 .numProps = 1};
+  SIKeyCmpFunc cmps[] = {si_cmp_string};
+  SIIndexStats *stats = SI_NewIndexStats(&spec, cmps);
+
+  // values that only differ by case are distinct in a case sensitive column
+  char *strs[] = {"abc", "ABC", "Abc"};
+  for (int i = 0; i < 3000; i++) {
+    SIValue v = SI_StringValC(strs[i % 3]);
+    SIMultiKey *mk = SI_NewMultiKey(&v, 1);
+    SIIndexStats_Add(stats, mk);
+    SIMultiKey_Free(mk);
+  }
+  double ndv = SIIndexStats_Distinct(stats, 0);
+  mu_check(ndv >= 2.5 && ndv <= 3.5);
+  SIIndexStats_Free(stats);
+}
+
+MU_TEST(testStatsRemove) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{T_INT32}, {T_INT32}},
+                 .numProps = 2};
+  SIKeyCmpFunc cmps[] = {si_cmp_int, si_cmp_int};
+  SIIndexStats *stats = SI_NewIndexStats(&spec, cmps);
+
+  // a few removals leave the sample mostly intact
+  for (int i = 0; i < 2000; i++) {
+    addStatsRow(stats, i, i, 0);
+  }
+  for (int i = 0; i < 100; i++) {
+    addStatsRow(stats, i, i, 1);
+  }
+  mu_check(!SIIndexStats_NeedsRebuild(stats));
+
+  // removed values leave the sample at once, but the sketch still counts them
+  for (int i = 100; i < 2000; i++) {
+    addStatsRow(stats, i, i, 1);
+  }
+  mu_check(stats->numRows == 0);
+  mu_check(stats->cols[0].sampleLen == 0);
+  mu_check(SIIndexStats_NeedsRebuild(stats));
+  SIIndexStats_Clear(stats);
+  mu_check(!SIIndexStats_NeedsRebuild(stats));
+
+  // only the live rows are estimated
+  for (int i = 0; i < 2000; i++) {
+    addStatsRow(stats, 5000 + i % 10, i % 7, 0);
+  }
+  double ndv = SIIndexStats_Distinct(stats, 0);
+  mu_check(ndv >= 8 && ndv <= 12);
+  ndv = SIIndexStats_Distinct(stats, 1);
+  mu_check(ndv >= 5 && ndv <= 9);
+
+  SIQuery q;
+  SIQueryPlan *qp = buildPlan("$1 = 5003", &spec, stats, &q);
+  mu_check(qp->estimatedRows > 100 && qp->estimatedRows < 300);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+  qp = buildPlan("$1 < 2000", &spec, stats, &q);
+  mu_check(qp->estimatedRows < 10);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+
+  SIIndexStats_Free(stats);
+}
+
+MU_TEST(testQueryPlanCartesianCap) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{T_INT32}, {T_INT32}},
+                 .numProps = 2};
+
+  // 40 x 40 ranges is too much - we expect to only seek on the first column
+  char str[1024] = "$1 IN (0";
+  for (int i = 1; i < 40; i++) {
+    sprintf(str + strlen(str), ", %d", i);
+  }
+  strcat(str, ") AND $2 IN (0");
+  for (int i = 1; i < 40; i++) {
+    sprintf(str + strlen(str), ", %d", i);
+  }
+  strcat(str, ")");
+
+  SIQuery q;
+  SIQueryPlan *qp = buildPlan(str, &spec, NULL, &q);
+  mu_check(qp != NULL);
+  mu_check(qp->strategy == QP_RANGE);
+  mu_assert_int_eq(40, qp->numRanges);
+  mu_check(qp->filterTree != NULL);
+  mu_check(qp->filterTree->type == QN_PRED);
+  mu_check(qp->filterTree->pred.propId == 1);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+}
+
+MU_TEST(testLikePredicate) {
+  struct {
+    char *str;
+    char *pattern;
+    int match;
+  } cases[] = {
+      {"foobar", "%oba%", 1},  {"foobar", "%bar", 1},   {"foobar", "%foo", 0},
+      {"foobar", "f_o%r", 1},  {"foobar", "%o%o%", 1},  {"foobar", "%o%x%", 0},
+      {"foobar", "foobar%", 1}, {"foobar", "%", 1},     {"", "%", 1},
+      {"foobar", "_", 0},      {"aaab", "%aab", 1},     {"abab", "%ab%ab", 1},
+  };
+  for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    SIString s = SI_WrapString(cases[i].str);
+    SIString p = SI_WrapString(cases[i].pattern);
+    mu_assert_int_eq(cases[i].match, SI_LikeMatch(&s, &p));
+  }
+
+  // only patterns that aren't an equality or a prefix become LIKE predicates
+  char *strs[] = {"$1 LIKE 'foo'", "$1 LIKE 'foo%'", "$1 LIKE '%foo'",
+                  "$1 LIKE 'f_o%'"};
+  SIPredicateType types[] = {PRED_EQ, PRED_RNG, PRED_LIKE, PRED_LIKE};
+  for (int i = 0; i < 4; i++) {
+    SIQuery q = SI_NewQuery();
+    mu_check(SI_ParseQuery(&q, strs[i], strlen(strs[i]), NULL, NULL));
+    mu_check(q.root->type == QN_PRED);
+    mu_check(q.root->pred.t == types[i]);
+    SIQuery_Free(&q);
+  }
+}
+
+MU_TEST(testNotEqualsPlan) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{T_INT32}, {T_INT32}},
+                 .numProps = 2};
+
+  // != on the index prefix becomes the two ranges around the value
+  SIQuery q;
+  SIQueryPlan *qp = buildPlan("$1 != 3", &spec, NULL, &q);
+  mu_check(qp != NULL);
+  mu_check(qp->strategy == QP_RANGE);
+  mu_assert_int_eq(2, qp->numRanges);
+  mu_check(qp->filterTree == NULL);
+  char *expected[] = {"[-inf, 3)", "(3, +inf]"};
+  for (int i = 0; i < 2; i++) {
+    siPlanRange *rng;
+    Vector_Get(qp->ranges, i, &rng);
+    sds s = SIPlanRange_ToString(rng, sdsempty());
+    mu_check(!strcmp(s, expected[i]));
+    sdsfree(s);
+  }
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+
+  // after an equality prefix the ranges extend it
+  qp = buildPlan("$1 = 1 AND $2 != 3", &spec, NULL, &q);
+  mu_check(qp != NULL);
+  mu_assert_int_eq(2, qp->numRanges);
+  mu_check(qp->filterTree == NULL);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+
+  // after a range it is left as a residual filter
+  qp = buildPlan("$1 > 1 AND $2 != 3", &spec, NULL, &q);
+  mu_check(qp != NULL);
+  mu_assert_int_eq(1, qp->numRanges);
+  mu_check(qp->filterTree != NULL);
+  sds s = SIQueryNode_ToString(qp->filterTree, sdsempty());
+  mu_check(!strcmp(s, "$2 != 3"));
+  sdsfree(s);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+}
+
+MU_TEST(testNegate) {
+  struct {
+    SIQueryNode *n;
+    char *expected;
+  } cases[] = {
+      {SI_PredEquals(SI_IntVal(3)), "$1 != 3"},
+      {SI_PredNotEquals(SI_IntVal(3)), "$1 = 3"},
+      {SI_PredBetween(SI_IntVal(1), SI_IntVal(5), 0, 1), "($1 < 1 OR $1 >= 5)"},
+      {SI_PredBetween(SI_IntVal(1), SI_InfVal(), 1, 0), "$1 <= 1"},
+      {SI_PredBetween(SI_NegativeInfVal(), SI_InfVal(), 0, 0), "$1 IS NULL"},
+      {SI_PredIsNull(), "$1 IS NOT NULL"},
+      {SI_PredLike(SI_StringValC(strdup("%foo"))), "$1 NOT LIKE \"%foo\""},
+      {SIQuery_NewLogicNode(SI_PredEquals(SI_IntVal(1)), OP_OR,
+                            SI_PredBetween(SI_IntVal(4), SI_IntVal(6), 1, 1)),
+       "($1 != 1 AND ($1 <= 4 OR $1 >= 6))"},
+  };
+  for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    if (cases[i].n->type == QN_PRED) {
+      cases[i].n->pred.propId = 0;
+    } else {
+      cases[i].n->op.left->pred.propId = 0;
+      cases[i].n->op.right->pred.propId = 0;
+    }
+    SIQueryNode *n = SIQueryNode_Negate(cases[i].n);
+    sds s = SIQueryNode_ToString(n, sdsempty());
+    mu_check(!strcmp(s, cases[i].expected));
+    sdsfree(s);
+
+    // negating twice matches the original predicate again
+    SIQueryNode_Free(SIQueryNode_Negate(n));
+  }
+
+  SIValueVector v = SI_NewValueVector(2);
+  SIValueVector_Append(&v, SI_IntVal(1));
+  SIValueVector_Append(&v, SI_IntVal(2));
+  SIQueryNode *n = SI_PredIn(v);
+  n->pred.propId = 0;
+  n = SIQueryNode_Negate(n);
+  sds s = SIQueryNode_ToString(n, sdsempty());
+  mu_check(!strcmp(s, "($1 != 1 AND $1 != 2)"));
+  sdsfree(s);
+  SIQueryNode_Free(n);
+  SIValueVector_Free(&v);
+}
+
+MU_TEST(testNotParser) {
+  struct {
+    char *str;
+    char *expected;
+  } cases[] = {
+      {"NOT ($1 = 'x')", "$1 != \"x\""},
+      {"$1 IS NOT NULL", "$1 IS NOT NULL"},
+      {"$1 NOT LIKE '%foo'", "$1 NOT LIKE \"%foo\""},
+      {"NOT $1 = 1 AND $2 = 2", "($1 != 1 AND $2 = 2)"},
+      {"NOT NOT $1 IS NULL", "$1 IS NULL"},
+  };
+  for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    SIQuery q = SI_NewQuery();
+    char *parseError = NULL;
+    mu_check(SI_ParseQuery(&q, cases[i].str, strlen(cases[i].str), NULL,
+                           &parseError));
+    mu_check(parseError == NULL);
+    sds s = SIQueryNode_ToString(q.root, sdsempty());
+    mu_check(!strcmp(s, cases[i].expected));
+    sdsfree(s);
+    SIQuery_Free(&q);
+  }
+}
+
+MU_TEST(testQueryPlanToString) {
+  SISpec spec = {.properties = (SIIndexProperty[]){{T_INT32}, {T_INT32}},
+                 .numProps = 2};
+
+  SIQuery q;
+  SIQueryPlan *qp = buildPlan("$1 = 3 AND $2 > 5", &spec, NULL, &q);
+  mu_check(qp != NULL);
+  mu_assert_int_eq(1, qp->numRanges);
+  mu_check(qp->filterTree == NULL);
+  siPlanRange *rng;
+  Vector_Get(qp->ranges, 0, &rng);
+  sds s = SIPlanRange_ToString(rng, sdsempty());
+  mu_check(!strcmp(s, "(3::5, 3::+inf]"));
+  sdsfree(s);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
+
+  qp = buildPlan("$1 = 3 AND ($2 = 1 OR $2 IN (4, 5))", &spec, NULL, &q);
+  mu_check(qp != NULL);
+  mu_check(qp->filterTree != NULL);
+  s = SIQueryNode_ToString(qp->filterTree, sdsempty());
+  mu_check(!strcmp(s, "($2 = 1 OR $2 IN (4, 5))"));
+  sdsfree(s);
+  SIQueryPlan_Free(qp);
+  SIQuery_Free(&q);
 }
 
 SIQueryError validateQuery(const char *str, SISpec *spec) {
@@ -209,6 +566,15 @@ int main(int argc, char **argv) {
   // return testIndex();
   MU_RUN_TEST(testQueryParser);
   MU_RUN_TEST(testQueryPlan);
+  MU_RUN_TEST(testQueryPlanStats);
+  MU_RUN_TEST(testStatsRemove);
+  MU_RUN_TEST(testStatsCaseSensitive);
+  MU_RUN_TEST(testQueryPlanCartesianCap);
+  MU_RUN_TEST(testLikePredicate);
+  MU_RUN_TEST(testNotEqualsPlan);
+  MU_RUN_TEST(testNegate);
+  MU_RUN_TEST(testNotParser);
+  MU_RUN_TEST(testQueryPlanToString);
   MU_RUN_TEST(testQueryNormalize);
   MU_RUN_TEST(testTimeFunctions);
   MU_REPORT();
@@ -3,6 +3,7 @@
 #include "minunit.h"
 
 #include "../src/value.h"
+#include "../src/thread_pool.h"
 #include "../src/rmutil/alloc.h"
 
 #define vtc(f, val, T, memb)                                                   \
@@ -108,10 +109,37 @@ MU_TEST(testValueCast) {
   SIValue_Free(&v);
 }
 
+// takes and releases references to a string shared by many threads
+void stringRefJob(void *arg) {
+  SIValue *v = arg;
+  for (int i = 0; i < 100000; i++) {
+    SIValue c = SIValue_Copy(*v);
+    SIValue_Free(&c);
+  }
+}
+
+MU_TEST(testStringRefcount) {
+  SIString s = SIString_Copy((SIString){.str = "foo", .len = 3});
+  SIValue v = SI_StringVal(s);
+
+  SIThreadPool *pool = SI_NewThreadPool(4);
+  mu_check(pool != NULL);
+  for (int i = 0; i < 8; i++) {
+    SIThreadPool_Push(pool, stringRefJob, &v);
+  }
+  SIThreadPool_Free(pool);
+
+  // no reference was lost or freed twice
+  mu_assert_int_eq(1, *v.stringval.refcount);
+  mu_check(!strcmp(v.stringval.str, "foo"));
+  SIValue_Free(&v);
+}
+
 int main(int argc, char **argv) {
   // RMUTil_InitAlloc();
   MU_RUN_TEST(testValue);
   MU_RUN_TEST(testValueCast);
+  MU_RUN_TEST(testStringRefcount);
   MU_REPORT();
   return minunit_status;
 }
\ No newline at end of file